@@ -19,20 +19,131 @@
 #include "sanitizer_common/sanitizer_common.h"
 #include "sanitizer_common/sanitizer_file.h"
 #include "sanitizer_common/sanitizer_posix.h"
+#include "sanitizer_common/sanitizer_mutex.h"
 #include "dfsan/dfsan.h"
 
+#include "event_ring.h"
+#include "cov_map.h"
+
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
 using namespace __dfsan;
 
 static uint32_t __instance_id;
 static uint32_t __session_id;
 static int __pipe_fd;
+static struct event_ring *__ring;
+static StaticSpinMutex __pipe_lock;
+
+static inline void __ring_notify() {
+  // pairs with the reader setting reader_waiting then re-checking head
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&__ring->reader_waiting, __ATOMIC_RELAXED) &&
+      __atomic_exchange_n(&__ring->reader_waiting, 0, __ATOMIC_ACQ_REL)) {
+    char bell = 0;
+    if (internal_write(__pipe_fd, &bell, 1) < 0) {
+      Die();
+    }
+  }
+}
+
+static inline void __ring_wait(uint64_t tail) {
+  __atomic_store_n(&__ring->writer_waiting, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&__ring->tail, __ATOMIC_SEQ_CST) != tail)
+    return;
+  // bounded, so a reader that missed the flag can't stall us forever
+  struct timespec ts = {0, 10 * 1000 * 1000};
+  syscall(SYS_futex, &__ring->writer_waiting, FUTEX_WAIT, 1, &ts, nullptr, 0);
+}
+
+static void __ring_put(const void *buf, size_t size) {
+  const uint8_t *p = (const uint8_t*)buf;
+  uint64_t head = __ring->head; // only modified under the lock
+  while (size) {
+    uint64_t tail = __atomic_load_n(&__ring->tail, __ATOMIC_ACQUIRE);
+    uint64_t space = SYMSAN_RING_SIZE - (head - tail);
+    if (space == 0) {
+      __ring_wait(tail);
+      continue;
+    }
+    size_t n = size < space ? size : space;
+    size_t off = head & (SYMSAN_RING_SIZE - 1);
+    size_t first = Min(n, (size_t)(SYMSAN_RING_SIZE - off));
+    internal_memcpy(&__ring->data[off], p, first);
+    internal_memcpy(&__ring->data[0], p + first, n - first);
+    head += n;
+    p += n;
+    size -= n;
+    // publish as we go, so events larger than the ring still get through
+    __atomic_store_n(&__ring->head, head, __ATOMIC_RELEASE);
+    __ring_notify();
+  }
+}
+
+// send an event, optionally followed by its payload, as a single unit
+static void __send(const void *msg, size_t size,
+                   const void *extra = nullptr, size_t extra_size = 0) {
+  if (__ring) {
+    // the lock lives in the shm, so it also covers forked writers
+    while (__atomic_exchange_n(&__ring->lock, 1, __ATOMIC_ACQUIRE))
+      internal_sched_yield();
+    __ring_put(msg, size);
+    if (extra) __ring_put(extra, extra_size);
+    __atomic_store_n(&__ring->lock, 0, __ATOMIC_RELEASE);
+    return;
+  }
+
+  SpinMutexLock l(&__pipe_lock);
+  if (internal_write(__pipe_fd, msg, size) < 0) {
+    Die();
+  }
+  if (extra && internal_write(__pipe_fd, extra, extra_size) < 0) {
+    Die();
+  }
+}
 
 // filter?
 SANITIZER_INTERFACE_ATTRIBUTE THREADLOCAL uint32_t __taint_trace_callstack;
 
-static inline void __solve_cond(dfsan_label label, uint8_t result,
-                                uint8_t add_nested, uint8_t loop_flag,
-                                uint32_t cid, void *addr) {
+// published by the driver, see cov_map.h
+static const uint8_t *__cov_map;
+
+static inline bool __branch_covered(uint32_t cid, void *addr) {
+  return __cov_map && symsan_cov_covered(__cov_map, cid, (uptr)addr);
+}
+
+// Per-site hit budget, so hot loops don't flood the driver with the same
+// branch. The hits of each (site, direction) are counted in a direct-mapped
+// table indexed by the low bits of the site's coverage map slot, which mixes
+// the full address. Sites colliding in the table still share a budget, so
+// it's off unless asked for. Past the budget, only the hits at powers of two
+// are sent, like the hit count buckets of AFL. Only the branches that would
+// be sent are charged, i.e., not the covered ones.
+static const int kBudgetBits = 16;
+static atomic_uint16_t __branch_hits[1 << kBudgetBits];
+
+static inline bool __within_budget(uint32_t cid, void *addr, uint8_t result) {
+  int budget = flags().branch_budget;
+  if (budget <= 0)
+    return true;
+  // the direction is the lowest bit, like in the map
+  uint32_t i = (symsan_cov_slot(cid, (uptr)addr) | (result & 1)) &
+               ((1 << kBudgetBits) - 1);
+  // races only lose counts
+  uint16_t n = atomic_load_relaxed(&__branch_hits[i]);
+  if (n == UINT16_MAX)
+    return false;
+  atomic_store_relaxed(&__branch_hits[i], ++n);
+  return n <= budget || (n & (n - 1)) == 0;
+}
+
+static inline void __send_cond(dfsan_label label, uint8_t result,
+                               uint8_t add_nested, uint8_t loop_flag,
+                               uint32_t cid, void *addr) {
 
   if (__pipe_fd < 0)
     return;
@@ -71,9 +182,25 @@ static inline void __solve_cond(dfsan_label label, uint8_t result,
     .result = result
   };
 
-  if (internal_write(__pipe_fd, &msg, sizeof(msg)) < 0) {
-    Die();
-  }
+  __send(&msg, sizeof(msg));
+}
+
+static inline void __solve_cond(dfsan_label label, uint8_t result,
+                                uint8_t add_nested, uint8_t loop_flag,
+                                uint32_t cid, void *addr) {
+
+  if (__pipe_fd < 0)
+    return;
+
+  // nothing left to solve
+  if (__branch_covered(cid, addr))
+    return;
+
+  // the real loop exits without a label are not counted by the driver
+  if (label != 0 && !__within_budget(cid, addr, result))
+    return;
+
+  __send_cond(label, result, add_nested, loop_flag, cid, addr);
 }
 
 static inline void __send_ubi(dfsan_label label, uint64_t result,
@@ -92,9 +219,7 @@ static inline void __send_ubi(dfsan_label label, uint64_t result,
     .result = result
   };
 
-  if (internal_write(__pipe_fd, &msg, sizeof(msg)) < 0) {
-    Die();
-  }
+  __send(&msg, sizeof(msg));
 }
 
 static struct switch_true_case {
@@ -129,8 +254,13 @@ __taint_trace_cmp(dfsan_label op1, dfsan_label op2, uint32_t size,
   AOUT("solving cmp: %u %u %u %d %lu %lu 0x%x @%p\n",
        op1, op2, size, predicate, c1, c2, cid, addr);
 
-  // save info to a union table slot
   uint8_t r = get_const_result(c1, c2, predicate);
+  // don't even create the label, the true case is sent from the switch end
+  // so it's checked there
+  if (!r && (__branch_covered(cid, addr) || !__within_budget(cid, addr, r)))
+    return;
+
+  // save info to a union table slot
   dfsan_label temp = dfsan_union(op1, op2, (predicate << 8) | ICmp, size, c1, c2);
 
   if (r) {
@@ -139,8 +269,8 @@ __taint_trace_cmp(dfsan_label op1, dfsan_label op2, uint32_t size,
     __switch_true_case.label = temp;
     __switch_true_case.cid = cid;
   } else {
-    // solve without add_nested
-    __solve_cond(temp, r, 0, 0, cid, addr);
+    // solve without add_nested, already filtered above
+    __send_cond(temp, r, 0, 0, cid, addr);
   }
 }
 
@@ -284,10 +414,6 @@ __taint_trace_gep(dfsan_label ptr_label, uint64_t ptr,
     .result = (uint64_t)index
   };
 
-  if (internal_write(__pipe_fd, &msg, sizeof(msg)) < 0) {
-    Die();
-  }
-
   gep_msg gmsg = {
     .ptr_label = ptr_label,
     .index_label = index_label,
@@ -298,10 +424,7 @@ __taint_trace_gep(dfsan_label ptr_label, uint64_t ptr,
     .current_offset = current_offset
   };
 
-  // FIXME: assuming single writer so msg will arrive in the same order
-  if (internal_write(__pipe_fd, &gmsg, sizeof(gmsg)) < 0) {
-    Die();
-  }
+  __send(&msg, sizeof(msg), &gmsg, sizeof(gmsg));
 
   return;
 }
@@ -348,22 +471,17 @@ __taint_trace_memcmp(dfsan_label label) {
     .result = (uint64_t)info->size
   };
 
-  if (internal_write(__pipe_fd, &msg, sizeof(msg)) < 0) {
-    Die();
-  }
-
-  if (!has_content)
+  if (!has_content) {
+    __send(&msg, sizeof(msg));
     return;
+  }
 
   size_t msg_size = sizeof(memcmp_msg) + info->size;
   memcmp_msg *mmsg = (memcmp_msg*)__builtin_alloca(msg_size);
   mmsg->label = label;
   internal_memcpy(mmsg->content, (void*)info->op1.i, info->size); // concrete oprand is always in op1
 
-  // FIXME: assuming single writer so msg will arrive in the same order
-  if (internal_write(__pipe_fd, mmsg, msg_size) < 0) {
-    Die();
-  }
+  __send(&msg, sizeof(msg), mmsg, msg_size);
 
   return;
 }
@@ -396,9 +514,7 @@ __taint_trace_memerr(dfsan_label ptr_label, uptr ptr, dfsan_label size_label,
     .result = r
   };
 
-  if (internal_write(__pipe_fd, &msg, sizeof(msg)) < 0) {
-    Die();
-  }
+  __send(&msg, sizeof(msg));
 }
 
 extern "C" SANITIZER_INTERFACE_ATTRIBUTE void symsan_target_hit(void *addr) {
@@ -416,13 +532,54 @@ extern "C" SANITIZER_INTERFACE_ATTRIBUTE void symsan_target_hit(void *addr) {
       .result = 0,
   };
 
-  if (internal_write(__pipe_fd, &msg, sizeof(msg)) < 0) {
-    Die();
-  }
+  __send(&msg, sizeof(msg));
+}
+
+extern "C" void ResetSolver() {
+  if (flags().branch_budget > 0)
+    internal_memset(__branch_hits, 0, sizeof(__branch_hits));
+  __switch_true_case.label = 0;
 }
 
 extern "C" void InitializeSolver() {
   __instance_id = flags().instance_id;
   __session_id = flags().session_id;
   __pipe_fd = flags().pipe_fd;
+
+  // the union table of the driver can differ in size from ours, e.g., with
+  // symsan-py's ut_size, the ring and the coverage map follow the driver's
+  uptr ring_offset = flags().ring_offset ? flags().ring_offset
+                                         : uniontable_size;
+
+  if (flags().event_ring && __pipe_fd >= 0) {
+    if (flags().shm_fd == -1) {
+      Report("FATAL: event_ring requires shm_fd\n");
+      Die();
+    }
+    // the ring follows the union table in the same shm object
+    uptr ring = internal_mmap(nullptr, SYMSAN_RING_MAP_SIZE,
+                              PROT_READ | PROT_WRITE, MAP_SHARED,
+                              flags().shm_fd, ring_offset);
+    if (internal_iserror(ring)) {
+      Report("FATAL: failed to map the event ring\n");
+      Die();
+    }
+    __ring = (struct event_ring *)ring;
+  }
+
+  if (flags().cov_filter && __pipe_fd >= 0) {
+    if (flags().shm_fd == -1) {
+      Report("FATAL: cov_filter requires shm_fd\n");
+      Die();
+    }
+    // after the ring, read-only for the target
+    uptr map = internal_mmap(nullptr, SYMSAN_COV_MAP_SIZE, PROT_READ,
+                             MAP_SHARED, flags().shm_fd,
+                             ring_offset + SYMSAN_RING_MAP_SIZE);
+    if (internal_iserror(map)) {
+      Report("WARNING: failed to map the coverage map, not filtering\n");
+    } else {
+      __cov_map = (const uint8_t *)map;
+    }
+  }
 }
@@ -15,11 +15,20 @@
 extern "C" {
 #include "afl-fuzz.h"
 #include "launch.h"
+#include "cov_map.h"
 }
 
 #include "parse-rgd.h"
 
+#include "wheels/threadpool/ctpl.h"
+#include "wheels/concurrentqueue/queue.h"
+
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <deque>
+#include <future>
+#include <numeric>
 #include <unordered_map>
 #include <unordered_set>
 #include <utility>
@@ -64,7 +73,18 @@ static bool NestedSolving = false;
 static int TraceBounds = 0;
 static int SolveUB = 0;
 static int ForceStdin = 0;
+static int UseForkServer = 0;
+static int UsePersistent = 0;
+static size_t HugePages = 0;
+static int CovFilter = 0;
+// off by default, colliding sites share a budget in the target, so it may
+// drop the events the local counter would still keep
+static int BranchBudget = 0;
+static uint8_t *CovMap = nullptr;
 static bool SaveSolved = false;
+static int SolverThreads = 0;
+static bool Portfolio = false;
+static std::shared_ptr<symsan::QueryCache> SolverCache;
 
 #undef alloc_printf
 #define alloc_printf(_str...) ({ \
@@ -78,6 +98,7 @@ static bool SaveSolved = false;
 
 using solver_t = std::shared_ptr<rgd::Solver>;
 using branch_ctx_t = std::shared_ptr<rgd::BranchContext>;
+using seed_t = std::shared_ptr<const std::vector<u8>>;
 
 enum mutation_state_t {
   MUTATION_INVALID,
@@ -92,9 +113,12 @@ struct my_mutator_t {
     argv(NULL), out_fd(-1), cur_queue_entry(NULL),
     cur_mutation_state(MUTATION_INVALID), output_buf(NULL),
     cur_task(nullptr), cur_solver_index(-1),
-    task_mgr(tmgr), cov_mgr(cmgr) {}
+    task_mgr(tmgr), cov_mgr(cmgr), pending_jobs(0) {}
 
   ~my_mutator_t() {
+    // drop the queued jobs and wait for the running ones
+    if (pool) pool->stop(false);
+    if (race_pool) race_pool->stop(false);
     if (out_fd >= 0) close(out_fd);
     ck_free(out_dir);
     ck_free(out_file);
@@ -120,11 +144,34 @@ struct my_mutator_t {
   rgd::CovManager* cov_mgr;
   rgd::RGDAstParser* parser;
   std::vector<solver_t> solvers;
+  std::vector<rgd::task_t> new_tasks; // added by the last trace
 
   // XXX: well, we have to keep track of solving states
   rgd::task_t cur_task;
-  size_t cur_solver_index;
+  size_t cur_solver_index; // into solver_order
+  std::vector<size_t> solver_order; // for cur_task
+
+  // background solving (SYMSAN_SOLVER_THREADS), each worker runs its own
+  // set of solvers, indexed by the thread id of the pool
+  std::unique_ptr<ctpl::thread_pool> pool;
+  std::vector<std::vector<solver_t>> worker_solvers;
+  std::atomic<size_t> pending_jobs;
+  moodycamel::ConcurrentQueue<std::vector<u8>> solved_inputs;
+
+  // portfolio solving (SYMSAN_PORTFOLIO), the solvers of a set race on a
+  // task, all but one on these threads
+  std::unique_ptr<ctpl::thread_pool> race_pool;
+};
+
+// per solver, indexed like the solvers of a set, shared by all the sets.
+// The wins per time spent order the solvers
+struct solver_stats_t {
+  explicit solver_stats_t(const char *name) : name(name) {}
+  const char *name;
+  std::atomic<uint64_t> wins{0};
+  std::atomic<uint64_t> time_us{0};
 };
+static std::deque<solver_stats_t> SolverStats;
 
 // FIXME: find another way to make the union table hash work
 static dfsan_label_info *__dfsan_label_info;
@@ -147,6 +194,8 @@ static uint64_t total_tasks = 0;
 static std::map<uint64_t, uint64_t> task_size_dist;
 static uint64_t solved_tasks = 0;
 static uint64_t solved_branches = 0;
+static uint64_t max_target_rss = 0;
+static uint64_t max_shm_used = 0;
 
 static void reset_global_caches(size_t buf_size) {
   local_counter.clear();
@@ -173,6 +222,10 @@ static void handle_cond(pipe_msg &msg, my_mutator_t *my_mutator) {
 
   const branch_ctx_t ctx = my_mutator->cov_mgr->add_branch((void*)msg.addr,
       msg.id, msg.result != 0, msg.context, false, false);
+  // once both directions are in, the target stops sending the branch
+  if (CovMap) {
+    symsan_cov_set(CovMap, msg.id, msg.addr, ctx->direction);
+  }
 
   branch_ctx_t neg_ctx = std::make_shared<rgd::BranchContext>();
   *neg_ctx = *ctx;
@@ -191,6 +244,7 @@ static void handle_cond(pipe_msg &msg, my_mutator_t *my_mutator) {
     for (auto const& task_id : tasks) {
       auto task = my_mutator->parser->retrieve_task(task_id);
       my_mutator->task_mgr->add_task(neg_ctx, task);
+      my_mutator->new_tasks.push_back(task);
 #if PRINT_STATS
       task_size_dist[task->constraints.size()] += 1;
 #endif
@@ -231,6 +285,7 @@ static void handle_gep(gep_msg &gmsg, pipe_msg &msg, my_mutator_t *my_mutator) {
   for (auto const& task_id : tasks) {
     auto task = my_mutator->parser->retrieve_task(task_id);
     my_mutator->task_mgr->add_task(ctx, task);
+    my_mutator->new_tasks.push_back(task);
 #if PRINT_STATS
     task_size_dist[task->constraints.size()] += 1;
 #endif
@@ -239,6 +294,197 @@ static void handle_gep(gep_msg &gmsg, pipe_msg &msg, my_mutator_t *my_mutator) {
   total_tasks += tasks.size();
 }
 
+static void create_solvers(std::vector<solver_t> &solvers) {
+  auto add_solver = [&solvers](solver_t solver, const char *name) {
+    if (SolverStats.size() == solvers.size()) {
+      SolverStats.emplace_back(name);
+    }
+    solvers.emplace_back(std::move(solver));
+  };
+  // always use the simpler i2s solver
+  add_solver(std::make_shared<rgd::I2SSolver>(), "i2s");
+  if (getenv("SYMSAN_USE_JIGSAW"))
+    add_solver(std::make_shared<rgd::JITSolver>(
+        getenv("SYMSAN_JIT_CACHE_DIR"),
+        getenv("SYMSAN_JIT_THRESHOLD") ?
+            strtoull(getenv("SYMSAN_JIT_THRESHOLD"), NULL, 0) : 0,
+        getenv("SYMSAN_JIT_BATCH") != NULL), "jigsaw");
+  if (getenv("SYMSAN_USE_Z3"))
+    add_solver(std::make_shared<rgd::Z3Solver>(), "z3");
+  // one cache for all the solvers of all the workers
+  if (SolverCache) {
+    for (auto &solver : solvers) {
+      solver->set_query_cache(SolverCache);
+    }
+  }
+}
+
+/// @brief let the solvers see all the new tasks at once, e.g., to jit the
+/// constraints in one batch
+static void prepare_tasks(my_mutator_t *data) {
+  // workers' solvers share the JIT, preparing with one set is enough
+  auto &solvers = data->pool ? data->worker_solvers[0] : data->solvers;
+  for (auto &solver : solvers) {
+    solver->prepare(data->new_tasks);
+  }
+  data->new_tasks.clear();
+}
+
+static inline uint64_t time_us() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/// @brief order the solvers by their wins per time spent, the ones that
+/// haven't won yet keep their configured order, after the others
+static void rank_solvers(std::vector<size_t> &order) {
+  order.resize(SolverStats.size());
+  std::iota(order.begin(), order.end(), 0);
+  auto score = [](size_t i) {
+    auto const& stats = SolverStats[i];
+    return (double)stats.wins / (double)(stats.time_us + 1);
+  };
+  std::stable_sort(order.begin(), order.end(), [&score](size_t a, size_t b) {
+    return score(a) > score(b);
+  });
+}
+
+/// @brief race the solvers on a task, each on its own thread, the first one
+/// to solve it, or to prove it unsat, stops the others. i2s only guesses,
+/// its output is queued as well, but it doesn't stop the race
+static void race_task(my_mutator_t *data, std::vector<solver_t> &solvers,
+                      seed_t seed, rgd::task_t const& task) {
+  std::vector<size_t> order;
+  rank_solvers(order);
+  const size_t n = order.size();
+  std::vector<std::vector<u8>> outputs(n);
+  std::vector<rgd::solver_result_t> results(n, rgd::SOLVER_ERROR);
+
+  auto run = [&](size_t i) {
+    size_t output_size = 0;
+    outputs[i].resize(seed->size());
+    uint64_t start = time_us();
+    results[i] = solvers[i]->solve(task, seed->data(), seed->size(),
+                                   outputs[i].data(), output_size);
+    SolverStats[i].time_us += time_us() - start;
+    // only a solver claiming the task has checked its solution
+    bool won = results[i] == rgd::SOLVER_SAT && task->solved_by_self();
+    if (won || results[i] == rgd::SOLVER_UNSAT) {
+      if (won) SolverStats[i].wins++;
+      task->stopped = true;
+      for (size_t j = 0; j < n; j++) {
+        if (j != i) solvers[j]->interrupt();
+      }
+    }
+    outputs[i].resize(results[i] == rgd::SOLVER_SAT ? output_size : 0);
+  };
+
+  // the best ranked one runs here
+  task->start_race();
+  std::vector<std::future<void>> racers;
+  for (size_t k = 1; k < n; k++) {
+    size_t i = order[k];
+    racers.emplace_back(data->race_pool->push([&run, i](int) { run(i); }));
+  }
+  run(order[0]);
+  for (auto &racer : racers) {
+    racer.wait();
+  }
+  task->end_race();
+
+  // the guess of i2s may well be the solution of another one
+  std::vector<bool> queued(n, false);
+  for (size_t i = 0; i < n; i++) {
+    if (results[i] == rgd::SOLVER_UNSAT) {
+      task->skip_next = true;
+    } else if (results[i] == rgd::SOLVER_SAT && !outputs[i].empty()) {
+      queued[i] = true;
+      for (size_t j = 0; j < i && queued[i]; j++) {
+        queued[i] = !queued[j] || outputs[j] != outputs[i];
+      }
+    }
+  }
+  for (size_t i = 0; i < n; i++) {
+    if (queued[i]) {
+      data->solved_inputs.enqueue(std::move(outputs[i]));
+    }
+  }
+}
+
+/// @brief solve a group of tasks on a pool thread, solved inputs are queued
+/// for afl_custom_fuzz to pick up
+static void solve_tasks(my_mutator_t *data, int tid, seed_t seed,
+                        std::vector<rgd::task_t> const& tasks) {
+  auto &solvers = data->worker_solvers[tid];
+  std::vector<size_t> order;
+  for (auto const& task : tasks) {
+    if (Portfolio) {
+      race_task(data, solvers, seed, task);
+      continue;
+    }
+    rank_solvers(order);
+    std::vector<u8> last; // the last output queued for the task
+    for (size_t i : order) {
+      std::vector<u8> output(seed->size());
+      size_t output_size = 0;
+      uint64_t start = time_us();
+      auto ret = solvers[i]->solve(task, seed->data(), seed->size(),
+          output.data(), output_size);
+      SolverStats[i].time_us += time_us() - start;
+      if (ret == rgd::SOLVER_SAT) {
+        output.resize(output_size);
+        // without validation feedback here, a solution that hasn't been
+        // checked (e.g., an i2s guess) is queued, but the next solvers
+        // still try the task
+        if (output != last) {
+          last = output;
+          data->solved_inputs.enqueue(std::move(output));
+        }
+        if (task->solved_by_self()) {
+          SolverStats[i].wins++;
+          break;
+        }
+      } else if (ret == rgd::SOLVER_UNSAT) {
+        task->skip_next = true;
+        break;
+      }
+      // timeout or error, try the next solver
+    }
+  }
+  data->pending_jobs--;
+}
+
+/// @brief hand all the pending tasks to the solver pool
+static void dispatch_tasks(my_mutator_t *data, const u8 *buf, size_t buf_size) {
+  // nested tasks read the solving state of their base task, so they are
+  // solved in the same job, right after it
+  std::vector<std::vector<rgd::task_t>> groups;
+  std::unordered_map<const rgd::SearchTask*, size_t> group_of;
+  while (auto task = data->task_mgr->get_next_task()) {
+    size_t group = groups.size();
+    for (auto base = task->base_task; base != nullptr; base = base->base_task) {
+      auto itr = group_of.find(base.get());
+      if (itr != group_of.end()) {
+        group = itr->second;
+        break;
+      }
+    }
+    if (group == groups.size()) {
+      groups.emplace_back();
+    }
+    groups[group].push_back(task);
+    group_of[task.get()] = group;
+  }
+
+  auto seed = std::make_shared<const std::vector<u8>>(buf, buf + buf_size);
+  for (auto &tasks : groups) {
+    data->pending_jobs++;
+    data->pool->push([data, seed, tasks = std::move(tasks)](int tid) {
+      solve_tasks(data, tid, seed, tasks);
+    });
+  }
+}
+
 /// no splice input
 extern "C" void afl_custom_splice_optout(my_mutator_t *data) {
   (void)(data);
@@ -260,12 +506,31 @@ extern "C" my_mutator_t *afl_custom_init(afl_state *afl, unsigned int seed) {
     FATAL("afl_custom_init alloc");
     return NULL;
   }
-  // always use the simpler i2s solver
-  data->solvers.emplace_back(std::make_shared<rgd::I2SSolver>());
-  if (getenv("SYMSAN_USE_JIGSAW"))
-    data->solvers.emplace_back(std::make_shared<rgd::JITSolver>());
-  if (getenv("SYMSAN_USE_Z3"))
-    data->solvers.emplace_back(std::make_shared<rgd::Z3Solver>());
+  // share the solver results, also with other instances through the file
+  if (getenv("SYMSAN_QUERY_CACHE") || getenv("SYMSAN_QUERY_CACHE_FILE")) {
+    SolverCache = std::make_shared<symsan::QueryCache>(
+        getenv("SYMSAN_QUERY_CACHE_FILE"));
+  }
+  // solve tasks in the background?
+  char *solver_threads = getenv("SYMSAN_SOLVER_THREADS");
+  if (solver_threads) {
+    SolverThreads = atoi(solver_threads);
+  }
+  if (SolverThreads > 0) {
+    data->worker_solvers.resize(SolverThreads);
+    for (auto &solvers : data->worker_solvers) {
+      create_solvers(solvers);
+    }
+    data->pool = std::make_unique<ctpl::thread_pool>(SolverThreads);
+  } else {
+    create_solvers(data->solvers);
+  }
+  // race the solvers on each task, instead of trying them in turn
+  if (getenv("SYMSAN_PORTFOLIO") && SolverStats.size() > 1) {
+    Portfolio = true;
+    data->race_pool = std::make_unique<ctpl::thread_pool>(
+        std::max(SolverThreads, 1) * (int)(SolverStats.size() - 1));
+  }
   // make nested solving optional too
   if (getenv("SYMSAN_USE_NESTED")) {
     NestedSolving = true;
@@ -282,6 +547,25 @@ extern "C" my_mutator_t *afl_custom_init(afl_state *afl, unsigned int seed) {
   if (getenv("SYMSAN_FORCE_STDIN")) {
     ForceStdin = 1;
   }
+  // avoid exec'ing the symsan binary for every input
+  if (getenv("SYMSAN_USE_FORKSERVER")) {
+    UseForkServer = 1;
+  }
+  // libFuzzer-style harness linked with the symsan proxy
+  if (getenv("SYMSAN_USE_PERSISTENT")) {
+    UsePersistent = 1;
+  }
+  if (getenv("SYMSAN_BRANCH_BUDGET")) {
+    BranchBudget = atoi(getenv("SYMSAN_BRANCH_BUDGET"));
+  }
+  // let the target skip the branches already covered in both directions
+  if (getenv("SYMSAN_COV_FILTER")) {
+    CovFilter = 1;
+  }
+  // bytes at the start of the union table backed by huge pages
+  if (getenv("SYMSAN_HUGE_PAGES")) {
+    HugePages = strtoull(getenv("SYMSAN_HUGE_PAGES"), NULL, 0);
+  }
   // enable saving solved tasks
   if (getenv("SYMSAN_SAVE_SOLVED")) {
     SaveSolved = true;
@@ -328,6 +612,9 @@ extern "C" my_mutator_t *afl_custom_init(afl_state *afl, unsigned int seed) {
   if (__dfsan_label_info == (void *)-1) {
     FATAL("Failed to init symsan launcher: %s\n", strerror(errno));
   }
+  if (CovFilter) {
+    CovMap = symsan_get_cov_map();
+  }
 
   // setup the parser
   data->parser = new rgd::RGDAstParser(__dfsan_label_info, uniontable_size, NestedSolving, MAX_AST_SIZE);
@@ -375,7 +662,8 @@ extern "C" u32 afl_custom_fuzz_count(my_mutator_t *data, const u8 *buf,
   u32 input_id = data->afl->queue_cur->id;
   u32 timeout = std::min(MIN_TIMEOUT, data->afl->fsrv.exec_tmout);
   if (data->fuzzed_inputs.find(input_id) != data->fuzzed_inputs.end()) {
-    return 0;
+    // keep draining inputs solved in the background
+    return data->pool ? (u32)data->solved_inputs.size_approx() : 0;
   }
   data->fuzzed_inputs.insert(input_id);
 
@@ -384,10 +672,16 @@ extern "C" u32 afl_custom_fuzz_count(my_mutator_t *data, const u8 *buf,
   DEBUGF("Fuzzing %s\n", data->cur_queue_entry);
 
   // FIXME: should we use the afl->queue_cur->fname instead?
-  // write the buf to the file
-  lseek(data->out_fd, 0, SEEK_SET);
-  ck_write(data->out_fd, buf, buf_size, data->out_file);
-  fsync(data->out_fd);
+  // hand the buf over in memory, the target reads it from a sealed memfd
+  // instead of the file, which is only sized for stat() on its path
+  int input_fd = symsan_set_input_buffer(buf, buf_size);
+  if (input_fd < 0) {
+    // no memfd, write the buf to the file
+    lseek(data->out_fd, 0, SEEK_SET);
+    ck_write(data->out_fd, buf, buf_size, data->out_file);
+    fsync(data->out_fd);
+    input_fd = data->out_fd;
+  }
   if (ftruncate(data->out_fd, buf_size)) {
     WARNF("Failed to truncate output file: %s\n", strerror(errno));
     return 0;
@@ -417,10 +711,15 @@ extern "C" u32 afl_custom_fuzz_count(my_mutator_t *data, const u8 *buf,
     symsan_set_bounds_check(TraceBounds);
     symsan_set_solve_ub(SolveUB);
     symsan_set_force_stdin(ForceStdin);
+    symsan_set_forkserver(UseForkServer);
+    symsan_set_persistent(UsePersistent);
+    symsan_set_huge_pages(HugePages);
+    symsan_set_cov_filter(CovMap != nullptr);
+    symsan_set_branch_budget(BranchBudget);
   }
 
   // launch the symsan child process
-  int ret = symsan_run(data->out_fd);
+  int ret = symsan_run(input_fd);
   if (ret < 0) {
     WARNF("Failed to start symsan bin: %s\n", strerror(errno));
     return 0;
@@ -520,6 +819,22 @@ extern "C" u32 afl_custom_fuzz_count(my_mutator_t *data, const u8 *buf,
     symsan_terminate();
   }
 
+  struct symsan_run_stats run_stats;
+  if (symsan_get_run_stats(&run_stats) == 0) {
+    DEBUGF("target rss %lu KB, shm %lu KB, %lu KB released\n",
+           run_stats.max_rss, run_stats.shm_used >> 10,
+           run_stats.shm_released >> 10);
+    max_target_rss = std::max(max_target_rss, run_stats.max_rss);
+    max_shm_used = std::max(max_shm_used, run_stats.shm_used);
+  }
+
+  prepare_tasks(data);
+
+  if (data->pool) {
+    dispatch_tasks(data, buf, buf_size);
+    return (u32)(data->pending_jobs + data->solved_inputs.size_approx());
+  }
+
   // reinit solving state
   data->cur_task = nullptr;
 
@@ -534,8 +849,11 @@ static void print_stats(my_mutator_t *data) {
     "Total branches: %zu,\n"\
     "Total tasks: %zu,\n"\
     "Solved tasks: %zu,\n"\
-    "Solved branches: %zu\n",
-    total_branches, total_tasks, solved_tasks, solved_branches);
+    "Solved branches: %zu\n"\
+    "Peak target RSS: %zu KB\n"\
+    "Peak shm used: %zu KB\n",
+    total_branches, total_tasks, solved_tasks, solved_branches,
+    max_target_rss, max_shm_used >> 10);
   dprintf(data->log_fd, "Task size distribution:\n");
   for (auto const& kv : task_size_dist) {
     dprintf(data->log_fd, "\t %zu: %zu\n", kv.first, kv.second);
@@ -543,6 +861,50 @@ static void print_stats(my_mutator_t *data) {
   for (auto &solver : data->solvers) {
     solver->print_stats(data->log_fd);
   }
+  for (auto &solvers : data->worker_solvers) {
+    for (auto &solver : solvers) {
+      solver->print_stats(data->log_fd);
+    }
+  }
+  dprintf(data->log_fd, "Solver wins:\n");
+  for (auto const& stats : SolverStats) {
+    dprintf(data->log_fd, "\t %s: %lu in %lu ms\n", stats.name,
+            stats.wins.load(), stats.time_us.load() / 1000);
+  }
+}
+
+static void save_solved(my_mutator_t *data, size_t size) {
+  char *solved_file = alloc_printf("%s/id_%zu", data->out_dir, solved_tasks);
+  if (solved_file != NULL) {
+    int fd = open(solved_file, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+      WARNF("Failed to create solved file %s: %s\n", solved_file, strerror(errno));
+    } else {
+      lseek(fd, 0, SEEK_SET);
+      ck_write(fd, data->output_buf, size, solved_file);
+      close(fd);
+    }
+    free(solved_file);
+  }
+}
+
+/// @brief pick up an input solved in the background, there is no validation
+/// feedback here, a task is tried by each solver until one finds a solution
+static size_t fuzz_solved(my_mutator_t *data, u8 **out_buf) {
+  std::vector<u8> solved;
+  if (!data->solved_inputs.try_dequeue(solved) || solved.size() > MAX_FILE) {
+#if PRINT_STATS
+    if (data->pending_jobs == 0) print_stats(data);
+#endif
+    return 0;
+  }
+  memcpy(data->output_buf, solved.data(), solved.size());
+  *out_buf = data->output_buf;
+  if (SaveSolved) {
+    save_solved(data, solved.size());
+  }
+  solved_tasks += 1;
+  return solved.size();
 }
 
 extern "C"
@@ -557,6 +919,28 @@ size_t afl_custom_fuzz(my_mutator_t *data, uint8_t *buf, size_t buf_size,
     return 0;
   }
 
+  if (data->pool) {
+    *out_buf = buf;
+    return fuzz_solved(data, out_buf);
+  }
+
+  if (Portfolio) {
+    // race on the next tasks until one yields an input
+    seed_t seed;
+    while (data->solved_inputs.size_approx() == 0) {
+      auto task = data->task_mgr->get_next_task();
+      if (!task) {
+        break;
+      }
+      if (!seed) {
+        seed = std::make_shared<const std::vector<u8>>(buf, buf + buf_size);
+      }
+      race_task(data, data->solvers, seed, task);
+    }
+    *out_buf = buf;
+    return fuzz_solved(data, out_buf);
+  }
+
   // try to get a task if we don't already have one
   // or if we've find a valid solution from the previous mutation
   if (!data->cur_task || data->cur_mutation_state == MUTATION_VALIDATED) {
@@ -571,6 +955,7 @@ size_t afl_custom_fuzz(my_mutator_t *data, uint8_t *buf, size_t buf_size,
       return 0;
     }
     // reset the solver and state
+    rank_solvers(data->solver_order);
     data->cur_solver_index = 0;
     data->cur_mutation_state = MUTATION_INVALID;
   }
@@ -591,6 +976,7 @@ size_t afl_custom_fuzz(my_mutator_t *data, uint8_t *buf, size_t buf_size,
 #endif
         return 0;
       }
+      rank_solvers(data->solver_order);
       data->cur_solver_index = 0; // reset solver index
     }
   }
@@ -598,27 +984,19 @@ size_t afl_custom_fuzz(my_mutator_t *data, uint8_t *buf, size_t buf_size,
   // default return values
   size_t new_buf_size = 0;
   *out_buf = buf;
-  auto &solver = data->solvers[data->cur_solver_index];
+  size_t solver_index = data->solver_order[data->cur_solver_index];
+  auto &solver = data->solvers[solver_index];
+  uint64_t start = time_us();
   auto ret = solver->solve(data->cur_task, buf, buf_size,
       data->output_buf, new_buf_size);
+  SolverStats[solver_index].time_us += time_us() - start;
   if (likely(ret == rgd::SOLVER_SAT)) {
     DEBUGF("task solved\n");
     data->cur_mutation_state = MUTATION_IN_VALIDATION;
     *out_buf = data->output_buf;
     if (SaveSolved) {
       // save the solved task
-      char *solved_file = alloc_printf("%s/id_%zu", data->out_dir, solved_tasks);
-      if (solved_file != NULL) {
-        int fd = open(solved_file, O_RDWR | O_CREAT | O_TRUNC, 0644);
-        if (fd < 0) {
-          WARNF("Failed to create solved file %s: %s\n", solved_file, strerror(errno));
-        } else {
-          lseek(fd, 0, SEEK_SET);
-          ck_write(fd, data->output_buf, new_buf_size, solved_file);
-          close(fd);
-        }
-        free(solved_file);
-      }
+      save_solved(data, new_buf_size);
     }
     solved_tasks += 1;
   } else if (ret == rgd::SOLVER_TIMEOUT) {
@@ -653,6 +1031,9 @@ uint8_t afl_custom_queue_new_entry(my_mutator_t * data,
     if (data->cur_task) {
       data->cur_task->skip_next = true;
       solved_branches += 1;
+      if (data->cur_solver_index < data->solver_order.size()) {
+        SolverStats[data->solver_order[data->cur_solver_index]].wins++;
+      }
     }
   }
   return 0;
@@ -18,8 +18,13 @@ extern "C" {
 #include <utility>
 #include <vector>
 #include <algorithm>
+#include <chrono>
+#include <condition_variable>
 #include <deque>
 #include <fstream>
+#include <future>
+#include <mutex>
+#include <thread>
 
 #include <nlohmann/json.hpp>
 
@@ -96,6 +101,7 @@ static size_t max_seeds = 64;
 
 // z3parser
 symsan::Z3ParserSolver *__z3_parser = nullptr;
+static bool query_cache = false;
 
 struct Seed {
   std::vector<uint8_t> data;
@@ -552,6 +558,212 @@ static void generate_input(symsan::Z3ParserSolver::solution_t &solutions) {
   seed_queue.push_back(std::move(new_seed));
 }
 
+// The events of a run go through three stages: a reader thread drains them
+// from the target, so it never stalls on a full pipe, the main thread parses
+// them into tasks in order, and the tasks are solved on a pool of threads.
+// The solutions are merged back in the order of the tasks once the run is
+// over, so the outputs are the same as when solving them one by one.
+
+template <typename T>
+class BlockingQueue {
+public:
+  void push(T &&v) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      queue_.push_back(std::move(v));
+    }
+    cv_.notify_one();
+  }
+
+  // no more pushes, pop returns false once drained
+  void close() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      closed_ = true;
+    }
+    cv_.notify_all();
+  }
+
+  bool pop(T &v) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this] { return !queue_.empty() || closed_; });
+    if (queue_.empty())
+      return false;
+    v = std::move(queue_.front());
+    queue_.pop_front();
+    return true;
+  }
+
+private:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<T> queue_;
+  bool closed_ = false;
+};
+
+struct Event {
+  pipe_msg msg;
+  gep_msg gmsg;
+  std::vector<uint8_t> memcmp; // memcmp_msg with its content
+};
+
+static void read_events(BlockingQueue<Event> *events) {
+  Event ev;
+  while (symsan_read_event(&ev.msg, sizeof(ev.msg), 0) > 0) {
+    if (ev.msg.msg_type == gep_type) {
+      if (symsan_read_event(&ev.gmsg, sizeof(ev.gmsg), 0) != sizeof(ev.gmsg)) {
+        fprintf(stderr, "Failed to receive gep msg: %s\n", strerror(errno));
+        continue;
+      }
+    } else if (ev.msg.msg_type == memcmp_type && ev.msg.flags) {
+      size_t msg_size = sizeof(memcmp_msg) + ev.msg.result;
+      ev.memcmp.resize(msg_size);
+      if (symsan_read_event(ev.memcmp.data(), msg_size, 0) != msg_size) {
+        fprintf(stderr, "Failed to receive memcmp msg: %s\n", strerror(errno));
+        ev.memcmp.clear();
+        continue;
+      }
+    }
+    events->push(std::move(ev));
+    ev = Event();
+  }
+  events->close();
+}
+
+using solution_t = symsan::Z3ParserSolver::solution_t;
+using exported_gep = symsan::Z3ParserSolver::exported_gep;
+
+// solver threads, each with its own z3 context, the tasks are handed over
+// as SMT-LIB2 as the parser's context can't be shared. Each thread keeps an
+// incremental session over the tasks of a run, like solve_task does. The
+// symbolic GEP indices are enumerated on the pool as well, each job gives
+// all the solutions of its task or GEP.
+class SolverPool {
+public:
+  explicit SolverPool(unsigned threads) {
+    for (unsigned i = 0; i < threads; i++) {
+      workers_.emplace_back(&SolverPool::work, this);
+    }
+  }
+
+  ~SolverPool() {
+    jobs_.close();
+    for (auto &t : workers_) {
+      t.join();
+    }
+  }
+
+  // a new run, the sessions are reset before solving its tasks
+  void restart() { run_++; }
+
+  std::future<std::vector<solution_t>> submit(std::string &&smt2) {
+    Job job;
+    job.smt2 = std::move(smt2);
+    return submit(std::move(job));
+  }
+
+  std::future<std::vector<solution_t>> submit(exported_gep &&gep) {
+    Job job;
+    job.gep = std::make_unique<exported_gep>(std::move(gep));
+    return submit(std::move(job));
+  }
+
+  // wall-clock time with at least one task being solved
+  double get_busy_time() {
+    std::lock_guard<std::mutex> lock(busy_mutex_);
+    return busy_us_ / 1e6;
+  }
+
+private:
+  struct Job {
+    std::string smt2; // a task, or
+    std::unique_ptr<exported_gep> gep; // a GEP index to enumerate
+    unsigned run;
+    std::promise<std::vector<solution_t>> solutions;
+  };
+
+  std::future<std::vector<solution_t>> submit(Job &&job) {
+    job.run = run_;
+    auto result = job.solutions.get_future();
+    jobs_.push(std::move(job));
+    return result;
+  }
+
+  void work() {
+    z3::context context;
+    symsan::Z3ParserSolver::Session session(context);
+    unsigned run = 0;
+    Job job;
+    while (jobs_.pop(job)) {
+      if (job.run != run) {
+        session.reset();
+        run = job.run;
+      }
+      std::vector<solution_t> results;
+      set_busy(true);
+      if (job.gep) {
+        __z3_parser->enum_gep(context, *job.gep, 5000U,
+            [&results](solution_t &solutions) {
+              results.push_back(std::move(solutions));
+              return true;
+            });
+      } else {
+        solution_t solutions;
+        __z3_parser->solve_exported(session, job.smt2, 5000U, solutions);
+        results.push_back(std::move(solutions));
+      }
+      set_busy(false);
+      job.solutions.set_value(std::move(results));
+    }
+  }
+
+  void set_busy(bool busy) {
+    auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(busy_mutex_);
+    if (busy && busy_++ == 0) {
+      busy_since_ = now;
+    } else if (!busy && --busy_ == 0) {
+      busy_us_ += std::chrono::duration_cast<std::chrono::microseconds>(
+          now - busy_since_).count();
+    }
+  }
+
+  BlockingQueue<Job> jobs_;
+  std::vector<std::thread> workers_;
+  unsigned run_ = 0; // only touched by the parsing thread
+  std::mutex busy_mutex_;
+  unsigned busy_ = 0;
+  std::chrono::steady_clock::time_point busy_since_;
+  uint64_t busy_us_ = 0;
+};
+
+static std::unique_ptr<SolverPool> solver_pool;
+// solutions of the tasks of the current run, in the order they were parsed
+static std::vector<std::future<std::vector<solution_t>>> pending_solutions;
+
+static void submit_tasks(std::vector<uint64_t> &tasks) {
+  for (auto id : tasks) {
+    std::string smt2;
+    if (__z3_parser->export_task(id, smt2) != 0) {
+      AOUT("WARNING: failed to export task %lu\n", id);
+      continue;
+    }
+    pending_solutions.push_back(solver_pool->submit(std::move(smt2)));
+  }
+}
+
+static void merge_solutions() {
+  for (auto &f : pending_solutions) {
+    for (auto &solutions : f.get()) {
+      if (solutions.size() != 0) {
+        AOUT("task solved\n");
+        generate_input(solutions);
+      }
+    }
+  }
+  pending_solutions.clear();
+}
+
 static void __solve_cond(dfsan_label label, uint8_t r, bool add_nested, void *addr) {
 
   AOUT("solving label %d = %d, add_nested: %d\n", label, r, add_nested);
@@ -561,19 +773,7 @@ static void __solve_cond(dfsan_label label, uint8_t r, bool add_nested, void *ad
     return;
   }
 
-  for (auto id : tasks) {
-    // solve
-    symsan::Z3ParserSolver::solution_t solutions;
-    auto status = __z3_parser->solve_task(id, 5000U, solutions);
-    if (solutions.size() != 0) {
-      AOUT("branch solved\n");
-      generate_input(solutions);
-    } else {
-      AOUT("branch not solvable @%p\n", addr);
-    }
-    solutions.clear();
-  }
-
+  submit_tasks(tasks);
 }
 
 static void __handle_gep(dfsan_label ptr_label, uptr ptr,
@@ -584,23 +784,16 @@ static void __handle_gep(dfsan_label ptr_label, uptr ptr,
   AOUT("tainted GEP index: %ld = %d, ne: %ld, es: %ld, offset: %ld\n",
       index, index_label, num_elems, elem_size, current_offset);
 
-  std::vector<uint64_t> tasks;
-  if (__z3_parser->parse_gep(ptr_label, ptr, index_label, index, num_elems,
-                             elem_size, current_offset, true, tasks)) {
+  // enumerated on the pool with one incremental solver, the solutions are
+  // merged along with the ones of the tasks, in order
+  exported_gep gep;
+  if (__z3_parser->export_gep(ptr_label, ptr, index_label, index, num_elems,
+                              elem_size, current_offset, gep)) {
     AOUT("WARNING: failed to parse gep %d @%p\n", index_label, addr);
     return;
   }
-
-  for (auto id : tasks) {
-    symsan::Z3ParserSolver::solution_t solutions;
-    auto status = __z3_parser->solve_task(id, 5000U, solutions);
-    if (solutions.size() != 0) {
-      AOUT("gep solved\n");
-      generate_input(solutions);
-    } else {
-      AOUT("gep not solvable @%p\n", addr);
-    }
-    solutions.clear();
+  if (!gep.smt2.empty()) {
+    pending_solutions.push_back(solver_pool->submit(std::move(gep)));
   }
 }
 
@@ -806,6 +999,15 @@ int main(int argc, char* const argv[]) {
   symsan_set_debug(debug);
   symsan_set_bounds_check(1);
   symsan_set_solve_ub(solve_ub);
+
+  // same knob as the AFL++ mutator, defaults to one thread per core
+  unsigned solver_threads = std::thread::hardware_concurrency();
+  char *threads_opt = getenv("SYMSAN_SOLVER_THREADS");
+  if (threads_opt) {
+    solver_threads = strtoul(threads_opt, NULL, 0);
+  }
+  solver_pool = std::make_unique<SolverPool>(std::max(solver_threads, 1U));
+
   // exploration loop over queued seeds
   AOUT("Starting exploration loop, max_seeds=%zu\n", max_seeds);
   while (!seed_queue.empty() && seeds_processed < max_seeds) {
@@ -874,6 +1076,13 @@ int main(int argc, char* const argv[]) {
 
     if (!__z3_parser) {
       __z3_parser = new symsan::Z3ParserSolver(shm_base, uniontable_size, __z3_context);
+      __z3_parser->set_dump_smt2(debug);
+      // same knobs as the AFL++ mutator
+      if (getenv("SYMSAN_QUERY_CACHE") || getenv("SYMSAN_QUERY_CACHE_FILE")) {
+        __z3_parser->set_query_cache(std::make_shared<symsan::QueryCache>(
+            getenv("SYMSAN_QUERY_CACHE_FILE")));
+        query_cache = true;
+      }
     }
     std::vector<symsan::input_t> inputs;
     inputs.push_back({(uint8_t*)input_buf, input_size});
@@ -883,15 +1092,18 @@ int main(int argc, char* const argv[]) {
       close(fd);
       continue;
     }
+    solver_pool->restart();
 
     current_seed = &seed;
 
-    pipe_msg msg;
-    gep_msg gmsg;
-    size_t msg_size;
-    memcmp_msg *mmsg = nullptr;
+    BlockingQueue<Event> events;
+    std::thread reader(read_events, &events);
 
-    while (symsan_read_event(&msg, sizeof(msg), 0) > 0) {
+    Event ev;
+    while (events.pop(ev)) {
+      const pipe_msg &msg = ev.msg;
+      const gep_msg &gmsg = ev.gmsg;
+      memcmp_msg *mmsg = nullptr;
       pretty_print_pipe_msg(msg);
       switch (msg.msg_type) {
         case cond_type:
@@ -911,10 +1123,6 @@ int main(int argc, char* const argv[]) {
           __solve_cond(msg.label, msg.result, msg.flags & F_ADD_CONS, (void*)msg.addr);
           break;
         case gep_type:
-          if (symsan_read_event(&gmsg, sizeof(gmsg), 0) != sizeof(gmsg)) {
-            fprintf(stderr, "Failed to receive gep msg: %s\n", strerror(errno));
-            break;
-          }
           if (msg.label != gmsg.index_label) {
             fprintf(stderr, "Incorrect gep msg: %d vs %d\n", msg.label, gmsg.index_label);
             break;
@@ -925,20 +1133,12 @@ int main(int argc, char* const argv[]) {
         case memcmp_type:
           if (!msg.flags)
             break;
-          msg_size = sizeof(memcmp_msg) + msg.result;
-          mmsg = (memcmp_msg*)malloc(msg_size); // not freed until terminate
-          if (symsan_read_event(mmsg, msg_size, 0) != msg_size) {
-            fprintf(stderr, "Failed to receive memcmp msg: %s\n", strerror(errno));
-            free(mmsg);
-            break;
-          }
+          mmsg = (memcmp_msg*)ev.memcmp.data();
           if (msg.label != mmsg->label) {
             fprintf(stderr, "Incorrect memcmp msg: %d vs %d\n", msg.label, mmsg->label);
-            free(mmsg);
             break;
           }
           __z3_parser->record_memcmp(msg.label, mmsg->content, msg.result);
-          free(mmsg);
           break;
         case memerr_type:
           if (msg.flags & F_TARGET_HIT) {
@@ -951,6 +1151,8 @@ int main(int argc, char* const argv[]) {
           break;
       }
     }
+    reader.join();
+    merge_solutions();
 
     if (run_target_hit) {
       target_reached = true;
@@ -1024,6 +1226,19 @@ int main(int argc, char* const argv[]) {
     write_rewards(reward_output_path, rows);
   }
 
+  double solving_secs = solver_pool->get_busy_time();
+  solver_pool.reset();
+  if (__z3_parser) {
+    // solver time is summed over the threads, the rate is per wall second
+    double secs = __z3_parser->get_solve_time();
+    uint64_t solves = __z3_parser->get_solve_count();
+    fprintf(stderr, "[fgtest] %lu solves in %.3fs wall, %.3fs solver time, "
+            "%.1f solves/sec\n", solves, solving_secs, secs,
+            solving_secs > 0 ? solves / solving_secs : 0.0);
+    if (query_cache) {
+      __z3_parser->get_cache_stats().print(STDERR_FILENO);
+    }
+  }
   symsan_destroy();
   
   // Clean up allocated output_dir
@@ -20,8 +20,25 @@
 #include <fcntl.h>
 
 extern int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+// provided by the symsan runtime, < 0 if not in persistent mode
+extern int __taint_persistent_next(const uint8_t **data, size_t *size);
 
 int main(int argc, char* argv[]) {
+    // persistent mode, keep taking inputs from the launcher
+    const uint8_t *data;
+    size_t size;
+    int ret;
+    while ((ret = __taint_persistent_next(&data, &size)) > 0) {
+        // copy to the heap like below, so bounds are tracked the same way
+        uint8_t *copy = (uint8_t*)malloc(size);
+        memcpy(copy, data, size);
+        LLVMFuzzerTestOneInput(copy, size);
+        free(copy);
+    }
+    if (ret == 0) {
+        return 0;
+    }
+
     // open file
     int fd = open(argv[1], O_RDONLY);
     if (fd < 0) {
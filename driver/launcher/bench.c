@@ -0,0 +1,135 @@
+/*
+  Measure the launcher throughput (execs/sec) with and without forkserver.
+
+  usage: launch-bench [-n runs] [-s] [-p] /path/to/symsan-binary input [args...]
+
+  The input file is passed via "@@" in args if present, otherwise as stdin
+  (or always as stdin with -s). With -p, the persistent mode is measured as
+  well, which requires a harness linked with the symsan proxy. Each run drains all events from the target
+  so the numbers include the tracing cost, not just process creation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <fcntl.h>
+#include <sys/time.h>
+
+#include "launch.h"
+
+static const size_t kUnionTableSize = 0xc00000000; // keep in sync with dfsan
+static char event_buf[4096];
+
+static double now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static int bench(int fd, int runs, int forkserver, int persistent,
+                 double *elapsed, struct symsan_run_stats *stats) {
+  symsan_set_forkserver(forkserver);
+  symsan_set_persistent(persistent);
+
+  double start = now();
+  for (int i = 0; i < runs; i++) {
+    int ret = symsan_run(fd);
+    if (ret != 0) {
+      fprintf(stderr, "symsan_run failed: %d\n", ret);
+      return -1;
+    }
+    while (symsan_read_event(event_buf, sizeof(event_buf), 0) > 0)
+      ;
+  }
+  *elapsed = now() - start;
+  // of the last run, the shm should not grow with the number of runs
+  symsan_get_run_stats(stats);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  int runs = 1000;
+  int use_stdin = 0;
+  int persistent = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "+n:sp")) > 0) {
+    switch (opt) {
+      case 'n': runs = atoi(optarg); break;
+      case 's': use_stdin = 1; break;
+      case 'p': persistent = 1; break;
+      default:
+        fprintf(stderr, "usage: %s [-n runs] [-s] [-p] program input [args...]\n",
+                argv[0]);
+        return 1;
+    }
+  }
+
+  if (argc - optind < 2 || runs <= 0) {
+    fprintf(stderr, "usage: %s [-n runs] [-s] [-p] program input [args...]\n",
+            argv[0]);
+    return 1;
+  }
+
+  char *program = argv[optind];
+  char *input = argv[optind + 1];
+  int fd = open(input, O_RDONLY);
+  if (fd < 0) {
+    perror("open input");
+    return 1;
+  }
+
+  if (symsan_init(program, kUnionTableSize) == (void *)-1) {
+    perror("symsan_init");
+    return 1;
+  }
+
+  // target args: program itself followed by the remaining args, with @@
+  // replaced by the input file
+  int targc = argc - optind - 1;
+  char **targv = (char **)calloc(targc + 1, sizeof(char *));
+  targv[0] = program;
+  for (int i = 1; i < targc; i++) {
+    char *arg = argv[optind + 1 + i];
+    if (!strcmp(arg, "@@") && !use_stdin) {
+      targv[i] = input;
+      use_stdin = -1; // file input
+    } else {
+      targv[i] = arg;
+    }
+  }
+  if (use_stdin == -1) {
+    symsan_set_input(input);
+  } else {
+    symsan_set_input("stdin");
+  }
+  symsan_set_args(targc, targv);
+  free(targv);
+
+  double t_exec, t_fsrv, t_pers;
+  struct symsan_run_stats s_exec, s_fsrv, s_pers;
+  if (bench(fd, runs, 0, 0, &t_exec, &s_exec) != 0 ||
+      bench(fd, runs, 1, 0, &t_fsrv, &s_fsrv) != 0 ||
+      (persistent && bench(fd, runs, 0, 1, &t_pers, &s_pers) != 0)) {
+    symsan_destroy();
+    return 1;
+  }
+
+  printf("runs: %d\n", runs);
+  printf("fork+exec:  %.2f execs/sec, rss %lu KB, shm %lu KB\n",
+         runs / t_exec, s_exec.max_rss, s_exec.shm_used >> 10);
+  printf("forkserver: %.2f execs/sec (%.2fx), rss %lu KB, shm %lu KB\n",
+         runs / t_fsrv, t_exec / t_fsrv, s_fsrv.max_rss,
+         s_fsrv.shm_used >> 10);
+  if (persistent) {
+    printf("persistent: %.2f execs/sec (%.2fx), rss %lu KB, shm %lu KB\n",
+           runs / t_pers, t_exec / t_pers, s_pers.max_rss,
+           s_pers.shm_used >> 10);
+  }
+
+  symsan_destroy();
+  close(fd);
+  return 0;
+}
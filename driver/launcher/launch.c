@@ -1,23 +1,32 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // fallocate, SEEK_DATA, memfd_create
+#endif
 #include "defs.h"
 #include "debug.h"
 #include "version.h"
 #include "launch.h"
+#include "event_ring.h"
+#include "cov_map.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include <linux/futex.h>
 #include <sys/ipc.h>
 #include <sys/mman.h>
 #include <sys/select.h>
 #include <sys/shm.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/resource.h>
 #include <fcntl.h>
+#include <linux/falloc.h>
 
 #undef alloc_printf
 #define alloc_printf(_str...) ({ \
@@ -29,17 +38,32 @@
     _tmp; \
   })
 
+// fds the forkserver gets its control socket and the per-run event pipe on,
+// the same numbers afl uses for its own forkserver
+#define FORKSRV_CTL_FD  198
+#define FORKSRV_PIPE_FD 199
+// fd the target finds the sealed input buffer on, for file inputs
+#define TAINT_INPUT_FD  197
+
+// ms to wait for the forkserver's hello, a target that never sends it (e.g.,
+// not built with the forkserver) is run with fork+exec instead
+#define FORKSRV_HELLO_TIMEOUT 10000
+
 struct symsan_config {
   char *symsan_bin;
   char *input_file;
   char **argv;
   char *shm_name;
   int shm_fd;
+  int input_buf_fd;
   void *label_info;
   int pipefds[2];
   char *symsan_env;
   int symsan_pid;
   size_t shm_size;
+  size_t thp_size;
+  struct event_ring *ring;
+  uint8_t *cov_map;
 
   int is_input_file;
   int is_input_sdtin;
@@ -50,15 +74,28 @@ struct symsan_config {
   int exit_on_memerror;
   int trace_file_size;
   int force_stdin;
+  int use_forkserver;
+  int use_persistent;
+  int use_event_ring;
+  int use_cov_filter;
+  int branch_budget;
 
   int dev_null_fd;
 
+  int fsrv_fd;
+  int fsrv_pid;
+  char *fsrv_env;
+  int fsrv_failed; // the server never came up, fork+exec every run
+
   int exit_status;
   int is_killed;
+  struct symsan_run_stats stats;
 };
 
 static struct symsan_config g_config;
 
+static void stop_forkserver();
+
 __attribute__((visibility("default")))
 void* symsan_init(const char *symsan_bin, const size_t uniontable_size) {
 
@@ -71,8 +108,12 @@ void* symsan_init(const char *symsan_bin, const size_t uniontable_size) {
   g_config.argv = NULL;
   g_config.shm_name = NULL;
   g_config.shm_fd = -1;
+  g_config.input_buf_fd = -1;
   g_config.label_info = NULL;
   g_config.shm_size = uniontable_size;
+  g_config.thp_size = 0;
+  g_config.ring = NULL;
+  g_config.cov_map = NULL;
   g_config.pipefds[0] = -1;
   g_config.pipefds[1] = -1;
   g_config.symsan_env = NULL;
@@ -86,9 +127,19 @@ void* symsan_init(const char *symsan_bin, const size_t uniontable_size) {
   g_config.exit_on_memerror = 1;
   g_config.trace_file_size = 0;
   g_config.force_stdin = 0;
+  g_config.use_forkserver = 0;
+  g_config.use_persistent = 0;
+  g_config.use_event_ring = 1;
+  g_config.use_cov_filter = 0;
+  g_config.branch_budget = 0;
   g_config.dev_null_fd = -1;
+  g_config.fsrv_fd = -1;
+  g_config.fsrv_pid = -1;
+  g_config.fsrv_env = NULL;
+  g_config.fsrv_failed = 0;
   g_config.exit_status = 0;
   g_config.is_killed = 0;
+  memset(&g_config.stats, 0, sizeof(g_config.stats));
 
   // open /dev/null
   g_config.dev_null_fd = open("/dev/null", O_RDWR);
@@ -106,8 +157,10 @@ void* symsan_init(const char *symsan_bin, const size_t uniontable_size) {
   if (g_config.shm_fd == -1) {
     return (void *)-1;
   }
-  // set the size of the shm
-  if (ftruncate(g_config.shm_fd, uniontable_size) == -1) {
+  // set the size of the shm, the event ring goes after the union table,
+  // followed by the coverage map
+  if (ftruncate(g_config.shm_fd, uniontable_size + SYMSAN_RING_MAP_SIZE +
+                SYMSAN_COV_MAP_SIZE) == -1) {
     return (void *)-1;
   }
   // clear O_CLOEXEC flag
@@ -115,6 +168,18 @@ void* symsan_init(const char *symsan_bin, const size_t uniontable_size) {
   // mmap the shm
   g_config.label_info = mmap(NULL, uniontable_size, PROT_READ, MAP_SHARED,
       g_config.shm_fd, 0);
+  // mmap the ring, fall back to plain pipe reads if this fails
+  void *ring = mmap(NULL, SYMSAN_RING_MAP_SIZE, PROT_READ | PROT_WRITE,
+      MAP_SHARED, g_config.shm_fd, uniontable_size);
+  if (ring != MAP_FAILED) {
+    g_config.ring = (struct event_ring *)ring;
+  }
+  // mmap the coverage map, the target then gets no branch filter
+  void *cov_map = mmap(NULL, SYMSAN_COV_MAP_SIZE, PROT_READ | PROT_WRITE,
+      MAP_SHARED, g_config.shm_fd, uniontable_size + SYMSAN_RING_MAP_SIZE);
+  if (cov_map != MAP_FAILED) {
+    g_config.cov_map = (uint8_t *)cov_map;
+  }
 
   return g_config.label_info;
 }
@@ -145,6 +210,43 @@ int symsan_set_input(const char *input) {
   return 0;
 }
 
+__attribute__((visibility("default")))
+int symsan_set_input_buffer(const void *buf, size_t size) {
+  if (!buf && size) {
+    return SYMSAN_INVALID_ARGS;
+  }
+
+  // a new memfd per input, the sealed one may still be mapped by the target
+  int fd = memfd_create("symsan-input", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd < 0) {
+    return -1;
+  }
+  const char *p = (const char *)buf;
+  size_t left = size;
+  while (left > 0) {
+    ssize_t n = write(fd, p, left);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      close(fd);
+      return -1;
+    }
+    p += n;
+    left -= n;
+  }
+  // the target maps it as its taint buffer, so it must not change under it
+  if (fcntl(fd, F_ADD_SEALS,
+            F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) != 0) {
+    close(fd);
+    return -1;
+  }
+
+  if (g_config.input_buf_fd != -1) {
+    close(g_config.input_buf_fd);
+  }
+  g_config.input_buf_fd = fd;
+  return fd;
+}
+
 __attribute__((visibility("default")))
 int symsan_set_args(const int argc, char* const argv[]) {
   if (argc < 1 || !argv) {
@@ -171,6 +273,9 @@ int symsan_set_args(const int argc, char* const argv[]) {
   }
   g_config.argv[argc] = NULL;
 
+  // a running forkserver was exec'd with the old args
+  stop_forkserver();
+
   return 0;
 
 error:
@@ -218,6 +323,338 @@ int symsan_set_force_stdin(int enable) {
   return 0;
 }
 
+__attribute__((visibility("default")))
+int symsan_set_forkserver(int enable) {
+  g_config.use_forkserver = !!enable;
+  g_config.fsrv_failed = 0;
+  return 0;
+}
+
+__attribute__((visibility("default")))
+int symsan_set_persistent(int enable) {
+  g_config.use_persistent = !!enable;
+  g_config.fsrv_failed = 0;
+  return 0;
+}
+
+__attribute__((visibility("default")))
+int symsan_set_event_ring(int enable) {
+  g_config.use_event_ring = enable;
+  return 0;
+}
+
+__attribute__((visibility("default")))
+int symsan_set_cov_filter(int enable) {
+  g_config.use_cov_filter = !!enable;
+  return 0;
+}
+
+__attribute__((visibility("default")))
+int symsan_set_branch_budget(int budget) {
+  g_config.branch_budget = budget > 0 ? budget : 0;
+  return 0;
+}
+
+__attribute__((visibility("default")))
+uint8_t* symsan_get_cov_map() {
+  return g_config.cov_map;
+}
+
+__attribute__((visibility("default")))
+int symsan_set_huge_pages(size_t prefix) {
+  g_config.thp_size = prefix < g_config.shm_size ? prefix : g_config.shm_size;
+  return 0;
+}
+
+__attribute__((visibility("default")))
+int symsan_get_run_stats(struct symsan_run_stats *stats) {
+  if (!stats) {
+    return -1;
+  }
+
+  *stats = g_config.stats;
+  return 0;
+}
+
+static int ring_enabled() {
+  return g_config.use_event_ring && g_config.ring != NULL;
+}
+
+// the fd a file input is read from, if it's delivered as a buffer
+static int taint_input_fd(int fd) {
+  return (g_config.is_input_file && fd == g_config.input_buf_fd) ?
+      TAINT_INPUT_FD : -1;
+}
+
+static int cov_filter_enabled() {
+  return g_config.use_cov_filter && g_config.cov_map != NULL;
+}
+
+// drop whatever the last target left behind, must be called before the
+// next target is started
+static void reset_ring() {
+  struct event_ring *ring = g_config.ring;
+  if (ring == NULL) {
+    return;
+  }
+  ring->tail = ring->head;
+  ring->lock = 0;
+  ring->reader_waiting = 0;
+  ring->writer_waiting = 0;
+}
+
+// bytes of the shm object held by tmpfs
+static uint64_t shm_used() {
+  struct stat st;
+  if (fstat(g_config.shm_fd, &st) != 0) {
+    return 0;
+  }
+  return (uint64_t)st.st_blocks * 512;
+}
+
+// the union table stays in tmpfs after the target is gone, so punch out
+// whatever the last run has written before starting a new one, at a cost
+// proportional to that. Labels are allocated from the start of the table and
+// the alloca labels from its end, so the used ranges are found with
+// SEEK_DATA/SEEK_HOLE rather than from a high-water label. The first page is
+// kept, the record of the constant label is only written once by a
+// forkserver or persistent target
+static void release_union_table() {
+  const off_t page = 4096;
+  const off_t end = g_config.shm_size;
+  uint64_t released = 0;
+  off_t off = page;
+  while (off < end) {
+    off_t data = lseek(g_config.shm_fd, off, SEEK_DATA);
+    if (data < 0 || data >= end) {
+      break; // ENXIO, nothing left
+    }
+    off_t hole = lseek(g_config.shm_fd, data, SEEK_HOLE);
+    if (hole < 0 || hole > end) {
+      hole = end; // up to the ring
+    }
+    if (fallocate(g_config.shm_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                  data, hole - data) != 0) {
+      break;
+    }
+    released += hole - data;
+    off = hole;
+  }
+  g_config.stats.shm_released = released;
+}
+
+// common setup for the freshly forked target (or forkserver) process
+static void prepare_target_process(const char *env) {
+  // clear signal handlers and masks
+  sigset_t set;
+  sigemptyset(&set);
+  sigprocmask(SIG_SETMASK, &set, NULL);
+
+  // disable core dump as shadow mem is toooooo large
+  struct rlimit limit;
+  limit.rlim_cur = limit.rlim_max = 0;
+  setrlimit(RLIMIT_CORE, &limit);
+
+  setenv("TAINT_OPTIONS", env, 1);
+  unsetenv("LD_PRELOAD"); // don't preload anything
+  if (!g_config.enable_debug) {
+    close(1);
+    close(2);
+    dup2(g_config.dev_null_fd, 1);
+    dup2(g_config.dev_null_fd, 2);
+  }
+}
+
+static void stop_forkserver() {
+  if (g_config.fsrv_fd != -1) {
+    close(g_config.fsrv_fd); // server exits on EOF
+    g_config.fsrv_fd = -1;
+  }
+  if (g_config.fsrv_pid > 0) {
+    kill(g_config.fsrv_pid, SIGKILL);
+    waitpid(g_config.fsrv_pid, NULL, 0);
+    g_config.fsrv_pid = -1;
+  }
+  if (g_config.fsrv_env != NULL) {
+    free(g_config.fsrv_env);
+    g_config.fsrv_env = NULL;
+  }
+}
+
+static int start_forkserver(char *env) {
+  int sv[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+    return -1;
+  }
+
+  g_config.fsrv_pid = fork();
+  if (g_config.fsrv_pid == 0) {
+    close(sv[0]);
+    // the server must not hold any end of the event pipe, or the launcher
+    // will never see an EOF
+    if (g_config.pipefds[0] != -1) close(g_config.pipefds[0]);
+    if (g_config.pipefds[1] != -1) close(g_config.pipefds[1]);
+    if (sv[1] != FORKSRV_CTL_FD) {
+      dup2(sv[1], FORKSRV_CTL_FD);
+      close(sv[1]);
+    }
+    prepare_target_process(env);
+    execv(g_config.symsan_bin, g_config.argv);
+    _exit(1);
+  } else if (g_config.fsrv_pid < 0) {
+    close(sv[0]);
+    close(sv[1]);
+    return -1;
+  }
+
+  close(sv[1]);
+  g_config.fsrv_fd = sv[0];
+
+  // wait for the hello, a binary without forkserver support just runs
+  // to the end and closes the socket, one that crashes or hangs before
+  // reaching the server is killed once the timeout expires
+  struct timeval tv;
+  tv.tv_sec = FORKSRV_HELLO_TIMEOUT / 1000;
+  tv.tv_usec = (FORKSRV_HELLO_TIMEOUT % 1000) * 1000;
+  fd_set rfds;
+  FD_ZERO(&rfds);
+  FD_SET(g_config.fsrv_fd, &rfds);
+  uint32_t hello;
+  if (select(g_config.fsrv_fd + 1, &rfds, NULL, NULL, &tv) <= 0 ||
+      read(g_config.fsrv_fd, &hello, sizeof(hello)) != sizeof(hello)) {
+    stop_forkserver();
+    return -1;
+  }
+
+  g_config.fsrv_env = env;
+  return 0;
+}
+
+static int request_fork(int fd) {
+  int fds[2] = { g_config.pipefds[1], fd };
+  // the persistent target always takes its input from the fd
+  int nfds = (g_config.is_input_sdtin || g_config.use_persistent ||
+              taint_input_fd(fd) != -1) ? 2 : 1;
+  uint32_t req = 0;
+  char cbuf[CMSG_SPACE(sizeof(fds))];
+  struct iovec iov = { &req, sizeof(req) };
+  struct msghdr mh;
+  struct cmsghdr *c;
+
+  memset(&mh, 0, sizeof(mh));
+  memset(cbuf, 0, sizeof(cbuf));
+  mh.msg_iov = &iov;
+  mh.msg_iovlen = 1;
+  mh.msg_control = cbuf;
+  mh.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+  c = CMSG_FIRSTHDR(&mh);
+  c->cmsg_level = SOL_SOCKET;
+  c->cmsg_type = SCM_RIGHTS;
+  c->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+  memcpy(CMSG_DATA(c), fds, sizeof(int) * nfds);
+
+  if (sendmsg(g_config.fsrv_fd, &mh, MSG_NOSIGNAL) != sizeof(req)) {
+    return -1;
+  }
+
+  uint32_t pid;
+  if (read(g_config.fsrv_fd, &pid, sizeof(pid)) != sizeof(pid)) {
+    return -1;
+  }
+  g_config.symsan_pid = (int)pid;
+  return 0;
+}
+
+static int symsan_run_forkserver(int fd) {
+  char *env = alloc_printf(
+      "taint_file=\"%s\":shm_fd=%d:pipe_fd=%d:debug=%d:trace_bounds=%d:"
+      "solve_ub=%d:exit_on_memerror=%d:trace_fsize=%d:force_stdin=%d:"
+      "event_ring=%d:ring_offset=%zu:cov_filter=%d:branch_budget=%d:"
+      "union_table_thp=%zu:taint_fd=%d:%s=1:fsrv_fd=%d",
+      g_config.input_file, g_config.shm_fd, FORKSRV_PIPE_FD,
+      g_config.enable_debug, g_config.enable_bounds_check,
+      g_config.enable_solve_ub, g_config.exit_on_memerror,
+      g_config.trace_file_size, g_config.force_stdin, ring_enabled(),
+      g_config.shm_size, cov_filter_enabled(), g_config.branch_budget, g_config.thp_size,
+      taint_input_fd(fd), g_config.use_persistent ? "persistent" : "forkserver",
+      FORKSRV_CTL_FD);
+  if (env == NULL) {
+    return SYMSAN_NO_MEMORY;
+  }
+
+  // configs could have been changed since the server was started
+  if (g_config.fsrv_env != NULL && strcmp(env, g_config.fsrv_env) != 0) {
+    stop_forkserver();
+  }
+  if (g_config.fsrv_fd == -1) {
+    if (g_config.enable_debug) {
+      fprintf(stderr, "SYMSAN_ENV: %s\n", env);
+    }
+    if (start_forkserver(env) != 0) {
+      free(env);
+      g_config.fsrv_failed = 1;
+      return -1;
+    }
+  } else {
+    free(env);
+  }
+
+  if (pipe(g_config.pipefds) != 0) {
+    return SYMSAN_NO_MEMORY;
+  }
+
+  int ret = request_fork(fd);
+  if (ret != 0) {
+    // the server may have died, give it one more chance
+    env = strdup(g_config.fsrv_env);
+    stop_forkserver();
+    if (env == NULL || start_forkserver(env) != 0 || request_fork(fd) != 0) {
+      free(env);
+      stop_forkserver();
+      g_config.fsrv_failed = 1;
+      close(g_config.pipefds[0]);
+      close(g_config.pipefds[1]);
+      g_config.pipefds[0] = g_config.pipefds[1] = -1;
+      return -1;
+    }
+  }
+
+  close(g_config.pipefds[1]); // close the write fd
+  g_config.pipefds[1] = -1;
+  g_config.is_killed = 0; // reset kill flag
+
+  return 0;
+}
+
+// reap the finished target, either our child or the forkserver's
+static void wait_target() {
+  if (g_config.symsan_pid == -1) {
+    return; // already reaped
+  }
+  struct rusage ru;
+  memset(&ru, 0, sizeof(ru));
+  if (g_config.fsrv_fd != -1) {
+    uint64_t max_rss = 0;
+    if (read(g_config.fsrv_fd, &g_config.exit_status,
+             sizeof(g_config.exit_status)) != sizeof(g_config.exit_status) ||
+        read(g_config.fsrv_fd, &max_rss, sizeof(max_rss)) != sizeof(max_rss)) {
+      // lost the server (or the persistent target itself crashed), collect
+      // its status and restart it on the next run
+      if (wait4(g_config.fsrv_pid, &g_config.exit_status, 0, &ru) > 0) {
+        g_config.fsrv_pid = -1;
+        max_rss = ru.ru_maxrss;
+      }
+      stop_forkserver();
+    }
+    g_config.stats.max_rss = max_rss;
+  } else {
+    wait4(g_config.symsan_pid, &g_config.exit_status, 0, &ru);
+    g_config.stats.max_rss = ru.ru_maxrss;
+  }
+  g_config.stats.shm_used = shm_used();
+  g_config.symsan_pid = -1;
+}
+
 __attribute__((visibility("default")))
 int symsan_run(int fd) {
   if (fd < 0) {
@@ -240,17 +677,43 @@ int symsan_run(int fd) {
     return SYMSAN_MISSING_INPUT;
   }
 
+  // the last target may still be alive, e.g., if not all its events were
+  // read, the server only takes new requests after it is reaped, and
+  // nothing may be writing to the ring or the shm while they are reset
+  if (g_config.symsan_pid > 0) {
+    symsan_terminate();
+  }
+
   // unlikely but double check
   if (g_config.pipefds[0] != -1) {
     close(g_config.pipefds[0]);
+    g_config.pipefds[0] = -1;
   }
   if (g_config.pipefds[1] != -1) {
     close(g_config.pipefds[1]);
+    g_config.pipefds[1] = -1;
   }
   if (g_config.symsan_env == NULL) {
     free(g_config.symsan_env);
   }
 
+  reset_ring();
+  if (g_config.symsan_pid == -1) {
+    release_union_table();
+  }
+  g_config.stats.max_rss = 0;
+  g_config.stats.shm_used = 0;
+
+  if ((g_config.use_forkserver || g_config.use_persistent) &&
+      !g_config.fsrv_failed) {
+    int ret = symsan_run_forkserver(fd);
+    if (ret == 0 || !g_config.fsrv_failed) {
+      return ret;
+    }
+    fprintf(stderr, "WARNING: failed to start the forkserver, "
+            "running the target without it\n");
+  }
+
   int ret = pipe(g_config.pipefds);
   if (ret != 0) {
     return SYMSAN_NO_MEMORY;
@@ -259,11 +722,15 @@ int symsan_run(int fd) {
   // fds and configs could have been changed, so always set up new ones
   g_config.symsan_env = alloc_printf(
       "taint_file=\"%s\":shm_fd=%d:pipe_fd=%d:debug=%d:trace_bounds=%d:"
-      "solve_ub=%d:exit_on_memerror=%d:trace_fsize=%d:force_stdin=%d",
+      "solve_ub=%d:exit_on_memerror=%d:trace_fsize=%d:force_stdin=%d:"
+      "event_ring=%d:ring_offset=%zu:cov_filter=%d:branch_budget=%d:"
+      "union_table_thp=%zu:taint_fd=%d",
       g_config.input_file, g_config.shm_fd, g_config.pipefds[1],
       g_config.enable_debug, g_config.enable_bounds_check,
       g_config.enable_solve_ub, g_config.exit_on_memerror,
-      g_config.trace_file_size, g_config.force_stdin);
+      g_config.trace_file_size, g_config.force_stdin, ring_enabled(),
+      g_config.shm_size, cov_filter_enabled(), g_config.branch_budget, g_config.thp_size,
+      taint_input_fd(fd));
   if (g_config.symsan_env == NULL) {
     return SYMSAN_NO_MEMORY;
   }
@@ -274,30 +741,14 @@ int symsan_run(int fd) {
 
   g_config.symsan_pid = fork();
   if (g_config.symsan_pid == 0) {
-    // clear signal handlers and masks
-    sigset_t set;
-    sigemptyset(&set);
-    sigprocmask(SIG_SETMASK, &set, NULL);
-
-    // disable core dump as shadow mem is toooooo large
-    struct rlimit limit;
-    limit.rlim_cur = limit.rlim_max = 0;
-    setrlimit(RLIMIT_CORE, &limit);
-
     close(g_config.pipefds[0]); // close the read fd
-    setenv("TAINT_OPTIONS", (char*)g_config.symsan_env, 1);
-    unsetenv("LD_PRELOAD"); // don't preload anything
+    prepare_target_process(g_config.symsan_env);
     if (g_config.is_input_sdtin) {
       close(0);
       lseek(fd, 0, SEEK_SET);
       dup2(fd, 0);
-    }
-    if (!g_config.enable_debug) {
-      close(1);
-      close(2);
-      int dev_null_fd = open("/dev/null", O_RDWR);
-      dup2(g_config.dev_null_fd, 1);
-      dup2(g_config.dev_null_fd, 2);
+    } else if (taint_input_fd(fd) != -1) {
+      dup2(fd, TAINT_INPUT_FD); // without the close-on-exec flag
     }
     ret = execv(g_config.symsan_bin, g_config.argv);
     return ret;
@@ -316,11 +767,110 @@ int symsan_run(int fd) {
   return 0;
 }
 
+static void ring_get(struct event_ring *ring, uint64_t tail, void *buf,
+                     size_t n) {
+  size_t off = tail & (SYMSAN_RING_SIZE - 1);
+  size_t first = n < SYMSAN_RING_SIZE - off ? n : SYMSAN_RING_SIZE - off;
+  memcpy(buf, &ring->data[off], first);
+  memcpy((char *)buf + first, &ring->data[0], n - first);
+}
+
+// read exactly size bytes from the ring, unless the target is gone first,
+// returns the number of bytes read, or -1 on timeout or error
+static ssize_t read_ring(void *buf, size_t size, unsigned int timeout) {
+  struct event_ring *ring = g_config.ring;
+  struct timeval deadline;
+  size_t copied = 0;
+  int eof = 0;
+
+  if (timeout) {
+    gettimeofday(&deadline, NULL);
+    deadline.tv_sec += timeout / 1000;
+    deadline.tv_usec += (timeout % 1000) * 1000;
+    if (deadline.tv_usec >= 1000000) {
+      deadline.tv_sec += 1;
+      deadline.tv_usec -= 1000000;
+    }
+  }
+
+  while (copied < size) {
+    uint64_t tail = ring->tail;
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    if (head != tail) {
+      size_t n = head - tail;
+      if (n > size - copied) n = size - copied;
+      ring_get(ring, tail, (char *)buf + copied, n);
+      copied += n;
+      __atomic_store_n(&ring->tail, tail + n, __ATOMIC_RELEASE);
+      if (__atomic_load_n(&ring->writer_waiting, __ATOMIC_SEQ_CST) &&
+          __atomic_exchange_n(&ring->writer_waiting, 0, __ATOMIC_ACQ_REL)) {
+        syscall(SYS_futex, &ring->writer_waiting, FUTEX_WAKE, 1, NULL, NULL, 0);
+      }
+      continue;
+    }
+    if (eof) {
+      break; // all writers are gone and the ring is drained
+    }
+
+    // announce we are going to sleep, then check again before doing so
+    __atomic_store_n(&ring->reader_waiting, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) != tail) {
+      __atomic_store_n(&ring->reader_waiting, 0, __ATOMIC_RELAXED);
+      continue;
+    }
+
+    if (timeout) {
+      struct timeval now, tv;
+      gettimeofday(&now, NULL);
+      timersub(&deadline, &now, &tv);
+      if (tv.tv_sec < 0) {
+        return -1;
+      }
+      fd_set rfds;
+      FD_ZERO(&rfds);
+      FD_SET(g_config.pipefds[0], &rfds);
+      if (select(g_config.pipefds[0] + 1, &rfds, NULL, NULL, &tv) <= 0) {
+        return -1;
+      }
+    }
+
+    // drain the doorbells, the writer may ring more than once
+    char bells[64];
+    ssize_t n = read(g_config.pipefds[0], bells, sizeof(bells));
+    if (n == 0) {
+      eof = 1;
+    } else if (n < 0) {
+      return -1;
+    }
+    __atomic_store_n(&ring->reader_waiting, 0, __ATOMIC_RELAXED);
+  }
+
+  return copied;
+}
+
 __attribute__((visibility("default")))
 ssize_t symsan_read_event(void *buf, size_t size, unsigned int timeout) {
   if (size == 0) {
     return 0;
   }
+  // the target is gone, e.g., after a short read
+  if (g_config.pipefds[0] == -1) {
+    return -1;
+  }
+
+  if (ring_enabled()) {
+    ssize_t n = read_ring(buf, size, timeout);
+    if (n < 0 && g_config.symsan_pid > 0) {
+      kill(g_config.symsan_pid, SIGKILL);
+      g_config.is_killed = 1;
+    }
+    if (n != size) {
+      wait_target();
+      close(g_config.pipefds[0]); // close the read fd
+      g_config.pipefds[0] = -1;
+    }
+    return n;
+  }
 
   int ret = 1;
 
@@ -340,7 +890,7 @@ ssize_t symsan_read_event(void *buf, size_t size, unsigned int timeout) {
   ssize_t n = -1;
   if (ret > 0) { // no timeout or select okay
     n = read(g_config.pipefds[0], buf, size);
-  } else {
+  } else if (g_config.symsan_pid > 0) {
     // time out or error on select
     kill(g_config.symsan_pid, SIGKILL);
     g_config.is_killed = 1;
@@ -348,8 +898,7 @@ ssize_t symsan_read_event(void *buf, size_t size, unsigned int timeout) {
 
   if (n != size) {
     // error or EOF
-    waitpid(g_config.symsan_pid, &g_config.exit_status, 0);
-    g_config.symsan_pid = -1;
+    wait_target();
     close(g_config.pipefds[0]); // close the read fd
     g_config.pipefds[0] = -1;
   }
@@ -365,9 +914,9 @@ int symsan_terminate() {
   } else if (g_config.symsan_pid > 0) {
     kill(g_config.symsan_pid, SIGKILL);
     g_config.is_killed = 1;
-    waitpid(g_config.symsan_pid, &g_config.exit_status, 0);
-    g_config.symsan_pid = -1;
+    wait_target();
     close(g_config.pipefds[0]);
+    g_config.pipefds[0] = -1;
     return 0;
   } else {
     return -1;
@@ -387,12 +936,23 @@ int symsan_get_exit_status(int *status) {
 __attribute__((visibility("default")))
 void symsan_destroy() {
   symsan_terminate();
+  stop_forkserver();
 
   if (g_config.label_info != NULL) {
     munmap(g_config.label_info, g_config.shm_size);
     g_config.label_info = NULL;
   }
 
+  if (g_config.ring != NULL) {
+    munmap(g_config.ring, SYMSAN_RING_MAP_SIZE);
+    g_config.ring = NULL;
+  }
+
+  if (g_config.cov_map != NULL) {
+    munmap(g_config.cov_map, SYMSAN_COV_MAP_SIZE);
+    g_config.cov_map = NULL;
+  }
+
   if (g_config.dev_null_fd != -1) {
     close(g_config.dev_null_fd);
     g_config.dev_null_fd = -1;
@@ -403,6 +963,11 @@ void symsan_destroy() {
     g_config.shm_fd = -1;
   }
 
+  if (g_config.input_buf_fd != -1) {
+    close(g_config.input_buf_fd);
+    g_config.input_buf_fd = -1;
+  }
+
   if (g_config.shm_name != NULL) {
     shm_unlink(g_config.shm_name);
     free(g_config.shm_name);
@@ -0,0 +1,48 @@
+#ifndef SYMSAN_COV_MAP_H
+#define SYMSAN_COV_MAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Shared-memory bitmap of the (branch, direction) pairs the driver has
+// already seen, mapped after the event ring in the same shm object. The
+// target skips the cond events of the branches with both directions set, as
+// neither can lead to a new solving task.
+//
+// A branch is keyed by its id and the full address of its call site, the
+// latter tells apart inlined copies of the same source branch, as the
+// driver's EdgeCovManager does. Both are mixed into all 64 bits before
+// taking the slot, so only branches sharing a slot, about one in
+// 2^(SYMSAN_COV_MAP_BITS - 1) for each other branch covered, get skipped
+// without being covered.
+
+#define SYMSAN_COV_MAP_BITS 22 // 2M branches, two bits each
+#define SYMSAN_COV_MAP_SIZE (1UL << (SYMSAN_COV_MAP_BITS - 3))
+
+static inline uint32_t symsan_cov_slot(uint32_t id, uint64_t addr) {
+  // murmur3's fmix64
+  uint64_t h = addr ^ ((uint64_t)id * 0x9e3779b97f4a7c15ULL);
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  // the direction goes into the lowest bit
+  return (uint32_t)(h >> (64 - SYMSAN_COV_MAP_BITS + 1)) << 1;
+}
+
+static inline void symsan_cov_set(uint8_t *map, uint32_t id, uint64_t addr,
+                                  int direction) {
+  uint32_t bit = symsan_cov_slot(id, addr) | !!direction;
+  __atomic_or_fetch(&map[bit >> 3], 1 << (bit & 7), __ATOMIC_RELAXED);
+}
+
+// both directions are set
+static inline int symsan_cov_covered(const uint8_t *map, uint32_t id,
+                                     uint64_t addr) {
+  uint32_t bit = symsan_cov_slot(id, addr);
+  uint8_t both = 3 << (bit & 7);
+  return (__atomic_load_n(&map[bit >> 3], __ATOMIC_RELAXED) & both) == both;
+}
+
+#endif /* !SYMSAN_COV_MAP_H */
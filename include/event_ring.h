@@ -0,0 +1,36 @@
+#ifndef SYMSAN_EVENT_RING_H
+#define SYMSAN_EVENT_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Shared-memory byte ring carrying the trace events from the target to the
+// launcher, mapped right after the union table in the same shm object.
+//
+// The stream has exactly the same content as the event pipe would have,
+// the pipe is kept for wakeups and EOF only: the writer rings the doorbell
+// (a single byte) only when the reader has announced it is about to sleep,
+// and the reader sees EOF on it once the target is gone. When the ring is
+// full, the writer sleeps on a futex until the reader catches up.
+//
+// Writers (threads, or forked processes) are serialized by the spinlock, so
+// the two pieces of gep and memcmp events are never interleaved.
+
+#define SYMSAN_RING_SIZE (1UL << 20) // must be a power of 2
+
+struct event_ring {
+  // owned by the writer(s)
+  uint64_t head __attribute__((aligned(64)));
+  uint32_t lock;
+  uint32_t writer_waiting; // futex
+  // owned by the reader
+  uint64_t tail __attribute__((aligned(64)));
+  uint32_t reader_waiting;
+  uint8_t data[SYMSAN_RING_SIZE] __attribute__((aligned(64)));
+};
+
+// size of the mapping, rounded up to pages
+#define SYMSAN_RING_MAP_SIZE \
+  ((sizeof(struct event_ring) + 4095) & ~(size_t)4095)
+
+#endif /* !SYMSAN_EVENT_RING_H */
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "boost/dynamic_bitset.hpp"
+
+namespace rgd {
+
+// Set of (flattened) input offsets a label depends on.
+//
+// Most labels depend on a handful of contiguous byte ranges, so the set is
+// kept as a sorted list of disjoint intervals, and only falls back to a
+// bitset covering [lo, hi] once it becomes too fragmented. The payload is
+// immutable and shared, so labels whose deps are the same as one of their
+// operands' (casts, ops with a constant, ...) don't cost any extra memory.
+class InputDeps {
+public:
+  static const size_t npos = (size_t)-1;
+
+  InputDeps() = default;
+
+  bool empty() const { return rep_ == nullptr; }
+
+  // add [idx, idx + n)
+  void set(size_t idx, size_t n = 1) {
+    if (n == 0) return;
+    InputDeps other;
+    auto rep = std::make_shared<Rep>();
+    rep->intervals.push_back({idx, idx + n});
+    other.rep_ = std::move(rep);
+    *this |= other;
+  }
+
+  InputDeps& operator|=(const InputDeps &other) {
+    if (other.empty() || rep_ == other.rep_) return *this;
+    if (empty()) {
+      rep_ = other.rep_;
+      return *this;
+    }
+    // avoid allocating a new payload if one already covers the other
+    if (contains(*other.rep_, *rep_)) {
+      rep_ = other.rep_;
+      return *this;
+    }
+    if (contains(*rep_, *other.rep_)) {
+      return *this;
+    }
+    rep_ = merge(*rep_, *other.rep_);
+    return *this;
+  }
+
+  size_t find_first() const {
+    if (empty()) return npos;
+    if (rep_->dense) {
+      return rep_->base + rep_->bits.find_first();
+    }
+    return rep_->intervals.front().lo;
+  }
+
+  size_t find_next(size_t pos) const {
+    if (empty()) return npos;
+    if (rep_->dense) {
+      if (pos < rep_->base) return find_first();
+      size_t next = rep_->bits.find_next(pos - rep_->base);
+      return next == Bits::npos ? npos : rep_->base + next;
+    }
+    auto &iv = rep_->intervals;
+    // first interval that ends after pos + 1
+    auto itr = std::upper_bound(iv.begin(), iv.end(), pos + 1,
+        [](size_t p, const Interval &i) { return p < i.hi; });
+    if (itr == iv.end()) return npos;
+    return std::max(pos + 1, itr->lo);
+  }
+
+  // bytes used by the payload, shared payloads are counted by every owner
+  size_t memory_usage() const {
+    if (empty()) return 0;
+    return sizeof(Rep) + rep_->intervals.capacity() * sizeof(Interval) +
+           rep_->bits.num_blocks() * sizeof(Bits::block_type);
+  }
+
+private:
+  // beyond this many intervals, a bitset is smaller and faster to merge
+  static const size_t kMaxIntervals = 32;
+
+  using Bits = boost::dynamic_bitset<uint64_t>;
+  struct Interval {
+    size_t lo, hi; // [lo, hi)
+  };
+  struct Rep {
+    bool dense = false;
+    std::vector<Interval> intervals; // sorted, disjoint, not adjacent
+    size_t base = 0; // dense: bit i is offset base + i
+    Bits bits;
+    size_t lo() const { return dense ? base : intervals.front().lo; }
+    size_t hi() const { return dense ? base + bits.size() : intervals.back().hi; }
+  };
+
+  std::shared_ptr<const Rep> rep_;
+
+  // whether a is a superset of b, only checks the cheap cases
+  static bool contains(const Rep &a, const Rep &b) {
+    if (a.dense || b.dense) return false;
+    if (a.intervals.size() != 1) return false;
+    auto &i = a.intervals.front();
+    return i.lo <= b.lo() && b.hi() <= i.hi;
+  }
+
+  static void add_bits(Bits &bits, size_t base, const Rep &r) {
+    if (r.dense) {
+      for (size_t i = r.bits.find_first(); i != Bits::npos;
+           i = r.bits.find_next(i)) {
+        bits.set(r.base + i - base);
+      }
+    } else {
+      for (auto &i : r.intervals) {
+        bits.set(i.lo - base, i.hi - i.lo, true);
+      }
+    }
+  }
+
+  static std::shared_ptr<const Rep> merge(const Rep &a, const Rep &b) {
+    auto rep = std::make_shared<Rep>();
+    if (!a.dense && !b.dense) {
+      auto &x = a.intervals, &y = b.intervals;
+      auto &out = rep->intervals;
+      out.reserve(x.size() + y.size());
+      size_t i = 0, j = 0;
+      while (i < x.size() || j < y.size()) {
+        const Interval &n = (j == y.size() || (i < x.size() && x[i].lo <= y[j].lo))
+                            ? x[i++] : y[j++];
+        if (!out.empty() && n.lo <= out.back().hi) {
+          out.back().hi = std::max(out.back().hi, n.hi);
+        } else {
+          out.push_back(n);
+        }
+      }
+      if (out.size() <= kMaxIntervals) {
+        out.shrink_to_fit();
+        return rep;
+      }
+      out.clear();
+      out.shrink_to_fit();
+    }
+    // too fragmented, switch to a bitset over the covered range
+    rep->dense = true;
+    rep->base = std::min(a.lo(), b.lo());
+    rep->bits.resize(std::max(a.hi(), b.hi()) - rep->base);
+    add_bits(rep->bits, rep->base, a);
+    add_bits(rep->bits, rep->base, b);
+    return rep;
+  }
+};
+
+};
@@ -21,6 +21,16 @@ void* symsan_init(const char *symsan_bin, size_t uniontable_size);
 /// @return success or error code
 int symsan_set_input(const char *input);
 
+/// @brief deliver the next input from memory, as a sealed memfd the target
+///        maps directly instead of a file written to disk. For file inputs,
+///        the target's opens of the path set by symsan_set_input are
+///        redirected to it, the path only has to exist
+/// @param buf: contents of the input
+/// @param size: size of the input
+/// @return the fd to pass to symsan_run, owned by the launcher and valid
+///         until the next call, < 0 on error
+int symsan_set_input_buffer(const void *buf, size_t size);
+
 /// @brief set the arguments for the target binary
 /// @param argc: number of arguments
 /// @param argv: array of arguments
@@ -45,8 +55,57 @@ int symsan_set_trace_file_size(int enable);
 /// @brief set the force stdin mode for the target binary
 int symsan_set_force_stdin(int enable);
 
+/// @brief set the forkserver mode, the target binary is exec'd once and
+///        parks after init, each symsan_run then only forks a new child.
+///        If the server doesn't come up, e.g., the binary crashes before
+///        reaching it, every run falls back to fork+exec until this or
+///        symsan_set_persistent is called again
+int symsan_set_forkserver(int enable);
+
+/// @brief set the persistent mode, for harnesses linked with the symsan proxy,
+///        one target process keeps tracing inputs read from the fd passed to
+///        symsan_run, takes precedence over the forkserver mode
+int symsan_set_persistent(int enable);
+
+/// @brief set whether events are delivered through the shared-memory ring
+///        after the union table (default) instead of the pipe, the pipe is
+///        then only used for wakeups and to detect the target's exit
+int symsan_set_event_ring(int enable);
+
+/// @brief set whether the target skips the branches whose both directions
+///        are set in the coverage map, see cov_map.h
+int symsan_set_cov_filter(int enable);
+
+/// @brief set the per-site hit budget of the target, the events of a branch
+///        beyond it are only sent at hit counts that are powers of two
+/// @param budget: hits sent in full, 0 for no limit (default)
+int symsan_set_branch_budget(int budget);
+
+/// @brief get the coverage map shared with the target, the driver sets the
+///        (branch, direction) pairs it has seen with symsan_cov_set
+/// @return pointer to the map, NULL if it couldn't be mapped
+uint8_t* symsan_get_cov_map();
+
+/// @brief back the first prefix bytes of the union table with transparent
+///        huge pages, where the labels of every run are allocated. Depends on
+///        /sys/kernel/mm/transparent_hugepage/shmem_enabled allowing advise
+/// @param prefix: size of the prefix in bytes, 0 to disable (default)
+int symsan_set_huge_pages(size_t prefix);
+
+/// @brief per-run resource usage, of the last target that has exited
+struct symsan_run_stats {
+  uint64_t max_rss;      // peak RSS of the target in KB, for the persistent
+                         // mode the peak of the process so far
+  uint64_t shm_used;     // bytes of the shm (tmpfs) held at the end of the run
+  uint64_t shm_released; // bytes of the union table released before the run
+};
+
+/// @brief retrieve the resource usage of the last run
+int symsan_get_run_stats(struct symsan_run_stats *stats);
+
 /// @brief run the target binary with the input file descriptor
-/// @param fd: input file descriptor, only used if input is "stdin"
+/// @param fd: input file descriptor, only used if input is "stdin", or if it
+///            was returned by symsan_set_input_buffer
 /// @return < 0 on syscall error, > 0 on setup error, 0 on success
 int symsan_run(int fd);
 
@@ -4,8 +4,7 @@
 
 #include "task.h"
 #include "union_find.h"
-
-#include "boost/dynamic_bitset.hpp"
+#include "input_deps.h"
 
 namespace rgd {
 
@@ -55,7 +54,7 @@ private:
 
   // dependencies tracking
   size_t input_size_; // record the whole input size
-  using input_dep_t = boost::dynamic_bitset<>;
+  using input_dep_t = InputDeps;
   std::vector<input_dep_t> branch_to_inputs; // label -> flattened input dependencies
   // <input_id, offset> will be flattened to bit \sigma_{i=0}^{input_id}{size_of(input_i)} + offset
   inline size_t input_to_dep_idx(uint32_t input_id, uint32_t offset) {
@@ -69,6 +68,10 @@ private:
   std::vector<std::vector<expr_t> > input_to_branches;
 
   [[nodiscard]] expr_t get_root_expr(dfsan_label label);
+  [[nodiscard]] bool scan_label(dfsan_label label);
+  // scan a label skipped by the linear scan, along with its children that
+  // were skipped too, without recursion
+  [[nodiscard]] bool scan_pending(dfsan_label label);
   [[nodiscard]] bool scan_labels(dfsan_label label);
   [[nodiscard]] int find_roots(dfsan_label label, AstNode *ret,
                                std::unordered_set<dfsan_label> &subroots);
@@ -84,6 +87,14 @@ private:
                    constraint_t constraint);
 
   bool save_constraint(expr_t expr, bool result);
+  // input bytes a relational leaf depends on, minus the concretized operand
+  [[nodiscard]] input_dep_t leaf_deps(dfsan_label label);
+  // whether a relational leaf, with its possibly negated kind, holds on the
+  // current input
+  [[nodiscard]] bool holds_on_input(const rgd::AstNode *node);
+  // drop the leaves of a clause that share no input bytes, directly or
+  // through the saved constraints, with the rest and already hold
+  void slice_clause(const clause_t &clause, clause_t &live);
   inline void add_nested_constraint(task_t task, const clause_t &nested_caluse);
 };
 
@@ -1,9 +1,14 @@
 #pragma once
 
 #include "parse.h"
+#include "query_cache.h"
 
 #include <z3++.h>
 
+#include <atomic>
+#include <functional>
+#include <memory>
+
 namespace symsan {
 
 struct trace_cond {
@@ -48,11 +53,50 @@ public:
 
   int add_constraints(dfsan_label label, uint64_t result) override;
 
+  // Serialize a task as SMT-LIB2, to be solved in another context, e.g., on a
+  // solver thread, as a z3 context can't be shared across threads. The task
+  // is consumed, like when it's solved.
+  int export_task(uint64_t task_id, std::string &smt2);
+
+  // A symbolic GEP index to enumerate in another context, like a task from
+  // export_task. The SMT-LIB2 first asserts (= index curr), which carries the
+  // index expression, then the nested constraints. The values to try are
+  // [lb, ub) in steps, other than curr.
+  struct exported_gep {
+    std::string smt2;
+    uint64_t curr;
+    uint64_t lb;
+    uint64_t ub;
+    uint64_t step;
+  };
+  // smt2 is left empty if the GEP has nothing to enumerate
+  int export_gep(dfsan_label ptr_label, uptr ptr,
+                 dfsan_label index_label, int64_t index,
+                 uint64_t num_elems, uint64_t elem_size,
+                 int64_t current_offset, exported_gep &gep);
+
 protected:
   z3::context &context_;
   const char* input_name_format;
   const char* atoi_name_format;
 
+  // the values a symbolic GEP index (or the address, for bounded buffers)
+  // can take: [lb, ub) in steps, other than curr
+  struct index_range {
+    z3::expr index;
+    uint64_t curr;
+    uint64_t lb;
+    uint64_t ub;
+    uint64_t step;
+    z3_task_t nested;
+  };
+  // range is left empty if the GEP has nothing to enumerate
+  int parse_gep_range(dfsan_label ptr_label, uptr ptr,
+                      dfsan_label index_label, int64_t index,
+                      uint64_t num_elems, uint64_t elem_size,
+                      int64_t current_offset,
+                      std::unique_ptr<index_range> &range);
+
 private:
   bool strict_value_filtering_ = true;
 
@@ -67,6 +111,8 @@ private:
   std::vector<uint32_t> tsize_cache_;
   std::vector<input_dep_set_t> deps_cache_;
   std::vector<Z3_ast> expr_cache_;
+  // labels that failed to serialize, e.g., with an unsupported operator
+  std::vector<bool> failed_cache_;
   std::vector<uint64_t> value_cache_;
   static const size_t SIZE_INCREMENT = 2048;
 
@@ -104,14 +150,13 @@ private:
   }
 
   inline void cache_expr(dfsan_label label, z3::expr const &e) {
-    if (label != expr_cache_.size()) {
-      // fprintf(stderr, "expected label %zu, got %u\n",
-      //         expr_cache_.size(), label);
+    if (label >= expr_cache_.size() || expr_cache_[label] != nullptr) {
+      // fprintf(stderr, "unexpected label %u\n", label);
       throw z3::exception("missing or adding too many expressions");
     }
     Z3_ast ast = e;
     Z3_inc_ref(context_, ast); // increment reference count
-    expr_cache_.emplace_back(ast);
+    expr_cache_[label] = ast;
   }
 
   inline z3::expr get_cached_expr(dfsan_label label, input_dep_set_t &deps) {
@@ -119,6 +164,14 @@ private:
       throw z3::exception("invalid label");
     }
     Z3_ast ast = expr_cache_[label];
+    if (ast == nullptr) {
+      if (failed_cache_[label]) {
+        throw z3::exception("unsupported label");
+      }
+      // not written yet when the linear scan passed it
+      serialize_pending(label);
+      ast = expr_cache_[label];
+    }
     if (ast == nullptr) {
       throw z3::exception("cannot find cached expression");
     }
@@ -126,12 +179,27 @@ private:
     return z3::expr(context_, ast);
   }
 
+  inline bool invalid_gep_labels(dfsan_label ptr_label, dfsan_label index_label) {
+    return index_label < CONST_OFFSET ||
+           index_label == __dfsan::kInitializingLabel || index_label >= size_ ||
+           ptr_label == __dfsan::kInitializingLabel || ptr_label >= size_;
+  }
+
   inline void dump_value_cache(dfsan_label label);
 
   z3::expr read_concrete(dfsan_label label, uint16_t size);
   z3::expr serialize(dfsan_label label, input_dep_set_t &deps);
+  void serialize_label(dfsan_label label);
+  // serialize a label skipped by the linear scan, along with its children
+  // that were skipped too, without recursion
+  void serialize_pending(dfsan_label label);
   inline void collect_more_deps(input_dep_set_t &deps);
   inline size_t add_nested_constraints(input_dep_set_t &deps, z3_task_t *task);
+  // Drop the nested constraints from task[first] on that share no input
+  // byte, even transitively, with root. They hold on the current input, and
+  // the bytes they constrain are left as they are by any solution of the
+  // rest. Returns the number of constraints dropped.
+  size_t slice_independent(const z3::expr &root, z3_task_t &task, size_t first);
   inline void save_constraint(z3::expr expr, input_dep_set_t &inputs);
   void construct_index_tasks(z3::expr &index, uint64_t curr,
                              uint64_t lb, uint64_t ub, uint64_t step,
@@ -163,10 +231,96 @@ public:
   };
 
   using solution_t = std::vector<struct solution_val>;
+
+  // An incremental solver for the tasks of a run in one context. The tasks
+  // share most of their nested constraints, so each distinct one is asserted
+  // once behind a literal, keyed by the id of the constraint, which z3 keeps
+  // the same for the same constraint parsed again in the context. A task
+  // only switches its own on as assumptions. Like its context, a session
+  // belongs to one thread.
+  class Session {
+  public:
+    explicit Session(z3::context &context) : context_(context) {}
+    z3::context &context() { return context_; }
+    // drop the constraints, e.g., of the last run
+    void reset() { solver_.reset(); lits_.clear(); }
+  private:
+    friend class Z3ParserSolver;
+    z3::context &context_;
+    std::unique_ptr<z3::solver> solver_;
+    std::unordered_map<unsigned, z3::expr> lits_;
+    z3::expr literal(const z3::expr &e);
+  };
+
+  int restart(std::vector<input_t> &inputs) override;
+
+  // Solve a saved task, in the session of the parser's context, which is
+  // kept for the whole run.
   solving_status solve_task(uint64_t task_id, unsigned timeout, solution_t &solutions);
 
+  // Solve a task from export_task in the given session. Only the session
+  // and its context are touched, so it can run on another thread while the
+  // parsing goes on.
+  solving_status solve_exported(Session &session, const std::string &smt2,
+                                unsigned timeout, solution_t &solutions) const;
+
+  // called with each solution, returns false to stop the enumeration
+  using solution_cb_t = std::function<bool(solution_t &solutions)>;
+
+  // Enumerate the values of a GEP index from export_gep in the given
+  // context, with one incremental solver, instead of a task per candidate
+  // value as parse_gep does. Like solve_exported, it can run on another
+  // thread. The boundary values (lb, the last one in range, and ub) are
+  // tried first, then the rest of the range one model at a time, each
+  // blocked once found. Gives up after budget ms. Returns the number of
+  // solutions, -1 on error.
+  int enum_gep(z3::context &context, const exported_gep &gep,
+               unsigned budget, const solution_cb_t &cb) const;
+
+  // print the queries as SMT-LIB2 to stdout
+  void set_dump_smt2(bool v) { dump_smt2_ = v; }
+
+  // number of solver checks and the time spent in them, summed over all
+  // contexts, i.e., per solver thread second when solving in parallel
+  uint64_t get_solve_count() const { return solves_; }
+  double get_solve_time() const { return solve_us_ / 1e6; }
+
+  // look up solve_task and solve_exported in a cache shared with other
+  // solvers and runs, and record their results
+  void set_query_cache(std::shared_ptr<QueryCache> cache) { query_cache_ = cache; }
+  const QueryCache::stats_t& get_cache_stats() const { return cache_stats_; }
+
 private:
-  void generate_solution(z3::model &m, solution_t &solutions);
+  bool dump_smt2_ = false;
+  mutable std::atomic<uint64_t> solves_{0};
+  mutable std::atomic<uint64_t> solve_us_{0};
+
+  // session of solve_task
+  Session session_{context_};
+
+  std::shared_ptr<QueryCache> query_cache_;
+  mutable QueryCache::stats_t cache_stats_;
+  // Answer a task from the cache, true on a hit. Otherwise, nested_unsat
+  // tells if the nested constraints are known unsat, so only the optimistic
+  // one is left to solve.
+  bool lookup_task(const z3_task_t &task, QueryCache::query_t &query,
+                   bool &nested_unsat, solving_status &ret,
+                   solution_t &solutions) const;
+  void cache_task(const z3_task_t &task, const QueryCache::query_t &query,
+                  solving_status ret, const solution_t &solutions,
+                  uint64_t cost) const;
+  bool check_model(const z3_task_t &task, const QueryCache::model_t &model) const;
+
+  solving_status solve(Session &session, const z3_task_t &task,
+                       unsigned timeout, solution_t &solutions) const;
+  // the optimistic constraint is already asserted, the nested ones are
+  // switched on by the assumptions
+  solving_status check_task(z3::solver &solver, const z3_task_t &task,
+                            const z3::expr_vector &assumptions,
+                            solution_t &solutions) const;
+  // with decls, only the constants among them are taken from the model
+  void generate_solution(z3::model &m, solution_t &solutions,
+                         const std::unordered_set<unsigned> *decls = nullptr) const;
 
 };
 
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace symsan {
+
+// Cache of solver results, in the style of KLEE's counterexample cache. A
+// query is a set of constraints, each given by a hash of its canonical form,
+// so the same branch constraints hit across seeds and tasks. Besides exact
+// hits, a lookup answers:
+//  - unsat, if a known unsat set is a subset of the query;
+//  - sat, with its model, if a known sat set is a superset of the query;
+//  - a candidate model, from the largest known sat subset of the query,
+//    which the caller has to check against the rest of the query.
+//
+// With a file, the results are also appended to it, mapped shared, and the
+// ones appended by other processes (e.g., parallel fuzzers or earlier runs)
+// are picked up on the next lookup. The file is an append-only log, once
+// full, new results are only kept in memory.
+//
+// Thread-safe, one cache can be shared by all the solvers of a process.
+class QueryCache {
+public:
+  // a query, as the sorted unique hashes of its constraints, see normalize()
+  using query_t = std::vector<uint64_t>;
+  // a model, as pairs of (input id << 32 | offset, value)
+  using model_t = std::vector<std::pair<uint64_t, uint8_t>>;
+
+  enum result_t {
+    miss,
+    sat,
+    unsat,
+    candidate,
+  };
+
+  // per solver, so they can tell their hits apart
+  struct stats_t {
+    std::atomic<uint64_t> lookups{0};
+    std::atomic<uint64_t> exact{0};
+    std::atomic<uint64_t> unsat_subset{0};
+    std::atomic<uint64_t> sat_superset{0};
+    std::atomic<uint64_t> candidates{0};
+    std::atomic<uint64_t> candidate_hits{0};
+    std::atomic<uint64_t> saved_us{0};
+    void print(int fd) const;
+  };
+
+  static const size_t kDefaultFileSize = 256UL << 20;
+
+  // an empty path for an in-memory cache
+  explicit QueryCache(const char *path = nullptr,
+                      size_t file_size = kDefaultFileSize);
+  ~QueryCache();
+  QueryCache(const QueryCache&) = delete;
+  QueryCache& operator=(const QueryCache&) = delete;
+
+  // sort and deduplicate the constraint hashes of a query
+  static void normalize(query_t &query);
+
+  // mix the fields of a constraint into its hash
+  static inline uint64_t mix(uint64_t h, uint64_t v) {
+    h ^= v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+  }
+
+  // Look up a normalized query. On sat and candidate, the model is returned
+  // as well. cost is the solving time (us) of the matched entry, which the
+  // caller adds to saved_us once a candidate checks out.
+  result_t lookup(const query_t &query, model_t &model, uint64_t &cost,
+                  stats_t &stats);
+
+  // record the result of a normalized query, solved in cost us
+  void insert(const query_t &query, bool is_sat, const model_t &model,
+              uint64_t cost);
+
+  size_t size();
+
+private:
+  struct entry_t {
+    query_t query;
+    model_t model;
+    uint64_t cost;
+    bool sat;
+  };
+
+  std::mutex lock_;
+  std::vector<entry_t> entries_;
+  // hash of the whole query -> entries
+  std::unordered_multimap<uint64_t, uint32_t> exact_;
+  // smallest constraint -> entries, an entry is a subset of the query only
+  // if found under one of the constraints of the query
+  std::unordered_map<uint64_t, std::vector<uint32_t>> heads_;
+  // constraint -> entries containing it, a superset of the query is found
+  // under the smallest constraint of the query
+  std::unordered_map<uint64_t, std::vector<uint32_t>> index_;
+
+  // the shared file, if any
+  struct file_header;
+  file_header *file_;
+  size_t file_size_;
+  // offset of the next record to read from the file
+  uint64_t cursor_;
+
+  static uint64_t query_key(const query_t &query);
+  bool add_entry(const query_t &query, bool is_sat, const model_t &model,
+                 uint64_t cost);
+  void sync_file();
+  void append_file(const query_t &query, bool is_sat, const model_t &model,
+                   uint64_t cost);
+};
+
+}; // namespace symsan
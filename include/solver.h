@@ -1,6 +1,7 @@
 #pragma once
 
 #include "task.h"
+#include "query_cache.h"
 
 #include <stdint.h>
 #include <z3++.h>
@@ -27,6 +28,26 @@ public:
                                 const uint8_t *in_buf, size_t in_size,
                                 uint8_t *out_buf, size_t &out_size) = 0;
   virtual void print_stats(int fd) = 0;
+  // called with a batch of new tasks before they are solved, e.g., to
+  // amortize per-task setup
+  virtual void prepare(std::vector<std::shared_ptr<SearchTask>> const& tasks) {}
+  // stop a solve() running on another thread, e.g., when it has lost the
+  // race on the task to another solver, see SearchTask::claim()
+  virtual void interrupt() {}
+  // look up the results of other solvers, instances and runs, and record
+  // the own ones, in a shared cache
+  void set_query_cache(std::shared_ptr<symsan::QueryCache> cache) {
+    query_cache_ = cache;
+  }
+protected:
+  std::shared_ptr<symsan::QueryCache> query_cache_;
+  symsan::QueryCache::stats_t cache_stats_;
+  // the constraints of a task as a query, keyed by their ASTs, constants,
+  // and comparisons, so they match across tasks and seeds
+  static void cache_query(SearchTask const& task,
+                          symsan::QueryCache::query_t &query);
+  static void to_model(std::unordered_map<size_t, uint8_t> const& solution,
+                       symsan::QueryCache::model_t &model);
 };
 
 class Z3Solver : public Solver {
@@ -35,8 +56,14 @@ public:
   solver_result_t solve(std::shared_ptr<SearchTask> task,
                         const uint8_t *in_buf, size_t in_size,
                         uint8_t *out_buf, size_t &out_size) override;
-  void print_stats(int fd) override {} ;
+  void print_stats(int fd) override;
+  // a running check doesn't look at the task, it has to be interrupted
+  void interrupt() override { context_.interrupt(); }
 private:
+  // a cached model of a subset of the task, checked against the rest
+  bool check_model(z3::expr_vector const& exprs,
+                   symsan::QueryCache::model_t const& model);
+
   z3::expr serialize_rel(uint32_t comparison,
                          const AstNode* node,
                          const std::vector<std::pair<bool, uint64_t>> &input_args,
@@ -46,25 +73,44 @@ private:
                      const std::vector<std::pair<bool, uint64_t>> &input_args,
                      std::unordered_map<uint32_t,z3::expr> &expr_cache);
 
-  z3::context &context_;
+  // z3 contexts are not thread-safe, each solver owns one so that solvers
+  // can be used from different threads
+  z3::context context_;
   z3::solver solver_;
 };
 
 class JITSolver : public Solver {
 public:
-  JITSolver();
+  // compiled constraints are also cached in cache_dir, if set, which can
+  // be shared by later or concurrent runs.
+  // With a jit_threshold, constraints are interpreted until they have been
+  // evaluated that many times (-1: never jit), otherwise always jitted.
+  // With batch_probes, the jitted constraints also get a vectorized variant
+  // evaluating the probes of a partial derivative at once
+  JITSolver(const char *cache_dir = nullptr, uint64_t jit_threshold = 0,
+            bool batch_probes = false);
   solver_result_t solve(std::shared_ptr<SearchTask> task,
                         const uint8_t *in_buf, size_t in_size,
                         uint8_t *out_buf, size_t &out_size) override;
   void print_stats(int fd) override;
+  // jit all the constraints of the tasks at once
+  void prepare(std::vector<std::shared_ptr<SearchTask>> const& tasks) override;
 private:
-  std::atomic_ulong uuid;
+  const Bytecode* get_bytecode(std::shared_ptr<const Constraint> const& c);
+  bool should_interpret(std::shared_ptr<const Constraint> const& c);
+  void jit_batch(std::vector<std::shared_ptr<const Constraint>> const& pending);
+
+  const uint64_t jit_threshold;
   std::atomic_ulong cache_hits;
   std::atomic_ulong cache_misses;
   std::atomic_ulong num_timeout;
   std::atomic_ulong num_solved;
   std::atomic_ulong process_time;
   std::atomic_ulong jit_time;
+  std::atomic_ulong num_jitted;
+  std::atomic_ulong num_batches;
+  std::atomic_ulong num_bytecode;
+  std::atomic_ulong num_promoted;
   std::atomic_ulong solving_time;
 };
 
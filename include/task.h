@@ -2,11 +2,13 @@
 
 #include <stdint.h>
 
+#include <atomic>
 #include <bitset>
 #include <cassert>
 #include <map>
 #include <memory>
 #include <stdexcept>
+#include <thread>
 #include <tuple>
 #include <unordered_map>
 #include <vector>
@@ -18,13 +20,24 @@ namespace rgd {
 
 // JIT'ed function for each relational constraint
 typedef void(*test_fn_type)(uint64_t*);
+// interpreted alternative to the JIT'ed function
+struct Bytecode;
 
 // the first two slots of the arguments for reseved for the left and right operands
 static const int RET_OFFSET = 2;
 
+// vectorized variant of a JIT'ed function, evaluating BATCH_LANES candidate
+// inputs that only differ in one arg slot: batch[0, BATCH_LANES) are the
+// values of args[slot], and the comparison operands of each candidate are
+// returned in batch[BATCH_LANES, 2 * BATCH_LANES) and
+// batch[2 * BATCH_LANES, 3 * BATCH_LANES)
+typedef void(*batch_fn_type)(const uint64_t* args, uint64_t slot, uint64_t* batch);
+static const int BATCH_LANES = 8;
+
 struct Constraint {
   Constraint() = delete;
-  Constraint(int ast_size): fn(nullptr), const_num(0) {
+  Constraint(int ast_size): fn(nullptr), batch_fn(nullptr), bc(nullptr),
+      const_num(0) {
     ast = std::make_shared<AstNode>(ast_size);
   }
   Constraint(const Constraint&) = default; // XXX: okay to use default?
@@ -32,6 +45,11 @@ struct Constraint {
 
   // JIT'ed function for a comparison expression
   test_fn_type fn;
+  // and its vectorized variant over BATCH_LANES candidates, if any, set
+  // before fn
+  batch_fn_type batch_fn;
+  // or its bytecode, used until fn is set
+  const Bytecode *bc;
   // the AST
   std::shared_ptr<AstNode> ast;
 
@@ -74,7 +92,7 @@ class SearchTask {
 public:
   SearchTask(): scratch_args(nullptr), max_const_num_(0),
       stopped(false), attempts(0), solved(false), skip_next(false),
-      base_task(nullptr) {}
+      base_task(nullptr), racing(false) {}
   SearchTask(const SearchTask&) = delete;
   ~SearchTask() { if (scratch_args) free(scratch_args); }
   inline bool has_finalized() const { return scratch_args != nullptr; }
@@ -170,16 +188,21 @@ public:
   // the input array used for all JIT'ed functions
   // all input bytes are extended to 64 bits
   uint64_t* scratch_args;
+  // the candidates and results of the batch functions
+  alignas(64) uint64_t batch_args[3 * BATCH_LANES];
 
   // intermediate states for the search
   std::vector<uint64_t> min_distances; // current best
   std::vector<uint64_t> distances; // general scratch
   std::vector<uint64_t> plus_distances; // used in partial derivation
   std::vector<uint64_t> minus_distances; // used in partial derivation
+  std::vector<uint64_t> probe_distances; // batched probes of a partial derivation
+  std::vector<bool> probe_batched;
 
   // statistics
   uint64_t start; //start time
-  bool stopped;
+  // set to stop the gd, also from other threads
+  std::atomic<bool> stopped;
   int attempts;
 
   // solutions
@@ -190,6 +213,47 @@ public:
   std::shared_ptr<SearchTask> base_task;
   bool skip_next; // FIXME: an ugly hack to skip the next task
 
+  // portfolio solving, while solvers race on the task, each on its own
+  // thread, only the first to solve it claims it and writes the solution,
+  // claiming also stops the gd of the others
+  std::atomic<bool> racing;
+  std::atomic<std::thread::id> claimant;
+
+  void start_race() {
+    claimant = std::thread::id();
+    racing = true;
+  }
+
+  void end_race() {
+    racing = false;
+  }
+
+  // called by a solver before writing its solution, false if another one
+  // was first
+  bool claim() {
+    if (!racing) return true;
+    std::thread::id none;
+    std::thread::id self = std::this_thread::get_id();
+    if (claimant.compare_exchange_strong(none, self)) {
+      stopped = true;
+      return true;
+    }
+    return none == self;
+  }
+
+  // another solver has claimed the task, no need to go on
+  bool lost() const {
+    if (!racing) return false;
+    std::thread::id owner = claimant;
+    return owner != std::thread::id() && owner != std::this_thread::get_id();
+  }
+
+  // solved by the calling solver, rather than by another one in the race
+  bool solved_by_self() const {
+    if (!racing) return solved;
+    return claimant == std::this_thread::get_id();
+  }
+
   void finalize() {
     // aggregate the contraints, map each input byte to a constraint to
     // an index in the "global" input array (i.e., the scratch_args)
@@ -295,6 +359,16 @@ public:
     }
   }
 
+  // load hint from (offset, value) pairs, e.g., a cached model
+  void load_hint(std::vector<std::pair<uint64_t, uint8_t>> const& hint) {
+    std::unordered_map<uint64_t, uint8_t> values(hint.begin(), hint.end());
+    for (auto itr = inputs_.begin(), e = inputs_.end(); itr != e; itr++) {
+      auto got = values.find(itr->first);
+      if (got != values.end())
+        itr->second = got->second;
+    }
+  }
+
 };
 
 using task_t = std::shared_ptr<rgd::SearchTask>;
@@ -181,6 +181,19 @@ static cl::opt<bool> ClSolveUB(
     cl::desc("Solve undefined behaviours."),
     cl::Hidden, cl::init(false));
 
+// SYMSAN specific flags, check the shadow of small loads and stores inline and
+// only call into the runtime when some label is non-zero
+static cl::opt<bool> ClInlineFastPath(
+    "taint-inline-fast-path",
+    cl::desc("Inline the zero-label fast path of shadow loads and stores."),
+    cl::Hidden, cl::init(true));
+
+static cl::opt<bool> ClInlineTraceGuards(
+    "taint-inline-trace-guards",
+    cl::desc("Test the labels inline and only call the trace hooks from a "
+             "cold block when they are non-zero."),
+    cl::Hidden, cl::init(true));
+
 static StringRef getGlobalTypeString(const GlobalValue &G) {
   // Types of GlobalVariables are always pointer types.
   Type *GType = G.getValueType();
@@ -201,6 +214,7 @@ struct MemoryMapParams {
   uint64_t AndMask;
   uint64_t XorMask;
   uint64_t ShadowBase;
+  uint64_t SummaryBase;
 };
 
 } // end anonymous namespace
@@ -211,8 +225,12 @@ static const MemoryMapParams Linux_X86_64_MemoryMapParams = {
     0x700000000000, // AndMask (keep old style)
     0,              // XorMask (not used)
     0,              // ShadowBase (not used)
+    0x400d00000000, // SummaryBase, a byte per 4KB shadow page, see dfsan.h
 };
 
+// The shadow summary has a byte per page of shadow memory.
+static const unsigned ShadowPageShift = 12;
+
 namespace {
 
 class TaintABIList {
@@ -376,6 +394,7 @@ class Taint {
   FunctionType *TaintUnionStoreFnTy;
   FunctionType *TaintUnimplementedFnTy;
   FunctionType *TaintSetLabelFnTy;
+  FunctionType *TaintMemTransferFnTy;
   FunctionType *TaintNonzeroLabelFnTy;
   FunctionType *TaintVarargWrapperFnTy;
   FunctionType *TaintTraceCmpFnTy;
@@ -401,6 +420,7 @@ class Taint {
   FunctionCallee TaintUnionStoreFn;
   FunctionCallee TaintUnimplementedFn;
   FunctionCallee TaintSetLabelFn;
+  FunctionCallee TaintMemTransferFn;
   FunctionCallee TaintNonzeroLabelFn;
   FunctionCallee TaintVarargWrapperFn;
   FunctionCallee TaintTraceCmpFn;
@@ -433,6 +453,7 @@ class Taint {
 
   Value *getShadowOffset(Value *Addr, IRBuilder<> &IRB);
   Value *getShadowAddress(Value *Addr, IRBuilder<> &IRB);
+  Value *getShadowSummaryAddress(Value *ShadowAddr, IRBuilder<> &IRB);
   bool isInstrumented(const Function *F);
   bool isInstrumented(const GlobalAlias *GA);
   FunctionType *getArgsFunctionType(FunctionType *T);
@@ -528,6 +549,9 @@ struct TaintFunction {
                 bool IsForceZeroLabels)
       : TT(TT), F(F), IsNativeABI(IsNativeABI),
         IsForceZeroLabels(IsForceZeroLabels) {
+    // like dfsan, don't make huge functions even larger for the register
+    // allocator
+    AvoidNewBlocks = F->size() > 1000;
     DT.recalculate(*F);
     LI = new LoopInfo(DT);
     // initialize the pseudo-random number generator with the function name
@@ -591,10 +615,47 @@ struct TaintFunction {
 
   Align getShadowAlign(Align InstAlignment);
 
+  /// Copies the shadow of a memcpy/memmove. Small constant lengths check the
+  /// summary of the source and the labels of the destination inline, and only
+  /// call the runtime when either may be non-zero
+  void transferShadow(MemTransferInst &I);
+
 private:
+  /// Whether a primitive shadow of Size bytes gets the inline fast path
+  bool useInlineFastPath(uint64_t Size) {
+    return ClInlineFastPath && !AvoidNewBlocks &&
+           (Size == 1 || Size == 2 || Size == 4 || Size == 8);
+  }
+  /// Whether clearing the shadow of Size bytes gets the inline check of the
+  /// old labels, the wide load gets too large for bigger ones
+  bool useInlineZeroStore(uint64_t Size) {
+    return ClInlineFastPath && !AvoidNewBlocks && Size <= 16;
+  }
+  /// Marks the branch guarding an inline slow path, so it's not traced and
+  /// loop latch detection can see through it
+  void markFastPath(Instruction *SlowTerm) {
+    BasicBlock *Head = SlowTerm->getParent()->getSinglePredecessor();
+    Head->getTerminator()->setMetadata("nosanitize",
+                                       MDNode::get(*TT.Ctx, None));
+  }
+  /// Puts the call of a trace hook, which returns right away on zero labels,
+  /// into a cold block only entered if NonZero holds. Returns where to insert
+  /// the call, i.e., the terminator of the cold block, or Pos if the call
+  /// stays unconditional
+  Instruction *guardTraceCall(Value *NonZero, Instruction *Pos) {
+    if (!ClInlineTraceGuards || AvoidNewBlocks || isa<Constant>(NonZero))
+      return Pos;
+    Instruction *SlowTerm = SplitBlockAndInsertIfThen(
+        NonZero, Pos, /*Unreachable=*/false, TT.ColdCallWeights, &DT, LI);
+    markFastPath(SlowTerm);
+    return SlowTerm;
+  }
   /// Loads a primitive shadow label
   Value *loadPrimitiveShadow(Value *Addr, uint64_t Size, uint64_t Align,
                              IRBuilder<> &IRB);
+  /// Stores a primitive shadow label
+  void storePrimitiveShadow(Value *Shadow, Value *ShadowAddr, uint64_t Size,
+                            uint64_t Align, IRBuilder<> &IRB);
   /// Loads shadow recursively for aggregate types
   void loadShadowRecursive(Value *Shadow, SmallVector<unsigned, 4> &Indices,
                            Type *SubTy, Value *Addr, uint64_t Size,
@@ -916,6 +977,10 @@ bool Taint::initializeModule(Module &M) {
       IntptrTy };
   TaintSetLabelFnTy = FunctionType::get(Type::getVoidTy(*Ctx),
                                         TaintSetLabelArgs, /*isVarArg=*/false);
+  Type *TaintMemTransferArgs[3] = { Type::getInt8PtrTy(*Ctx),
+      Type::getInt8PtrTy(*Ctx), IntptrTy };
+  TaintMemTransferFnTy = FunctionType::get(
+      Type::getVoidTy(*Ctx), TaintMemTransferArgs, /*isVarArg=*/false);
   TaintNonzeroLabelFnTy = FunctionType::get(
       Type::getVoidTy(*Ctx), None, /*isVarArg=*/false);
   TaintVarargWrapperFnTy = FunctionType::get(
@@ -1146,6 +1211,12 @@ void Taint::initializeRuntimeFunctions(Module &M) {
     TaintSetLabelFn =
         Mod->getOrInsertFunction("__dfsan_set_label", TaintSetLabelFnTy, AL);
   }
+  {
+    AttributeList AL;
+    AL = AL.addFnAttribute(M.getContext(), Attribute::NoUnwind);
+    TaintMemTransferFn = Mod->getOrInsertFunction("__dfsan_mem_transfer",
+                                                  TaintMemTransferFnTy, AL);
+  }
   {
     TaintNonzeroLabelFn =
         Mod->getOrInsertFunction("__dfsan_nonzero_label", TaintNonzeroLabelFnTy);
@@ -1169,6 +1240,8 @@ void Taint::initializeRuntimeFunctions(Module &M) {
       TaintUnionStoreFn.getCallee()->stripPointerCasts());
   TaintRuntimeFunctions.insert(
       TaintSetLabelFn.getCallee()->stripPointerCasts());
+  TaintRuntimeFunctions.insert(
+      TaintMemTransferFn.getCallee()->stripPointerCasts());
   TaintRuntimeFunctions.insert(
       TaintUnimplementedFn.getCallee()->stripPointerCasts());
   TaintRuntimeFunctions.insert(
@@ -1685,6 +1758,16 @@ Value *Taint::getShadowAddress(Value *Addr, IRBuilder<> &IRB) {
   return IRB.CreateIntToPtr(ShadowLong, PrimitiveShadowPtrTy);
 }
 
+/// The summary byte of the shadow page holding ShadowAddr, non-zero once the
+/// page may hold a non-zero label.
+Value *Taint::getShadowSummaryAddress(Value *ShadowAddr, IRBuilder<> &IRB) {
+  Value *SummaryLong = IRB.CreateLShr(
+      IRB.CreatePointerCast(ShadowAddr, IntptrTy), ShadowPageShift);
+  SummaryLong = IRB.CreateAdd(
+      SummaryLong, ConstantInt::get(IntptrTy, MapParams->SummaryBase));
+  return IRB.CreateIntToPtr(SummaryLong, Type::getInt8PtrTy(*Ctx));
+}
+
 static inline bool isConstantOne(const Value *V) {
   if (const ConstantInt *CI = dyn_cast<ConstantInt>(V))
     return CI->isOne();
@@ -1804,6 +1887,48 @@ Align TaintFunction::getShadowAlign(Align InstAlignment) {
   return Align(Alignment.value() * TT.ShadowWidthBytes);
 }
 
+void TaintFunction::transferShadow(MemTransferInst &I) {
+  IRBuilder<> IRB(&I);
+  Type *Int8Ptr = Type::getInt8PtrTy(*TT.Ctx);
+  Value *Dest = IRB.CreatePointerCast(I.getDest(), Int8Ptr);
+  Value *Src = IRB.CreatePointerCast(I.getSource(), Int8Ptr);
+  Value *Len = IRB.CreateZExtOrTrunc(I.getLength(), TT.IntptrTy);
+  ConstantInt *CLen = dyn_cast<ConstantInt>(I.getLength());
+  if (!CLen || CLen->isZero() || !useInlineZeroStore(CLen->getZExtValue())) {
+    // copied by the runtime, which skips the clean shadow pages and keeps the
+    // shadow summary of the destination up to date
+    IRB.CreateCall(TT.TaintMemTransferFn, {Dest, Src, Len});
+    return;
+  }
+
+  // a copy from a clean source only clears the destination, nothing to do if
+  // it's all zero as well. The labels span at most two shadow pages
+  uint64_t Size = CLen->getZExtValue();
+  Value *SrcShadow = TT.getShadowAddress(I.getSource(), IRB);
+  Value *SrcShadowEnd = IRB.CreateConstGEP1_64(TT.PrimitiveShadowTy, SrcShadow,
+                                               Size - 1);
+  Value *SrcSummary = IRB.CreateOr(
+      IRB.CreateLoad(IRB.getInt8Ty(),
+                     TT.getShadowSummaryAddress(SrcShadow, IRB)),
+      IRB.CreateLoad(IRB.getInt8Ty(),
+                     TT.getShadowSummaryAddress(SrcShadowEnd, IRB)));
+  IntegerType *WideShadowTy =
+      IntegerType::get(*TT.Ctx, Size * TT.ShadowWidthBits);
+  Value *DestShadow = IRB.CreateBitCast(
+      TT.getShadowAddress(I.getDest(), IRB),
+      PointerType::getUnqual(WideShadowTy));
+  Value *OldShadow = IRB.CreateAlignedLoad(
+      WideShadowTy, DestShadow, getShadowAlign(I.getDestAlign().valueOrOne()));
+  Value *NonZero = IRB.CreateOr(
+      IRB.CreateICmpNE(SrcSummary, IRB.getInt8(0)),
+      IRB.CreateICmpNE(OldShadow, ConstantInt::get(WideShadowTy, 0)));
+  Instruction *SlowTerm = SplitBlockAndInsertIfThen(
+      NonZero, &I, /*Unreachable=*/false, TT.ColdCallWeights, &DT, LI);
+  markFastPath(SlowTerm);
+  IRBuilder<> SlowIRB(SlowTerm);
+  SlowIRB.CreateCall(TT.TaintMemTransferFn, {Dest, Src, Len});
+}
+
 void TaintFunction::checkBounds(Value *Ptr, Value* Size, Instruction *Pos) {
   IRBuilder<> IRB(Pos);
   // another place to check for global variable as the ptr
@@ -1854,11 +1979,78 @@ Value *TaintFunction::loadPrimitiveShadow(Value *Addr, uint64_t Size,
     return TT.ZeroPrimitiveShadow;
 
   Value *ShadowAddr = TT.getShadowAddress(Addr, IRB);
-  CallInst *FallbackCall = IRB.CreateCall(
+  if (!useInlineFastPath(Size)) {
+    CallInst *FallbackCall = IRB.CreateCall(
+        TT.TaintUnionLoadFn, {ShadowAddr, ConstantInt::get(TT.IntptrTy, Size),
+                              ConstantInt::get(TT.IntptrTy, Align)});
+    FallbackCall->addRetAttr(Attribute::ZExt);
+    return FallbackCall;
+  }
+
+  // fast path: load all the labels at once, if they're all zero, so is
+  // the union; otherwise let the runtime figure it out
+  IntegerType *WideShadowTy =
+      IntegerType::get(*TT.Ctx, Size * TT.ShadowWidthBits);
+  Value *WideAddr =
+      IRB.CreateBitCast(ShadowAddr, PointerType::getUnqual(WideShadowTy));
+  Value *WideShadow =
+      IRB.CreateAlignedLoad(WideShadowTy, WideAddr, MaybeAlign(Align));
+  Value *NonZero =
+      IRB.CreateICmpNE(WideShadow, ConstantInt::get(WideShadowTy, 0));
+  Instruction *Pos = &*IRB.GetInsertPoint();
+  Instruction *SlowTerm = SplitBlockAndInsertIfThen(
+      NonZero, Pos, /*Unreachable=*/false, TT.ColdCallWeights, &DT, LI);
+  markFastPath(SlowTerm);
+  BasicBlock *Head = SlowTerm->getParent()->getSinglePredecessor();
+
+  IRBuilder<> SlowIRB(SlowTerm);
+  CallInst *FallbackCall = SlowIRB.CreateCall(
       TT.TaintUnionLoadFn, {ShadowAddr, ConstantInt::get(TT.IntptrTy, Size),
                             ConstantInt::get(TT.IntptrTy, Align)});
   FallbackCall->addRetAttr(Attribute::ZExt);
-  return FallbackCall;
+
+  // the split moved Pos into a new block, don't keep inserting into Head
+  IRB.SetInsertPoint(Pos);
+  PHINode *Shadow = PHINode::Create(TT.PrimitiveShadowTy, 2, "",
+                                    &Pos->getParent()->front());
+  Shadow->addIncoming(TT.ZeroPrimitiveShadow, Head);
+  Shadow->addIncoming(FallbackCall, SlowTerm->getParent());
+  return Shadow;
+}
+
+// Stores a dynamic primitive shadow, or a zero one, only calling the runtime
+// when either the label or the labels already in the shadow memory are
+// non-zero, so untainted stores never write to (and dirty) the shadow pages.
+void TaintFunction::storePrimitiveShadow(Value *Shadow, Value *ShadowAddr,
+                                         uint64_t Size, uint64_t Align,
+                                         IRBuilder<> &IRB) {
+  Value *SizeArg = ConstantInt::get(TT.IntptrTy, Size);
+  Value *AlignArg = ConstantInt::get(TT.IntptrTy, Align);
+  bool Inline = TT.isZeroShadow(Shadow) ?
+      useInlineZeroStore(Size) :
+      useInlineFastPath(Size) && !isa<Constant>(Shadow);
+  if (!Inline) {
+    IRB.CreateCall(TT.TaintUnionStoreFn, {Shadow, ShadowAddr, SizeArg, AlignArg});
+    return;
+  }
+
+  // union_store clears the old labels when storing a zero one
+  IntegerType *WideShadowTy =
+      IntegerType::get(*TT.Ctx, Size * TT.ShadowWidthBits);
+  Value *WideAddr =
+      IRB.CreateBitCast(ShadowAddr, PointerType::getUnqual(WideShadowTy));
+  Value *OldShadow =
+      IRB.CreateAlignedLoad(WideShadowTy, WideAddr, MaybeAlign(Align));
+  Value *NonZero = IRB.CreateOr(
+      IRB.CreateICmpNE(Shadow, TT.ZeroPrimitiveShadow),
+      IRB.CreateICmpNE(OldShadow, ConstantInt::get(WideShadowTy, 0)));
+  Instruction *Pos = &*IRB.GetInsertPoint();
+  Instruction *SlowTerm = SplitBlockAndInsertIfThen(
+      NonZero, Pos, /*Unreachable=*/false, TT.ColdCallWeights, &DT, LI);
+  markFastPath(SlowTerm);
+  IRBuilder<> SlowIRB(SlowTerm);
+  SlowIRB.CreateCall(TT.TaintUnionStoreFn, {Shadow, ShadowAddr, SizeArg, AlignArg});
+  IRB.SetInsertPoint(Pos);
 }
 
 void TaintFunction::loadShadowRecursive(
@@ -2114,10 +2306,7 @@ void TaintFunction::storeShadowRecursive(
     Value *PrimitiveShadow = IRB.CreateExtractValue(Shadow, Indices);
     // then store the primitive shadow into the shadow address
     Value *ShadowAddr = TT.getShadowAddress(Addr, IRB);
-    IRB.CreateCall(TT.TaintUnionStoreFn,
-                   {PrimitiveShadow, ShadowAddr,
-                    ConstantInt::get(TT.IntptrTy, SubSize),
-                    ConstantInt::get(TT.IntptrTy, Align)});
+    storePrimitiveShadow(PrimitiveShadow, ShadowAddr, SubSize, Align, IRB);
     return;
   }
 
@@ -2173,22 +2362,16 @@ void TaintFunction::storeShadow(Value *Addr, Type *T, uint64_t Size,
   Value *ShadowAddr = TT.getShadowAddress(Addr, IRB);
   const Align ShadowAlign = getShadowAlign(Alignment);
   // check if the shadow is zero, if so, clear the shadow memory regardless
-  // of the shadow type
+  // of the shadow type, only if it's not clean already
   if (TT.isZeroShadow(Shadow)) {
-    IntegerType *ShadowTy =
-        IntegerType::get(*TT.Ctx, Size * TT.ShadowWidthBits);
-    Value *ExtZeroShadow = ConstantInt::get(ShadowTy, 0);
-    Value *ExtShadowAddr =
-        IRB.CreateBitCast(ShadowAddr, PointerType::getUnqual(ShadowTy));
-    IRB.CreateAlignedStore(ExtZeroShadow, ExtShadowAddr, ShadowAlign);
+    storePrimitiveShadow(TT.ZeroPrimitiveShadow, ShadowAddr, Size,
+                         ShadowAlign.value(), IRB);
     return;
   }
 
   // now check if we're storing an aggragate shadow object
   if (!isa<ArrayType>(T) && !isa<StructType>(T)) {
-    IRB.CreateCall(TT.TaintUnionStoreFn,
-                   {Shadow, ShadowAddr, ConstantInt::get(TT.IntptrTy, Size),
-                    ConstantInt::get(TT.IntptrTy, ShadowAlign.value())});
+    storePrimitiveShadow(Shadow, ShadowAddr, Size, ShadowAlign.value(), IRB);
     return;
   }
 
@@ -2272,7 +2455,10 @@ void TaintFunction::visitCmpInst(CmpInst *I) {
   auto &DL = M->getDataLayout();
   unsigned size = DL.getTypeSizeInBits(Op1->getType());
 
-  IRBuilder<> IRB(I);
+  IRBuilder<> GuardIRB(I);
+  Value *NonZero = GuardIRB.CreateICmpNE(
+      GuardIRB.CreateOr(Op1Shadow, Op2Shadow), TT.ZeroPrimitiveShadow);
+  IRBuilder<> IRB(guardTraceCall(NonZero, I));
   Op1 = IRB.CreateZExtOrTrunc(Op1, TT.Int64Ty);
   Op2 = IRB.CreateZExtOrTrunc(Op2, TT.Int64Ty);
   ConstantInt *Size = ConstantInt::get(TT.Int32Ty, size);
@@ -2308,7 +2494,10 @@ void TaintFunction::visitSwitchInst(SwitchInst *I) {
   ConstantInt *Predicate = ConstantInt::get(TT.Int32Ty, 32); // EQ, ==
   ConstantInt *CID = ConstantInt::get(TT.Int32Ty, TT.getInstructionId(I));
 
-  IRBuilder<> IRB(I);
+  // all the cases and the end in one cold block
+  IRBuilder<> GuardIRB(I);
+  Value *NonZero = GuardIRB.CreateICmpNE(CondShadow, TT.ZeroPrimitiveShadow);
+  IRBuilder<> IRB(guardTraceCall(NonZero, I));
   for (auto C : I->cases()) {
     Value *CV = C.getCaseValue();
 
@@ -2418,8 +2607,13 @@ void TaintFunction::visitGEPInst(GetElementPtrInst *I) {
                            {Bounds, Ptr, Shadow, Index, NE, ES, Offset, CID});
           }
           if (ClTraceGEPOffset) {
-            IRB.CreateCall(TT.TaintTraceGEPFn,
-                           {Bounds, Ptr, Shadow, Index, NE, ES, Offset, CID});
+            Value *NonZero =
+                IRB.CreateICmpNE(Shadow, TT.ZeroPrimitiveShadow);
+            IRBuilder<> CallIRB(guardTraceCall(NonZero, I));
+            CallIRB.CreateCall(TT.TaintTraceGEPFn,
+                               {Bounds, Ptr, Shadow, Index, NE, ES, Offset, CID});
+            // the split moved I into a new block
+            IRB.SetInsertPoint(I);
           }
         } else {
           break;
@@ -2557,15 +2751,36 @@ Value* TaintFunction::visitSelectInst(Value *Cond, Value *TrueShadow,
         SelectInst::Create(Cond, TrueShadow, FalseShadow, "", I);
   }
 
+  // with an untainted condition, the runtime just picks one of the labels
+  if (TT.isZeroShadow(CondShadow)) {
+    return TrueShadow == FalseShadow ? TrueShadow :
+        SelectInst::Create(Cond, TrueShadow, FalseShadow, "", I);
+  }
+
   // special case, when select is used to implement logical AND and OR
-  IRBuilder<> IRB(I);
-  Cond = IRB.CreateZExt(Cond, TT.Int8Ty);
+  IRBuilder<> GuardIRB(I);
+  Value *NonZero = GuardIRB.CreateICmpNE(CondShadow, TT.ZeroPrimitiveShadow);
+  Instruction *Pos = guardTraceCall(NonZero, I);
+  IRBuilder<> IRB(Pos);
+  Value *CondVal = IRB.CreateZExt(Cond, TT.Int8Ty);
   Value *TrueVal = IRB.CreateZExt(I->getTrueValue(), TT.Int8Ty);
   Value *FalseVal = IRB.CreateZExt(I->getFalseValue(), TT.Int8Ty);
   ConstantInt *CID = ConstantInt::get(TT.Int32Ty, TT.getInstructionId(I));
-  return IRB.CreateCall(TT.TaintTraceSelectFn,
-                        {CondShadow, TrueShadow, FalseShadow, Cond,
-                         TrueVal, FalseVal, CID});
+  CallInst *Call = IRB.CreateCall(TT.TaintTraceSelectFn,
+                                  {CondShadow, TrueShadow, FalseShadow,
+                                   CondVal, TrueVal, FalseVal, CID});
+  if (Pos == I)
+    return Call;
+
+  BasicBlock *Head = Pos->getParent()->getSinglePredecessor();
+  Value *FastShadow = TrueShadow == FalseShadow ? TrueShadow :
+      SelectInst::Create(Cond, TrueShadow, FalseShadow, "",
+                         Head->getTerminator());
+  PHINode *Shadow = PHINode::Create(TT.PrimitiveShadowTy, 2, "",
+                                    &I->getParent()->front());
+  Shadow->addIncoming(FastShadow, Head);
+  Shadow->addIncoming(Call, Pos->getParent());
+  return Shadow;
 }
 
 void TaintVisitor::visitSelectInst(SelectInst &I) {
@@ -2611,25 +2826,7 @@ void TaintVisitor::visitMemTransferInst(MemTransferInst &I) {
     TF.solveBounds(I.getDest(), I.getLength(), &I);
     TF.solveBounds(I.getSource(), I.getLength(), &I);
   }
-  IRBuilder<> IRB(&I);
-  Value *DestShadow = TF.TT.getShadowAddress(I.getDest(), IRB);
-  Value *SrcShadow = TF.TT.getShadowAddress(I.getSource(), IRB);
-  Value *LenShadow = IRB.CreateMul(
-      I.getLength(),
-      ConstantInt::get(I.getLength()->getType(), TF.TT.ShadowWidthBytes));
-  Type *Int8Ptr = Type::getInt8PtrTy(*TF.TT.Ctx);
-  DestShadow = IRB.CreateBitCast(DestShadow, Int8Ptr);
-  SrcShadow = IRB.CreateBitCast(SrcShadow, Int8Ptr);
-  auto *MTI = cast<MemTransferInst>(
-      IRB.CreateCall(I.getFunctionType(), I.getCalledOperand(),
-                     {DestShadow, SrcShadow, LenShadow, I.getVolatileCst()}));
-  if (ClPreserveAlignment) {
-    MTI->setDestAlignment(I.getDestAlign() * TF.TT.ShadowWidthBytes);
-    MTI->setSourceAlignment(I.getSourceAlign() * TF.TT.ShadowWidthBytes);
-  } else {
-    MTI->setDestAlignment(Align(TF.TT.ShadowWidthBytes));
-    MTI->setSourceAlignment(Align(TF.TT.ShadowWidthBytes));
-  }
+  TF.transferShadow(I);
 }
 
 static bool isAMustTailRetVal(Value *RetVal) {
@@ -2975,12 +3172,24 @@ void TaintVisitor::visitPHINode(PHINode &PN) {
   TF.PHIFixups.push_back({&PN, ShadowPN});
 }
 
+// Like BasicBlock::getSingleSuccessor, but looks through the inline fast
+// paths of shadow loads and stores, which always rejoin.
+static inline const BasicBlock *getSingleSuccessor(const BasicBlock *BB) {
+  if (const BasicBlock *Succ = BB->getSingleSuccessor())
+    return Succ;
+  const BranchInst *BI = dyn_cast<BranchInst>(BB->getTerminator());
+  if (BI && BI->isConditional() && BI->getMetadata("nosanitize") &&
+      BI->getSuccessor(0)->getSingleSuccessor() == BI->getSuccessor(1))
+    return BI->getSuccessor(1);
+  return nullptr;
+}
+
 static inline bool isLoopLatch(const BasicBlock *BB, const BasicBlock *Header) {
   const BasicBlock *Succ = nullptr;
   SmallVector<const BasicBlock*> Visited;
   while (BB != Header) {
     Visited.push_back(BB);
-    if ((Succ = BB->getSingleSuccessor()) == nullptr)
+    if ((Succ = getSingleSuccessor(BB)) == nullptr)
       return false;
     BB = Succ;
     if (Visited.end() != std::find(Visited.begin(), Visited.end(), BB))
@@ -3018,7 +3227,20 @@ void TaintFunction::visitCondition(Value *Condition, Instruction *I) {
     return;
   ConstantInt *LF = ConstantInt::get(TT.Int8Ty, flag);
   ConstantInt *CID = ConstantInt::get(TT.Int32Ty, TT.getInstructionId(I));
-  IRB.CreateCall(TT.TaintTraceCondFn, {Shadow, Condition, LF, CID});
+  Instruction *Pos = I;
+  if (Condition->getType()->isIntegerTy(1)) {
+    // the runtime drops untainted conditions, unless the loop is exited
+    Value *NonZero = IRB.CreateICmpNE(Shadow, TT.ZeroPrimitiveShadow);
+    if ((flag & LoopExitBranch) == LoopExitBranch)
+      NonZero = ConstantInt::getTrue(*TT.Ctx);
+    else if (flag & TrueBranchLoopExit)
+      NonZero = IRB.CreateOr(NonZero, Condition);
+    else if (flag & FalseBranchLoopExit)
+      NonZero = IRB.CreateOr(NonZero, IRB.CreateNot(Condition));
+    Pos = guardTraceCall(NonZero, I);
+  }
+  IRBuilder<> CallIRB(Pos);
+  CallIRB.CreateCall(TT.TaintTraceCondFn, {Shadow, Condition, LF, CID});
 }
 
 void TaintVisitor::visitBranchInst(BranchInst &BR) {
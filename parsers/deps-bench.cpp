@@ -0,0 +1,146 @@
+/*
+  Measure the memory and time of tracking input dependencies per label,
+  with the sparse InputDeps vs. a full-width bitset per label (what the
+  rgd parser used to do).
+
+  usage: deps-bench [-n labels] [-s input size] [-b]
+
+  The labels are synthetic but shaped like a parser's: byte reads and
+  multi-byte loads at a moving cursor, casts, and binary ops over recently
+  created labels. The bitset baseline is only run with -b, as it needs
+  labels * input size / 8 bytes.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "input_deps.h"
+
+struct label_t {
+  int kind; // 0: read, 1: load, 2: unary, 3: binary
+  uint32_t l1, l2;
+  size_t offset, len;
+};
+
+static std::vector<label_t> gen_labels(size_t n, size_t input_size) {
+  std::mt19937_64 rng(0x5eed);
+  std::vector<label_t> labels(1); // label 0 is the constant
+  std::vector<uint32_t> ast_size(1, 1);
+  uint32_t last_leaf = 0;
+  size_t cursor = 0;
+  // an operand among the recent labels, expressions rarely grow past a few
+  // dozen nodes before they're consumed by a branch
+  auto pick = [&](size_t i, size_t window) -> uint32_t {
+    uint32_t l = i - 1 - rng() % std::min<size_t>(i - 1, window);
+    return ast_size[l] < 32 ? l : last_leaf;
+  };
+  for (size_t i = 1; i < n; i++) {
+    label_t l = {};
+    unsigned r = rng() % 100;
+    if (i < 16 || r < 20) {
+      l.kind = 0;
+      l.offset = cursor++ % input_size;
+      l.len = 1;
+    } else if (r < 30) {
+      l.kind = 1;
+      l.len = 1 << (rng() % 4);
+      l.offset = (cursor += l.len) % (input_size - l.len);
+    } else if (r < 50) {
+      l.kind = 2;
+      l.l1 = pick(i, 16);
+    } else {
+      l.kind = 3;
+      l.l1 = pick(i, 16);
+      // mostly local, but sometimes reach far back (e.g., a length field)
+      l.l2 = pick(i, rng() % 10 ? 64 : i - 1);
+    }
+    if (l.kind < 2) last_leaf = i;
+    ast_size.push_back(1 + (l.kind > 1 ? ast_size[l.l1] : 0) +
+                       (l.kind > 2 ? ast_size[l.l2] : 0));
+    labels.push_back(l);
+  }
+  return labels;
+}
+
+template <typename Deps, typename Set>
+static double build(const std::vector<label_t> &labels, std::vector<Deps> &deps,
+                    Deps empty, Set set) {
+  auto start = std::chrono::steady_clock::now();
+  deps.reserve(labels.size());
+  for (auto &l : labels) {
+    deps.push_back(empty);
+    Deps &d = deps.back();
+    switch (l.kind) {
+      case 0: case 1: set(d, l.offset, l.len); break;
+      case 2: d |= deps[l.l1]; break;
+      case 3: d |= deps[l.l1]; d |= deps[l.l2]; break;
+    }
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+template <typename Deps>
+static size_t iterate(const std::vector<Deps> &deps) {
+  size_t sum = 0;
+  for (size_t i = 0; i < deps.size(); i += 97) {
+    for (size_t b = deps[i].find_first(); b != Deps::npos; b = deps[i].find_next(b))
+      sum += b;
+  }
+  return sum;
+}
+
+int main(int argc, char **argv) {
+  size_t n = 1000000;
+  size_t input_size = 256 * 1024;
+  bool baseline = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:s:b")) > 0) {
+    switch (opt) {
+      case 'n': n = strtoull(optarg, NULL, 0); break;
+      case 's': input_size = strtoull(optarg, NULL, 0); break;
+      case 'b': baseline = true; break;
+      default:
+        fprintf(stderr, "usage: %s [-n labels] [-s input size] [-b]\n", argv[0]);
+        return 1;
+    }
+  }
+  if (n < 2 || input_size < 16) {
+    fprintf(stderr, "too few labels or input too small\n");
+    return 1;
+  }
+
+  auto labels = gen_labels(n, input_size);
+  printf("labels: %zu, input size: %zu\n", n, input_size);
+
+  std::vector<rgd::InputDeps> sparse;
+  double t = build(labels, sparse, rgd::InputDeps(),
+      [](rgd::InputDeps &d, size_t off, size_t len) { d.set(off, len); });
+  size_t mem = 0;
+  for (auto &d : sparse) mem += sizeof(d) + d.memory_usage();
+  printf("sparse: %.3fs, %.2f MB (upper bound, shared payloads counted per label), "
+         "checksum %zu\n", t, mem / 1048576.0, iterate(sparse));
+
+  size_t bitset_mem = n * (sizeof(boost::dynamic_bitset<>) +
+                           (input_size + 63) / 64 * sizeof(uint64_t));
+  if (!baseline) {
+    printf("bitset: %.2f MB (estimated, run with -b to measure)\n",
+           bitset_mem / 1048576.0);
+    return 0;
+  }
+  sparse.clear();
+  sparse.shrink_to_fit();
+
+  std::vector<boost::dynamic_bitset<>> dense;
+  t = build(labels, dense, boost::dynamic_bitset<>(input_size),
+      [](boost::dynamic_bitset<> &d, size_t off, size_t len) { d.set(off, len, true); });
+  printf("bitset: %.3fs, %.2f MB, checksum %zu\n", t, bitset_mem / 1048576.0,
+         iterate(dense));
+  return 0;
+}
@@ -1054,99 +1054,161 @@ int RGDAstParser::find_roots(dfsan_label label, AstNode *ret,
   return 0;
 }
 
+// A label that has been handed out but not written, e.g., in the unused tail
+// of a thread's label chunk, or still being created by another thread. Input
+// labels always have a size.
+static inline bool is_pending(const dfsan_label_info *info) {
+  return info->op == 0 && info->size == 0;
+}
+
 [[gnu::hot]]
-bool RGDAstParser::scan_labels(dfsan_label label) {
-  // assuming label has been checked by caller
-  // assuming the last label scanned is the size of the cache
-  // turns out linear scan is way faster than tree traversal
-  for (size_t i = ast_size_cache.size(); i <= label; i++) {
-    if (i == 0) { // the constant label
-      ast_size_cache.push_back(1); // constant takes one node too
-      branch_to_inputs.emplace_back(input_dep_t(input_size_));
-      nested_cmp_cache.push_back(0);
-      continue;
+bool RGDAstParser::scan_label(dfsan_label i) {
+  dfsan_label_info *info = get_label_info(i);
+  if (unlikely(is_pending(info))) {
+    return false;
+  }
+  // conservatively check validity of labels
+  // so following parsing will not throw exceptions
+  if (unlikely(info->l1 >= size_ || info->l2 >= size_)) {
+    WARNF("invalid label: %u, l1=%u, l2=%u\n", i, info->l1, info->l2);
+    return false;
+  }
+  if (info->op == 0) {
+    // input deps
+    uint32_t input_id = info->op2.i;
+    uint32_t offset = info->op1.i;
+    // skip if invalid
+    if (unlikely(input_id >= inputs_cache.size())) {
+      WARNF("invalid input id: %u\n", input_id);
+      return false;
     }
-    dfsan_label_info *info = get_label_info(i);
-    // conservatively check validity of labels
-    // so following parsing will not throw exceptions
-    if (unlikely(info->l1 >= size_ || info->l2 >= size_)) {
-      WARNF("invalid label: %lu, l1=%u, l2=%u\n", i, info->l1, info->l2);
+    size_t buf_size = inputs_cache[input_id].second;
+    if (unlikely(offset >= buf_size)) {
+      WARNF("invalid input offset: %u >= %lu\n", offset, buf_size);
       return false;
     }
-    if (info->op == 0) {
-      // AST nodes
-      ast_size_cache.push_back(1); // one Read node
-      // input deps
-      uint32_t input_id = info->op2.i;
-      uint32_t offset = info->op1.i;
-      // skip if invalid
-      if (unlikely(input_id >= inputs_cache.size())) {
-        WARNF("invalid input id: %u\n", input_id);
-        return false;
-      }
-      size_t buf_size = inputs_cache[input_id].second;
-      if (unlikely(offset >= buf_size)) {
-        WARNF("invalid input offset: %u >= %lu\n", offset, buf_size);
-        return false;
-      }
-      branch_to_inputs.emplace_back(input_dep_t(input_size_));
-      // get flattened index
-      size_t idx = input_to_dep_idx(input_id, offset);
-      auto &itr = branch_to_inputs[i];
-      itr.set(idx); // flattened location
+    // get flattened index
+    size_t idx = input_to_dep_idx(input_id, offset);
+    auto &itr = branch_to_inputs[i];
+    itr.set(idx); // flattened location
 #if DEBUG
-      assert(branch_to_inputs[i].find_first() == idx);
+    assert(branch_to_inputs[i].find_first() == idx);
 #endif
-      // nested cmp?
-      nested_cmp_cache.push_back(0);
-    } else if (info->op == __dfsan::Load) {
-      // AST nodes
-      ast_size_cache.push_back(1); // one Read node
-      // input deps
-      uint32_t input_id = get_label_info(info->l1)->op2.i;
-      uint32_t offset = get_label_info(info->l1)->op1.i;
-      // skip if invalid
-      if (unlikely(input_id >= inputs_cache.size())) {
-        WARNF("invalid input id: %u\n", input_id);
-        return false;
-      }
-      size_t buf_size = inputs_cache[input_id].second;
-      if (unlikely(offset + info->l2 > buf_size)) {
-        WARNF("invalid input offset: %u + %u > %lu\n", offset, info->l2, buf_size);
-        return false;
-      }
-      branch_to_inputs.emplace_back(input_dep_t(input_size_));
-      // get flattened index
-      size_t idx = input_to_dep_idx(input_id, offset);
-      auto &itr = branch_to_inputs[i];
-      for (size_t n = 0; n < info->l2; ++n) {
-        // DEBUGF("adding input: %lu <- %lu\n", i, offset + n);
-        itr.set(idx + n); // input offsets
-      }
+    // AST nodes
+    ast_size_cache[i] = 1; // one Read node
+    // nested cmp?
+    nested_cmp_cache[i] = 0;
+  } else if (info->op == __dfsan::Load) {
+    // input deps
+    uint32_t input_id = get_label_info(info->l1)->op2.i;
+    uint32_t offset = get_label_info(info->l1)->op1.i;
+    // skip if invalid
+    if (unlikely(input_id >= inputs_cache.size())) {
+      WARNF("invalid input id: %u\n", input_id);
+      return false;
+    }
+    size_t buf_size = inputs_cache[input_id].second;
+    if (unlikely(offset + info->l2 > buf_size)) {
+      WARNF("invalid input offset: %u + %u > %lu\n", offset, info->l2, buf_size);
+      return false;
+    }
+    // get flattened index
+    size_t idx = input_to_dep_idx(input_id, offset);
+    auto &itr = branch_to_inputs[i];
+    itr.set(idx, info->l2); // input offsets
 #if DEBUG
-      if (likely(info->l2 > 0))
-        assert(branch_to_inputs[i].find_first() == idx);
+    if (likely(info->l2 > 0))
+      assert(branch_to_inputs[i].find_first() == idx);
 #endif
-      // nested cmp?
+    // AST nodes
+    ast_size_cache[i] = 1; // one Read node
+    // nested cmp?
+    nested_cmp_cache[i] = 0;
+  } else {
+    if (unlikely(info->l1 >= i || info->l2 >= i)) {
+      WARNF("invalid label: %u, l1=%u, l2=%u\n", i, info->l1, info->l2);
+      return false;
+    }
+    // a child that was still pending when the linear scan passed it
+    if (info->l1 != 0 && ast_size_cache[info->l1] == 0 && !scan_pending(info->l1))
+      return false;
+    if (info->l2 != 0 && ast_size_cache[info->l2] == 0 && !scan_pending(info->l2))
+      return false;
+    // input deps
+    auto &itr = branch_to_inputs[i];
+    if (info->l1 != 0) itr |= branch_to_inputs[info->l1];
+    if (info->l2 != 0) itr |= branch_to_inputs[info->l2];
+    // nested cmp?
+    uint8_t nested = 0;
+    nested += info->l1 == 0 ? 0 : nested_cmp_cache[info->l1];
+    nested += info->l2 == 0 ? 0 : nested_cmp_cache[info->l2];
+    if (info->op == __dfsan::fmemcmp || (info->op & 0xff) == __dfsan::ICmp)
+      nested += 1;
+    nested_cmp_cache[i] = nested;
+    // AST nodes, last, as a non-zero size marks the label as scanned
+    uint32_t left  = info->l1 == 0 ? 1 : ast_size_cache[info->l1];
+    uint32_t right = info->l2 == 0 ? 1 : ast_size_cache[info->l2];
+    ast_size_cache[i] = left + right + 1;
+  }
+  return true;
+}
+
+bool RGDAstParser::scan_pending(dfsan_label label) {
+  // the children have smaller labels and are scanned first, a chain of
+  // pending labels can be long so keep our own stack
+  std::vector<dfsan_label> stack = {label};
+  while (!stack.empty()) {
+    dfsan_label l = stack.back();
+    if (ast_size_cache[l] != 0) {
+      // pushed twice, e.g., as both operands
+      stack.pop_back();
+      continue;
+    }
+    dfsan_label_info *info = get_label_info(l);
+    bool ready = true;
+    if (info->op != 0 && info->op != __dfsan::Load) {
+      // invalid children are left to scan_label to report
+      for (dfsan_label c : {info->l1, info->l2}) {
+        if (c != 0 && c < l && ast_size_cache[c] == 0) {
+          stack.push_back(c);
+          ready = false;
+        }
+      }
+    }
+    if (!ready) {
+      continue;
+    }
+    if (!scan_label(l)) {
+      return false;
+    }
+    stack.pop_back();
+  }
+  return true;
+}
+
+[[gnu::hot]]
+bool RGDAstParser::scan_labels(dfsan_label label) {
+  // assuming label has been checked by caller
+  // assuming the last label scanned is the size of the cache
+  // turns out linear scan is way faster than tree traversal.
+  // Labels are not dense, the runtime hands them out in per-thread chunks,
+  // so the ones not written yet are left with a zero AST size and scanned
+  // again once something refers to them
+  for (size_t i = ast_size_cache.size(); i <= label; i++) {
+    branch_to_inputs.emplace_back();
+    if (i == 0) { // the constant label
+      ast_size_cache.push_back(1); // constant takes one node too
       nested_cmp_cache.push_back(0);
-    } else {
-      // AST nodes
-      uint32_t left  = info->l1 == 0 ? 1 : ast_size_cache[info->l1];
-      uint32_t right = info->l2 == 0 ? 1 : ast_size_cache[info->l2];
-      ast_size_cache.push_back(left + right + 1);
-      // input deps
-      branch_to_inputs.emplace_back(input_dep_t(input_size_));
-      auto &itr = branch_to_inputs[i];
-      if (info->l1 != 0) itr |= branch_to_inputs[info->l1];
-      if (info->l2 != 0) itr |= branch_to_inputs[info->l2];
-      // nested cmp?
-      uint8_t nested = 0;
-      nested += info->l1 == 0 ? 0 : nested_cmp_cache[info->l1];
-      nested += info->l2 == 0 ? 0 : nested_cmp_cache[info->l2];
-      if (info->op == __dfsan::fmemcmp || (info->op & 0xff) == __dfsan::ICmp)
-        nested += 1;
-      nested_cmp_cache.push_back(nested);
+      continue;
     }
+    ast_size_cache.push_back(0);
+    nested_cmp_cache.push_back(0);
+    // an invalid label only fails the ASTs it is part of
+    (void)scan_label(i);
+  }
+  if (unlikely(ast_size_cache[label] == 0 && !scan_pending(label))) {
+    WARNF("label %u not written or invalid\n", label);
+    return false;
   }
 #if DEBUG
   DEBUGF("ast_size: %d = %u\n", label, ast_size_cache[label]);
@@ -1338,7 +1400,14 @@ int RGDAstParser::parse_cond(dfsan_label label, bool result, bool add_nested,
   to_dnf(root.get(), dnf);
 
   // finally, we construct a search task for each clause in the DNF
-  for (auto const& clause : dnf) {
+  for (auto const& full_clause : dnf) {
+    // leave out the parts of the clause the solver won't need to touch
+    clause_t clause;
+    slice_clause(full_clause, clause);
+    if (clause.empty()) {
+      DEBUGF("clause already holds on the input\n");
+      continue;
+    }
     task_t task = construct_task(clause);
     if (task != nullptr) {
       tasks.push_back(save_task(task));
@@ -1357,20 +1426,7 @@ int RGDAstParser::parse_cond(dfsan_label label, bool result, bool add_nested,
       bool has_nested = false;
       // then, iterate each var in the clause
       for (auto const& var: clause) {
-        const dfsan_label l = var->label();
-        // assert(branch_to_inputs.size() > l);
-        auto &itr = branch_to_inputs[l];
-        auto citr = concretize_node.find(l);
-        if (unlikely(citr != concretize_node.end())) {
-          // skip dependencies if the operand is concretized
-          if (citr->second == 1) {
-            // if the lhs is concretized, use the rhs deps only
-            itr = branch_to_inputs[get_label_info(l)->l2];
-          } else if (citr->second == 2) {
-            // if the rhs is concretized, use the lhs deps only
-            itr = branch_to_inputs[get_label_info(l)->l1];
-          }
-        }
+        input_dep_t itr = leaf_deps(var->label());
         if (unlikely(itr.find_first() == input_dep_t::npos)) {
           // not actual input dependency, skip
           continue;
@@ -1413,6 +1469,104 @@ int RGDAstParser::parse_cond(dfsan_label label, bool result, bool add_nested,
   return 0;
 }
 
+RGDAstParser::input_dep_t RGDAstParser::leaf_deps(dfsan_label label) {
+  // a copy, so the cached deps of label are left alone
+  input_dep_t deps = branch_to_inputs[label];
+  auto citr = concretize_node.find(label);
+  if (unlikely(citr != concretize_node.end())) {
+    if (citr->second == 1) {
+      // if the lhs is concretized, use the rhs deps only
+      deps = branch_to_inputs[get_label_info(label)->l2];
+    } else if (citr->second == 2) {
+      // if the rhs is concretized, use the lhs deps only
+      deps = branch_to_inputs[get_label_info(label)->l1];
+    }
+  }
+  return deps;
+}
+
+bool RGDAstParser::holds_on_input(const rgd::AstNode *node) {
+  dfsan_label_info *info = get_label_info(node->label());
+  // icmp records both concrete operands, memcmp only a piece of them
+  if ((info->op & 0xff) != __dfsan::ICmp) {
+    return false;
+  }
+  auto itr = OP_MAP.find(info->op);
+  if (unlikely(itr == OP_MAP.end())) {
+    return false;
+  }
+  uint64_t op1 = info->op1.i;
+  uint64_t op2 = info->op2.i;
+  uint16_t pred = info->op >> 8;
+  if (pred >= __dfsan::bvsgt && info->size > 0 && info->size < 64) {
+    // operands are recorded zero-extended
+    uint32_t shift = 64 - info->size;
+    op1 = (uint64_t)((int64_t)(op1 << shift) >> shift);
+    op2 = (uint64_t)((int64_t)(op2 << shift) >> shift);
+  }
+  bool r = eval_icmp(info->op, op1, op2);
+  uint16_t kind = itr->second.first;
+  if (node->kind() == kind) {
+    return r;
+  } else if (node->kind() == rgd::negate_cmp(kind)) {
+    return !r;
+  }
+  return false;
+}
+
+void RGDAstParser::slice_clause(const clause_t &clause, clause_t &live) {
+  const size_t n = clause.size();
+  if (n <= 1) {
+    live = clause;
+    return;
+  }
+
+  // group the leaves by the data-flow sets of their input bytes, so the
+  // saved constraints a group would pull in as nested ones are all on its
+  // own bytes. Use the full deps here, a concretized operand still keeps
+  // its value only if no other leaf changes its bytes.
+  std::vector<size_t> group(n);
+  for (size_t i = 0; i < n; i++) group[i] = i;
+  auto find = [&group](size_t i) {
+    while (group[i] != i) i = group[i] = group[group[i]];
+    return i;
+  };
+  std::unordered_map<size_t, size_t> set_to_leaf;
+  std::vector<bool> has_deps(n, false);
+  for (size_t i = 0; i < n; i++) {
+    auto const& deps = branch_to_inputs[clause[i]->label()];
+    for (auto input = deps.find_first(); input != input_dep_t::npos;
+         input = deps.find_next(input)) {
+      has_deps[i] = true;
+      auto r = set_to_leaf.emplace(data_flow_deps.find(input), i);
+      if (!r.second) {
+        group[find(i)] = find(r.first->second);
+      }
+    }
+  }
+
+  // a group can be left out only if all its leaves hold on the input,
+  // as the solver will then never change its bytes. Leaves without deps
+  // (e.g., through atoi) are always kept, they may still be on the input.
+  std::vector<bool> keep(n, false);
+  for (size_t i = 0; i < n; i++) {
+    if (!has_deps[i] || !holds_on_input(clause[i])) {
+      keep[find(i)] = true;
+    }
+  }
+  for (size_t i = 0; i < n; i++) {
+    if (keep[find(i)]) {
+      live.push_back(clause[i]);
+    }
+#if DEBUG
+    else {
+      DEBUGF("slice independent constraint: (%d, %d)\n",
+             clause[i]->label(), clause[i]->kind());
+    }
+#endif
+  }
+}
+
 bool RGDAstParser::save_constraint(expr_t expr, bool result) {
   // assumes scan_labels has been called
 
@@ -1448,17 +1602,7 @@ bool RGDAstParser::save_constraint(expr_t expr, bool result) {
 #if DEBUG
       assert(branch_to_inputs.size() > l);
 #endif
-      auto &itr = branch_to_inputs[l];
-      auto citr = concretize_node.find(l);
-      if (unlikely(citr != concretize_node.end())) {
-        if (citr->second == 1) {
-          // if the lhs is concretized, use the rhs deps only
-          itr = branch_to_inputs[get_label_info(l)->l2];
-        } else if (citr->second == 2) {
-          // if the rhs is concretized, use the lhs deps only
-          itr = branch_to_inputs[get_label_info(l)->l1];
-        }
-      }
+      input_dep_t itr = leaf_deps(l);
       auto root = itr.find_first();
       if (root == input_dep_t::npos) {
         // not actual input dependency, skip
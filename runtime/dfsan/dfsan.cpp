@@ -34,16 +34,19 @@
 
 #include <assert.h>
 #include <arpa/inet.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/shm.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/un.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 using namespace __dfsan;
@@ -53,6 +56,17 @@ typedef atomic_uint32_t atomic_dfsan_label;
 static atomic_dfsan_label __dfsan_last_label;
 static dfsan_label_info *__dfsan_label_info;
 
+// Each thread hands out labels from its own chunk of the label space,
+// reserved from __dfsan_last_label, so parallel threads don't all fight
+// over the counter. The unused tail of a chunk is never written (i.e.,
+// zeroed), and the parsers skip such labels. Bumping the epoch drops the
+// chunks of all threads.
+static const dfsan_label kLabelChunkSize = 4096;
+static atomic_uint32_t __dfsan_label_epoch;
+static THREADLOCAL dfsan_label __label_chunk_next;
+static THREADLOCAL dfsan_label __label_chunk_end;
+static THREADLOCAL u32 __label_chunk_epoch;
+
 // FIXME: single thread
 // statck bottom
 static dfsan_label __alloca_stack_bottom;
@@ -67,6 +81,7 @@ struct taint_socket __dfsan::tainted_socket;
 
 // Hash table
 static const uptr hashtable_size = (1ULL << 32);
+// initial number of slots, the table grows with the labels
 static const size_t hashtable_buckets = (1ULL << 20);
 static __taint::union_hashtable __union_table(hashtable_buckets);
 
@@ -91,6 +106,8 @@ SANITIZER_INTERFACE_ATTRIBUTE uptr __dfsan_shadow_ptr_mask;
 // | application memory |
 // +--------------------+ 0x700000040000 (kAppAddr)
 // |--------------------| UnusedAddr()
+// |   shadow summary   |
+// |--------------------| ShadowSummaryAddr()
 // |                    |
 // |    union table     |
 // |                    |
@@ -116,7 +133,7 @@ int __dfsan::vmaSize;
 #endif
 
 static uptr UnusedAddr() {
-  return MappingArchImpl<MAPPING_UNION_TABLE_ADDR>() + uniontable_size;
+  return ShadowSummaryAddr() + ShadowSummarySize();
 }
 
 // Checks we do not run out of labels.
@@ -130,6 +147,31 @@ static void dfsan_check_label(dfsan_label label) {
   }
 }
 
+// A new label, larger than min, i.e., the labels it's built from
+static inline dfsan_label dfsan_alloc_label(dfsan_label min) {
+  u32 epoch = atomic_load_relaxed(&__dfsan_label_epoch);
+  if (UNLIKELY(__label_chunk_next == __label_chunk_end ||
+               __label_chunk_epoch != epoch)) {
+    dfsan_label base = atomic_fetch_add(&__dfsan_last_label, kLabelChunkSize,
+                                        memory_order_relaxed);
+    __label_chunk_next = base + 1;
+    __label_chunk_end = base + kLabelChunkSize + 1;
+    __label_chunk_epoch = epoch;
+  }
+  if (UNLIKELY(__label_chunk_next <= min)) {
+    // built from a label in a newer chunk of another thread, take one from
+    // the counter rather than waste the rest of the chunk
+    return atomic_fetch_add(&__dfsan_last_label, 1, memory_order_relaxed) + 1;
+  }
+  return __label_chunk_next++;
+}
+
+// Rewind the label space, for a new run
+static void dfsan_reset_labels() {
+  atomic_store(&__dfsan_last_label, 0, memory_order_relaxed);
+  atomic_fetch_add(&__dfsan_label_epoch, 1, memory_order_relaxed);
+}
+
 // based on https://github.com/Cyan4973/xxHash
 // simplified since we only have 12 bytes info
 static inline uint32_t xxhash(uint32_t h1, uint32_t h2, uint32_t h3) {
@@ -345,8 +387,7 @@ dfsan_label __taint_union(dfsan_label l1, dfsan_label l2, uint16_t op,
     }
   }
 
-  dfsan_label label =
-    atomic_fetch_add(&__dfsan_last_label, 1, memory_order_relaxed) + 1;
+  dfsan_label label = dfsan_alloc_label(l1 > l2 ? l1 : l2);
   dfsan_check_label(label);
   assert(label > l1 && label > l2);
 
@@ -388,6 +429,7 @@ dfsan_label __taint_union_load(const dfsan_label *ls, uptr n, uint64_t align) {
   } else if (((uptr)ls & (align - 1)) != 0) {
     AOUT("WARNING: unaligned load %p\n", ls);
   }
+  if (shadow_is_clean(ls, n)) return 0;
   dfsan_label label0 = ls[0];
   if (label0 == kInitializingLabel) return kInitializingLabel;
 
@@ -491,6 +533,15 @@ void __taint_union_store(dfsan_label l, dfsan_label *ls, uptr n, uint64_t align)
   } else if (((uptr)ls & (align - 1)) != 0) {
     AOUT("WARNING: unaligned store %p\n", ls);
   }
+  // a clean page stays clean with zero labels
+  if (l == 0) {
+    if (!shadow_is_clean(ls, n)) {
+      for (uptr i = 0; i < n; ++i)
+        ls[i] = 0;
+    }
+    return;
+  }
+  shadow_mark_dirty(ls, n);
   if (l != kInitializingLabel) {
     // for debugging
     dfsan_label h = atomic_load(&__dfsan_last_label, memory_order_relaxed);
@@ -501,8 +552,8 @@ void __taint_union_store(dfsan_label l, dfsan_label *ls, uptr n, uint64_t align)
     return;
   }
 
-  // fast path 1: constant and bounds
-  if (l == 0 || is_kind_of_label(l, Alloca)) {
+  // fast path 1: bounds
+  if (is_kind_of_label(l, Alloca)) {
     for (uptr i = 0; i < n; ++i)
       ls[i] = l;
     return;
@@ -591,8 +642,7 @@ dfsan_label __taint_trace_global(uint64_t addr, uint64_t size) {
       return label;
     }
 
-    dfsan_label label =
-      atomic_fetch_add(&__dfsan_last_label, 1, memory_order_relaxed) + 1;
+    dfsan_label label = dfsan_alloc_label(0);
     dfsan_check_label(label);
     internal_memcpy(&__dfsan_label_info[label], &label_info, sizeof(dfsan_label_info));
     __union_table.insert(&__dfsan_label_info[label], label);
@@ -790,32 +840,69 @@ dfsan_union(dfsan_label l1, dfsan_label l2, uint16_t op, uint16_t size,
   return __taint_union(l1, l2, op, size, op1, op2);
 }
 
-extern "C" SANITIZER_INTERFACE_ATTRIBUTE
-dfsan_label dfsan_create_label(off_t offset) {
-  dfsan_label label =
-    atomic_fetch_add(&__dfsan_last_label, 1, memory_order_relaxed) + 1;
-  dfsan_check_label(label);
-  internal_memset(&__dfsan_label_info[label], 0, sizeof(dfsan_label_info));
+static inline void init_input_label(dfsan_label label, off_t offset) {
   __dfsan_label_info[label].size = 8;
   // label may not equal to offset when using stdin
   __dfsan_label_info[label].op1.i = offset;
   // init a non-zero hash
   __dfsan_label_info[label].hash = xxhash(offset, 0, 8);
+}
+
+extern "C" SANITIZER_INTERFACE_ATTRIBUTE
+dfsan_label dfsan_create_label(off_t offset) {
+  dfsan_label label = dfsan_alloc_label(0);
+  dfsan_check_label(label);
+  internal_memset(&__dfsan_label_info[label], 0, sizeof(dfsan_label_info));
+  init_input_label(label, offset);
+  return label;
+}
+
+// Labels for n consecutive input bytes from offset, as one block of
+// consecutive labels, returns the first one
+extern "C" SANITIZER_INTERFACE_ATTRIBUTE
+dfsan_label dfsan_create_labels(off_t offset, uptr n) {
+  if (n == 0)
+    return 0;
+  dfsan_label label;
+  u32 epoch = atomic_load_relaxed(&__dfsan_label_epoch);
+  if (__label_chunk_epoch == epoch &&
+      __label_chunk_end - __label_chunk_next >= n) {
+    // from the chunk of the calling thread, like single labels
+    label = __label_chunk_next;
+    __label_chunk_next += n;
+  } else {
+    label = atomic_fetch_add(&__dfsan_last_label, n, memory_order_relaxed) + 1;
+    // retire the chunk, it's below the block, so the unions of the block's
+    // labels would never take from it. The next one starts above the block
+    if (__label_chunk_epoch == epoch)
+      __label_chunk_next = __label_chunk_end;
+  }
+  dfsan_check_label(label);
+  dfsan_check_label(label + n - 1);
+  internal_memset(&__dfsan_label_info[label], 0, n * sizeof(dfsan_label_info));
+  for (uptr i = 0; i < n; i++)
+    init_input_label(label + i, offset + i);
   return label;
 }
 
 extern "C" SANITIZER_INTERFACE_ATTRIBUTE
 void __dfsan_set_label(dfsan_label label, void *addr, uptr size) {
   if (addr == 0) return;
-  for (dfsan_label *labelp = shadow_for(addr); size != 0; --size, ++labelp) {
+  // In a program where most addresses are not labeled, it is common that
+  // a page of shadow memory is entirely zeroed.  The Linux copy-on-write
+  // implementation will share all of the zeroed pages, making a copy of a
+  // page when any value is written, even if the value does not change.
+  // Zero labels are only written to the pages the summary says may hold
+  // labels, which dramatically reduces the amount of real memory used by
+  // large programs.
+  if (label == 0) {
+    dfsan_clear_shadow(addr, size);
+    return;
+  }
+  dfsan_label *labelp = shadow_for(addr);
+  shadow_mark_dirty(labelp, size);
+  for (; size != 0; --size, ++labelp) {
     // Don't write the label if it is already the value we need it to be.
-    // In a program where most addresses are not labeled, it is common that
-    // a page of shadow memory is entirely zeroed.  The Linux copy-on-write
-    // implementation will share all of the zeroed pages, making a copy of a
-    // page when any value is written.  The un-sharing will happen even if
-    // the value written does not change the value in memory.  Avoiding the
-    // write when both |label| and |*labelp| are zero dramatically reduces
-    // the amount of real memory used by large programs.
     if (label == *labelp)
       continue;
 
@@ -829,8 +916,74 @@ void dfsan_set_label(dfsan_label label, void *addr, uptr size) {
   __dfsan_set_label(label, addr, size);
 }
 
+void __dfsan::dfsan_clear_shadow(void *addr, uptr n) {
+  dfsan_label *ls = shadow_for(addr);
+  dfsan_label *end = ls + n;
+  while (ls < end) {
+    dfsan_label *next =
+        (dfsan_label *)RoundUpTo((uptr)ls + 1, kShadowPageSize);
+    if (next > end) next = end;
+    if (*shadow_summary_for(ls))
+      internal_memset(ls, 0, (uptr)next - (uptr)ls);
+    ls = next;
+  }
+}
+
+// like memmove, so the ranges may overlap
+void __dfsan::dfsan_copy_shadow(void *dest, const void *src, uptr n) {
+  if (n == 0) return;
+  dfsan_label *sdest = shadow_for(dest);
+  const dfsan_label *ssrc = shadow_for(src);
+  if (shadow_is_clean(ssrc, n)) {
+    dfsan_clear_shadow(dest, n);
+    return;
+  }
+  shadow_mark_dirty(sdest, n);
+  internal_memmove(sdest, ssrc, n * sizeof(dfsan_label));
+}
+
+// memcpy and memmove in the instrumented code
+extern "C" SANITIZER_INTERFACE_ATTRIBUTE
+void __dfsan_mem_transfer(void *dest, const void *src, uptr n) {
+  dfsan_copy_shadow(dest, src, n);
+}
+
+// 8 labels, stored at the 4-byte alignment of the shadow
+typedef dfsan_label label_vec
+    __attribute__((vector_size(32), aligned(4), may_alias));
+
+static bool has_avx2;
+
+__attribute__((target("avx2")))
+static void set_label_range_avx2(dfsan_label first, dfsan_label *labelp,
+                                 uptr size) {
+  label_vec v = {0, 1, 2, 3, 4, 5, 6, 7};
+  v += first;
+  uptr i = 0;
+  for (; i + 8 <= size; i += 8, v += 8)
+    *(label_vec *)(labelp + i) = v;
+  for (; i < size; i++)
+    labelp[i] = first + i;
+}
+
+// Write the labels first, first + 1, ... to the shadow of size bytes, i.e.,
+// the labels of consecutive input bytes
+SANITIZER_INTERFACE_ATTRIBUTE
+void dfsan_set_label_range(dfsan_label first, void *addr, uptr size) {
+  if (addr == 0 || size == 0) return;
+  dfsan_label *labelp = shadow_for(addr);
+  shadow_mark_dirty(labelp, size);
+  if (has_avx2) {
+    set_label_range_avx2(first, labelp, size);
+    return;
+  }
+  for (uptr i = 0; i < size; i++)
+    labelp[i] = first + i;
+}
+
 SANITIZER_INTERFACE_ATTRIBUTE
 void dfsan_add_label(dfsan_label label, uint8_t op, void *addr, uptr size) {
+  shadow_mark_dirty(shadow_for(addr), size);
   for (dfsan_label *labelp = shadow_for(addr); size != 0; --size, ++labelp)
     *labelp = __taint_union(*labelp, label, op, 1, 0, 0);
 }
@@ -882,6 +1035,10 @@ extern "C" SANITIZER_INTERFACE_ATTRIBUTE uptr
 dfsan_get_label_count(void) {
   dfsan_label max_label_allocated =
       atomic_load(&__dfsan_last_label, memory_order_relaxed);
+  // not counting the rest of the chunk of the calling thread, the chunks of
+  // the other threads are counted as used
+  if (__label_chunk_epoch == atomic_load_relaxed(&__dfsan_label_epoch))
+    max_label_allocated -= __label_chunk_end - __label_chunk_next;
 
   return static_cast<uptr>(max_label_allocated);
 }
@@ -921,6 +1078,18 @@ taint_set_file(int dirfd, const char *filename, int fd) {
   }
   realpath(filename, path);
   if (internal_strcmp(tainted.filename, path) == 0) {
+    if (flags().taint_fd >= 0) {
+      // the file on disk is only a name, read the launcher's buffer instead,
+      // through a new open file description so each open has its own offset
+      char fd_path[32];
+      internal_snprintf(fd_path, sizeof(fd_path), "/proc/self/fd/%d",
+                        flags().taint_fd);
+      uptr buf_fd = internal_open(fd_path, O_RDONLY);
+      if (!internal_iserror(buf_fd)) {
+        internal_dup2(buf_fd, fd);
+        internal_close(buf_fd);
+      }
+    }
     tainted.fd = fd;
     AOUT("fd:%d created\n", fd);
   }
@@ -1090,24 +1259,41 @@ static void InitializeTaintFile() {
       Report("WARNING: failed to get to real path for taint file\n");
       return;
     }
-    stat(filename, &st);
-    tainted.size = st.st_size;
     tainted.is_stdin = 0;
-    // map a copy
-    tainted.buf = static_cast<char *>(
-      MapFileToMemory(filename, &tainted.buf_size));
-    if (tainted.buf == nullptr) {
-      Printf("FATAL: failed to map a copy of input file\n");
-      Die();
+    if (flags().taint_fd >= 0) {
+      // map the launcher's sealed buffer, it can't change under us
+      if (fstat(flags().taint_fd, &st) != 0) {
+        Printf("FATAL: failed to stat input buffer\n");
+        Die();
+      }
+      tainted.size = st.st_size;
+      if (st.st_size > 0) {
+        tainted.buf_size = RoundUpTo(st.st_size, GetPageSizeCached());
+        uptr map = internal_mmap(nullptr, tainted.buf_size, PROT_READ,
+                                 MAP_PRIVATE, flags().taint_fd, 0);
+        if (internal_iserror(map, &err)) {
+          Printf("FATAL: failed to map input buffer %s\n", strerror(err));
+          Die();
+        }
+        tainted.buf = reinterpret_cast<char *>(map);
+      }
+    } else {
+      stat(filename, &st);
+      tainted.size = st.st_size;
+      // map a copy
+      tainted.buf = static_cast<char *>(
+        MapFileToMemory(filename, &tainted.buf_size));
+      if (tainted.buf == nullptr) {
+        Printf("FATAL: failed to map a copy of input file\n");
+        Die();
+      }
     }
     AOUT("%s %ld size\n", filename, tainted.size);
   }
 
   if (tainted.fd != -1 && !tainted.is_stdin) {
-    for (off_t i = 0; i < tainted.size; i++) {
-      dfsan_label label = dfsan_create_label(i);
-      dfsan_check_label(label);
-    }
+    // reads of the file are labeled with offset + CONST_OFFSET
+    dfsan_create_labels(0, tainted.size);
   }
 }
 
@@ -1156,6 +1342,241 @@ static void InitializeTaintSocket() {
   }
 }
 
+// Forkserver protocol, over the unix socket inherited as fsrv_fd:
+//   server -> launcher: u32 hello (server pid), once
+//   launcher -> server: u32 request, with the write end of the event pipe
+//                       (and the input fd for stdin, or the input buffer for
+//                       taint_fd) attached as SCM_RIGHTS
+//   server -> launcher: u32 child pid, then s32 wait status and u64 peak RSS
+//                       (in KB) once it exits
+// The persistent mode speaks the same protocol, with the target itself as
+// the "child" and the input fd always attached.
+static int RecvRunRequest(int sock, int fds[2]) {
+  uint32_t req;
+  char cbuf[CMSG_SPACE(sizeof(int) * 2)];
+  struct iovec iov = { &req, sizeof(req) };
+  struct msghdr mh;
+  internal_memset(&mh, 0, sizeof(mh));
+  mh.msg_iov = &iov;
+  mh.msg_iovlen = 1;
+  mh.msg_control = cbuf;
+  mh.msg_controllen = sizeof(cbuf);
+
+  ssize_t n;
+  do {
+    n = recvmsg(sock, &mh, 0);
+  } while (n < 0 && errno == EINTR);
+  if (n != sizeof(req))
+    return -1;
+
+  int nfds = 0;
+  for (struct cmsghdr *c = CMSG_FIRSTHDR(&mh); c; c = CMSG_NXTHDR(&mh, c)) {
+    if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS) {
+      nfds = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      if (nfds > 2) nfds = 2;
+      internal_memcpy(fds, CMSG_DATA(c), nfds * sizeof(int));
+    }
+  }
+  return nfds;
+}
+
+static bool SendExitStatus(int sock, int status, uint64_t max_rss) {
+  char buf[sizeof(status) + sizeof(max_rss)];
+  internal_memcpy(buf, &status, sizeof(status));
+  internal_memcpy(buf + sizeof(status), &max_rss, sizeof(max_rss));
+  return internal_write(sock, buf, sizeof(buf)) == sizeof(buf);
+}
+
+// Park right after the input-independent part of the init is done and hand
+// out one child per launcher request. Only returns in the children.
+static void InitializeForkServer() {
+  int sock = flags().fsrv_fd;
+  if (sock < 0 || flags().pipe_fd < 0) {
+    Report("WARNING: forkserver requested without control or pipe fd\n");
+    return;
+  }
+
+  uint32_t hello = internal_getpid();
+  if (internal_write(sock, &hello, sizeof(hello)) != sizeof(hello)) {
+    Report("WARNING: launcher not responding, running without forkserver\n");
+    internal_close(sock);
+    return;
+  }
+
+  while (true) {
+    int fds[2] = {-1, -1};
+    int nfds = RecvRunRequest(sock, fds);
+    if (nfds < 1) {
+      // launcher is gone or confused, nothing left to do
+      internal__exit(0);
+    }
+
+    pid_t child = fork();
+    if (child < 0) {
+      Report("FATAL: forkserver failed to fork\n");
+      Die();
+    }
+
+    if (child == 0) {
+      internal_close(sock);
+      internal_dup2(fds[0], flags().pipe_fd);
+      internal_close(fds[0]);
+      if (nfds > 1) {
+        // the input buffer of a file input goes where the flag says
+        int input_fd = flags().taint_fd >= 0 ? flags().taint_fd : 0;
+        internal_lseek(fds[1], 0, SEEK_SET);
+        internal_dup2(fds[1], input_fd);
+        internal_close(fds[1]);
+      }
+      // every run starts with a clean label space, without the records of
+      // the labels created by the parent, the chunks leave holes
+      internal_memset(&__dfsan_label_info[1], 0,
+                      atomic_load(&__dfsan_last_label, memory_order_relaxed) *
+                          sizeof(dfsan_label_info));
+      dfsan_reset_labels();
+      return;
+    }
+
+    for (int i = 0; i < nfds; i++)
+      internal_close(fds[i]);
+
+    uint32_t pid = child;
+    if (internal_write(sock, &pid, sizeof(pid)) != sizeof(pid))
+      internal__exit(0);
+
+    int status = 0;
+    struct rusage ru;
+    internal_memset(&ru, 0, sizeof(ru));
+    while (wait4(child, &status, 0, &ru) < 0) {
+      if (errno != EINTR) {
+        status = -1;
+        break;
+      }
+    }
+    if (!SendExitStatus(sock, status, ru.ru_maxrss))
+      internal__exit(0);
+  }
+}
+
+// Persistent mode, a libFuzzer-style harness keeps asking for the next
+// input and the runtime state is rewound in between.
+static bool persistent_started = false;
+static uptr persistent_alloc_mark;
+static char *persistent_buf;
+static uptr persistent_buf_size;
+static char persistent_empty_buf[1];
+
+// rewind the per-run state of the solver
+extern "C" void ResetSolver();
+
+// the labels of the run that got no dedup, the union hashtable was full
+static void ReportDroppedUnions() {
+  if (u64 dropped = __union_table.num_dropped()) {
+    Report("WARNING: DataFlowSanitizer: union hashtable full, %llu labels "
+           "not deduplicated\n", dropped);
+  }
+}
+
+static void ResetTaintState() {
+  // stale union table entries are simply overwritten, so rewinding the
+  // counter is enough for the labels
+  dfsan_reset_labels();
+  // dropping the pages clears both the shadow and the hashtable, at a cost
+  // proportional to what the last run has touched
+  ReleaseMemoryPagesToOS(ShadowAddr(), UnionTableAddr());
+  ReleaseMemoryPagesToOS(ShadowSummaryAddr(),
+                         ShadowSummaryAddr() + ShadowSummarySize());
+  __taint::allocator_reset(persistent_alloc_mark);
+  // back to the initial table, allocated before the mark
+  ReportDroppedUnions();
+  __union_table.reset();
+  ResetSolver();
+}
+
+extern "C" SANITIZER_INTERFACE_ATTRIBUTE int
+__taint_persistent_next(const uint8_t **data, size_t *size) {
+  if (!flags().persistent)
+    return -1;
+
+  int sock = flags().fsrv_fd;
+  if (sock < 0 || flags().pipe_fd < 0) {
+    Report("WARNING: persistent mode without control or pipe fd\n");
+    return -1;
+  }
+
+  if (!persistent_started) {
+    uint32_t hello = internal_getpid();
+    if (internal_write(sock, &hello, sizeof(hello)) != sizeof(hello)) {
+      Report("WARNING: launcher not responding, running without persistent mode\n");
+      return -1;
+    }
+    persistent_started = true;
+    persistent_alloc_mark = __taint::allocator_mark();
+  } else {
+    // done with the last input, closing the pipe lets the launcher see EOF
+    internal_close(flags().pipe_fd);
+    if (persistent_buf) {
+      UnmapOrDie(persistent_buf, persistent_buf_size);
+      persistent_buf = nullptr;
+    }
+    // the peak of the process, there's no per-input one
+    struct rusage ru;
+    internal_memset(&ru, 0, sizeof(ru));
+    getrusage(RUSAGE_SELF, &ru);
+    if (!SendExitStatus(sock, 0, ru.ru_maxrss))
+      return 0;
+  }
+
+  int fds[2] = {-1, -1};
+  int nfds = RecvRunRequest(sock, fds);
+  if (nfds < 2) {
+    // launcher is gone or confused
+    for (int i = 0; i < nfds; i++)
+      internal_close(fds[i]);
+    return 0;
+  }
+
+  internal_dup2(fds[0], flags().pipe_fd);
+  internal_close(fds[0]);
+
+  uint32_t pid = internal_getpid();
+  if (internal_write(sock, &pid, sizeof(pid)) != sizeof(pid)) {
+    internal_close(fds[1]);
+    return 0;
+  }
+
+  ResetTaintState();
+
+  struct stat st;
+  if (fstat(fds[1], &st) != 0 || st.st_size == 0) {
+    *data = (const uint8_t *)persistent_empty_buf;
+    *size = 0;
+    internal_close(fds[1]);
+    return 1;
+  }
+
+  // map the input instead of copying it
+  int err;
+  persistent_buf_size = RoundUpTo(st.st_size, GetPageSizeCached());
+  uptr map = internal_mmap(nullptr, persistent_buf_size, PROT_READ,
+                           MAP_PRIVATE, fds[1], 0);
+  internal_close(fds[1]);
+  if (internal_iserror(map, &err)) {
+    Printf("FATAL: failed to map input %s\n", strerror(err));
+    Die();
+  }
+  persistent_buf = reinterpret_cast<char *>(map);
+
+  // same labels as a pre-labeled taint file, i.e., offset + CONST_OFFSET
+  dfsan_label label = dfsan_create_labels(0, st.st_size);
+  dfsan_set_label_range(label, persistent_buf, st.st_size);
+  tainted.size = st.st_size;
+
+  *data = (const uint8_t *)persistent_buf;
+  *size = st.st_size;
+  return 1;
+}
+
 // information is passed implicitly through flags()
 extern "C" void InitializeSolver();
 
@@ -1189,6 +1610,7 @@ static void InitializePlatformEarly() {
 }
 
 static void dfsan_fini() {
+  ReportDroppedUnions();
   if (internal_strcmp(flags().dump_labels_at_exit, "") != 0) {
     fd_t fd = OpenFile(flags().dump_labels_at_exit, WrOnly);
     if (fd == kInvalidFd) {
@@ -1215,6 +1637,9 @@ static void dfsan_init(int argc, char **argv, char **envp) {
   print_debug = flags().debug;
 
   ::InitializePlatformEarly();
+  // before the constructors, which would do it otherwise
+  __builtin_cpu_init();
+  has_avx2 = __builtin_cpu_supports("avx2");
   uptr ret;
   int err;
   ret = MmapFixedSuperNoReserve(ShadowAddr(), UnionTableAddr() - ShadowAddr());
@@ -1236,6 +1661,17 @@ if (flags().shm_fd != -1) {
     Printf("FATAL: error mapping shared union table %s\n", strerror(err));
     Die();
   }
+  // the labels of every run are allocated from the start of the table
+  if (flags().union_table_thp > 0) {
+    uptr thp = Min(RoundUpTo(flags().union_table_thp, GetPageSizeCached()),
+                   uniontable_size);
+    internal_madvise(UnionTableAddr(), thp, MADV_HUGEPAGE);
+  }
+
+  if (!MmapFixedNoReserve(ShadowSummaryAddr(), ShadowSummarySize())) {
+    Printf("FATAL: error mapping shadow summary\n");
+    Die();
+  }
 
   // init const label
   internal_memset(&__dfsan_label_info[CONST_LABEL], 0, sizeof(dfsan_label_info));
@@ -1259,6 +1695,10 @@ if (flags().shm_fd != -1) {
 
   InitializeInterceptors();
 
+  // everything below depends on the input, so it has to be done per run
+  if (flags().forkserver)
+    InitializeForkServer();
+
   InitializeTaintFile();
 
   InitializeTaintSocket();
@@ -1278,6 +1718,7 @@ static void (*dfsan_init_ptr)(int, char **, char **) = dfsan_init;
 
 extern "C" {
 SANITIZER_INTERFACE_WEAK_DEF(void, InitializeSolver, void) {}
+SANITIZER_INTERFACE_WEAK_DEF(void, ResetSolver, void) {}
 
 // Default empty implementations (weak) for hooks
 SANITIZER_INTERFACE_WEAK_DEF(void, __taint_trace_cmp, dfsan_label, dfsan_label,
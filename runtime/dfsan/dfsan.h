@@ -21,6 +21,7 @@
 #include <stdint.h>
 
 using __sanitizer::uptr;
+using __sanitizer::u8;
 
 extern bool print_debug;
 
@@ -88,6 +89,8 @@ void dfsan_store_label(dfsan_label l1, void *addr, uptr size);
 dfsan_label dfsan_union(dfsan_label l1, dfsan_label l2, uint16_t op, uint16_t size,
                         uint64_t op1, uint64_t op2);
 dfsan_label dfsan_create_label(off_t offset);
+dfsan_label dfsan_create_labels(off_t offset, uptr n);
+void dfsan_set_label_range(dfsan_label first, void *addr, uptr size);
 dfsan_label dfsan_get_label(const void *addr);
 dfsan_label_info* dfsan_get_label_info(dfsan_label label);
 
@@ -135,6 +138,47 @@ inline void *app_for(const dfsan_label *l) {
   return (void *) ((((uptr) l) >> 2) | AppBaseAddr());
 }
 
+// The shadow summary has a byte per page of shadow memory, set once the page
+// may hold a non-zero label. Zero labels are stored without setting it, e.g.,
+// inline by the instrumentation, so a clean page is all zero, and shadow
+// reads and writes of clean pages can be skipped without touching them.
+static const uptr kShadowPageShift = 12;
+static const uptr kShadowPageSize = 1ULL << kShadowPageShift;
+
+// right after the union table, for the shadow below the hash table
+inline uptr ShadowSummaryAddr() {
+  return UnionTableAddr() + uniontable_size;
+}
+
+inline uptr ShadowSummarySize() {
+  return HashTableAddr() >> kShadowPageShift;
+}
+
+inline u8 *shadow_summary_for(const dfsan_label *ls) {
+  return (u8 *)ShadowSummaryAddr() + ((uptr)ls >> kShadowPageShift);
+}
+
+// whether the n labels from ls are all zero
+inline bool shadow_is_clean(const dfsan_label *ls, uptr n) {
+  if (n == 0) return true;
+  u8 *end = shadow_summary_for(ls + n - 1);
+  for (u8 *p = shadow_summary_for(ls); p <= end; ++p)
+    if (*p) return false;
+  return true;
+}
+
+// before storing non-zero labels to the n labels from ls
+inline void shadow_mark_dirty(const dfsan_label *ls, uptr n) {
+  if (n == 0) return;
+  u8 *end = shadow_summary_for(ls + n - 1);
+  for (u8 *p = shadow_summary_for(ls); p <= end; ++p)
+    if (!*p) *p = 1;
+}
+
+// the labels of n bytes, skipping clean shadow pages
+void dfsan_clear_shadow(void *addr, uptr n);
+void dfsan_copy_shadow(void *dest, const void *src, uptr n);
+
 dfsan_label_info* get_label_info(dfsan_label label);
 
 struct Flags {
@@ -71,6 +71,19 @@ static inline dfsan_label get_label_for(int fd, off_t offset) {
   else return (offset + CONST_OFFSET);
 }
 
+// Label n bytes read from fd at offset in one go, the labels of consecutive
+// input bytes are consecutive
+static inline void set_labels_for(int fd, off_t offset, void *addr, ssize_t n) {
+  if (n <= 0)
+    return;
+  if (is_stdin_taint() || (fd ==0 && flags().force_stdin)) {
+    dfsan_set_label_range(dfsan_create_labels(current_stdin_offset, n), addr, n);
+    current_stdin_offset += n;
+  } else {
+    dfsan_set_label_range(offset + CONST_OFFSET, addr, n);
+  }
+}
+
 extern "C" SANITIZER_INTERFACE_ATTRIBUTE void
 __taint_trace_offset(dfsan_label offset_label, int64_t offset, unsigned size);
 
@@ -387,10 +400,7 @@ __dfsw_strlen(const char *s, dfsan_label s_label, dfsan_label *ret_label) {
 
 static void *dfsan_memcpy(void *dest, const void *src, size_t n) {
   if (n == 0) return dest;
-  dfsan_label *sdest = shadow_for(dest);
-  const dfsan_label *ssrc = shadow_for(src);
-  // FIXME: check and avoid copying labels?
-  internal_memcpy((void *)sdest, (const void *)ssrc, n * sizeof(dfsan_label));
+  dfsan_copy_shadow(dest, src, n);
   return internal_memcpy(dest, src, n);
 }
 
@@ -424,12 +434,8 @@ void *__dfsw_memmove(void *dest, const void *src, size_t n,
     __taint_solve_bounds(src_label, (uint64_t)src, n_label, n, 0, 1, 0, 0);
     __taint_solve_bounds(dest_label, (uint64_t)dest, n_label, n, 0, 1, 0, 0);
   }
-  dfsan_label tmp[n];
-  dfsan_label *sdest = shadow_for(dest);
-  const dfsan_label *ssrc = shadow_for(src);
-  internal_memcpy((void *)tmp, (const void *)ssrc, n * sizeof(dfsan_label));
+  dfsan_copy_shadow(dest, src, n);
   void *ret = internal_memmove(dest, src, n);
-  internal_memcpy((void *)sdest, (const void *)tmp, n * sizeof(dfsan_label));
   *ret_label = dest_label;
   return ret;
 }
@@ -536,9 +542,7 @@ __dfsw_pread(int fd, void *buf, size_t count, off_t offset,
   *ret_label = 0;
   if (ret >= 0) {
     if (taint_get_file(fd)) {
-      for (ssize_t i = 0; i < ret; i++) {
-        dfsan_set_label(get_label_for(fd, offset + i), (char *)buf + i, 1);
-      }
+      set_labels_for(fd, offset, buf, ret);
       // *ret_label = dfsan_union(0, 0, fsize, sizeof(ret) * 8, offset, 0);
     } else {
       dfsan_set_label(0, buf, ret);
@@ -561,9 +565,7 @@ __dfsw_read(int fd, void *buf, size_t count,
   if (ret >= 0) {
     if (taint_get_file(fd)) {
       AOUT("offset = %ld, ret = %ld\n", offset, ret);
-      for(ssize_t i = 0; i < ret; i++) {
-        dfsan_set_label(get_label_for(fd, offset + i), (char *)buf + i, 1);
-      }
+      set_labels_for(fd, offset, buf, ret);
       // for (size_t i = ret; i < count; i++)
       //   dfsan_set_label(-1, (char *)buf + i, 1);
       // *ret_label = dfsan_union(0, 0, fsize, sizeof(ret) * 8, offset, 0);
@@ -853,7 +855,7 @@ char *__dfsw_stpcpy(char *dest, const char *src, dfsan_label dest_label,
   __taint_check_bounds(dest_label, (uptr)dest, 0, len);
   char *ret = stpcpy(dest, src);
   if (ret) {
-    internal_memcpy(shadow_for(dest), shadow_for(src), sizeof(dfsan_label) * len);
+    dfsan_copy_shadow(dest, src, len);
   }
   *ret_label = dest_label;
   return ret;
@@ -866,8 +868,7 @@ char *__dfsw_strcpy(char *dest, const char *src, dfsan_label dst_label,
   __taint_check_bounds(dst_label, (uptr)dest, 0, len);
   char *ret = strcpy(dest, src);
   if (ret) {
-    internal_memcpy(shadow_for(dest), shadow_for(src),
-                    sizeof(dfsan_label) * len);
+    dfsan_copy_shadow(dest, src, len);
   }
   *ret_label = dst_label;
   return ret;
@@ -1193,9 +1194,7 @@ SANITIZER_INTERFACE_ATTRIBUTE ssize_t __dfsw_recv(
     off_t offset = taint_get_socket(sockfd);
     if (offset >= 0) {
       AOUT("recv: fd = %d, offset = %ld, ret = %ld\n", sockfd, offset, ret);
-      for (ssize_t i = 0; i < ret; i++) {
-        dfsan_set_label(dfsan_create_label(offset + i), (char *)buf + i, 1);
-      }
+      dfsan_set_label_range(dfsan_create_labels(offset, ret), buf, ret);
       taint_update_socket_offset(sockfd, ret);
     } else {
       // clear the label?
@@ -1225,9 +1224,7 @@ SANITIZER_INTERFACE_ATTRIBUTE ssize_t __dfsw_recvfrom(
   if (ret > 0) {
     off_t offset = taint_get_socket(sockfd);
     if (offset >= 0) {
-      for (ssize_t i = 0; i < ret; i++) {
-        dfsan_set_label(dfsan_create_label(offset + i), (char *)buf + i, 1);
-      }
+      dfsan_set_label_range(dfsan_create_labels(offset, ret), buf, ret);
       taint_update_socket_offset(sockfd, ret);
     } else {
       // clear the label?
@@ -1255,9 +1252,8 @@ static void taint_handle_msg(int sockfd, struct msghdr *msg, size_t msg_len) {
     size_t iov_written =
         bytes_written < iov->iov_len ? bytes_written : iov->iov_len;
     if (offset >= 0) {
-      for (size_t j = 0; j < iov_written; ++j) {
-        dfsan_set_label(dfsan_create_label(offset + j), (char *)iov->iov_base + j, 1);
-      }
+      dfsan_set_label_range(dfsan_create_labels(offset, iov_written),
+                            iov->iov_base, iov_written);
       taint_update_socket_offset(sockfd, iov_written);
       offset += iov_written;
     } else {
@@ -1530,9 +1526,8 @@ static int format_buffer(char *str, size_t size, const char *fmt,
           char *arg = va_arg(ap, char *);
           retval = formatter.format(arg);
           va_labels++;
-          internal_memcpy(shadow_for(formatter.str_cur()), shadow_for(arg),
-                          sizeof(dfsan_label) *
-                              formatter.num_written_bytes(retval));
+          dfsan_copy_shadow(formatter.str_cur(), arg,
+                            formatter.num_written_bytes(retval));
           end_fmt = true;
           break;
         }
@@ -1738,9 +1733,8 @@ __dfsw_fread(void *ptr, size_t size, size_t nmemb, FILE *stream,
       internal_memset(ptr, 0, size * nmemb);
       fwrite(ptr, size, nmemb, stream);
       // update taint
-      for (size_t i = 0; i < size * nmemb; i++) {
-        dfsan_set_label(dfsan_create_label(offset + i), (char *)ptr + i, 1);
-      }
+      dfsan_set_label_range(dfsan_create_labels(offset, size * nmemb), ptr,
+                            size * nmemb);
       return nmemb; // directly return
     }
   }
@@ -1752,9 +1746,7 @@ __dfsw_fread(void *ptr, size_t size, size_t nmemb, FILE *stream,
   AOUT("fread(%lu,%lu) = %ld, off = %ld\n", size, nmemb, ret, offset);
   if (ret) {
     if (tfsize) {
-      for (size_t i = 0; i < ret * size; i++) {
-        dfsan_set_label(get_label_for(fd, offset + i), (char *)ptr + i, 1);
-      }
+      set_labels_for(fd, offset, ptr, ret * size);
       // for (size_t i = ret * size; i < size * nmemb; i++) {
       //   dfsan_set_label(-1, (char *)ptr + i, 1);
       // }
@@ -1787,9 +1779,8 @@ __dfsw_fread_unlocked(
       internal_memset(ptr, 0, size * nmemb);
       fwrite(ptr, size, nmemb, stream);
       // update taint
-      for (size_t i = 0; i < size * nmemb; i++) {
-        dfsan_set_label(dfsan_create_label(offset + i), (char *)ptr + i, 1);
-      }
+      dfsan_set_label_range(dfsan_create_labels(offset, size * nmemb), ptr,
+                            size * nmemb);
       return nmemb; // directly return
     }
   }
@@ -1801,9 +1792,7 @@ __dfsw_fread_unlocked(
   AOUT("fread(%lu,%lu) = %ld, off = %ld\n", size, nmemb, ret, offset);
   if (ret) {
     if (tfsize) {
-      for (size_t i = 0; i < ret * size; i++) {
-        dfsan_set_label(get_label_for(fd, offset + i), (char *)ptr + i, 1);
-      }
+      set_labels_for(fd, offset, ptr, ret * size);
       // for (size_t i = ret * size; i < nmemb * size; i++) {
       //   dfsan_set_label(-1, (char *)ptr + i, 1);
       // }
@@ -1826,10 +1815,7 @@ __dfsw_getline(char **lineptr, size_t *n, FILE *stream,
   if (ret) {
     if (taint_get_file(fd)) {
       // including a terminating null byte
-      for (ssize_t i = 0; i < ret; i++) {
-        void *addr = (*lineptr) + i;
-        dfsan_set_label(get_label_for(fd, offset + i), addr, 1);
-      }
+      set_labels_for(fd, offset, *lineptr, ret);
       dfsan_set_label(0, (*lineptr) + ret, 1);
       // *ret_label = dfsan_union(0, 0, fsize, sizeof(ret) * 8, offset, 0);
       // FIXME: set the label for the ptr to track the buffer size
@@ -1853,11 +1839,8 @@ __dfsw_getdelim(char **lineptr, size_t *n, int delim, FILE *stream,
   if (ret) {
     if (taint_get_file(fd)) {
       // including a terminating null byte
-      for(ssize_t i = 0; i < ret; i++) {
-        void *addr = (*lineptr) + i;
-        dfsan_set_label(get_label_for(fd, offset + i), addr, 1);
-        // FIXME: set the label for the ptr to track the buffer size
-      }
+      set_labels_for(fd, offset, *lineptr, ret);
+      // FIXME: set the label for the ptr to track the buffer size
       dfsan_set_label(0, (*lineptr) + ret, 1);
       // *ret_label = dfsan_union(0, 0, fsize, sizeof(ret) * 8, offset, 0);
     } else {
@@ -1878,10 +1861,7 @@ __dfsw___getdelim(char **lineptr, size_t *n, int delim, FILE *stream,
   *ret_label = 0;
   if (ret) {
     if (taint_get_file(fd)) {
-      for(ssize_t i = 0; i < ret; i++) {
-        void *addr = (*lineptr) + i;
-        dfsan_set_label(get_label_for(fd, offset + i), addr, 1);
-      }
+      set_labels_for(fd, offset, *lineptr, ret);
       dfsan_set_label(0, (*lineptr) + ret, 1);
       // *ret_label = dfsan_union(0, 0, fsize, sizeof(ret) * 8, offset, 0);
       // FIXME: set the label for the ptr to track the buffer size
@@ -1898,8 +1878,7 @@ __dfsw_gets(char *str, dfsan_label str_label, dfsan_label *ret_label) {
   // gets discard until c11
   char *ret = fgets(str, sizeof(str), stdin);
   if (ret && taint_get_file(0)) {
-    for (off_t i = 0; i <= strlen(ret); i++)
-      dfsan_set_label(get_label_for(0, offset + i), ret + i, 1);
+    set_labels_for(0, offset, ret, strlen(ret) + 1);
     *ret_label = str_label;
   } else {
     *ret_label = 0;
@@ -1930,9 +1909,7 @@ __dfsw_getutxent(dfsan_label *ret_label) {
   *ret_label = 0;
   if (ret && is_utmp_taint()) {
     off_t offset = get_utmp_offset();
-    for (size_t i = 0; i < sizeof(struct utmpx); i++) {
-      dfsan_set_label(get_label_for(-1, offset + i), (char *)ret + i, 1);
-    }
+    set_labels_for(-1, offset, ret, sizeof(struct utmpx));
     set_utmp_offset(offset + sizeof(struct utmpx));
   }
   return ret;
@@ -1951,10 +1928,7 @@ char *__dfsw_fgets(char *s, int size, FILE *stream, dfsan_label s_label,
   if (ret) {
     if (taint_get_file(fd)) {
       // including terminating \0
-      for (size_t i = 0; i < strlen(ret); i++) {
-        char *buf = s + i;
-        dfsan_set_label(get_label_for(fd, offset + i), buf, 1);
-      }
+      set_labels_for(fd, offset, s, strlen(ret));
       dfsan_set_label(0, s + strlen(ret), 1);
       // for(int i = strlen(ret) + 1; i < size; i++) {
       //   char *buf = s + i;
@@ -1981,10 +1955,7 @@ char *__dfsw_fgets_unlocked(char *s, int size, FILE *stream, dfsan_label s_label
   if (ret) {
     if (taint_get_file(fd)) {
       // including terminating \0
-      for(size_t i = 0; i < strlen(ret); i++) {
-        char *buf = s + i;
-        dfsan_set_label(get_label_for(fd, offset + i), buf, 1);
-      }
+      set_labels_for(fd, offset, s, strlen(ret));
       dfsan_set_label(0, s + strlen(ret), 1);
       // for(int i = strlen(ret) + 1; i < size; i++) {
       //   char *buf = s + i;
@@ -2018,7 +1989,7 @@ __dfsw_realloc(void *ptr, size_t new_size,
   *ret_label = 0;
 
   if (ret) {
-    internal_memset(shadow_for(ret), 0, sizeof(dfsan_label) * new_size);
+    dfsan_clear_shadow(ret, new_size);
     if (flags().trace_bounds) {
       dfsan_label bound = dfsan_union(0, new_size_label, Alloca, sizeof(ret) * 8,
           (uint64_t)ret, (uint64_t)ret + new_size);
@@ -2032,7 +2003,7 @@ __dfsw_realloc(void *ptr, size_t new_size,
       size_t size = malloc_usable_size(ptr);
       size = size < new_size ? size : new_size;
       internal_memcpy(ret, ptr, size);
-      internal_memcpy(shadow_for(ret), shadow_for(ptr), sizeof(dfsan_label) * size);
+      dfsan_copy_shadow(ret, ptr, size);
     }
     if (flags().trace_bounds) {
       // mark old buffer as freed without truely free it
@@ -2062,7 +2033,7 @@ __dfsw___libc_realloc(void *ptr, size_t new_size,
   void *ret = malloc(new_size);
   *ret_label = 0;
   if (ret) {
-    internal_memset(shadow_for(ret), 0, sizeof(dfsan_label) * new_size);
+    dfsan_clear_shadow(ret, new_size);
     if (flags().trace_bounds) {
       dfsan_label bound = dfsan_union(0, new_size_label, Alloca, sizeof(ret) * 8,
           (uint64_t)ret, (uint64_t)ret + new_size);
@@ -2076,7 +2047,7 @@ __dfsw___libc_realloc(void *ptr, size_t new_size,
       size_t size = malloc_usable_size(ptr);
       size = size < new_size ? size : new_size;
       internal_memcpy(ret, ptr, size);
-      internal_memcpy(shadow_for(ret), shadow_for(ptr), sizeof(dfsan_label) * size);
+      dfsan_copy_shadow(ret, ptr, size);
     }
     if (flags().trace_bounds) {
       // mark old buffer as freed without truely free it
@@ -2110,7 +2081,7 @@ void *__dfsw_reallocarray(void *ptr, size_t nmemb, size_t new_size,
   void *ret = calloc(nmemb, new_size);
   *ret_label = 0;
   if (ret) {
-    internal_memset(shadow_for(ret), 0, sizeof(dfsan_label) * new_size * nmemb);
+    dfsan_clear_shadow(ret, new_size * nmemb);
     if (flags().trace_bounds) {
       dfsan_label bound = dfsan_union(nmemb_label, new_size_label, Alloca, sizeof(ret) * 8,
           (uint64_t)ret, (uint64_t)ret + (new_size * nmemb));
@@ -2124,7 +2095,7 @@ void *__dfsw_reallocarray(void *ptr, size_t nmemb, size_t new_size,
       size_t size = malloc_usable_size(ptr);
       size = size < new_size ? size : new_size * nmemb;
       internal_memcpy(ret, ptr, size);
-      internal_memcpy(shadow_for(ret), shadow_for(ptr), sizeof(dfsan_label) * size);
+      dfsan_copy_shadow(ret, ptr, size);
     }
     if (flags().trace_bounds) {
       // mark old buffer as freed without truely free it
@@ -2157,7 +2128,7 @@ void *__dfsw___libc_reallocarray(void *ptr, size_t nmemb, size_t new_size,
   }
   void *ret = calloc(nmemb, new_size);
   if (ret) {
-    internal_memset(shadow_for(ret), 0, sizeof(dfsan_label) * new_size * nmemb);
+    dfsan_clear_shadow(ret, new_size * nmemb);
     if (flags().trace_bounds) {
       dfsan_label bound = dfsan_union(nmemb_label, new_size_label, Alloca, sizeof(ret) * 8,
           (uint64_t)ret, (uint64_t)ret + (new_size * nmemb));
@@ -2171,7 +2142,7 @@ void *__dfsw___libc_reallocarray(void *ptr, size_t nmemb, size_t new_size,
       size_t size = malloc_usable_size(ptr);
       size = size < new_size ? size : new_size * nmemb;
       internal_memcpy(ret, ptr, size);
-      internal_memcpy(shadow_for(ret), shadow_for(ptr), sizeof(dfsan_label) * size);
+      dfsan_copy_shadow(ret, ptr, size);
     }
     if (flags().trace_bounds) {
       // mark old buffer as freed without truely free it
@@ -2205,7 +2176,7 @@ void *__dfsw_calloc(size_t nmemb, size_t size,
   void *ret = calloc(nmemb, size);
   *ret_label = 0;
   if (ret) {
-    internal_memset(shadow_for(ret), 0, sizeof(dfsan_label) * size * nmemb);
+    dfsan_clear_shadow(ret, size * nmemb);
     if (flags().trace_bounds) {
       dfsan_label bound = dfsan_union(nmemb_label, size_label, Alloca, sizeof(ret) * 8,
           (uint64_t)ret, (uint64_t)ret + (size * nmemb));
@@ -2229,7 +2200,7 @@ void *__dfsw___libc_calloc(size_t nmemb, size_t size,
   void *ret = calloc(nmemb, size);
   *ret_label = 0;
   if (ret) {
-    internal_memset(shadow_for(ret), 0, sizeof(dfsan_label) * size * nmemb);
+    dfsan_clear_shadow(ret, size * nmemb);
     if (flags().trace_bounds) {
       dfsan_label bound = dfsan_union(nmemb_label, size_label, Alloca, sizeof(ret) * 8,
           (uint64_t)ret, (uint64_t)ret + (size * nmemb));
@@ -2248,7 +2219,7 @@ void *__dfsw_malloc(size_t size, dfsan_label size_label,
   void *ret = malloc(size);
   *ret_label = 0;
   if (ret) {
-    internal_memset(shadow_for(ret), 0, sizeof(dfsan_label) * size);
+    dfsan_clear_shadow(ret, size);
     if (flags().trace_bounds) {
       dfsan_label bound = dfsan_union(0, size_label, Alloca, sizeof(ret) * 8,
           (uint64_t)ret, (uint64_t)ret + size);
@@ -2266,7 +2237,7 @@ void *__dfsw___libc_malloc(size_t size, dfsan_label size_label,
   void *ret = malloc(size);
   *ret_label = 0;
   if (ret) {
-    internal_memset(shadow_for(ret), 0, sizeof(dfsan_label) * size);
+    dfsan_clear_shadow(ret, size);
     if (flags().trace_bounds) {
       dfsan_label bound = dfsan_union(0, size_label, Alloca, sizeof(ret) * 8,
           (uint64_t)ret, (uint64_t)ret + size);
@@ -2285,7 +2256,7 @@ void *__dfsw_aligned_alloc(size_t alignment, size_t size,
   void *ret = aligned_alloc(alignment, size);
   *ret_label = 0;
   if (ret) {
-    internal_memset(shadow_for(ret), 0, sizeof(dfsan_label) * size);
+    dfsan_clear_shadow(ret, size);
     if (flags().trace_bounds) {
       dfsan_label bound = dfsan_union(0, size_label, Alloca, sizeof(ret) * 8,
           (uint64_t)ret, (uint64_t)ret + size);
@@ -2304,7 +2275,7 @@ int __dfsw_posix_memalign(void **memptr, size_t alignment, size_t size,
   int ret = posix_memalign(memptr, alignment, size);
   *ret_label = 0;
   if (!ret && memptr && *memptr) {
-    internal_memset(shadow_for(*memptr), 0, sizeof(dfsan_label) * size);
+    dfsan_clear_shadow(*memptr, size);
     if (flags().trace_bounds) {
       dfsan_label bound = dfsan_union(0, size_label, Alloca, sizeof(*memptr) * 8,
           (uint64_t)(*memptr), (uint64_t)(*memptr) + size);
@@ -2321,7 +2292,7 @@ void *__dfsw_valloc(size_t size, dfsan_label size_label, dfsan_label *ret_label)
   void *ret = valloc(size);
   *ret_label = 0;
   if (ret) {
-    internal_memset(shadow_for(ret), 0, sizeof(dfsan_label) * size);
+    dfsan_clear_shadow(ret, size);
     if (flags().trace_bounds) {
       dfsan_label bound = dfsan_union(0, size_label, Alloca, sizeof(ret) * 8,
           (uint64_t)ret, (uint64_t)ret + size);
@@ -2338,7 +2309,7 @@ void *__dfsw___libc_valloc(size_t size, dfsan_label size_label, dfsan_label *ret
   void *ret = valloc(size);
   *ret_label = 0;
   if (ret) {
-    internal_memset(shadow_for(ret), 0, sizeof(dfsan_label) * size);
+    dfsan_clear_shadow(ret, size);
     if (flags().trace_bounds) {
       dfsan_label bound = dfsan_union(0, size_label, Alloca, sizeof(ret) * 8,
           (uint64_t)ret, (uint64_t)ret + size);
@@ -2356,7 +2327,7 @@ void *__dfsw_memalign(size_t alignment, size_t size, dfsan_label alignment_label
   void *ret = memalign(alignment, size);
   *ret_label = 0;
   if (ret) {
-    internal_memset(shadow_for(ret), 0, sizeof(dfsan_label) * size);
+    dfsan_clear_shadow(ret, size);
     if (flags().trace_bounds) {
       dfsan_label bound = dfsan_union(0, size_label, Alloca, sizeof(ret) * 8,
           (uint64_t)ret, (uint64_t)ret + size);
@@ -2374,7 +2345,7 @@ void *__dfsw___libc_memalign(size_t alignment, size_t size, dfsan_label alignmen
   void *ret = memalign(alignment, size);
   *ret_label = 0;
   if (ret) {
-    internal_memset(shadow_for(ret), 0, sizeof(dfsan_label) * size);
+    dfsan_clear_shadow(ret, size);
     if (flags().trace_bounds) {
       dfsan_label bound = dfsan_union(0, size_label, Alloca, sizeof(ret) * 8,
           (uint64_t)ret, (uint64_t)ret + size);
@@ -2391,7 +2362,7 @@ void *__dfsw_pvalloc(size_t size, dfsan_label size_label, dfsan_label *ret_label
   void *ret = pvalloc(size);
   *ret_label = 0;
   if (ret) {
-    internal_memset(shadow_for(ret), 0, sizeof(dfsan_label) * size);
+    dfsan_clear_shadow(ret, size);
     if (flags().trace_bounds) {
       dfsan_label bound = dfsan_union(0, size_label, Alloca, sizeof(ret) * 8,
           (uint64_t)ret, (uint64_t)ret + size);
@@ -2408,7 +2379,7 @@ void *__dfsw___libc_pvalloc(size_t size, dfsan_label size_label, dfsan_label *re
   void *ret = pvalloc(size);
   *ret_label = 0;
   if (ret) {
-    internal_memset(shadow_for(ret), 0, sizeof(dfsan_label) * size);
+    dfsan_clear_shadow(ret, size);
     if (flags().trace_bounds) {
       dfsan_label bound = dfsan_union(0, size_label, Alloca, sizeof(ret) * 8,
           (uint64_t)ret, (uint64_t)ret + size);
@@ -2554,8 +2525,7 @@ __dfsw_mmap(void *start, size_t length, int prot, int flags, int fd,
            ret, offset, length);
       size_t tainted_length = (offset + length) > fsize ? (fsize - offset)
                                                         : length;
-      for (size_t i = 0; i < tainted_length; i++)
-        dfsan_set_label(get_label_for(fd, offset + i), (char *)ret + i, 1);
+      set_labels_for(fd, offset, ret, tainted_length);
       for (size_t i = tainted_length; i < length; i++)
         dfsan_set_label(-1, (char *)ret + i, 1);
     } else {
@@ -30,6 +30,15 @@ void ReleaseShadowMemoryPagesToOS(void *addr, SIZE_T length) {
       (void *)((uptr)addr + RoundUpTo(length, GetPageSizeCached()));
   uptr end_shadow_addr = (uptr)__dfsan::shadow_for(end_addr);
   ReleaseMemoryPagesToOS(beg_shadow_addr, end_shadow_addr);
+  // only the whole pages are released (zeroed), and are clean again
+  uptr page = GetPageSizeCached();
+  uptr beg = RoundUpTo(beg_shadow_addr, page);
+  uptr end = RoundDownTo(end_shadow_addr, page);
+  if (beg >= end) return;
+  u8 *p = __dfsan::shadow_summary_for((const dfsan_label *)beg);
+  u8 *last = __dfsan::shadow_summary_for((const dfsan_label *)(end - 1));
+  for (; p <= last; ++p)
+    if (*p) *p = 0;
 }
 
 }
@@ -41,4 +41,21 @@ allocator_dealloc(uptr addr) {
   // do nothing for now
 }
 
+/**
+ * Current position of the bump pointer, to be rewound to later
+ * with allocator_reset, dropping everything allocated since.
+ */
+
+uptr allocator_mark() {
+  return atomic_load_relaxed(&next_usable_byte);
+}
+
+void allocator_reset(uptr mark) {
+  if (mark < begin_addr || mark >= end_addr) {
+    Report("FATAL: Invalid allocator mark\n");
+    Die();
+  }
+  atomic_store_relaxed(&next_usable_byte, mark);
+}
+
 } // namespace
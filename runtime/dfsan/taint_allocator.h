@@ -10,6 +10,8 @@ namespace __taint {
 void allocator_init(uptr begin, uptr end);
 void *allocator_alloc(uptr size);
 void allocator_dealloc(uptr addr);
+uptr allocator_mark();
+void allocator_reset(uptr mark);
 
 } // namespace
 
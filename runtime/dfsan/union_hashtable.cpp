@@ -1,46 +1,159 @@
+#include "sanitizer_common/sanitizer_common.h"
 #include "sanitizer_common/sanitizer_libc.h"
 #include "union_hashtable.h"
 #include "union_util.h"
 
 using namespace __taint;
+using namespace __sanitizer;
+
+// a slot is (hash << 32 | label), label 0 is never inserted
+static const u64 kEmpty = 0;
+// left behind in the old table by a moved slot, so probing goes on
+static const u64 kMoved = ~0ULL << 32;
+// slots moved from the old table by each insert, the table sizes are
+// multiples of it
+static const u64 kMigrateChunk = 64;
+// probing stops here, so a (nearly) full last table costs lost dedups
+// rather than long scans. Runs this long are rare below 3/4 full
+static const u64 kMaxProbes = 1024;
+
+static inline u64 make_slot(u32 hash, dfsan_label label) {
+  return ((u64)hash << 32) | label;
+}
+
+static inline u32 slot_hash(u64 slot) { return slot >> 32; }
+
+static inline dfsan_label slot_label(u64 slot) { return (dfsan_label)slot; }
+
+static dfsan_label probe(atomic_uint64_t *slots, u64 mask,
+                         const dfsan_label_info &key) {
+  u64 i = key.hash & mask;
+  for (u64 n = 0; n < kMaxProbes; n++, i = (i + 1) & mask) {
+    u64 slot = atomic_load(&slots[i], memory_order_acquire);
+    if (slot == kEmpty)
+      return 0;
+    dfsan_label label = slot_label(slot);
+    // only touch the record on a fingerprint match
+    if (slot_hash(slot) == key.hash && label != 0 &&
+        *__dfsan::get_label_info(label) == key)
+      return label;
+  }
+  return 0;
+}
+
+static bool put(atomic_uint64_t *slots, u64 mask, u64 slot) {
+  u64 i = slot_hash(slot) & mask;
+  for (u64 n = 0; n < kMaxProbes; n++, i = (i + 1) & mask) {
+    u64 cmp = kEmpty;
+    if (atomic_load_relaxed(&slots[i]) == kEmpty &&
+        atomic_compare_exchange_strong(&slots[i], &cmp, slot,
+                                       memory_order_release))
+      return true;
+  }
+  return false;
+}
 
 union_hashtable::union_hashtable(uint64_t n) {
-  bucket_size = n;
-  bucket = reinterpret_cast<atomic_uintptr_t*>(
-      allocator_alloc(n * sizeof(atomic_uintptr_t)));
-  __sanitizer::internal_memset(bucket, 0, n * sizeof(atomic_uintptr_t));
+  alloc_table(0, n);
+  reset();
+}
+
+void
+union_hashtable::alloc_table(int i, uint64_t n) {
+  // page aligned, so the pages can be released when the table is retired.
+  // The memory from the allocator is fresh, i.e., zeroed
+  uptr page = GetPageSizeCached();
+  uptr p = (uptr)allocator_alloc(n * sizeof(atomic_uint64_t) + page);
+  tables[i].slots = reinterpret_cast<atomic_uint64_t*>(RoundUpTo(p, page));
+  tables[i].mask = n - 1;
+  atomic_store_relaxed(&tables[i].count, 0);
+  atomic_store_relaxed(&tables[i].next_chunk, 0);
+  atomic_store_relaxed(&tables[i].moved, 0);
 }
 
-uint32_t
-union_hashtable::hash(const dfsan_label_info &key) {
-  return key.hash & (bucket_size - 1);
+void
+union_hashtable::reset() {
+  for (int i = 1; i < kMaxTables; i++) {
+    tables[i].slots = nullptr;
+  }
+  atomic_store_relaxed(&tables[0].count, 0);
+  atomic_store_relaxed(&migrating_to, 0);
+  atomic_store_relaxed(&growing, 0);
+  atomic_store_relaxed(&current, 0);
+  atomic_store_relaxed(&dropped, 0);
+}
+
+void
+union_hashtable::grow(uint32_t cur) {
+  if (cur + 1 >= kMaxTables ||
+      atomic_load(&migrating_to, memory_order_acquire) != 0)
+    return;
+  u8 cmp = 0;
+  if (!atomic_compare_exchange_strong(&growing, &cmp, 1, memory_order_acquire))
+    return;
+  if (atomic_load(&current, memory_order_acquire) == cur) {
+    alloc_table(cur + 1, (tables[cur].mask + 1) * 2);
+    // before the switch, so a lookup that sees the new table also checks
+    // the old one
+    atomic_store(&migrating_to, cur + 1, memory_order_release);
+    atomic_store(&current, cur + 1, memory_order_release);
+  }
+  atomic_store(&growing, 0, memory_order_release);
+}
+
+void
+union_hashtable::migrate(uint32_t to) {
+  table &from = tables[to - 1];
+  table &t = tables[to];
+  u64 n = from.mask + 1;
+  // the cursor of the new table, a straggler with a stale index finds it
+  // at the end
+  u64 start = atomic_fetch_add(&t.next_chunk, kMigrateChunk,
+                               memory_order_relaxed);
+  if (start >= n)
+    return;
+  for (u64 i = start; i < start + kMigrateChunk; i++) {
+    u64 slot = atomic_load(&from.slots[i], memory_order_acquire);
+    if (slot != kEmpty && slot != kMoved &&
+        put(t.slots, t.mask, slot))
+      atomic_fetch_add(&t.count, 1, memory_order_relaxed);
+    // only after it's in the new table
+    atomic_store(&from.slots[i], kMoved, memory_order_release);
+  }
+  if (atomic_fetch_add(&t.moved, kMigrateChunk, memory_order_acq_rel) +
+      kMigrateChunk == n) {
+    atomic_store(&migrating_to, 0, memory_order_release);
+    // racing lookups just find zeroes
+    uptr beg = (uptr)from.slots;
+    ReleaseMemoryPagesToOS(beg, beg + n * sizeof(atomic_uint64_t));
+  }
 }
 
 void
 union_hashtable::insert(dfsan_label_info *key, dfsan_label entry) {
-  uint32_t index = hash(*key);
-  auto curr = (struct union_hashtable_entry *)
-      allocator_alloc(sizeof(struct union_hashtable_entry));
-  curr->key = key; curr->entry = entry;
-  uptr p = atomic_load(&bucket[index], memory_order_acquire);
-  while (true) {
-    curr->next = reinterpret_cast<struct union_hashtable_entry *>(p);
-    if (atomic_compare_exchange_strong(&bucket[index], &p, (uptr)curr,
-                                       memory_order_seq_cst))
-      break; // spin until succeed, when fail, p will contain the current head
+  u32 to = atomic_load(&migrating_to, memory_order_acquire);
+  if (to != 0)
+    migrate(to);
+  u32 cur = atomic_load(&current, memory_order_acquire);
+  table &t = tables[cur];
+  // too crowded, the entry is only lost for dedup
+  if (!put(t.slots, t.mask, make_slot(key->hash, entry))) {
+    atomic_fetch_add(&dropped, 1, memory_order_relaxed);
+    grow(cur);
+  } else if (atomic_fetch_add(&t.count, 1, memory_order_relaxed) + 1 >
+             (t.mask + 1) / 4 * 3) {
+    grow(cur);
   }
 }
 
 option
 union_hashtable::lookup(const dfsan_label_info &key) {
-  uint64_t index = hash(key);
-  uptr p = atomic_load(&bucket[index], memory_order_acquire);
-  auto curr = reinterpret_cast<struct union_hashtable_entry *>(p);
-  while (curr) {
-    if (*(curr->key) == key) {
-      return some_dfsan_label(curr->entry);
-    }
-    curr = curr->next; // no data race here
-  }
-  return none();
+  u32 cur = atomic_load(&current, memory_order_acquire);
+  dfsan_label label = probe(tables[cur].slots, tables[cur].mask, key);
+  if (label == 0) {
+    u32 to = atomic_load(&migrating_to, memory_order_acquire);
+    if (to != 0)
+      label = probe(tables[to - 1].slots, tables[to - 1].mask, key);
+  }
+  return label != 0 ? some_dfsan_label(label) : none();
 }
@@ -8,28 +8,55 @@
 #include "union_util.h"
 #include "dfsan.h"
 
-using __sanitizer::atomic_uintptr_t;
-using __sanitizer::atomic_load;
-using __sanitizer::atomic_compare_exchange_strong;
-using __sanitizer::memory_order_acquire;
-using __sanitizer::memory_order_seq_cst;
+using __sanitizer::atomic_uint8_t;
+using __sanitizer::atomic_uint32_t;
+using __sanitizer::atomic_uint64_t;
 
 namespace __taint {
 
-struct union_hashtable_entry {
-  dfsan_label_info *key;
-  dfsan_label entry;
-  struct union_hashtable_entry *next;
-};
-
+// Lock-free open-addressing table from label records to labels, with linear
+// probing. A slot holds the hash of the record as a fingerprint and the
+// label, so probing never leaves the table and the record of a label is only
+// compared on a fingerprint match.
+//
+// The table doubles when it's 3/4 full, the slots are moved to the new table
+// a chunk at a time by the following inserts, and the pages of the old one
+// are returned to the OS once it's empty. As labels are never removed, a
+// lookup racing with an insert or a move may miss an entry, which only costs
+// a duplicate label.
 class union_hashtable {
-  atomic_uintptr_t *bucket;
-  uint64_t bucket_size;
-  uint32_t hash(const dfsan_label_info &key);
+  struct table {
+    atomic_uint64_t *slots;
+    uint64_t mask;
+    atomic_uint64_t count;
+    // moving the previous table into this one: the next chunk to move, and
+    // the number of slots moved
+    atomic_uint64_t next_chunk;
+    atomic_uint64_t moved;
+  };
+
+  // from the initial size, up to 256x, as the tables come from the bump
+  // allocator: 2^20 initial slots end up using 4GB - 8MB of its 4GB, and the
+  // last table holds 200M labels at 3/4 full
+  static const int kMaxTables = 9;
+
+  table tables[kMaxTables];
+  atomic_uint32_t current;      // index of the table to insert into
+  atomic_uint32_t migrating_to; // index of the table being filled, or 0
+  atomic_uint8_t growing;       // a new table is being allocated
+  atomic_uint64_t dropped;      // inserts lost for dedup, the table was full
+
+  void alloc_table(int i, uint64_t n);
+  void grow(uint32_t cur);
+  void migrate(uint32_t to);
 public:
   union_hashtable(uint64_t n);
   void insert(dfsan_label_info *key, dfsan_label value);
   option lookup(const dfsan_label_info &key);
+  uint64_t num_dropped() { return atomic_load_relaxed(&dropped); }
+  // drop all entries, the memory of the tables must have been released
+  // (i.e., zeroed) along with what the allocator is rewound to
+  void reset();
 };
 
 }
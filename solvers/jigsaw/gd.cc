@@ -3,6 +3,7 @@
 #include <iostream>
 
 #include "jit.h"
+#include "interp.h"
 #include "input.h"
 #include "grad.h"
 #include "config.h"
@@ -30,6 +31,18 @@ using namespace rgd;
                                                                                \
   })
 
+// run the JIT'ed function, or interpret the constraint if it has not been
+// promoted to the JIT (yet)
+static inline void evaluate(std::shared_ptr<const Constraint> const& c,
+                            uint64_t *args) {
+  auto fn = __atomic_load_n(&c->fn, __ATOMIC_ACQUIRE);
+  if (likely(fn != nullptr)) {
+    fn(args);
+  } else {
+    interpret(*__atomic_load_n(&c->bc, __ATOMIC_ACQUIRE), args);
+  }
+}
+
 static void dump_results(MutInput &input, std::shared_ptr<SearchTask> task) {
   int i = 0;
   for (auto it : task->inputs()) {
@@ -92,6 +105,15 @@ static void add_results(MutInput &input, std::shared_ptr<SearchTask> task) {
   }
 }
 
+// with other solvers racing on the task, the solution is only written if
+// the gd is the first to solve it
+static void found_solution(MutInput &input, std::shared_ptr<SearchTask> task) {
+  task->stopped = true;
+  if (task->claim()) {
+    add_results(input, task);
+    task->solved = true;
+  }
+}
 
 static inline uint64_t sat_inc(uint64_t base, uint64_t inc) {
   return base + inc < base ? -1 : base + inc;
@@ -172,23 +194,28 @@ static uint64_t get_distance(uint32_t comp, uint64_t a, uint64_t b) {
 }
 
 
+static uint64_t constraint_distance(MutInput &input, std::shared_ptr<SearchTask> task, size_t cons_id) {
+  auto& c = task->constraints(cons_id);
+  auto& cm = task->consmetas(cons_id);
+  int arg_idx = 0;
+  for (auto const &arg : cm->input_args) {
+    if (arg.first) {// symbolic
+      task->scratch_args[RET_OFFSET + arg_idx] = input.value[arg.second];
+    } else {
+      task->scratch_args[RET_OFFSET + arg_idx] = arg.second;
+    }
+    ++arg_idx;
+  }
+  evaluate(c, task->scratch_args);
+  return get_distance(cm->comparison, task->scratch_args[0], task->scratch_args[1]);
+}
+
+
 static uint64_t single_distance(MutInput &input, std::vector<uint64_t> &distances, std::shared_ptr<SearchTask> task, const uint32_t index) {
   // only re-compute the distance of the constraints that are affected by the change
   uint64_t res = 0;
   for (uint32_t cons_id : task->cmap(index)) {
-    auto& c = task->constraints(cons_id);
-    auto& cm = task->consmetas(cons_id);
-    int arg_idx = 0;
-    for (auto const &arg : cm->input_args) {
-      if (arg.first) {// symbolic
-        task->scratch_args[RET_OFFSET + arg_idx] = input.value[arg.second];
-      } else {
-        task->scratch_args[RET_OFFSET + arg_idx] = arg.second;
-      }
-      ++arg_idx;
-    }
-    c->fn(task->scratch_args);
-    uint64_t dis = get_distance(cm->comparison, task->scratch_args[0], task->scratch_args[1]);
+    uint64_t dis = constraint_distance(input, task, cons_id);
     distances[cons_id] = dis;
 #if DEBUG
     std::cout << "single distance of constraint " << cons_id << " is " << dis << std::endl;
@@ -217,7 +244,7 @@ static uint64_t distance(MutInput &input, std::vector<uint64_t> &distances, std:
       }
       ++arg_idx;
     }
-    c->fn(task->scratch_args);
+    evaluate(c, task->scratch_args);
     uint64_t dis = get_distance(cm->comparison, task->scratch_args[0], task->scratch_args[1]);
     distances[i] = dis;
     cm->op1 = task->scratch_args[0];
@@ -228,78 +255,160 @@ static uint64_t distance(MutInput &input, std::vector<uint64_t> &distances, std:
     res = sat_inc(res, dis);
   }
   if (res == 0) {
-    task->stopped = true;
-    task->solved = true;
     //dump_results(input, task);
-    add_results(input, task);
+    found_solution(input, task);
   }
   task->attempts++;
   if (task->attempts > MAX_EXEC_TIMES) {
     task->stopped = true;
-    task->solved = false;
+    // the solution of another solver in the race is left alone
+    if (!task->racing) task->solved = false;
   }
   return res;
 }
 
 
+// number of probes in each direction of a partial derivation, with the
+// deltas 1, 4, 16 and 64
+static const int kNumProbes = 4;
+static_assert(2 * kNumProbes <= BATCH_LANES, "probes don't fit in a batch");
+
+// evaluate the constraints affected by the input byte at index, with the
+// byte set to values[lane], into task->probe_distances. Only the ones with
+// a batch function are, the others are left to probe_distance
+static void batch_probe(MutInput &input, const uint32_t index,
+                        const uint64_t *values, std::shared_ptr<SearchTask> task) {
+  auto const& cons = task->cmap(index);
+  task->probe_distances.resize(cons.size() * BATCH_LANES);
+  task->probe_batched.assign(cons.size(), false);
+  for (size_t k = 0; k < cons.size(); k++) {
+    auto& c = task->constraints(cons[k]);
+    auto& cm = task->consmetas(cons[k]);
+    if (__atomic_load_n(&c->fn, __ATOMIC_ACQUIRE) == nullptr) {
+      continue;
+    }
+    auto batch_fn = __atomic_load_n(&c->batch_fn, __ATOMIC_RELAXED);
+    if (batch_fn == nullptr) {
+      continue;
+    }
+    uint64_t slot = -1;
+    int arg_idx = 0;
+    for (auto const &arg : cm->input_args) {
+      if (arg.first) { // symbolic
+        if (arg.second == index) slot = RET_OFFSET + arg_idx;
+        task->scratch_args[RET_OFFSET + arg_idx] = input.value[arg.second];
+      } else {
+        task->scratch_args[RET_OFFSET + arg_idx] = arg.second;
+      }
+      ++arg_idx;
+    }
+    memcpy(task->batch_args, values, BATCH_LANES * sizeof(*values));
+    batch_fn(task->scratch_args, slot, task->batch_args);
+    for (int lane = 0; lane < BATCH_LANES; lane++) {
+      task->probe_distances[k * BATCH_LANES + lane] = get_distance(cm->comparison,
+          task->batch_args[BATCH_LANES + lane], task->batch_args[2 * BATCH_LANES + lane]);
+    }
+    task->probe_batched[k] = true;
+  }
+}
+
+// the distances with the input byte at index set to the value of a lane,
+// as single_distance would have updated them from min_distances, returns
+// the total
+static uint64_t probe_distance(MutInput &input, std::vector<uint64_t> &distances,
+                               const uint32_t index, int lane, uint64_t *single_dis,
+                               std::shared_ptr<SearchTask> task) {
+  auto const& cons = task->cmap(index);
+  distances = task->min_distances;
+  *single_dis = 0;
+  for (size_t k = 0; k < cons.size(); k++) {
+    uint64_t dis = task->probe_batched[k] ?
+        task->probe_distances[k * BATCH_LANES + lane] :
+        constraint_distance(input, task, cons[k]);
+    distances[cons[k]] = dis;
+    *single_dis = sat_inc(*single_dis, dis);
+  }
+  uint64_t res = 0;
+  for (int i = 0, n = task->size(); i < n; i++)
+    res = sat_inc(res, distances[i]);
+  return res;
+}
+
+
 static void partial_derivative(MutInput &orig_input, const uint32_t index, uint64_t f0, bool *sign, bool* is_linear, uint64_t *val, std::shared_ptr<SearchTask> task) {
 
   uint64_t orig_val = orig_input.value[index];
-  uint64_t delta = 1;
   uint64_t f_plus = 0, f_minus = 0;
   uint64_t single_dis;
 
+  // the search moves the byte by a growing delta until the distance changes,
+  // which mostly happens on the first probe. When it doesn't, evaluate the
+  // rest of the probes at once: x+1, x+5, x+21 and x+85 in the first lanes,
+  // then the same downwards. Only the probes the search gets to are counted
+  // as attempts, or evaluated for the constraints without a batch function
+  uint64_t values[BATCH_LANES];
+  uint64_t up = orig_val, down = orig_val, delta = 1;
+  for (int i = 0; i < kNumProbes; i++, delta <<= 2) {
+    values[i] = (up += delta);
+    values[kNumProbes + i] = (down -= delta);
+  }
+  for (int i = 2 * kNumProbes; i < BATCH_LANES; i++) {
+    values[i] = orig_val; // unused
+  }
+  bool batched = false;
+  task->probe_batched.assign(task->cmap(index).size(), false);
+
   // calculate f(x+delta)
-  for (delta = 1; delta < 256; delta = delta << 1) {
-    task->plus_distances = task->min_distances;
-    orig_input.update(index, true, delta);
-    single_dis = single_distance(orig_input, task->plus_distances, task, index);
+  for (int i = 0; i < kNumProbes; i++) {
+    if (i > 0 && !batched) {
+      batch_probe(orig_input, index, values, task);
+      batched = true;
+    }
+    orig_input.value[index] = values[i];
+    f_plus = probe_distance(orig_input, task->plus_distances, index, i,
+                            &single_dis, task);
     if (single_dis == 0) { // well, we got lucky and found a solution
       *sign = true;
       *is_linear = false;
       *val = 0;
       return;
     }
-    f_plus = 0;
-    for (int i = 0, n = task->size(); i < n; i++)
-      f_plus = sat_inc(f_plus, task->plus_distances[i]);
 
     task->attempts += 1;
     if (task->attempts > MAX_EXEC_TIMES)
       task->stopped = true;
     if (task->stopped) { *val = 0; return; }
 
-    if (f_plus == f0) { // if f(x+delta) == f(x), delta is not large enough
-      delta = delta << 1;
-    } else {
+    // if f(x+delta) == f(x), delta is not large enough
+    if (f_plus != f0) {
       break;
     }
   }
   orig_input.value[index] = orig_val; // restore the original value
 
   // calculate f(x-delta)
-  for (delta = 1; delta < 256; delta = delta << 1) {
-    task->minus_distances = task->min_distances;
-    orig_input.update(index, false, delta);
-    single_dis = single_distance(orig_input, task->minus_distances, task, index);
+  for (int i = 0; i < kNumProbes; i++) {
+    if (i > 0 && !batched) {
+      batch_probe(orig_input, index, values, task);
+      batched = true;
+    }
+    orig_input.value[index] = values[kNumProbes + i];
+    f_minus = probe_distance(orig_input, task->minus_distances, index,
+                             kNumProbes + i, &single_dis, task);
     if (single_dis == 0) { // well, we got lucky and found a solution
       *sign = false;
       *is_linear = false;
       *val = 0;
       return;
     }
-    f_minus = 0;
-    for (int i = 0, n = task->size(); i < n; i++)
-      f_minus = sat_inc(f_minus, task->minus_distances[i]);
 
     task->attempts += 1;
     if (task->attempts > MAX_EXEC_TIMES)
       task->stopped = true;
     if (task->stopped) { *val = 0; return;}
 
-    if (f_minus == f0) { // if f(x-delta) == f(x), delta is not large enough
-      delta = delta << 1;
-    } else {
+    // if f(x-delta) == f(x), delta is not large enough
+    if (f_minus != f0) {
       break;
     }
   }
@@ -400,9 +509,7 @@ static uint64_t descend(MutInput &input_min, MutInput &input, uint64_t f0, Grad
       input = input_min;
     } else if (f_new == 0) {
       // found a solution
-      task->stopped = true;
-      task->solved = true;
-      add_results(input, task);
+      found_solution(input, task);
       return 0;
     } else {
       input_min = input;
@@ -450,9 +557,7 @@ static uint64_t descend(MutInput &input_min, MutInput &input, uint64_t f0, Grad
 
       if (f_new == 0) {
         // found a solution
-        task->stopped = true;
-        task->solved = true;
-        add_results(input, task);
+        found_solution(input, task);
         return 0;
       } else if (f_new > f_last) { // use > to give the next larger step a chance
         //if (f_new == UINTMAX_MAX)
@@ -523,7 +628,7 @@ static uint64_t try_new_i2s_value(std::shared_ptr<const Constraint> const& c, ui
     if (!arg.first) task->scratch_args[RET_OFFSET + arg_idx] = arg.second;
     ++arg_idx;
   }
-  c->fn(task->scratch_args);
+  evaluate(c, task->scratch_args);
   return get_distance(comparison, task->scratch_args[0], task->scratch_args[1]);
 }
 
@@ -685,7 +790,7 @@ bool rgd::gd_entry(std::shared_ptr<SearchTask> task) {
   uint64_t f0 = reload_input(input, task);
   f0 = try_i2s(input, scratch_input, f0, task);
   if (task->stopped)
-    return task->solved;
+    return task->solved_by_self();
 
   if (f0 == UINTMAX_MAX)
     return false;
@@ -734,5 +839,5 @@ bool rgd::gd_entry(std::shared_ptr<SearchTask> task) {
     //if (ep_i == 2) break;
   }
 
-  return task->solved;
+  return task->solved_by_self();
 }
@@ -0,0 +1,274 @@
+#include <stdexcept>
+#include <unordered_map>
+
+#include "interp.h"
+#include "task.h"
+
+using namespace rgd;
+
+namespace {
+
+class BytecodeBuilder {
+public:
+  BytecodeBuilder(Bytecode &bc, std::map<size_t, uint32_t> const& local_map)
+      : bc_(bc), local_map_(local_map) {}
+
+  // emit the code of node, returns the register holding its value
+  uint32_t emit(const AstNode* node);
+
+  void emitRoot(const AstNode* node);
+
+private:
+  Bytecode &bc_;
+  std::map<size_t, uint32_t> const& local_map_;
+  std::unordered_map<uint32_t, uint32_t> value_cache_;
+
+  uint32_t add(uint8_t op, uint16_t bits, uint32_t a, uint32_t b,
+               uint16_t bits1 = 0) {
+    if (bits == 0 || bits > 64 || bits1 > 64) {
+      throw std::invalid_argument("unsupported width");
+    }
+    if (bc_.num_regs >= Bytecode::kMaxRegs) {
+      throw std::invalid_argument("too many registers");
+    }
+    uint32_t dst = bc_.num_regs++;
+    bc_.code.push_back({op, (uint8_t)bits, (uint8_t)bits1, 0, dst, a, b});
+    return dst;
+  }
+};
+
+}
+
+uint32_t BytecodeBuilder::emit(const AstNode* node) {
+  auto itr = value_cache_.find(node->label());
+  if (node->label() != 0 && itr != value_cache_.end()) {
+    return itr->second;
+  }
+
+  uint32_t ret;
+  switch (node->kind()) {
+    case rgd::Bool:
+      ret = add(Bytecode::LoadImm, 1, node->boolvalue() ? 1 : 0, 0);
+      break;
+    case rgd::Constant:
+      ret = add(Bytecode::LoadArg, node->bits(), node->index() + RET_OFFSET, 0);
+      break;
+    case rgd::Read:
+      ret = add(Bytecode::Read, node->bits(),
+                local_map_.at(node->index()) + RET_OFFSET, node->bits() / 8);
+      break;
+    case rgd::Concat: {
+      const AstNode* rc1 = &node->children(0);
+      uint32_t c1 = emit(rc1);
+      uint32_t c2 = emit(&node->children(1));
+      ret = add(Bytecode::Concat, node->bits(), c1, c2, rc1->bits());
+      break;
+    }
+    case rgd::Extract:
+      ret = add(Bytecode::Extract, node->bits(), emit(&node->children(0)),
+                node->index());
+      break;
+    case rgd::ZExt:
+      ret = add(Bytecode::ZExt, node->bits(), emit(&node->children(0)), 0);
+      break;
+    case rgd::SExt: {
+      const AstNode* rc = &node->children(0);
+      ret = add(Bytecode::SExt, node->bits(), emit(rc), 0, rc->bits());
+      break;
+    }
+    case rgd::Neg:
+    case rgd::Not: {
+      uint8_t op = node->kind() == rgd::Neg ? Bytecode::Neg : Bytecode::Not;
+      ret = add(op, node->bits(), emit(&node->children(0)), 0);
+      break;
+    }
+    case rgd::Add:
+    case rgd::Sub:
+    case rgd::Mul:
+    case rgd::UDiv:
+    case rgd::SDiv:
+    case rgd::URem:
+    case rgd::SRem:
+    case rgd::And:
+    case rgd::Or:
+    case rgd::Xor:
+    case rgd::Shl:
+    case rgd::LShr:
+    case rgd::AShr: {
+      static const std::unordered_map<uint16_t, uint8_t> ops = {
+        {rgd::Add, Bytecode::Add}, {rgd::Sub, Bytecode::Sub},
+        {rgd::Mul, Bytecode::Mul}, {rgd::UDiv, Bytecode::UDiv},
+        {rgd::SDiv, Bytecode::SDiv}, {rgd::URem, Bytecode::URem},
+        {rgd::SRem, Bytecode::SRem}, {rgd::And, Bytecode::And},
+        {rgd::Or, Bytecode::Or}, {rgd::Xor, Bytecode::Xor},
+        {rgd::Shl, Bytecode::Shl}, {rgd::LShr, Bytecode::LShr},
+        {rgd::AShr, Bytecode::AShr},
+      };
+      uint32_t c1 = emit(&node->children(0));
+      uint32_t c2 = emit(&node->children(1));
+      ret = add(ops.at(node->kind()), node->bits(), c1, c2);
+      break;
+    }
+    default:
+      // relational and memcmp only at the root, the rest are not supported
+      // by the JIT either
+      throw std::invalid_argument("unhandled expression");
+  }
+
+  if (node->label() != 0) {
+    value_cache_.insert({node->label(), ret});
+  }
+  return ret;
+}
+
+void BytecodeBuilder::emitRoot(const AstNode* node) {
+  uint8_t op;
+  if (isRelationalKind(node->kind())) {
+    op = Bytecode::Cmp;
+  } else if (node->kind() == rgd::Memcmp || node->kind() == rgd::MemcmpN) {
+    op = Bytecode::Memcmp;
+  } else {
+    throw std::invalid_argument("non-relational expr");
+  }
+  uint32_t c1 = emit(&node->children(0));
+  uint32_t c2 = emit(&node->children(1));
+  bc_.code.push_back({op, 64, 0, 0, 0, c1, c2});
+}
+
+std::unique_ptr<Bytecode> rgd::compileBytecode(const AstNode* node,
+    std::map<size_t, uint32_t> const& local_map) {
+  auto bc = std::make_unique<Bytecode>();
+  bc->num_regs = 0;
+  bc->evals = 0;
+  try {
+    BytecodeBuilder(*bc, local_map).emitRoot(node);
+  } catch (std::exception &e) {
+    // std::out_of_range from local_map or the children too
+    return nullptr;
+  }
+  bc->code.shrink_to_fit();
+  return bc;
+}
+
+static inline uint64_t mask(uint8_t bits) {
+  return ~0ULL >> (64 - bits);
+}
+
+static inline int64_t sext(uint64_t v, uint8_t bits) {
+  return (int64_t)(v << (64 - bits)) >> (64 - bits);
+}
+
+void rgd::interpret(const Bytecode &bc, uint64_t *args) {
+  // must be in the order of Bytecode::Op
+  static const void* const dispatch[Bytecode::NumOps] = {
+    &&LoadImm, &&LoadArg, &&Read, &&Concat, &&Extract, &&ZExt, &&SExt,
+    &&Add, &&Sub, &&Mul, &&UDiv, &&SDiv, &&URem, &&SRem,
+    &&Neg, &&Not, &&And, &&Or, &&Xor,
+    &&Shl, &&LShr, &&AShr,
+    &&Cmp, &&Memcmp,
+  };
+  uint64_t regs[Bytecode::kMaxRegs];
+  const Bytecode::Insn *pc = bc.code.data();
+
+  __atomic_fetch_add(&bc.evals, 1, __ATOMIC_RELAXED);
+
+#define DST regs[pc->dst]
+#define A regs[pc->a]
+#define B regs[pc->b]
+#define NEXT() do { pc++; goto *dispatch[pc->op]; } while (0)
+
+  goto *dispatch[pc->op];
+
+LoadImm:
+  DST = pc->a;
+  NEXT();
+LoadArg:
+  DST = args[pc->a] & mask(pc->bits);
+  NEXT();
+Read: {
+  // input bytes are extended to 64 bits, one per arg
+  uint64_t v = 0;
+  for (uint32_t k = 0; k < pc->b; k++) {
+    v += args[pc->a + k] << (8 * k);
+  }
+  DST = v & mask(pc->bits);
+  NEXT();
+}
+Concat:
+  DST = ((B << pc->bits1) | A) & mask(pc->bits);
+  NEXT();
+Extract:
+  DST = pc->b < 64 ? (A >> pc->b) & mask(pc->bits) : 0;
+  NEXT();
+ZExt:
+  DST = A & mask(pc->bits);
+  NEXT();
+SExt:
+  DST = (uint64_t)sext(A, pc->bits1) & mask(pc->bits);
+  NEXT();
+Add:
+  DST = (A + B) & mask(pc->bits);
+  NEXT();
+Sub:
+  DST = (A - B) & mask(pc->bits);
+  NEXT();
+Mul:
+  DST = (A * B) & mask(pc->bits);
+  NEXT();
+// same as the JIT, division by zero is division by one
+UDiv:
+  DST = A / (B ? B : 1);
+  NEXT();
+URem:
+  DST = A % (B ? B : 1);
+  NEXT();
+SDiv: {
+  int64_t x = sext(A, pc->bits), y = sext(B, pc->bits);
+  // INT_MIN / -1 overflows, the result wraps to INT_MIN
+  DST = (y == -1 ? (uint64_t)0 - A : (uint64_t)(x / (y ? y : 1))) & mask(pc->bits);
+  NEXT();
+}
+SRem: {
+  int64_t x = sext(A, pc->bits), y = sext(B, pc->bits);
+  DST = (y == -1 ? 0 : (uint64_t)(x % (y ? y : 1))) & mask(pc->bits);
+  NEXT();
+}
+Neg:
+  DST = (0 - A) & mask(pc->bits);
+  NEXT();
+Not:
+  DST = ~A & mask(pc->bits);
+  NEXT();
+And:
+  DST = A & B;
+  NEXT();
+Or:
+  DST = A | B;
+  NEXT();
+Xor:
+  DST = A ^ B;
+  NEXT();
+// shifting by the width or more is poison in LLVM, pick the natural result
+Shl:
+  DST = B < pc->bits ? (A << B) & mask(pc->bits) : 0;
+  NEXT();
+LShr:
+  DST = B < pc->bits ? A >> B : 0;
+  NEXT();
+AShr:
+  DST = (uint64_t)(sext(A, pc->bits) >> (B < pc->bits ? B : pc->bits - 1))
+        & mask(pc->bits);
+  NEXT();
+Cmp:
+  args[0] = A;
+  args[1] = B;
+  return;
+Memcmp:
+  args[0] = A == B;
+  return;
+
+#undef DST
+#undef A
+#undef B
+#undef NEXT
+}
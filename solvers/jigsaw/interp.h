@@ -0,0 +1,67 @@
+#ifndef INTERP_H_
+#define INTERP_H_
+
+#include <stdint.h>
+
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "ast.h"
+
+namespace rgd {
+
+// Tier-0 evaluation of constraints: a register-based bytecode compiled
+// straight from the AST, run by a threaded interpreter with the same
+// contract as the JIT'ed functions (test_fn_type) over the scratch args.
+// Compiling is orders of magnitude cheaper than jitting, so constraints
+// can be interpreted until they have been evaluated often enough to be
+// worth the JIT.
+//
+// Values up to 64 bits are supported, wider ones (e.g., long memcmp
+// operands) are left to the JIT.
+struct Bytecode {
+  enum Op : uint8_t {
+    LoadImm,  // dst = a
+    LoadArg,  // dst = args[a]
+    Read,     // dst = args[a] | args[a + 1] << 8 | ..., b bytes
+    Concat,   // dst = b << bits1 | a
+    Extract,  // dst = a >> b
+    ZExt,
+    SExt,     // from bits1
+    Add, Sub, Mul, UDiv, SDiv, URem, SRem,
+    Neg, Not, And, Or, Xor,
+    Shl, LShr, AShr,
+    Cmp,      // args[0] = a, args[1] = b, end
+    Memcmp,   // args[0] = a == b, end
+    NumOps
+  };
+
+  struct Insn {
+    uint8_t op;
+    uint8_t bits;  // width of the result
+    uint8_t bits1; // width of the operand, if needed
+    uint8_t pad;
+    uint32_t dst;
+    uint32_t a;
+    uint32_t b;
+  };
+
+  // enough for any AST the parsers would hand to the solvers
+  static const uint32_t kMaxRegs = 1024;
+
+  std::vector<Insn> code;
+  uint32_t num_regs;
+  // number of times the bytecode has been run (racy, only a hint)
+  mutable uint64_t evals;
+};
+
+// nullptr if the AST cannot be interpreted
+std::unique_ptr<Bytecode> compileBytecode(const AstNode* node,
+    std::map<size_t, uint32_t> const& local_map);
+
+void interpret(const Bytecode &bc, uint64_t *args);
+
+}
+
+#endif
@@ -16,9 +16,13 @@
 #include "llvm/Transforms/Scalar.h"
 #include "llvm/Transforms/Scalar/GVN.h"
 
+#include <algorithm>
 #include <cassert>
 #include <iostream>
 #include <unordered_map>
+#include <unordered_set>
+
+#include <sys/time.h>
 
 #include "jit.h"
 #include "ast.h"
@@ -29,10 +33,106 @@ using namespace rgd;
 
 std::unique_ptr<GradJit> JIT;
 
+static std::unique_ptr<JitCache> Cache;
+static JitCacheStats CacheStats;
+// functions added to the JIT, by their key, and the symbol (and the keys to
+// cache the compiled module under) of the pending ids
+static std::unordered_set<std::string> added_functions;
+static std::unordered_map<uint64_t,
+    std::pair<std::string, std::vector<std::string>>> pending_functions;
+
+// whether to emit the batch variants, and their symbol suffix
+static bool EmitBatch;
+static const char kBatchSuffix[] = "_x8";
+static_assert(BATCH_LANES == 8, "update kBatchSuffix");
+
+static uint64_t getTimeStamp() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000000UL + tv.tv_usec;
+}
+
+int rgd::initJit(const char *cache_dir, bool batch) {
+  EmitBatch = batch;
+  if (cache_dir != nullptr) {
+    Cache = std::make_unique<JitCache>(cache_dir);
+    if (!Cache->init()) {
+      Cache = nullptr;
+    }
+  }
+  auto jit = GradJit::Create(Cache.get());
+  if (!jit) {
+    llvm::consumeError(jit.takeError());
+    return -1;
+  }
+  JIT = std::move(*jit);
+  if (Cache) {
+    // the cached objects have the batch variants or not
+    Cache->setTarget(JIT->getTargetId() + (batch ? " batch" : ""));
+  }
+  return 0;
+}
+
+const JitCacheStats* rgd::getJitCacheStats() {
+  return Cache ? &CacheStats : nullptr;
+}
+
+// a bits-wide integer, or a vector of them in the batch functions
+static llvm::Type* intType(llvm::IRBuilder<> &Builder, uint32_t bits,
+                           unsigned lanes) {
+  llvm::Type *Ty = llvm::Type::getIntNTy(Builder.getContext(), bits);
+  return lanes > 1 ? llvm::FixedVectorType::get(Ty, lanes) : Ty;
+}
+
+// the extra arguments of a batch function (see batch_fn_type)
+struct BatchArgs {
+  unsigned lanes;
+  llvm::Value* slot;   // the arg slot that differs between the lanes
+  llvm::Value* values; // and its value in each lane
+  llvm::Value* out;
+};
+
+// load an arg slot, splat into all lanes in a batch function, where the
+// probed slots (i.e., the input bytes) take the values of the lanes
+static llvm::Value* loadArg(llvm::IRBuilder<> &Builder, llvm::Value* arg,
+                            uint32_t slot, const BatchArgs *batch, bool probed) {
+  llvm::Value* idx[1];
+  idx[0] = llvm::ConstantInt::get(Builder.getInt32Ty(), slot);
+  llvm::Value* ret = Builder.CreateGEP(Builder.getInt64Ty(), arg, idx);
+  ret = Builder.CreateLoad(Builder.getInt64Ty(), ret);
+  if (batch != nullptr) {
+    ret = Builder.CreateVectorSplat(batch->lanes, ret);
+    if (probed) {
+      llvm::Value* cond = Builder.CreateICmpEQ(batch->slot,
+          llvm::ConstantInt::get(Builder.getInt64Ty(), slot));
+      ret = Builder.CreateSelect(cond, batch->values, ret);
+    }
+  }
+  return ret;
+}
+
+// store an output slot, of all lanes after the values in a batch function
+static void storeArg(llvm::IRBuilder<> &Builder, llvm::Value* arg,
+                     uint32_t slot, llvm::Value* val, const BatchArgs *batch) {
+  llvm::Value* idx[1];
+  if (batch == nullptr) {
+    idx[0] = llvm::ConstantInt::get(Builder.getInt32Ty(), slot);
+    Builder.CreateStore(val, Builder.CreateGEP(Builder.getInt64Ty(), arg, idx));
+    return;
+  }
+  idx[0] = llvm::ConstantInt::get(Builder.getInt32Ty(), (slot + 1) * batch->lanes);
+  llvm::Value* ptr = Builder.CreateGEP(Builder.getInt64Ty(), batch->out, idx);
+  ptr = Builder.CreateBitCast(ptr, llvm::PointerType::getUnqual(val->getType()));
+  Builder.CreateAlignedStore(val, ptr, llvm::Align(8));
+}
+
+// with a batch, emit the code evaluating its lanes at once, only values up
+// to 64 bits are supported
 static llvm::Value* codegen(llvm::IRBuilder<> &Builder,
     const AstNode* node,
     std::map<size_t, uint32_t> const& local_map, llvm::Value* arg,
-    std::unordered_map<uint32_t, llvm::Value*> &value_cache) {
+    std::unordered_map<uint32_t, llvm::Value*> &value_cache,
+    const BatchArgs *batch) {
 
   llvm::Value* ret = nullptr;
   //std::cout << "code gen and nargs is " << nargs << std::endl;
@@ -44,9 +144,17 @@ static llvm::Value* codegen(llvm::IRBuilder<> &Builder,
     return itr->second;
   }
 
-  llvm::Type *ArgTy = Builder.getInt64Ty();
+  unsigned lanes = batch ? batch->lanes : 1;
+  if (batch != nullptr && node->bits() > 64) {
+    throw std::invalid_argument("too wide for batch");
+  }
+
   switch (node->kind()) {
     case rgd::Bool: {
+      if (lanes > 1) {
+        ret = llvm::ConstantInt::get(intType(Builder, 1, lanes), node->boolvalue());
+        break;
+      }
       // getTrue is actually 1 bit integer 1
       if (node->boolvalue())
         ret = llvm::ConstantInt::getTrue(Builder.getContext());
@@ -58,11 +166,17 @@ static llvm::Value* codegen(llvm::IRBuilder<> &Builder,
       // The constant is now loading from arguments
       uint32_t start = node->index();
       uint32_t length = node->bits() / 8;
+      if (lanes > 1) {
+        ret = Builder.CreateZExtOrTrunc(
+            loadArg(Builder, arg, start + RET_OFFSET, batch, false),
+            intType(Builder, node->bits(), lanes));
+        break;
+      }
 
       llvm::Value* idx[1];
       // calculate the offset
       idx[0] = llvm::ConstantInt::get(Builder.getInt32Ty(), start + RET_OFFSET);
-      ret = Builder.CreateGEP(ArgTy, arg, idx);
+      ret = Builder.CreateGEP(Builder.getInt64Ty(), arg, idx);
       Type* CTy = llvm::Type::getIntNTy(Builder.getContext(), node->bits());
       llvm::PointerType* CPTy = llvm::PointerType::getUnqual(CTy);
       ret = Builder.CreateBitCast(ret, CPTy);
@@ -73,17 +187,11 @@ static llvm::Value* codegen(llvm::IRBuilder<> &Builder,
       uint32_t start = local_map.at(node->index());
       size_t length = node->bits() / 8;
       //std::cout << "read index " << start << " length " << length << std::endl;
-      llvm::Type *RTy = llvm::Type::getIntNTy(Builder.getContext(), node->bits());
-      llvm::Value* idx[1];
-      idx[0] = llvm::ConstantInt::get(Builder.getInt32Ty(), start + RET_OFFSET);
-      ret = Builder.CreateGEP(ArgTy, arg, idx);
-      ret = Builder.CreateLoad(ArgTy, ret);
+      llvm::Type *RTy = intType(Builder, node->bits(), lanes);
+      ret = loadArg(Builder, arg, start + RET_OFFSET, batch, true);
       ret = Builder.CreateZExtOrTrunc(ret, RTy);
       for (uint32_t k = 1; k < length; k++) {
-        idx[0] = llvm::ConstantInt::get(Builder.getInt32Ty(),
-                                        start + k + RET_OFFSET);
-        llvm::Value* tmp = Builder.CreateGEP(ArgTy, arg, idx);
-        tmp = Builder.CreateLoad(ArgTy, tmp);
+        llvm::Value* tmp = loadArg(Builder, arg, start + k + RET_OFFSET, batch, true);
         tmp = Builder.CreateZExtOrTrunc(tmp, RTy);
         tmp = Builder.CreateShl(tmp, 8 * k);
         ret = Builder.CreateAdd(ret, tmp);
@@ -94,13 +202,13 @@ static llvm::Value* codegen(llvm::IRBuilder<> &Builder,
       const AstNode* rc1 = &node->children(0);
       const AstNode* rc2 = &node->children(1);
       uint32_t bits = rc1->bits() + rc2->bits(); 
-      llvm::Value* c1 = codegen(Builder, rc1, local_map, arg, value_cache);
-      llvm::Value* c2 = codegen(Builder, rc2, local_map, arg, value_cache);
+      llvm::Value* c1 = codegen(Builder, rc1, local_map, arg, value_cache, batch);
+      llvm::Value* c2 = codegen(Builder, rc2, local_map, arg, value_cache, batch);
       ret = Builder.CreateOr(
           Builder.CreateShl(
-            Builder.CreateZExt(c2,llvm::Type::getIntNTy(Builder.getContext(),bits)),
+            Builder.CreateZExt(c2,intType(Builder, bits, lanes)),
             rc1->bits()),
-          Builder.CreateZExt(c1, llvm::Type::getIntNTy(Builder.getContext(), bits)));
+          Builder.CreateZExt(c1, intType(Builder, bits, lanes)));
       break;
     }
     case rgd::Extract: {
@@ -108,10 +216,10 @@ static llvm::Value* codegen(llvm::IRBuilder<> &Builder,
       //std::cerr << "Extract expression" << std::endl;
 #endif
       const AstNode* rc = &node->children(0);
-      llvm::Value* c = codegen(Builder, rc, local_map, arg, value_cache);
+      llvm::Value* c = codegen(Builder, rc, local_map, arg, value_cache, batch);
       ret = Builder.CreateTrunc(
           Builder.CreateLShr(c, node->index()),
-          llvm::Type::getIntNTy(Builder.getContext(), node->bits()));
+          intType(Builder, node->bits(), lanes));
       break;
     }
     case rgd::ZExt: {
@@ -119,10 +227,10 @@ static llvm::Value* codegen(llvm::IRBuilder<> &Builder,
       // std::cerr << "ZExt the bits is " << node->bits() << std::endl;
 #endif
       const AstNode* rc = &node->children(0);
-      llvm::Value* c = codegen(Builder, rc, local_map, arg, value_cache);
+      llvm::Value* c = codegen(Builder, rc, local_map, arg, value_cache, batch);
       //FIXME: we may face ZEXT to boolean expr
       ret = Builder.CreateZExtOrTrunc(c,
-          llvm::Type::getIntNTy(Builder.getContext(), node->bits()));
+          intType(Builder, node->bits(), lanes));
       break;
     }
     case rgd::SExt: {
@@ -130,42 +238,42 @@ static llvm::Value* codegen(llvm::IRBuilder<> &Builder,
       // std::cerr << "SExt the bits is " << node->bits() << std::endl;
 #endif
       const AstNode* rc = &node->children(0);
-      llvm::Value* c = codegen(Builder, rc,local_map, arg, value_cache);
+      llvm::Value* c = codegen(Builder, rc,local_map, arg, value_cache, batch);
       ret = Builder.CreateSExt(c,
-          llvm::Type::getIntNTy(Builder.getContext(), node->bits()));
+          intType(Builder, node->bits(), lanes));
       break;
     }
     case rgd::Add: {
       const AstNode* rc1 = &node->children(0);
       const AstNode* rc2 = &node->children(1);
-      llvm::Value* c1 = codegen(Builder, rc1, local_map, arg, value_cache);
-      llvm::Value* c2 = codegen(Builder, rc2, local_map, arg, value_cache);
+      llvm::Value* c1 = codegen(Builder, rc1, local_map, arg, value_cache, batch);
+      llvm::Value* c2 = codegen(Builder, rc2, local_map, arg, value_cache, batch);
       ret = Builder.CreateAdd(c1, c2);
       break;
     }
     case rgd::Sub: {
       const AstNode* rc1 = &node->children(0);
       const AstNode* rc2 = &node->children(1);
-      llvm::Value* c1 = codegen(Builder, rc1, local_map, arg, value_cache);
-      llvm::Value* c2 = codegen(Builder, rc2, local_map, arg, value_cache);
+      llvm::Value* c1 = codegen(Builder, rc1, local_map, arg, value_cache, batch);
+      llvm::Value* c2 = codegen(Builder, rc2, local_map, arg, value_cache, batch);
       ret = Builder.CreateSub(c1, c2);
       break;
     }
     case rgd::Mul: {
       const AstNode* rc1 = &node->children(0);
       const AstNode* rc2 = &node->children(1);
-      llvm::Value* c1 = codegen(Builder, rc1, local_map, arg, value_cache);
-      llvm::Value* c2 = codegen(Builder, rc2, local_map, arg, value_cache);
+      llvm::Value* c1 = codegen(Builder, rc1, local_map, arg, value_cache, batch);
+      llvm::Value* c2 = codegen(Builder, rc2, local_map, arg, value_cache, batch);
       ret = Builder.CreateMul(c1, c2);
       break;
     }
     case rgd::UDiv: {
       const AstNode* rc1 = &node->children(0);
       const AstNode* rc2 = &node->children(1);
-      llvm::Value* c1 = codegen(Builder, rc1, local_map, arg, value_cache);
-      llvm::Value* c2 = codegen(Builder, rc2, local_map, arg, value_cache);
-      llvm::Value* VA0 = llvm::ConstantInt::get(llvm::Type::getIntNTy(Builder.getContext(), node->bits()), 0);
-      llvm::Value* VA1 = llvm::ConstantInt::get(llvm::Type::getIntNTy(Builder.getContext(), node->bits()), 1);
+      llvm::Value* c1 = codegen(Builder, rc1, local_map, arg, value_cache, batch);
+      llvm::Value* c2 = codegen(Builder, rc2, local_map, arg, value_cache, batch);
+      llvm::Value* VA0 = llvm::ConstantInt::get(intType(Builder, node->bits(), lanes), 0);
+      llvm::Value* VA1 = llvm::ConstantInt::get(intType(Builder, node->bits(), lanes), 1);
       // FIXME: this is a hack to avoid division by zero, but should use a better way
       // FIXME: should record the divisor to avoid gradient vanish
       llvm::Value* cond = Builder.CreateICmpEQ(c2, VA0);
@@ -176,10 +284,10 @@ static llvm::Value* codegen(llvm::IRBuilder<> &Builder,
     case rgd::SDiv: {
       const AstNode* rc1 = &node->children(0);
       const AstNode* rc2 = &node->children(1);
-      llvm::Value* c1 = codegen(Builder, rc1, local_map, arg, value_cache);
-      llvm::Value* c2 = codegen(Builder, rc2, local_map, arg, value_cache);
-      llvm::Value* VA0 = llvm::ConstantInt::get(llvm::Type::getIntNTy(Builder.getContext(), node->bits()), 0);
-      llvm::Value* VA1 = llvm::ConstantInt::get(llvm::Type::getIntNTy(Builder.getContext(), node->bits()), 1);
+      llvm::Value* c1 = codegen(Builder, rc1, local_map, arg, value_cache, batch);
+      llvm::Value* c2 = codegen(Builder, rc2, local_map, arg, value_cache, batch);
+      llvm::Value* VA0 = llvm::ConstantInt::get(intType(Builder, node->bits(), lanes), 0);
+      llvm::Value* VA1 = llvm::ConstantInt::get(intType(Builder, node->bits(), lanes), 1);
       // FIXME: this is a hack to avoid division by zero, but should use a better way
       // FIXME: should record the divisor to avoid gradient vanish
       llvm::Value* cond = Builder.CreateICmpEQ(c2, VA0);
@@ -190,10 +298,10 @@ static llvm::Value* codegen(llvm::IRBuilder<> &Builder,
     case rgd::URem: {
       const AstNode* rc1 = &node->children(0);
       const AstNode* rc2 = &node->children(1);
-      llvm::Value* c1 = codegen(Builder, rc1, local_map, arg, value_cache);
-      llvm::Value* c2 = codegen(Builder, rc2, local_map, arg, value_cache);
-      llvm::Value* VA0 = llvm::ConstantInt::get(llvm::Type::getIntNTy(Builder.getContext(), node->bits()), 0);
-      llvm::Value* VA1 = llvm::ConstantInt::get(llvm::Type::getIntNTy(Builder.getContext(), node->bits()), 1);
+      llvm::Value* c1 = codegen(Builder, rc1, local_map, arg, value_cache, batch);
+      llvm::Value* c2 = codegen(Builder, rc2, local_map, arg, value_cache, batch);
+      llvm::Value* VA0 = llvm::ConstantInt::get(intType(Builder, node->bits(), lanes), 0);
+      llvm::Value* VA1 = llvm::ConstantInt::get(intType(Builder, node->bits(), lanes), 1);
       // FIXME: this is a hack to avoid division by zero, but should use a better way
       // FIXME: should record the divisor to avoid gradient vanish
       llvm::Value* cond = Builder.CreateICmpEQ(c2, VA0);
@@ -204,10 +312,10 @@ static llvm::Value* codegen(llvm::IRBuilder<> &Builder,
     case rgd::SRem: {
       const AstNode* rc1 = &node->children(0);
       const AstNode* rc2 = &node->children(1);
-      llvm::Value* c1 = codegen(Builder, rc1, local_map, arg, value_cache);
-      llvm::Value* c2 = codegen(Builder, rc2, local_map, arg, value_cache);
-      llvm::Value* VA0 = llvm::ConstantInt::get(llvm::Type::getIntNTy(Builder.getContext(), node->bits()), 0);
-      llvm::Value* VA1 = llvm::ConstantInt::get(llvm::Type::getIntNTy(Builder.getContext(), node->bits()), 1);
+      llvm::Value* c1 = codegen(Builder, rc1, local_map, arg, value_cache, batch);
+      llvm::Value* c2 = codegen(Builder, rc2, local_map, arg, value_cache, batch);
+      llvm::Value* VA0 = llvm::ConstantInt::get(intType(Builder, node->bits(), lanes), 0);
+      llvm::Value* VA1 = llvm::ConstantInt::get(intType(Builder, node->bits(), lanes), 1);
       // FIXME: this is a hack to avoid division by zero, but should use a better way
       // FIXME: should record the divisor to avoid gradient vanish
       llvm::Value* cond = Builder.CreateICmpEQ(c2, VA0);
@@ -217,61 +325,61 @@ static llvm::Value* codegen(llvm::IRBuilder<> &Builder,
     }
     case rgd::Neg: {
       const AstNode* rc = &node->children(0);
-      llvm::Value* c = codegen(Builder, rc, local_map, arg, value_cache);
+      llvm::Value* c = codegen(Builder, rc, local_map, arg, value_cache, batch);
       ret = Builder.CreateNeg(c);
       break;
     }
     case rgd::Not: {
       const AstNode* rc = &node->children(0);
-      llvm::Value* c = codegen(Builder, rc, local_map, arg, value_cache);
+      llvm::Value* c = codegen(Builder, rc, local_map, arg, value_cache, batch);
       ret = Builder.CreateNot(c);
       break;
     }
     case rgd::And: {
       const AstNode* rc1 = &node->children(0);
       const AstNode* rc2 = &node->children(1);
-      llvm::Value* c1 = codegen(Builder, rc1, local_map, arg, value_cache);
-      llvm::Value* c2 = codegen(Builder, rc2, local_map, arg, value_cache);
+      llvm::Value* c1 = codegen(Builder, rc1, local_map, arg, value_cache, batch);
+      llvm::Value* c2 = codegen(Builder, rc2, local_map, arg, value_cache, batch);
       ret = Builder.CreateAnd(c1, c2);
       break;
     }
     case rgd::Or: {
       const AstNode* rc1 = &node->children(0);
       const AstNode* rc2 = &node->children(1);
-      llvm::Value* c1 = codegen(Builder, rc1, local_map, arg, value_cache);
-      llvm::Value* c2 = codegen(Builder, rc2, local_map, arg, value_cache);
+      llvm::Value* c1 = codegen(Builder, rc1, local_map, arg, value_cache, batch);
+      llvm::Value* c2 = codegen(Builder, rc2, local_map, arg, value_cache, batch);
       ret = Builder.CreateOr(c1, c2);
       break;
     }
     case rgd::Xor: {
       const AstNode* rc1 = &node->children(0);
       const AstNode* rc2 = &node->children(1);
-      llvm::Value* c1 = codegen(Builder, rc1, local_map, arg, value_cache);
-      llvm::Value* c2 = codegen(Builder, rc2, local_map, arg, value_cache);
+      llvm::Value* c1 = codegen(Builder, rc1, local_map, arg, value_cache, batch);
+      llvm::Value* c2 = codegen(Builder, rc2, local_map, arg, value_cache, batch);
       ret = Builder.CreateXor(c1, c2);
       break;
     }
     case rgd::Shl: {
       const AstNode* rc1 = &node->children(0);
       const AstNode* rc2 = &node->children(1);
-      llvm::Value* c1 = codegen(Builder, rc1, local_map, arg, value_cache);
-      llvm::Value* c2 = codegen(Builder, rc2, local_map, arg, value_cache);
+      llvm::Value* c1 = codegen(Builder, rc1, local_map, arg, value_cache, batch);
+      llvm::Value* c2 = codegen(Builder, rc2, local_map, arg, value_cache, batch);
       ret = Builder.CreateShl(c1, c2);
       break;
     }
     case rgd::LShr: {
       const AstNode* rc1 = &node->children(0);
       const AstNode* rc2 = &node->children(1);
-      llvm::Value* c1 = codegen(Builder, rc1, local_map, arg, value_cache);
-      llvm::Value* c2 = codegen(Builder, rc2, local_map, arg, value_cache);
+      llvm::Value* c1 = codegen(Builder, rc1, local_map, arg, value_cache, batch);
+      llvm::Value* c2 = codegen(Builder, rc2, local_map, arg, value_cache, batch);
       ret = Builder.CreateLShr(c1, c2);
       break;
     }
     case rgd::AShr: {
       const AstNode* rc1 = &node->children(0);
       const AstNode* rc2 = &node->children(1);
-      llvm::Value* c1 = codegen(Builder, rc1, local_map, arg, value_cache);
-      llvm::Value* c2 = codegen(Builder, rc2, local_map, arg, value_cache);
+      llvm::Value* c1 = codegen(Builder, rc1, local_map, arg, value_cache, batch);
+      llvm::Value* c2 = codegen(Builder, rc2, local_map, arg, value_cache, batch);
       ret = Builder.CreateAShr(c1, c2);
       break;
     }
@@ -289,21 +397,16 @@ static llvm::Value* codegen(llvm::IRBuilder<> &Builder,
     // we don't really care about the comparison, just need to save the operands
       const AstNode* rc1 = &node->children(0);
       const AstNode* rc2 = &node->children(1);
-      llvm::Value* c1 = codegen(Builder, rc1, local_map, arg, value_cache);
-      llvm::Value* c2 = codegen(Builder, rc2, local_map, arg, value_cache);
+      llvm::Value* c1 = codegen(Builder, rc1, local_map, arg, value_cache, batch);
+      llvm::Value* c2 = codegen(Builder, rc2, local_map, arg, value_cache, batch);
       // extend to 64-bit to avoid overflow
-      llvm::Value* c1e = Builder.CreateZExt(c1, Builder.getInt64Ty());
-      llvm::Value* c2e = Builder.CreateZExt(c2, Builder.getInt64Ty());
+      llvm::Value* c1e = Builder.CreateZExt(c1, intType(Builder, 64, lanes));
+      llvm::Value* c2e = Builder.CreateZExt(c2, intType(Builder, 64, lanes));
 
       // save the comparison operands to the output args
       // so it's easier to negate the condition
-      llvm::Value* idx[1];
-      idx[0] = llvm::ConstantInt::get(Builder.getInt32Ty(), 0);
-      Builder.CreateStore(c1e,
-                          Builder.CreateGEP(Builder.getInt64Ty(), arg, idx));
-      idx[0] = llvm::ConstantInt::get(Builder.getInt32Ty(), 1);
-      Builder.CreateStore(c2e,
-                          Builder.CreateGEP(Builder.getInt64Ty(), arg, idx));
+      storeArg(Builder, arg, 0, c1e, batch);
+      storeArg(Builder, arg, 1, c2e, batch);
 
       ret = nullptr;
       break;
@@ -312,17 +415,14 @@ static llvm::Value* codegen(llvm::IRBuilder<> &Builder,
     case rgd::MemcmpN: {
       const AstNode* rc1 = &node->children(0);
       const AstNode* rc2 = &node->children(1);
-      llvm::Value* c1 = codegen(Builder, rc1, local_map, arg, value_cache);
-      llvm::Value* c2 = codegen(Builder, rc2, local_map, arg, value_cache);
+      llvm::Value* c1 = codegen(Builder, rc1, local_map, arg, value_cache, batch);
+      llvm::Value* c2 = codegen(Builder, rc2, local_map, arg, value_cache, batch);
       // c1 & c2 should be IntNty
       llvm::Value* ret = Builder.CreateICmpEQ(c1, c2);
-      ret = Builder.CreateZExt(ret, Builder.getInt64Ty());
+      ret = Builder.CreateZExt(ret, intType(Builder, 64, lanes));
 
       // just save the results
-      llvm::Value* idx[1];
-      idx[0] = llvm::ConstantInt::get(Builder.getInt32Ty(), 0);
-      Builder.CreateStore(ret,
-                          Builder.CreateGEP(Builder.getInt64Ty(), arg, idx));
+      storeArg(Builder, arg, 0, ret, batch);
 
       ret = nullptr;
       break;
@@ -371,66 +471,244 @@ static llvm::Value* codegen(llvm::IRBuilder<> &Builder,
   return ret; 
 }
 
-int rgd::addFunction(const AstNode* node,
-    std::map<size_t,uint32_t> const& local_map,
-    uint64_t id) {
+// emit the function evaluating node into M, nullptr if it cannot be jitted.
+// With lanes > 1, emit its batch variant (see batch_fn_type)
+static llvm::Function* emitFunction(llvm::Module &M, const AstNode* node,
+    std::map<size_t,uint32_t> const& local_map, std::string const& funcName,
+    unsigned lanes = 1) {
 
   if ((!isRelationalKind(node->kind()) &&
       node->kind() != rgd::Memcmp &&
       node->kind() != rgd::MemcmpN)) {
     std::cerr << "non-relational expr\n";
-    return -1;
+    return nullptr;
   }
 
-  // Open a new module.
-  std::string moduleName = "rgdjit_m" + std::to_string(id);
-  std::string funcName = "rgdjit_f" + std::to_string(id);
-
-  auto TheCtx = std::make_unique<llvm::LLVMContext>();
-  auto TheModule = std::make_unique<Module>(moduleName, *TheCtx);
-  TheModule->setDataLayout(JIT->getDataLayout());
-  llvm::IRBuilder<> Builder(*TheCtx);
+  llvm::IRBuilder<> Builder(M.getContext());
 
   std::vector<llvm::Type*> input_type(1,
       llvm::PointerType::getUnqual(Builder.getInt64Ty()));
+  if (lanes > 1) {
+    input_type.push_back(Builder.getInt64Ty());
+    input_type.push_back(llvm::PointerType::getUnqual(Builder.getInt64Ty()));
+  }
   llvm::FunctionType *funcType;
   funcType = llvm::FunctionType::get(Builder.getVoidTy(), input_type, false);
   auto *fooFunc = llvm::Function::Create(funcType, llvm::Function::ExternalLinkage,
-      funcName, TheModule.get());
+      funcName, &M);
   auto *po = llvm::BasicBlock::Create(Builder.getContext(), "entry", fooFunc);
   Builder.SetInsertPoint(po);
-  uint32_t idx = 0;
 
   auto args = fooFunc->arg_begin();
   llvm::Value* var = &(*args);
+  BatchArgs batch;
+  if (lanes > 1) {
+    batch.lanes = lanes;
+    batch.slot = &(*++args);
+    batch.out = &(*++args);
+    llvm::Type *VTy = intType(Builder, 64, lanes);
+    batch.values = Builder.CreateAlignedLoad(VTy,
+        Builder.CreateBitCast(batch.out, llvm::PointerType::getUnqual(VTy)),
+        llvm::Align(8));
+  }
   std::unordered_map<uint32_t, llvm::Value*> value_cache;
   llvm::Value* body = nullptr;
   try {
-    body = codegen(Builder, node, local_map, var, value_cache);
+    body = codegen(Builder, node, local_map, var, value_cache,
+                   lanes > 1 ? &batch : nullptr);
   } catch (std::invalid_argument &e) {
-    std::cerr << "Invalid node: " << e.what() << std::endl;
-    return -1;
+    // not all ASTs can be batched, the scalar function will do
+    if (lanes == 1) std::cerr << "Invalid node: " << e.what() << std::endl;
+    fooFunc->eraseFromParent();
+    return nullptr;
   }
   if (body != nullptr) {
     std::cerr << "non-comparison expr\n";
-    return -1;
+    fooFunc->eraseFromParent();
+    return nullptr;
   }
   Builder.CreateRet(body);
 
   llvm::raw_ostream *stream = &llvm::outs();
   llvm::verifyFunction(*fooFunc, stream);
+
+  return fooFunc;
+}
+
+// add the cached object of key to the JIT, if there is one. An object may
+// define several functions (compiled in one batch), all must be new to the JIT
+static bool loadCached(const std::string &key) {
+  uint64_t compile_time = 0;
+  uint64_t start = getTimeStamp();
+  auto obj = Cache->load(key, compile_time);
+  if (!obj) {
+    return false;
+  }
+  std::vector<std::string> keys;
+  if (!Cache->definedKeys(*obj, keys)) {
+    return false;
+  }
+  for (auto const& k : keys) {
+    if (added_functions.count(k)) return false;
+  }
+  JIT->addObject(std::move(obj));
+  added_functions.insert(keys.begin(), keys.end());
+  uint64_t load_time = getTimeStamp() - start;
+  CacheStats.hits++;
+  CacheStats.load_time += load_time;
+  if (compile_time > load_time)
+    CacheStats.saved_time += compile_time - load_time;
+  return true;
+}
+
+// emit the functions into one module and add it to the JIT, names[i] is set
+// to the symbol of fns[i] (empty if it cannot be jitted), batch_names[i] to
+// the symbol of its batch variant (empty if there is none), and store_keys
+// to the keys the compiled module should be cached under
+static void addFunctions(std::vector<JitFunction> const& fns, uint64_t id,
+                         std::vector<std::string> &names,
+                         std::vector<std::string> &batch_names,
+                         std::vector<std::string> &store_keys) {
+  // Open a new module.
+  std::string moduleName = "rgdjit_m" + std::to_string(id);
+
+  auto TheCtx = std::make_unique<llvm::LLVMContext>();
+  auto TheModule = std::make_unique<Module>(moduleName, *TheCtx);
+  TheModule->setDataLayout(JIT->getDataLayout());
+
+  names.assign(fns.size(), std::string());
+  batch_names.assign(fns.size(), std::string());
+  size_t num_funcs = 0;
+  for (size_t i = 0; i < fns.size(); i++) {
+    std::string funcName = "rgdjit_f" + std::to_string(id);
+    if (fns.size() > 1) funcName += "_" + std::to_string(i);
+    if (Cache) funcName = "rgdjit"; // named after the content below
+    auto *F = emitFunction(*TheModule, fns[i].node, *fns[i].local_map, funcName);
+    if (F == nullptr) {
+      continue;
+    }
+    if (Cache) {
+      // name the function after the content, so the compiled object can be
+      // found by later runs
+      std::string key = Cache->key(*F);
+      names[i] = "rgdjit_" + key;
+      if (added_functions.count(key) || loadCached(key)) {
+        F->eraseFromParent(); // same function already in the JIT
+        // and so is its batch variant, if any
+        if (added_functions.count(key + kBatchSuffix)) {
+          batch_names[i] = names[i] + kBatchSuffix;
+        }
+        continue;
+      }
+      CacheStats.misses++;
+      F->setName(names[i]);
+      added_functions.insert(key);
+      store_keys.push_back(key);
+      if (EmitBatch &&
+          emitFunction(*TheModule, fns[i].node, *fns[i].local_map,
+                       names[i] + kBatchSuffix, BATCH_LANES)) {
+        added_functions.insert(key + kBatchSuffix);
+        batch_names[i] = names[i] + kBatchSuffix;
+      }
+    } else {
+      names[i] = funcName;
+      if (EmitBatch &&
+          emitFunction(*TheModule, fns[i].node, *fns[i].local_map,
+                       funcName + kBatchSuffix, BATCH_LANES)) {
+        batch_names[i] = funcName + kBatchSuffix;
+      }
+    }
+    num_funcs++;
+  }
 #if DEBUG
   // TheModule->print(llvm::errs(), nullptr);
 #endif
 
-  JIT->addModule(std::move(TheModule), std::move(TheCtx));
+  if (num_funcs > 0) {
+    JIT->addModule(std::move(TheModule), std::move(TheCtx));
+  }
+}
+
+// the modules are compiled on the first lookup of their symbols
+static void storeCached(uint64_t id, std::vector<std::string> const& keys,
+                        uint64_t compile_time) {
+  std::string moduleName = "rgdjit_m" + std::to_string(id);
+  if (Cache->store(moduleName, keys, compile_time)) {
+    CacheStats.stores++;
+  }
+}
 
+int rgd::addFunction(const AstNode* node,
+    std::map<size_t,uint32_t> const& local_map,
+    uint64_t id) {
+  std::vector<JitFunction> fns = {{node, &local_map, nullptr}};
+  std::vector<std::string> names;
+  std::vector<std::string> batch_names;
+  std::vector<std::string> store_keys;
+  addFunctions(fns, id, names, batch_names, store_keys);
+  if (names[0].empty()) {
+    return -1;
+  }
+  pending_functions[id] = {names[0], std::move(store_keys)};
   return 0;
 }
 
 test_fn_type rgd::performJit(uint64_t id) {
-  std::string funcName = "rgdjit_f" + std::to_string(id);
-  auto ExprSymbol = JIT->lookup(funcName).get();
+  auto itr = pending_functions.find(id);
+  if (itr == pending_functions.end()) {
+    return nullptr;
+  }
+  auto pending = std::move(itr->second);
+  pending_functions.erase(itr);
+  uint64_t start = getTimeStamp();
+  auto ExprSymbol = JIT->lookup(pending.first).get();
+  if (!pending.second.empty()) {
+    storeCached(id, pending.second, getTimeStamp() - start);
+  }
   auto func = (test_fn_type)ExprSymbol.getAddress();
   return func;
 }
+
+size_t rgd::jitFunctions(std::vector<JitFunction> &fns, uint64_t id,
+                         uint64_t *ir_time) {
+  std::vector<std::string> names;
+  std::vector<std::string> batch_names;
+  std::vector<std::string> store_keys;
+  uint64_t ir_start = getTimeStamp();
+  addFunctions(fns, id, names, batch_names, store_keys);
+  if (ir_time) {
+    *ir_time = getTimeStamp() - ir_start;
+  }
+
+  // resolve all the symbols in one lookup
+  std::vector<std::string> symbols;
+  for (size_t i = 0; i < fns.size(); i++) {
+    if (!names[i].empty()) symbols.push_back(names[i]);
+    if (!batch_names[i].empty()) symbols.push_back(batch_names[i]);
+  }
+  std::sort(symbols.begin(), symbols.end());
+  symbols.erase(std::unique(symbols.begin(), symbols.end()), symbols.end());
+  if (symbols.empty()) {
+    return 0;
+  }
+  uint64_t start = getTimeStamp();
+  auto addrs = JIT->lookup(symbols);
+  if (!addrs) {
+    std::cerr << "failed to jit: " << llvm::toString(addrs.takeError()) << "\n";
+    return 0;
+  }
+  if (!store_keys.empty()) {
+    storeCached(id, store_keys, getTimeStamp() - start);
+  }
+
+  size_t num_jitted = 0;
+  for (size_t i = 0; i < fns.size(); i++) {
+    if (names[i].empty()) continue;
+    fns[i].fn = (test_fn_type)(*addrs)[names[i]];
+    if (!batch_names[i].empty()) {
+      fns[i].batch_fn = (batch_fn_type)(*addrs)[batch_names[i]];
+    }
+    num_jitted++;
+  }
+  return num_jitted;
+}
@@ -5,15 +5,36 @@
 
 #include "ast.h"
 #include "task.h"
+#include "jitcache.h"
 
 namespace rgd {
 
+// create the JIT, compiled functions are also cached in cache_dir if set.
+// With batch, the functions get a batch variant too, which takes about as
+// long to compile
+int initJit(const char *cache_dir, bool batch = false);
+
+const JitCacheStats* getJitCacheStats();
+
 int addFunction(const AstNode* node,
     std::map<size_t, uint32_t> const& local_map,
     uint64_t id);
 
 test_fn_type performJit(uint64_t id);
 
+struct JitFunction {
+  const AstNode *node;
+  const std::map<size_t, uint32_t> *local_map;
+  test_fn_type fn; // output
+  batch_fn_type batch_fn; // output, if the AST can be batched
+};
+
+// jit a batch of ASTs into a single module, compiled and resolved at once,
+// along with their batch variants, returns the number of functions jitted.
+// The time spent generating the IR goes into ir_time if set
+size_t jitFunctions(std::vector<JitFunction> &fns, uint64_t id,
+                    uint64_t *ir_time = nullptr);
+
 bool gd_entry(std::shared_ptr<SearchTask> task);
 
 }
@@ -0,0 +1,134 @@
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/IR/Function.h"
+#include "llvm/Object/ObjectFile.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/SHA1.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "jitcache.h"
+
+using namespace rgd;
+
+// entry: magic, compile time, then the object file
+static const char kMagic[8] = {'R', 'G', 'D', 'J', 'I', 'T', '0', '1'};
+static const size_t kHeaderSize = sizeof(kMagic) + sizeof(uint64_t);
+
+bool JitCache::init() {
+  if (auto EC = llvm::sys::fs::create_directories(dir_)) {
+    llvm::errs() << "Failed to create jit cache dir " << dir_ << ": "
+                 << EC.message() << "\n";
+    return false;
+  }
+  return true;
+}
+
+std::string JitCache::key(const llvm::Function &F) const {
+  std::string ir;
+  llvm::raw_string_ostream os(ir);
+  os << LLVM_VERSION_STRING << "\n" << target_ << "\n";
+  F.print(os);
+  os.flush();
+  return llvm::toHex(llvm::SHA1::hash(llvm::arrayRefFromStringRef(ir)), true);
+}
+
+std::unique_ptr<llvm::MemoryBuffer>
+JitCache::load(const std::string &key, uint64_t &compile_time) {
+  auto path = dir_ + "/" + key + ".o";
+  auto buf = llvm::MemoryBuffer::getFile(path);
+  if (!buf) {
+    return nullptr;
+  }
+  llvm::StringRef data = (*buf)->getBuffer();
+  if (data.size() <= kHeaderSize ||
+      memcmp(data.data(), kMagic, sizeof(kMagic)) != 0) {
+    llvm::errs() << "Invalid jit cache entry " << path << "\n";
+    return nullptr;
+  }
+  memcpy(&compile_time, data.data() + sizeof(kMagic), sizeof(compile_time));
+  // make an aligned copy of the object
+  return llvm::MemoryBuffer::getMemBufferCopy(data.drop_front(kHeaderSize), key);
+}
+
+bool JitCache::definedKeys(const llvm::MemoryBuffer &obj,
+                           std::vector<std::string> &keys) {
+  auto file = llvm::object::ObjectFile::createObjectFile(obj.getMemBufferRef());
+  if (!file) {
+    llvm::consumeError(file.takeError());
+    return false;
+  }
+  for (auto const& sym : (*file)->symbols()) {
+    auto flags = sym.getFlags();
+    if (!flags) {
+      llvm::consumeError(flags.takeError());
+      return false;
+    }
+    if ((*flags & llvm::object::BasicSymbolRef::SF_Undefined) ||
+        !(*flags & llvm::object::BasicSymbolRef::SF_Global)) {
+      continue;
+    }
+    auto name = sym.getName();
+    if (!name) {
+      llvm::consumeError(name.takeError());
+      return false;
+    }
+    if (name->consume_front("rgdjit_")) {
+      keys.push_back(name->str());
+    }
+  }
+  return !keys.empty();
+}
+
+bool JitCache::store(const std::string &module,
+                     std::vector<std::string> const& keys,
+                     uint64_t compile_time) {
+  std::unique_ptr<llvm::MemoryBuffer> obj;
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    auto itr = compiled_.find(module);
+    if (itr == compiled_.end()) return false;
+    obj = std::move(itr->second);
+    compiled_.erase(itr);
+  }
+
+  auto tmp = dir_ + "/" + module + ".tmp." + std::to_string(getpid());
+  std::error_code EC;
+  {
+    llvm::raw_fd_ostream os(tmp, EC, llvm::sys::fs::OF_None);
+    if (EC) {
+      llvm::errs() << "Failed to create jit cache entry " << tmp << ": "
+                   << EC.message() << "\n";
+      return false;
+    }
+    os.write(kMagic, sizeof(kMagic));
+    os.write((const char*)&compile_time, sizeof(compile_time));
+    os << obj->getBuffer();
+    os.close();
+    if (os.has_error()) {
+      os.clear_error();
+      llvm::sys::fs::remove(tmp);
+      return false;
+    }
+  }
+  // another process may have stored the same entry, either one is fine
+  bool stored = false;
+  for (auto const& key : keys) {
+    auto path = dir_ + "/" + key + ".o";
+    if (link(tmp.c_str(), path.c_str()) == 0) {
+      stored = true;
+    }
+  }
+  llvm::sys::fs::remove(tmp);
+  return stored;
+}
+
+void JitCache::notifyObjectCompiled(const llvm::Module *M,
+                                    llvm::MemoryBufferRef Obj) {
+  std::lock_guard<std::mutex> guard(lock_);
+  compiled_[M->getModuleIdentifier()] =
+      llvm::MemoryBuffer::getMemBufferCopy(Obj.getBuffer());
+}
@@ -0,0 +1,78 @@
+#ifndef JIT_CACHE_H_
+#define JIT_CACHE_H_
+
+#include "llvm/ExecutionEngine/ObjectCache.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace rgd {
+
+// Content-addressed on-disk cache of the objects compiled by the JIT, so
+// restarted or parallel fuzzer instances on the same machine don't compile
+// the same constraints again.
+//
+// An entry is keyed by the hash of the function's IR (generated from the AST
+// and its input mapping) and of the target, and the function is named after
+// the key. Functions compiled in one batch share one object, hard-linked
+// under each of their keys. Entries are written to a temp file and linked
+// into place, so several processes can share one directory.
+class JitCache : public llvm::ObjectCache {
+public:
+  explicit JitCache(std::string dir) : dir_(std::move(dir)) {}
+
+  // create the cache directory if needed
+  bool init();
+
+  // what the generated code depends on, besides the IR
+  void setTarget(std::string target) { target_ = std::move(target); }
+
+  // key of the function F
+  std::string key(const llvm::Function &F) const;
+
+  // load the object of key, with the time it took to compile it (in us)
+  std::unique_ptr<llvm::MemoryBuffer> load(const std::string &key,
+                                           uint64_t &compile_time);
+
+  // keys of the functions defined in an object loaded from the cache, with
+  // the suffix of the batch variants for them
+  bool definedKeys(const llvm::MemoryBuffer &obj, std::vector<std::string> &keys);
+
+  // save the object compiled for module, if there is one, under each key of
+  // the functions it defines
+  bool store(const std::string &module, std::vector<std::string> const& keys,
+             uint64_t compile_time);
+
+  // ObjectCache interface, only used to catch the compiled objects; hits
+  // are added to the JIT as objects directly, bypassing the IR layers
+  void notifyObjectCompiled(const llvm::Module *M,
+                            llvm::MemoryBufferRef Obj) override;
+  std::unique_ptr<llvm::MemoryBuffer> getObject(const llvm::Module *M) override {
+    return nullptr;
+  }
+
+private:
+  std::string dir_;
+  std::string target_;
+
+  std::mutex lock_;
+  std::unordered_map<std::string, std::unique_ptr<llvm::MemoryBuffer>> compiled_;
+};
+
+struct JitCacheStats {
+  std::atomic_ulong hits{0};
+  std::atomic_ulong misses{0};
+  std::atomic_ulong stores{0};
+  std::atomic_ulong load_time{0};  // us
+  std::atomic_ulong saved_time{0}; // us, compile time of the hits
+};
+
+}
+
+#endif
@@ -3,6 +3,7 @@
 
 #include "llvm/ADT/StringRef.h"
 #include "llvm/ExecutionEngine/JITSymbol.h"
+#include "llvm/ExecutionEngine/ObjectCache.h"
 #include "llvm/ExecutionEngine/Orc/CompileUtils.h"
 #include "llvm/ExecutionEngine/Orc/Core.h"
 #include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
@@ -41,16 +42,21 @@ private:
 
   llvm::orc::JITDylib &MainJD;
 
+  std::string TargetId;
+
 public:
   GradJit(std::unique_ptr<llvm::orc::ExecutionSession> ES,
-          llvm::orc::JITTargetMachineBuilder JTMB, llvm::DataLayout DL)
+          llvm::orc::JITTargetMachineBuilder JTMB, llvm::DataLayout DL,
+          llvm::ObjectCache *ObjCache)
       : ES(std::move(ES)), DL(std::move(DL)), Mangle(*this->ES, this->DL),
         ObjectLayer(*this->ES,
             []() { return std::make_unique<llvm::SectionMemoryManager>(); }),
         CompileLayer(*this->ES, ObjectLayer,
-            std::make_unique<llvm::orc::ConcurrentIRCompiler>(std::move(JTMB))),
+            std::make_unique<llvm::orc::ConcurrentIRCompiler>(JTMB, ObjCache)),
         OptimizeLayer(*this->ES, CompileLayer, optimizeModule),
-        MainJD(this->ES->createBareJITDylib("main")) {
+        MainJD(this->ES->createBareJITDylib("main")),
+        TargetId(JTMB.getTargetTriple().str() + " " + JTMB.getCPU() + " " +
+                 JTMB.getFeatures().getString()) {
     MainJD.addGenerator(
         cantFail(llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
             DL.getGlobalPrefix())));
@@ -61,7 +67,9 @@ public:
       ES->reportError(std::move(Err));
   }
 
-  static llvm::Expected<std::unique_ptr<GradJit>> Create() {
+  // compiled objects are passed to ObjCache, if any
+  static llvm::Expected<std::unique_ptr<GradJit>>
+  Create(llvm::ObjectCache *ObjCache = nullptr) {
     auto EPC = llvm::orc::SelfExecutorProcessControl::Create();
     if (!EPC) {
       llvm::errs() << "Cannot create EPC: " << EPC.takeError() << "\n";
@@ -70,24 +78,31 @@ public:
 
     auto ES = std::make_unique<llvm::orc::ExecutionSession>(std::move(*EPC));
 
-    llvm::orc::JITTargetMachineBuilder JTMB(
-        ES->getExecutorProcessControl().getTargetTriple());
+    // target the host CPU, so the batch functions get its vector extensions
+    auto JTMB = llvm::orc::JITTargetMachineBuilder::detectHost();
+    if (!JTMB) {
+      llvm::errs() << "Cannot detect host: " << JTMB.takeError() << "\n";
+      return JTMB.takeError();
+    }
 
-    auto DL = JTMB.getDefaultDataLayoutForTarget();
+    auto DL = JTMB->getDefaultDataLayoutForTarget();
     if (!DL) {
       llvm::errs() << "Cannot get default DL for target: "
                    << DL.takeError() << "\n";
       return DL.takeError();
     }
 
-    return std::make_unique<GradJit>(std::move(ES), std::move(JTMB),
-                                     std::move(*DL));
+    return std::make_unique<GradJit>(std::move(ES), std::move(*JTMB),
+                                     std::move(*DL), ObjCache);
   }
 
   const llvm::DataLayout &getDataLayout() const { return DL; }
 
   llvm::orc::JITDylib &getMainJITDylib() { return MainJD; }
 
+  // what the generated code depends on, besides the IR
+  const std::string &getTargetId() const { return TargetId; }
+
   void addModule(std::unique_ptr<llvm::Module> M,
                  std::unique_ptr<llvm::LLVMContext> ctx) {
     auto RT = MainJD.getDefaultResourceTracker();
@@ -95,10 +110,31 @@ public:
         llvm::orc::ThreadSafeModule(std::move(M), std::move(ctx))));
   }
 
+  // add an already compiled object, e.g., from the on-disk cache
+  void addObject(std::unique_ptr<llvm::MemoryBuffer> Obj) {
+    cantFail(ObjectLayer.add(MainJD, std::move(Obj)));
+  }
+
   llvm::Expected<llvm::JITEvaluatedSymbol> lookup(llvm::StringRef Name) {
     return ES->lookup({&MainJD}, Mangle(Name.str()));
   }
 
+  // resolve several symbols at once, so their modules are compiled together
+  llvm::Expected<std::map<std::string, llvm::JITTargetAddress>>
+  lookup(std::vector<std::string> const& Names) {
+    llvm::orc::SymbolLookupSet Symbols;
+    for (auto const& Name : Names)
+      Symbols.add(Mangle(Name));
+    auto Result = ES->lookup(llvm::orc::makeJITDylibSearchOrder({&MainJD}),
+                             std::move(Symbols));
+    if (!Result)
+      return Result.takeError();
+    std::map<std::string, llvm::JITTargetAddress> Addrs;
+    for (auto const& Name : Names)
+      Addrs[Name] = (*Result)[Mangle(Name)].getAddress();
+    return Addrs;
+  }
+
 private:
   static llvm::Expected<llvm::orc::ThreadSafeModule>
   optimizeModule(llvm::orc::ThreadSafeModule TSM,
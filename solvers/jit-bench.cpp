@@ -0,0 +1,263 @@
+/*
+  Measure the end-to-end solving throughput of JIGSAW with the constraints
+  always jitted, always interpreted, and interpreted until they get hot.
+
+  usage: jit-bench [-n constraints] [-r tasks per constraint] [-t threshold]
+                   [-f fields] [-s shift] [-b]
+
+  Each constraint compares the sum of arithmetic expressions over f 4-byte
+  input fields with a constant, and has its own shape so it can't reuse
+  another's function. A constraint is shared by r tasks, like the nested branches of a
+  parser share their constraints. Every mode is run in a fresh process, as
+  the JIT and its caches are global. With -b, the jitted constraints are
+  also batched.
+
+  With -s, every field is shifted right by that many bits first, so the
+  constraints are flat in the low bits: moving a byte by one rarely changes
+  the distance, and the gradient descent goes on to the larger probes,
+  which is what -b evaluates at once.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "solver.h"
+
+using namespace rgd;
+
+static const size_t kInputSize = 256;
+static const uint16_t kOps[] = {rgd::Add, rgd::Sub, rgd::Mul, rgd::Xor,
+                                rgd::And, rgd::Or, rgd::Shl, rgd::LShr};
+
+static uint64_t eval_op(uint16_t op, uint32_t a, uint32_t b) {
+  switch (op) {
+    case rgd::Add: return a + b;
+    case rgd::Sub: return a - b;
+    case rgd::Mul: return a * b;
+    case rgd::Xor: return a ^ b;
+    case rgd::And: return a & b;
+    case rgd::Or: return a | b;
+    case rgd::Shl: return b < 32 ? a << b : 0;
+    case rgd::LShr: return b < 32 ? a >> b : 0;
+  }
+  return 0;
+}
+
+static void add_const(Constraint &c, AstNode *node, uint32_t val) {
+  uint32_t arg_index = c.input_args.size();
+  c.input_args.push_back({false, val});
+  c.const_num++;
+  node->set_kind(rgd::Constant);
+  node->set_bits(32);
+  node->set_index(arg_index);
+  node->set_hash(xxhash(32, rgd::Constant, arg_index));
+}
+
+// as the parser hashes a binary op
+static void set_hash(AstNode *node) {
+  node->set_hash(xxhash(node->children(0).hash(),
+                        (node->kind() << 16) | node->bits(),
+                        node->children(1).hash()));
+}
+
+// ((((in[off..off+3] >> shift) op1 c1) op2 c2) ...), where the ops are the
+// digits of k in base 8, returns its value with the field set to sol
+static uint32_t gen_chain(Constraint &c, AstNode *node, size_t k, uint32_t off,
+                          uint32_t shift, uint32_t sol, uint32_t &label,
+                          std::mt19937_64 &rng) {
+  size_t depth = 1;
+  for (size_t x = k; x >= 8; x /= 8) depth++;
+
+  uint32_t value = sol >> shift;
+  std::vector<std::pair<uint16_t, uint32_t>> ops;
+  for (size_t x = k, d = 0; d < depth; x /= 8, d++) {
+    uint16_t op = kOps[x % 8];
+    uint32_t operand = (op == rgd::Shl || op == rgd::LShr) ? rng() % 8 : rng();
+    ops.push_back({op, operand});
+    value = eval_op(op, value, operand);
+  }
+
+  // the field, with the next free args
+  uint32_t arg_index = c.input_args.size();
+  for (uint32_t i = 0; i < 4; i++) {
+    c.local_map[off + i] = arg_index + i;
+    c.input_args.push_back({true, 0});
+    c.shapes[off + i] = i == 0 ? 4 : 0;
+  }
+
+  // op nodes from the top down, the innermost op is the first one
+  std::vector<AstNode*> path;
+  for (size_t d = depth; d-- > 0;) {
+    node->set_kind(ops[d].first);
+    node->set_bits(32);
+    node->set_label(label++);
+    path.push_back(node);
+    AstNode *lhs = node->add_children();
+    add_const(c, node->add_children(), ops[d].second);
+    node = lhs;
+  }
+  if (shift > 0) {
+    node->set_kind(rgd::LShr);
+    node->set_bits(32);
+    node->set_label(label++);
+    path.push_back(node);
+    AstNode *lhs = node->add_children();
+    add_const(c, node->add_children(), shift);
+    node = lhs;
+  }
+  node->set_kind(rgd::Read);
+  node->set_bits(32);
+  node->set_index(off);
+  node->set_label(label++);
+  node->set_hash(xxhash(32, rgd::Read, arg_index));
+  // hashes of the ops, bottom-up
+  for (size_t d = path.size(); d-- > 0;) {
+    set_hash(path[d]);
+    c.ops[path[d]->kind()] = true;
+  }
+  return value;
+}
+
+// chain(field 0) + chain(field 1) + ... == target
+static std::shared_ptr<const Constraint>
+gen_constraint(size_t k, size_t fields, uint32_t shift, const uint8_t *in_buf,
+               std::mt19937_64 &rng) {
+  size_t depth = 1;
+  for (size_t x = k; x >= 8; x /= 8) depth++;
+  if (shift > 0) depth++;
+  auto c = std::make_shared<Constraint>(fields * (2 * depth + 2) + 3);
+  // consecutive fields, each with a random solution, so the constraint is
+  // satisfiable
+  uint32_t base = rng() % (kInputSize - 4 * fields + 1);
+
+  // build the tree top-down, the root node is the constraint's AST
+  AstNode *root = c->ast.get();
+  uint32_t label = 1;
+  root->set_kind(rgd::Equal);
+  root->set_bits(1);
+  root->set_label(label++);
+  AstNode *expr = root->add_children();
+  AstNode *target = root->add_children();
+
+  std::vector<AstNode*> sums;
+  AstNode *node = expr;
+  uint32_t value = 0;
+  for (size_t f = 0; f < fields; f++) {
+    AstNode *chain = node;
+    if (f + 1 < fields) {
+      node->set_kind(rgd::Add);
+      node->set_bits(32);
+      node->set_label(label++);
+      sums.push_back(node);
+      chain = node->add_children();
+      node = node->add_children();
+    }
+    uint32_t off = base + 4 * f;
+    for (uint32_t i = 0; i < 4; i++) {
+      c->inputs[off + i] = in_buf[off + i];
+    }
+    value += gen_chain(*c, chain, k, off, shift, rng(), label, rng);
+  }
+  for (size_t d = sums.size(); d-- > 0;) {
+    set_hash(sums[d]);
+  }
+  add_const(*c, target, value);
+  set_hash(root);
+  return c;
+}
+
+static void run(const char *mode, uint64_t threshold, size_t n, size_t r,
+                size_t fields, uint32_t shift, bool batch) {
+  std::mt19937_64 rng(0x5eed);
+  uint8_t in_buf[kInputSize], out_buf[kInputSize];
+  for (auto &b : in_buf) b = rng();
+
+  std::vector<std::shared_ptr<const Constraint>> constraints;
+  for (size_t k = 0; k < n; k++) {
+    constraints.push_back(gen_constraint(k, fields, shift, in_buf, rng));
+  }
+
+  // XXX: includes the one-time JIT setup, like a real run
+  auto start = std::chrono::steady_clock::now();
+  JITSolver solver(nullptr, threshold, batch);
+  size_t sat = 0, tasks = 0;
+  for (size_t i = 0; i < r; i++) {
+    for (auto const& c : constraints) {
+      auto task = std::make_shared<SearchTask>();
+      task->add_constraint(c, rgd::Equal);
+      task->finalize();
+      size_t out_size = 0;
+      if (solver.solve(task, in_buf, kInputSize, out_buf, out_size) == SOLVER_SAT) {
+        sat++;
+      }
+      tasks++;
+    }
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  printf("%-8s: %zu tasks in %.3fs, %.0f tasks/s, %zu sat\n", mode, tasks,
+         elapsed.count(), tasks / elapsed.count(), sat);
+}
+
+int main(int argc, char **argv) {
+  size_t n = 1000;
+  size_t r = 1;
+  uint64_t threshold = 1000;
+  size_t fields = 1;
+  uint32_t shift = 0;
+  bool batch = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:r:t:f:s:b")) > 0) {
+    switch (opt) {
+      case 'n': n = strtoull(optarg, NULL, 0); break;
+      case 'r': r = strtoull(optarg, NULL, 0); break;
+      case 't': threshold = strtoull(optarg, NULL, 0); break;
+      case 'f': fields = strtoull(optarg, NULL, 0); break;
+      case 's': shift = strtoul(optarg, NULL, 0); break;
+      case 'b': batch = true; break;
+      default:
+        fprintf(stderr, "usage: %s [-n constraints] [-r tasks per constraint] "
+                "[-t threshold] [-f fields] [-s shift] [-b]\n", argv[0]);
+        return 1;
+    }
+  }
+  if (fields == 0 || fields > kInputSize / 4) {
+    fprintf(stderr, "fields must be between 1 and %zu\n", kInputSize / 4);
+    return 1;
+  }
+  if (shift > 24) {
+    fprintf(stderr, "shift must be at most 24\n");
+    return 1;
+  }
+  if (n == 0 || r == 0 || threshold == 0) {
+    fprintf(stderr, "nothing to do\n");
+    return 1;
+  }
+
+  printf("constraints: %zu, tasks per constraint: %zu, threshold: %lu, "
+         "fields: %zu, shift: %u, batch: %d\n", n, r, threshold, fields, shift,
+         batch);
+  struct { const char *name; uint64_t threshold; } modes[] = {
+    {"jit", 0}, {"interp", UINT64_MAX}, {"tiered", threshold},
+  };
+  for (auto &m : modes) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+      perror("fork");
+      return 1;
+    } else if (pid == 0) {
+      run(m.name, m.threshold, n, r, fields, shift, batch);
+      exit(0);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+  }
+  return 0;
+}
@@ -1,10 +1,14 @@
 #include "llvm/Support/TargetSelect.h"
 #include "llvm/Target/TargetMachine.h"
 
+#include <mutex>
+#include <unordered_set>
+
 #include "solver.h"
 #include "ast.h"
 #include "jigsaw/rgdJit.h"
 #include "jigsaw/jit.h"
+#include "jigsaw/interp.h"
 #include "wheels/lockfreehash/lprobe/hash_table.h"
 
 using namespace rgd;
@@ -30,16 +34,32 @@ static uint64_t getTimeStamp() {
   return tv.tv_sec * kUsToS + tv.tv_usec;
 }
 
-extern std::unique_ptr<GradJit> JIT;
-
 struct myKV {
   std::shared_ptr<AstNode> node;
   test_fn_type fn;
-  myKV(std::shared_ptr<AstNode> anode, test_fn_type f) : node(anode), fn(f) {}
+  batch_fn_type batch_fn;
+  myKV(std::shared_ptr<AstNode> anode, test_fn_type f, batch_fn_type bf)
+      : node(anode), fn(f), batch_fn(bf) {}
+};
+
+// XXX: workaround, the functions are the only mutable fields of a constraint,
+// set once. batch_fn is published along with fn
+static inline void publish(std::shared_ptr<const Constraint> const& c,
+                           const struct myKV *kv) {
+  auto mc = const_cast<Constraint*>(c.get());
+  __atomic_store_n(&mc->batch_fn, kv->batch_fn, __ATOMIC_RELAXED);
+  __atomic_store_n(&mc->fn, kv->fn, __ATOMIC_RELEASE);
+}
+
+struct myBC {
+  std::shared_ptr<AstNode> node;
+  const Bytecode *bc;
+  myBC(std::shared_ptr<AstNode> anode, const Bytecode *b) : node(anode), bc(b) {}
 };
 
+template <typename KV>
 struct myHash {
-  using eType = struct myKV*;
+  using eType = KV*;
   using kType = std::shared_ptr<AstNode>;
   eType empty() {return nullptr;}
   kType getKey(eType v) {return v->node;}
@@ -52,14 +72,141 @@ struct myHash {
   bool cas(eType* p, eType o, eType n) {return pbbs::atomic_compare_and_swap(p, o, n);}
 };
 
-static pbbs::Table<myHash> fCache(8000016, myHash(), 1.3);
+static pbbs::Table<myHash<myKV>> fCache(8000016, myHash<myKV>(), 1.3);
+static pbbs::Table<myHash<myBC>> bcCache(8000016, myHash<myBC>(), 1.3);
+
+// the JIT and the function (and bytecode) caches are shared by all JITSolver instances
+// (e.g., one per solving thread), lookups are lock-free but compiling into
+// the shared JIT is serialized
+static std::once_flag jit_init_flag;
+static std::mutex jit_lock;
+static std::atomic_ulong jit_uuid(0);
+
+JITSolver::JITSolver(const char *cache_dir, uint64_t jit_threshold,
+                     bool batch_probes)
+    : jit_threshold(jit_threshold), cache_hits(0), cache_misses(0),
+      num_timeout(0), num_solved(0), process_time(0), jit_time(0),
+      num_jitted(0), num_batches(0), num_bytecode(0), num_promoted(0),
+      solving_time(0) {
+  std::call_once(jit_init_flag, [cache_dir, batch_probes]() {
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+    llvm::InitializeNativeTargetAsmParser();
+
+    if (initJit(cache_dir, batch_probes) != 0) {
+      WARNF("failed to create the JIT\n");
+      abort();
+    }
+  });
+}
+
+const Bytecode* JITSolver::get_bytecode(std::shared_ptr<const Constraint> const& c) {
+  auto bc = __atomic_load_n(&c->bc, __ATOMIC_ACQUIRE);
+  if (bc != nullptr) {
+    return bc;
+  }
+  struct myBC *res = bcCache.find(c->ast);
+  if (res != nullptr) {
+    bc = res->bc;
+  } else {
+    auto code = compileBytecode(c->get_root(), c->local_map);
+    if (code == nullptr) {
+      return nullptr; // e.g., too wide, leave it to the JIT
+    }
+    num_bytecode++;
+    auto kv = new struct myBC(c->ast, code.release());
+    if (bcCache.insert(kv)) {
+      bc = kv->bc;
+    } else {
+      // compiled by another thread
+      delete kv->bc;
+      delete kv;
+      res = bcCache.find(c->ast);
+      if (res == nullptr) return nullptr;
+      bc = res->bc;
+    }
+  }
+  // XXX: workaround, like fn
+  __atomic_store_n(&const_cast<Constraint*>(c.get())->bc, bc, __ATOMIC_RELEASE);
+  return bc;
+}
+
+bool JITSolver::should_interpret(std::shared_ptr<const Constraint> const& c) {
+  if (jit_threshold == 0) {
+    return false;
+  }
+  auto bc = get_bytecode(c);
+  return bc != nullptr && __atomic_load_n(&bc->evals, __ATOMIC_RELAXED) < jit_threshold;
+}
+
+void JITSolver::jit_batch(std::vector<std::shared_ptr<const Constraint>> const& pending) {
+  std::lock_guard<std::mutex> guard(jit_lock);
+  std::vector<std::shared_ptr<const Constraint>> to_jit;
+  std::vector<JitFunction> fns;
+  for (auto const& c : pending) {
+    // another thread may have compiled the same AST while we were waiting
+    struct myKV *res = fCache.find(c->ast);
+    if (res != nullptr) {
+      cache_hits++;
+      publish(c, res);
+      continue;
+    }
+    cache_misses++;
+    to_jit.push_back(c);
+    fns.push_back({c->get_root(), &c->local_map, nullptr});
+  }
+  if (fns.empty()) {
+    return;
+  }
+
+  DEBUGF("jit %zu constraints in one batch\n", fns.size());
+  // the IR generation is the processing time, the rest is compiling
+  uint64_t start = getTimeStamp();
+  uint64_t ir_time = 0;
+  size_t jitted = jitFunctions(fns, ++jit_uuid, &ir_time);
+  process_time += ir_time;
+  jit_time += (getTimeStamp() - start) - ir_time;
+  num_jitted += jitted;
+  num_batches++;
 
-JITSolver::JITSolver(): uuid(0) {
-  llvm::InitializeNativeTarget();
-  llvm::InitializeNativeTargetAsmPrinter();
-  llvm::InitializeNativeTargetAsmParser();
+  for (size_t i = 0; i < fns.size(); i++) {
+    auto &c = to_jit[i];
+    if (fns[i].fn == nullptr) {
+      WARNF("failed to jit constraint %d\n", c->ast->label());
+      continue;
+    }
+    auto kv = new struct myKV(c->ast, fns[i].fn, fns[i].batch_fn);
+    if (!fCache.insert(kv)) {
+      // an equal AST in the same batch, keep the first one
+      delete kv;
+      kv = fCache.find(c->ast);
+      if (kv == nullptr) continue;
+    }
+    if (c->bc != nullptr) {
+      num_promoted++;
+    }
+    publish(c, kv);
+  }
+}
 
-  JIT = std::move(GradJit::Create().get());
+void JITSolver::prepare(std::vector<std::shared_ptr<SearchTask>> const& tasks) {
+  // collect the constraints that haven't been jitted yet, and won't be
+  // interpreted
+  std::vector<std::shared_ptr<const Constraint>> pending;
+  std::unordered_set<const Constraint*> seen;
+  for (auto const& task : tasks) {
+    for (size_t i = 0, n = task->size(); i < n; i++) {
+      auto &c = task->constraints(i);
+      if (__atomic_load_n(&c->fn, __ATOMIC_ACQUIRE) != nullptr ||
+          !seen.insert(c.get()).second || should_interpret(c)) {
+        continue;
+      }
+      pending.push_back(c);
+    }
+  }
+  if (!pending.empty()) {
+    jit_batch(pending);
+  }
 }
 
 solver_result_t
@@ -90,40 +237,81 @@ JITSolver::solve(std::shared_ptr<SearchTask> task,
     base_task = base_task->base_task;
   }
 
-  for (size_t i = 0, n = task->size(); i < n; i++) {
+  // gd can't tell unsat, it only takes the known ones from the cache, and
+  // starts the search from the model of a sat subset
+  symsan::QueryCache::query_t query;
+  symsan::QueryCache::model_t model;
+  bool cached = false;
+  bool hinted = false;
+  if (query_cache_) {
+    uint64_t cost = 0;
+    cache_query(*task, query);
+    switch (query_cache_->lookup(query, model, cost, cache_stats_)) {
+      case symsan::QueryCache::unsat:
+        return SOLVER_UNSAT;
+      case symsan::QueryCache::sat:
+        cached = true;
+        break;
+      case symsan::QueryCache::candidate:
+        task->load_hint(model);
+        hinted = true;
+        break;
+      default:
+        break;
+    }
+  }
+
+  // jit the ASTs into native functions if haven't done so, unless they
+  // are still cold enough to be interpreted.
+  // constraints are shared between tasks, which may be solved concurrently
+  std::vector<std::shared_ptr<const Constraint>> to_jit;
+  for (size_t i = 0, n = cached ? 0 : task->size(); i < n; i++) {
     auto &c = task->constraints(i);
     DEBUGF("process constraint %d (fn=%p)\n", c->ast->label(), c->fn);
-    // jit the AST into a native function if haven't done so
-    if (c->fn == nullptr) {
-      struct myKV *res = fCache.find(c->ast);
-      if (res == nullptr) {
-        cache_misses++;
-        DEBUGF("jit constraint %d\n", c->ast->label());
-        uint64_t id = ++uuid;
-        start = getTimeStamp();
-        if (addFunction(c->get_root(), c->local_map, id) != 0) {
-          WARNF("failed to add function\n");
-          return SOLVER_ERROR;
-        }
-        process_time += (getTimeStamp() - start);
-        start = getTimeStamp();
-        auto fn = performJit(id);
-        jit_time += (getTimeStamp() - start);
-        auto kv = new struct myKV(c->ast, fn);
-        if (!fCache.insert(kv))
-          delete kv;
-        const_cast<Constraint*>(c.get())->fn = fn; // XXX: workaround, no concurrent access
-      } else {
-        cache_hits++;
-        const_cast<Constraint*>(c.get())->fn = res->fn; // XXX: workaround
+    if (__atomic_load_n(&c->fn, __ATOMIC_ACQUIRE) != nullptr) {
+      continue;
+    }
+    struct myKV *res = fCache.find(c->ast);
+    if (res != nullptr) {
+      cache_hits++;
+      publish(c, res);
+    } else if (!should_interpret(c)) {
+      to_jit.push_back(c);
+    }
+  }
+  if (!to_jit.empty()) {
+    jit_batch(to_jit);
+    for (auto const& c : to_jit) {
+      if (c->fn == nullptr && c->bc == nullptr) {
+        return SOLVER_ERROR;
       }
     }
   }
 
   // solve the task
-  start = getTimeStamp();
-  bool res = gd_entry(task);
-  solving_time += (getTimeStamp() - start);
+  bool res = true;
+  if (cached) {
+    if (!task->claim()) {
+      num_timeout++;
+      return SOLVER_TIMEOUT;
+    }
+    task->solution.clear();
+    task->solution.insert(model.begin(), model.end());
+    task->solved = true;
+  } else {
+    start = getTimeStamp();
+    res = gd_entry(task);
+    uint64_t cost = getTimeStamp() - start;
+    solving_time += cost;
+    if (res && query_cache_) {
+      // counted as a hit of the candidate, though not checked beforehand
+      if (hinted) {
+        cache_stats_.candidate_hits++;
+      }
+      to_model(task->solution, model);
+      query_cache_->insert(query, true, model, cost);
+    }
+  }
   if (res) {
     DEBUGF("solved\n");
     out_size = in_size;
@@ -179,5 +367,25 @@ void JITSolver::print_stats(int fd) {
   dprintf(fd, "  num timeout: %lu\n", num_timeout.load());
   dprintf(fd, "  process time: %lu\n", process_time.load());
   dprintf(fd, "  jit  time: %lu\n", jit_time.load());
+  dprintf(fd, "  jitted functions: %lu (in %lu batches)\n", num_jitted.load(),
+          num_batches.load());
+  if (num_jitted) {
+    dprintf(fd, "  jit time per function: %lu\n", jit_time.load() / num_jitted.load());
+  }
+  if (jit_threshold) {
+    dprintf(fd, "  interpreted constraints: %lu (%lu promoted)\n",
+            num_bytecode.load(), num_promoted.load());
+  }
   dprintf(fd, "  solving time: %lu\n", solving_time.load());
+  if (query_cache_) {
+    cache_stats_.print(fd);
+  }
+  auto cache = getJitCacheStats();
+  if (cache) {
+    dprintf(fd, "  object cache hits: %lu\n", cache->hits.load());
+    dprintf(fd, "  object cache misses: %lu\n", cache->misses.load());
+    dprintf(fd, "  object cache stores: %lu\n", cache->stores.load());
+    dprintf(fd, "  object cache load time: %lu\n", cache->load_time.load());
+    dprintf(fd, "  object cache time saved: %lu\n", cache->saved_time.load());
+  }
 }
@@ -0,0 +1,327 @@
+#include "query_cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+using namespace symsan;
+
+#ifndef WARNF
+#define WARNF(_str...) do { fprintf(stderr, _str); } while (0)
+#endif
+
+// bound the memory and the cost of a lookup
+static const size_t kMaxEntries = 1UL << 21;
+static const size_t kMaxScan = 256; // latest entries scanned per constraint
+
+static const uint64_t kFileMagic = 0x3130304843514d53ULL; // "SMQCH001"
+static const uint32_t kRecordMagic = 0x52435153; // "SQCR"
+
+// the file is the header followed by the records, a zero-filled file is an
+// empty cache. Appending reserves the space by bumping tail, then marks the
+// record ready once written. A writer dying in between leaves a record never
+// ready, which stops the readers there, the later records are lost.
+struct QueryCache::file_header {
+  uint64_t magic;
+  uint64_t tail; // end of the reserved records, from the end of the header
+  uint64_t reserved[6];
+};
+
+struct record_header {
+  uint32_t ready;
+  uint32_t length; // of the whole record, 8-byte aligned
+  uint32_t num_constraints;
+  uint32_t num_bytes;
+  uint64_t cost;
+  uint8_t sat;
+  uint8_t pad[7];
+  // followed by the constraints, the positions and the values of the model
+};
+
+static inline size_t record_length(size_t num_constraints, size_t num_bytes) {
+  size_t len = sizeof(record_header) + num_constraints * sizeof(uint64_t) +
+               num_bytes * (sizeof(uint64_t) + sizeof(uint8_t));
+  return (len + 7) & ~7UL;
+}
+
+void QueryCache::stats_t::print(int fd) const {
+  uint64_t hits = exact + unsat_subset + sat_superset + candidate_hits;
+  dprintf(fd, "  query cache lookups: %lu\n", lookups.load());
+  dprintf(fd, "  query cache exact hits: %lu\n", exact.load());
+  dprintf(fd, "  query cache unsat subset hits: %lu\n", unsat_subset.load());
+  dprintf(fd, "  query cache sat superset hits: %lu\n", sat_superset.load());
+  dprintf(fd, "  query cache candidate models: %lu (%lu hits)\n",
+          candidates.load(), candidate_hits.load());
+  if (lookups) {
+    dprintf(fd, "  query cache hit rate: %.1f%%\n", 100.0 * hits / lookups);
+  }
+  dprintf(fd, "  query cache time saved: %lu\n", saved_us.load());
+}
+
+QueryCache::QueryCache(const char *path, size_t file_size)
+    : file_(nullptr), file_size_(0), cursor_(0) {
+  if (!path || !path[0]) {
+    return;
+  }
+
+  int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    WARNF("failed to open the query cache %s: %s\n", path, strerror(errno));
+    return;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    WARNF("failed to stat the query cache %s: %s\n", path, strerror(errno));
+    close(fd);
+    return;
+  }
+  // created with the size of the first user, the later ones map it as is
+  if (st.st_size == 0) {
+    if (ftruncate(fd, file_size) != 0) {
+      WARNF("failed to resize the query cache %s: %s\n", path, strerror(errno));
+      close(fd);
+      return;
+    }
+  } else {
+    file_size = st.st_size;
+  }
+  if (file_size <= sizeof(file_header)) {
+    WARNF("query cache %s is too small\n", path);
+    close(fd);
+    return;
+  }
+  void *addr = mmap(nullptr, file_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    WARNF("failed to map the query cache %s: %s\n", path, strerror(errno));
+    return;
+  }
+
+  auto header = reinterpret_cast<file_header*>(addr);
+  uint64_t magic = 0;
+  if (!__atomic_compare_exchange_n(&header->magic, &magic, kFileMagic, false,
+                                   __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) &&
+      magic != kFileMagic) {
+    WARNF("%s is not a query cache\n", path);
+    munmap(addr, file_size);
+    return;
+  }
+  file_ = header;
+  file_size_ = file_size;
+}
+
+QueryCache::~QueryCache() {
+  if (file_) {
+    munmap(file_, file_size_);
+  }
+}
+
+void QueryCache::normalize(query_t &query) {
+  std::sort(query.begin(), query.end());
+  query.erase(std::unique(query.begin(), query.end()), query.end());
+}
+
+uint64_t QueryCache::query_key(const query_t &query) {
+  uint64_t h = query.size();
+  for (uint64_t c : query) {
+    h = mix(h, c);
+  }
+  return h;
+}
+
+size_t QueryCache::size() {
+  std::lock_guard<std::mutex> guard(lock_);
+  return entries_.size();
+}
+
+bool QueryCache::add_entry(const query_t &query, bool is_sat,
+                           const model_t &model, uint64_t cost) {
+  uint64_t key = query_key(query);
+  auto range = exact_.equal_range(key);
+  for (auto itr = range.first; itr != range.second; ++itr) {
+    if (entries_[itr->second].query == query) {
+      return false;
+    }
+  }
+  if (entries_.size() >= kMaxEntries) {
+    return false;
+  }
+
+  uint32_t id = entries_.size();
+  entries_.push_back({query, model, cost, is_sat});
+  exact_.emplace(key, id);
+  heads_[query.front()].push_back(id);
+  for (uint64_t c : query) {
+    index_[c].push_back(id);
+  }
+  return true;
+}
+
+QueryCache::result_t
+QueryCache::lookup(const query_t &query, model_t &model, uint64_t &cost,
+                   stats_t &stats) {
+  if (query.empty()) {
+    return miss;
+  }
+  stats.lookups++;
+
+  std::lock_guard<std::mutex> guard(lock_);
+  if (file_) {
+    sync_file();
+  }
+
+  auto range = exact_.equal_range(query_key(query));
+  for (auto itr = range.first; itr != range.second; ++itr) {
+    auto const& e = entries_[itr->second];
+    if (e.query != query) {
+      continue;
+    }
+    stats.exact++;
+    stats.saved_us += e.cost;
+    cost = e.cost;
+    if (!e.sat) {
+      return unsat;
+    }
+    model = e.model;
+    return sat;
+  }
+
+  // known subsets, any unsat one makes the query unsat, the largest sat one
+  // gives the best candidate
+  const entry_t *best = nullptr;
+  for (uint64_t c : query) {
+    auto itr = heads_.find(c);
+    if (itr == heads_.end()) {
+      continue;
+    }
+    auto const& ids = itr->second;
+    size_t scanned = 0;
+    for (auto id = ids.rbegin(); id != ids.rend() && scanned < kMaxScan;
+         ++id, ++scanned) {
+      auto const& e = entries_[*id];
+      if (e.query.size() >= query.size() ||
+          !std::includes(query.begin(), query.end(),
+                         e.query.begin(), e.query.end())) {
+        continue;
+      }
+      if (!e.sat) {
+        stats.unsat_subset++;
+        stats.saved_us += e.cost;
+        cost = e.cost;
+        return unsat;
+      }
+      if (!best || e.query.size() > best->query.size()) {
+        best = &e;
+      }
+    }
+  }
+
+  // known sat supersets, their models assign every byte of the query
+  auto itr = index_.find(query.front());
+  if (itr != index_.end()) {
+    auto const& ids = itr->second;
+    size_t scanned = 0;
+    for (auto id = ids.rbegin(); id != ids.rend() && scanned < kMaxScan;
+         ++id, ++scanned) {
+      auto const& e = entries_[*id];
+      if (!e.sat || e.query.size() <= query.size() ||
+          !std::includes(e.query.begin(), e.query.end(),
+                         query.begin(), query.end())) {
+        continue;
+      }
+      stats.sat_superset++;
+      stats.saved_us += e.cost;
+      cost = e.cost;
+      model = e.model;
+      return sat;
+    }
+  }
+
+  if (best) {
+    stats.candidates++;
+    cost = best->cost;
+    model = best->model;
+    return candidate;
+  }
+  return miss;
+}
+
+void QueryCache::insert(const query_t &query, bool is_sat,
+                        const model_t &model, uint64_t cost) {
+  if (query.empty()) {
+    return;
+  }
+  std::lock_guard<std::mutex> guard(lock_);
+  if (add_entry(query, is_sat, model, cost) && file_) {
+    append_file(query, is_sat, model, cost);
+  }
+}
+
+void QueryCache::sync_file() {
+  uint8_t *data = reinterpret_cast<uint8_t*>(file_ + 1);
+  uint64_t capacity = file_size_ - sizeof(file_header);
+  uint64_t end = std::min(__atomic_load_n(&file_->tail, __ATOMIC_ACQUIRE),
+                          capacity);
+  query_t query;
+  model_t model;
+  while (cursor_ + sizeof(record_header) <= end) {
+    auto rec = reinterpret_cast<record_header*>(data + cursor_);
+    if (__atomic_load_n(&rec->ready, __ATOMIC_ACQUIRE) != kRecordMagic) {
+      break; // still being written
+    }
+    if (rec->length != record_length(rec->num_constraints, rec->num_bytes) ||
+        cursor_ + rec->length > capacity || rec->num_constraints == 0) {
+      WARNF("corrupted query cache record at %lu\n", cursor_);
+      cursor_ = capacity;
+      break;
+    }
+    auto constraints = reinterpret_cast<const uint64_t*>(rec + 1);
+    auto positions = constraints + rec->num_constraints;
+    auto values = reinterpret_cast<const uint8_t*>(positions + rec->num_bytes);
+    query.assign(constraints, constraints + rec->num_constraints);
+    model.clear();
+    for (uint32_t i = 0; i < rec->num_bytes; i++) {
+      model.push_back({positions[i], values[i]});
+    }
+    // including the ones appended by this process, already in memory
+    add_entry(query, rec->sat, model, rec->cost);
+    cursor_ += rec->length;
+  }
+}
+
+void QueryCache::append_file(const query_t &query, bool is_sat,
+                             const model_t &model, uint64_t cost) {
+  uint64_t capacity = file_size_ - sizeof(file_header);
+  size_t len = record_length(query.size(), model.size());
+  if (__atomic_load_n(&file_->tail, __ATOMIC_RELAXED) + len > capacity) {
+    return; // full
+  }
+  uint64_t off = __atomic_fetch_add(&file_->tail, len, __ATOMIC_RELAXED);
+  if (off + len > capacity) {
+    return;
+  }
+
+  uint8_t *data = reinterpret_cast<uint8_t*>(file_ + 1);
+  auto rec = reinterpret_cast<record_header*>(data + off);
+  rec->length = len;
+  rec->num_constraints = query.size();
+  rec->num_bytes = model.size();
+  rec->cost = cost;
+  rec->sat = is_sat;
+  auto constraints = reinterpret_cast<uint64_t*>(rec + 1);
+  auto positions = constraints + query.size();
+  auto values = reinterpret_cast<uint8_t*>(positions + model.size());
+  memcpy(constraints, query.data(), query.size() * sizeof(uint64_t));
+  for (size_t i = 0; i < model.size(); i++) {
+    positions[i] = model[i].first;
+    values[i] = model[i].second;
+  }
+  __atomic_store_n(&rec->ready, kRecordMagic, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,36 @@
+#include "solver.h"
+
+using namespace rgd;
+using symsan::QueryCache;
+
+// the slots of the constants are part of the shape, their values are hashed
+// along with the input_args
+static uint64_t hash_ast(const AstNode &node, uint64_t h) {
+  h = QueryCache::mix(h, node.kind());
+  h = QueryCache::mix(h, node.bits());
+  h = QueryCache::mix(h, node.index());
+  h = QueryCache::mix(h, node.boolvalue());
+  for (uint32_t i = 0; i < node.children_size(); i++) {
+    h = hash_ast(node.children(i), h);
+  }
+  return h;
+}
+
+void Solver::cache_query(SearchTask const& task, QueryCache::query_t &query) {
+  query.clear();
+  for (size_t i = 0, n = task.size(); i < n; i++) {
+    auto const& c = task.constraints(i);
+    uint64_t h = hash_ast(*c->get_root(), task.comparisons(i));
+    for (auto const& [sym, val] : c->input_args) {
+      h = QueryCache::mix(h, sym);
+      h = QueryCache::mix(h, val);
+    }
+    query.push_back(h);
+  }
+  QueryCache::normalize(query);
+}
+
+void Solver::to_model(std::unordered_map<size_t, uint8_t> const& solution,
+                      QueryCache::model_t &model) {
+  model.assign(solution.begin(), solution.end());
+}
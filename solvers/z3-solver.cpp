@@ -4,6 +4,8 @@
 
 #include <string.h>
 
+#include <chrono>
+
 using namespace rgd;
 
 #define DEBUG 0
@@ -19,11 +21,10 @@ using namespace rgd;
 #define WARNF(_str...) do { fprintf(stderr, _str); } while (0)
 #endif
 
-z3::context g_z3_context;
 const unsigned kSolverTimeout = 10000; // 10 seconds
 
 Z3Solver::Z3Solver()
-    : context_(g_z3_context), solver_(z3::solver(context_, "QF_BV"))
+    : solver_(z3::solver(context_, "QF_BV"))
 {
   // Set timeout for solver
   z3::params p(context_);
@@ -243,8 +244,7 @@ z3::expr Z3Solver::serialize_rel(uint32_t comparison,
   }
 }
 
-static inline void extract_model(z3::model &m, uint8_t *buf, size_t buf_size,
-                                 std::unordered_map<size_t, uint8_t> &solution) {
+static inline void extract_model(z3::model &m, symsan::QueryCache::model_t &model) {
   unsigned num_constants = m.num_consts();
   for (unsigned i = 0; i< num_constants; i++) {
     z3::func_decl decl = m.get_const_decl(i);
@@ -253,15 +253,43 @@ static inline void extract_model(z3::model &m, uint8_t *buf, size_t buf_size,
     if (name.kind() == Z3_INT_SYMBOL) {
       uint8_t value = (uint8_t)e.get_numeral_int();
       size_t offset = name.to_int();
-      if (offset < buf_size) {
-        buf[offset] = value;
-        solution[offset] = value;
-        DEBUGF("generate_input offset:%zu => %u\n", offset, value);
-      } else {
-        WARNF("offset %zu out of range %zu\n", offset, buf_size);
-      }
+      model.push_back({offset, value});
+    }
+  }
+}
+
+static inline void apply_model(symsan::QueryCache::model_t const& model,
+                               uint8_t *buf, size_t buf_size,
+                               std::unordered_map<size_t, uint8_t> &solution) {
+  for (auto const& [offset, value] : model) {
+    if (offset < buf_size) {
+      buf[offset] = value;
+      solution[offset] = value;
+      DEBUGF("generate_input offset:%zu => %u\n", offset, value);
+    } else {
+      WARNF("offset %zu out of range %zu\n", offset, buf_size);
+    }
+  }
+}
+
+bool Z3Solver::check_model(z3::expr_vector const& exprs,
+                           symsan::QueryCache::model_t const& model) {
+  z3::expr_vector src(context_);
+  z3::expr_vector dst(context_);
+  z3::sort sort = context_.bv_sort(8);
+  for (auto const& [offset, value] : model) {
+    src.push_back(context_.constant(context_.int_symbol(offset), sort));
+    dst.push_back(context_.bv_val(value, 8));
+  }
+  // the bytes not in the model are left symbolic, so any constraint on
+  // them fails the check
+  for (unsigned i = 0; i < exprs.size(); i++) {
+    z3::expr e = exprs[i];
+    if (!e.substitute(src, dst).simplify().is_true()) {
+      return false;
     }
   }
+  return true;
 }
 
 solver_result_t
@@ -300,18 +328,62 @@ Z3Solver::solve(std::shared_ptr<SearchTask> task,
     }
 
     std::unordered_map<uint32_t, z3::expr> expr_cache;
+    z3::expr_vector exprs(context_);
     for (size_t i = 0, n = task->size(); i < n; i++) {
       auto const &c = task->constraints(i);
       z3::expr z3expr = serialize_rel(task->comparisons(i), c->get_root(), c->input_args, expr_cache);
       DEBUGF("adding expr %s\n", z3expr.to_string().c_str());
-      solver_.add(z3expr);
+      exprs.push_back(z3expr);
+    }
+
+    symsan::QueryCache::query_t query;
+    symsan::QueryCache::model_t model;
+    bool cached = false;
+    if (query_cache_) {
+      uint64_t cost = 0;
+      cache_query(*task, query);
+      auto hit = query_cache_->lookup(query, model, cost, cache_stats_);
+      if (hit == symsan::QueryCache::unsat) {
+        return SOLVER_UNSAT;
+      } else if (hit == symsan::QueryCache::sat) {
+        cached = true;
+      } else if (hit == symsan::QueryCache::candidate &&
+                 check_model(exprs, model)) {
+        cache_stats_.candidate_hits++;
+        cache_stats_.saved_us += cost;
+        cached = true;
+      }
+    }
+
+    auto ret = z3::sat;
+    if (!cached) {
+      // racing with other solvers, which are already done
+      if (task->lost()) {
+        return SOLVER_TIMEOUT;
+      }
+      for (unsigned i = 0; i < exprs.size(); i++) {
+        solver_.add(exprs[i]);
+      }
+      auto start = std::chrono::steady_clock::now();
+      ret = solver_.check();
+      uint64_t cost = std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - start).count();
+      model.clear();
+      if (ret == z3::sat) {
+        z3::model m = solver_.get_model();
+        extract_model(m, model);
+      }
+      if (query_cache_ && ret != z3::unknown) {
+        query_cache_->insert(query, ret == z3::sat, model, cost);
+      }
     }
-    auto ret = solver_.check();
     if (ret == z3::sat) {
+      if (!task->claim()) {
+        return SOLVER_TIMEOUT;
+      }
       memcpy(out_buf, in_buf, in_size);
       out_size = in_size;
-      z3::model m = solver_.get_model();
-      extract_model(m, out_buf, out_size, task->solution);
+      apply_model(model, out_buf, out_size, task->solution);
       if (!task->atoi_info().empty()) {
         // if there are atoi bytes, handle them
         for (auto const &[offset, info] : task->atoi_info()) {
@@ -355,3 +427,10 @@ Z3Solver::solve(std::shared_ptr<SearchTask> task,
   }
   return SOLVER_ERROR;
 }
+
+void Z3Solver::print_stats(int fd) {
+  if (query_cache_) {
+    dprintf(fd, "Z3 solver stats:\n");
+    cache_stats_.print(fd);
+  }
+}
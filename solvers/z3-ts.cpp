@@ -2,6 +2,7 @@
 
 #include "parse-z3.h"
 
+#include <chrono>
 #include <unordered_map>
 #include <unordered_set>
 #include <utility>
@@ -88,6 +89,8 @@ int Z3AstParser::restart(std::vector<input_t> &inputs) {
   }
   expr_cache_.clear();
   expr_cache_.resize(1); // reserve for CONST_OFFSET
+  failed_cache_.clear();
+  failed_cache_.resize(1); // reserve for CONST_OFFSET
   deps_cache_.clear();
   deps_cache_.resize(1); // reserve for CONST_OFFSET
 #if FILTER_WRONG_AST
@@ -199,374 +202,450 @@ z3::expr Z3AstParser::serialize(dfsan_label label, input_dep_set_t &deps) {
   }
 
   dfsan_label last_label = expr_cache_.size() - 1;
-  if (label > expr_cache_.capacity()) {
-    // reserve more caches if needed
-    tsize_cache_.reserve(label + SIZE_INCREMENT);
-    expr_cache_.reserve(label + SIZE_INCREMENT);
-    deps_cache_.reserve(label + SIZE_INCREMENT);
+  if (label > last_label) {
+    if (label > expr_cache_.capacity()) {
+      // reserve more caches if needed
+      tsize_cache_.reserve(label + SIZE_INCREMENT);
+      expr_cache_.reserve(label + SIZE_INCREMENT);
+      failed_cache_.reserve(label + SIZE_INCREMENT);
+      deps_cache_.reserve(label + SIZE_INCREMENT);
 #if FILTER_WRONG_AST
-    value_cache_.reserve(label + SIZE_INCREMENT);
+      value_cache_.reserve(label + SIZE_INCREMENT);
+#endif
+    }
+    tsize_cache_.resize(label + 1);
+    expr_cache_.resize(label + 1);
+    failed_cache_.resize(label + 1);
+    deps_cache_.resize(label + 1);
+#if FILTER_WRONG_AST
+    value_cache_.resize(label + 1);
 #endif
   }
 
+  // labels are not dense, the runtime hands them out in per-thread chunks,
+  // the ones not written yet are serialized once something refers to them.
+  // An invalid or unsupported label only fails the expressions it is part of
   for (dfsan_label l = last_label + 1; l <= label; l++) {
+    try {
+      serialize_label(l);
+    } catch (z3::exception ze) {
+      failed_cache_[l] = true;
+    }
+  }
+
+  return get_cached_expr(label, deps);
+}
+
+void Z3AstParser::serialize_pending(dfsan_label label) {
+  // the children have smaller labels and are serialized first, a chain of
+  // pending labels can be long so keep our own stack
+  std::vector<dfsan_label> stack = {label};
+  while (!stack.empty()) {
+    dfsan_label l = stack.back();
+    if (expr_cache_[l] != nullptr) {
+      // pushed twice, e.g., as both operands
+      stack.pop_back();
+      continue;
+    }
+    dfsan_label_info *info = get_label_info(l);
+    if (info->op == 0 && info->size == 0) {
+      // still not written
+      return;
+    }
+    bool ready = true;
+    if (info->op != 0 && info->op != __dfsan::Load) {
+      for (dfsan_label c : {info->l1, info->l2}) {
+        if (c < CONST_OFFSET || c >= l || expr_cache_[c] != nullptr) {
+          continue;
+        }
+        if (failed_cache_[c]) {
+          failed_cache_[l] = true;
+          break;
+        }
+        stack.push_back(c);
+        ready = false;
+      }
+    }
+    if (failed_cache_[l]) {
+      stack.pop_back();
+      continue;
+    }
+    if (!ready) {
+      continue;
+    }
+    stack.pop_back();
+    try {
+      serialize_label(l);
+    } catch (z3::exception ze) {
+      failed_cache_[l] = true;
+    }
+    if (expr_cache_[l] == nullptr && !failed_cache_[l]) {
+      // a child is still not written
+      return;
+    }
+  }
+}
 
+void Z3AstParser::serialize_label(dfsan_label l) {
 #if FILTER_WRONG_AST
 #define RECORD_VALUE(value) \
-  value_cache_.emplace_back((uint64_t)(value))
+  value_cache_[l] = (uint64_t)(value)
 #else
 #define RECORD_VALUE(value) \
   do { } while (0)
 #endif
 
-    dfsan_label_info *info = get_label_info(l);
-    // fprintf(stderr, "%u = (l1:%u, l2:%u, op:%s, size:%u, op1:%lu, op2:%lu)\n",
-    //         l, info->l1, info->l2, get_op_name(info->op).c_str(),
-    //         info->size, info->op1.i, info->op2.i);
-    input_dep_set_t &input_deps = deps_cache_.emplace_back();
-
-    // special ops
-    char name[256];
-    if (info->op == 0) {
-      // input
-      uint32_t offset = info->op1.i; // legacy: offset in op1
-      uint32_t input = info->op2.i;
-      snprintf(name, sizeof(name), input_name_format, input, offset);
-      z3::symbol symbol = context_.str_symbol(name);
-      z3::sort sort = context_.bv_sort(8);
-      tsize_cache_.emplace_back(1);
-      input_deps.insert(std::make_pair(input, offset));
-      // caching is not super helpful
-      cache_expr(l, context_.constant(symbol, sort));
-      RECORD_VALUE(inputs_cache_[input].first[offset]);
-      continue;
-    } else if (info->op == __dfsan::Load) {
-      uint32_t offset = get_label_info(info->l1)->op1.i; // legacy: offset in op1
-      uint32_t input = get_label_info(info->l1)->op2.i;
-      snprintf(name, sizeof(name), input_name_format, input, offset);
-      z3::symbol symbol = context_.str_symbol(name);
-      z3::sort sort = context_.bv_sort(8);
-      z3::expr out = context_.constant(symbol, sort);
-      input_deps.insert(std::make_pair(input, offset));
+  dfsan_label_info *info = get_label_info(l);
+  if (info->op == 0 && info->size == 0) {
+    // not written yet, e.g., the unused tail of a thread's label chunk
+    return;
+  }
+  if (info->l1 >= l || (info->op != __dfsan::Load && info->l2 >= l)) {
+    throw z3::exception("invalid label");
+  }
+  // fprintf(stderr, "%u = (l1:%u, l2:%u, op:%s, size:%u, op1:%lu, op2:%lu)\n",
+  //         l, info->l1, info->l2, get_op_name(info->op).c_str(),
+  //         info->size, info->op1.i, info->op2.i);
+  input_dep_set_t &input_deps = deps_cache_[l];
+
+  // special ops
+  char name[256];
+  if (info->op == 0) {
+    // input
+    uint32_t offset = info->op1.i; // legacy: offset in op1
+    uint32_t input = info->op2.i;
+    snprintf(name, sizeof(name), input_name_format, input, offset);
+    z3::symbol symbol = context_.str_symbol(name);
+    z3::sort sort = context_.bv_sort(8);
+    tsize_cache_[l] = 1;
+    input_deps.insert(std::make_pair(input, offset));
+    // caching is not super helpful
+    cache_expr(l, context_.constant(symbol, sort));
+    RECORD_VALUE(inputs_cache_[input].first[offset]);
+    return;
+  } else if (info->op == __dfsan::Load) {
+    uint32_t offset = get_label_info(info->l1)->op1.i; // legacy: offset in op1
+    uint32_t input = get_label_info(info->l1)->op2.i;
+    snprintf(name, sizeof(name), input_name_format, input, offset);
+    z3::symbol symbol = context_.str_symbol(name);
+    z3::sort sort = context_.bv_sort(8);
+    z3::expr out = context_.constant(symbol, sort);
+    input_deps.insert(std::make_pair(input, offset));
 #if FILTER_WRONG_AST
-      uint64_t val = inputs_cache_[input].first[offset];
+    uint64_t val = inputs_cache_[input].first[offset];
 #endif
-      for (uint32_t i = 1; i < info->l2; i++) {
-        snprintf(name, sizeof(name), input_name_format, input, offset + i);
-        symbol = context_.str_symbol(name);
-        out = z3::concat(context_.constant(symbol, sort), out);
-        input_deps.insert(std::make_pair(input, offset + i));
+    for (uint32_t i = 1; i < info->l2; i++) {
+      snprintf(name, sizeof(name), input_name_format, input, offset + i);
+      symbol = context_.str_symbol(name);
+      out = z3::concat(context_.constant(symbol, sort), out);
+      input_deps.insert(std::make_pair(input, offset + i));
 #if FILTER_WRONG_AST
-        val |= (uint64_t)inputs_cache_[input].first[offset + i] << (i * 8);
+      val |= (uint64_t)inputs_cache_[input].first[offset + i] << (i * 8);
 #endif
-      }
-      tsize_cache_.emplace_back(1);
-      cache_expr(l, out);
-      RECORD_VALUE(val);
-      continue;
-    } else if (info->op == __dfsan::ZExt) {
-      z3::expr base = get_cached_expr(info->l1, input_deps);
-      if (base.is_bool()) // dirty hack since llvm lacks bool
-        base = z3::ite(base, context_.bv_val(1, 1),
-                            context_.bv_val(0, 1));
-      uint32_t base_size = base.get_sort().bv_size();
-      tsize_cache_.emplace_back(tsize_cache_[info->l1]);
-      cache_expr(l, z3::zext(base, info->size - base_size));
-      RECORD_VALUE(value_cache_[info->l1] & ((1UL << base_size) - 1));
-      continue;
-    } else if (info->op == __dfsan::SExt) {
-      z3::expr base = get_cached_expr(info->l1, input_deps);
-      uint32_t base_size = base.get_sort().bv_size();
-      tsize_cache_.emplace_back(tsize_cache_[info->l1]);
-      cache_expr(l, z3::sext(base, info->size - base_size));
-      RECORD_VALUE((int64_t)(value_cache_[info->l1] & ((1UL << base_size) - 1)));
-      continue;
-    } else if (info->op == __dfsan::Trunc) {
-      z3::expr base = get_cached_expr(info->l1, input_deps);
-      tsize_cache_.emplace_back(tsize_cache_[info->l1]);
-      cache_expr(l, base.extract(info->size - 1, 0));
-      RECORD_VALUE(value_cache_[info->l1] & ((1UL << info->size) - 1));
-      continue;
-    } else if (info->op == __dfsan::IntToPtr) {
-      z3::expr e = get_cached_expr(info->l1, input_deps);
-      tsize_cache_.emplace_back(tsize_cache_[info->l1]);
-      cache_expr(l, e);
-      RECORD_VALUE(value_cache_[info->l1]);
-      continue;
-    } //FIXME: other casting ops (PtrToInt, BitCast)?
-    // symsan-defined
-    else if (info->op == __dfsan::Extract) {
-      z3::expr base = get_cached_expr(info->l1, input_deps);
-      tsize_cache_.emplace_back(tsize_cache_[info->l1]);
-      cache_expr(l, base.extract((info->op2.i + info->size) - 1, info->op2.i));
-      RECORD_VALUE((value_cache_[info->l1] >> info->op2.i) &
-                    ((1UL << info->size) - 1));
-      continue;
-    } else if (info->op == __dfsan::Not) {
-      if (info->l2 == 0 || info->size != 1) {
-        throw z3::exception("invalid Not operation");
-      }
-      z3::expr e = get_cached_expr(info->l2, input_deps);
-      tsize_cache_.emplace_back(tsize_cache_[info->l2]);
-      if (!e.is_bool()) {
-        throw z3::exception("Only LNot should be recorded");
-      }
-      cache_expr(l, !e);
-      RECORD_VALUE(!value_cache_[info->l2]);
-      continue;
-    } else if (info->op == __dfsan::Neg) {
-      if (info->l2 == 0) {
-        throw z3::exception("invalid Neg predicate");
-      }
-      z3::expr e = get_cached_expr(info->l2, input_deps);
-      tsize_cache_.emplace_back(tsize_cache_[info->l2]);
-      cache_expr(l, -e);
-      RECORD_VALUE(-value_cache_[info->l2]);
-      continue;
     }
-    // higher-order
-    else if (info->op == __dfsan::fmemcmp) {
-      z3::expr op1 = (info->l1 >= CONST_OFFSET) ?
-                     get_cached_expr(info->l1, input_deps) :
-                     read_concrete(l, info->size); // memcmp size in bytes
-      if (info->l2 < CONST_OFFSET) {
-        throw z3::exception("invalid memcmp operand2");
-      }
-      z3::expr op2 = get_cached_expr(info->l2, input_deps);
-      tsize_cache_.emplace_back(1);
-      z3::expr e = z3::ite(op1 == op2, context_.bv_val(0, 32),
-                                       context_.bv_val(1, 32));
-      cache_expr(l, e);
-      RECORD_VALUE(0); // memcmp result is always 0 or 1
-      continue;
-    } else if (info->op == __dfsan::fsize) {
-      // file size
-      z3::symbol symbol = context_.str_symbol("fsize");
-      z3::sort sort = context_.bv_sort(info->size);
-      z3::expr base = context_.constant(symbol, sort);
-      tsize_cache_.emplace_back(1);
-      has_fsize = true; // XXX: set a flag
-      // don't cache because of deps
-      if (info->op1.i) {
-        // minus the offset stored in op1
-        z3::expr offset = context_.bv_val((uint64_t)info->op1.i, info->size);
-        cache_expr(l, base - offset);
-      } else {
-        cache_expr(l, base);
-      }
-      RECORD_VALUE(0); // FIXME: map to input size
-      continue;
-    } else if (info->op == __dfsan::fatoi) {
-      // string to integer conversion
-      assert(info->l1 == 0 && info->l2 >= CONST_OFFSET);
-      dfsan_label_info *src = get_label_info(info->l2);
-      assert(src->op == __dfsan::Load);
-      uint32_t offset = get_label_info(src->l1)->op1.i; // legacy: offset in op1
-      uint32_t input = get_label_info(src->l1)->op2.i;
-      int base = info->op1.i;
-      // FIXME: dependencies?
-      tsize_cache_.emplace_back(1);
-      // XXX: hacky, avoid string theory
-      snprintf(name, sizeof(name), atoi_name_format, input, offset, base);
-      z3::symbol symbol = context_.str_symbol(name);
-      z3::sort sort = context_.bv_sort(info->size);
-      cache_expr(l, context_.constant(symbol, sort));
-      RECORD_VALUE(0); // FIXME: map to atoi result?
-      continue;
-    } else if (info->op == __dfsan::Alloca || info->op == __dfsan::Free) {
-      // not expression, do nothing
-      tsize_cache_.emplace_back(0);
-      expr_cache_.emplace_back(nullptr);
-      RECORD_VALUE(0);
-      continue;
+    tsize_cache_[l] = 1;
+    cache_expr(l, out);
+    RECORD_VALUE(val);
+    return;
+  } else if (info->op == __dfsan::ZExt) {
+    z3::expr base = get_cached_expr(info->l1, input_deps);
+    if (base.is_bool()) // dirty hack since llvm lacks bool
+      base = z3::ite(base, context_.bv_val(1, 1),
+                          context_.bv_val(0, 1));
+    uint32_t base_size = base.get_sort().bv_size();
+    tsize_cache_[l] = tsize_cache_[info->l1];
+    cache_expr(l, z3::zext(base, info->size - base_size));
+    RECORD_VALUE(value_cache_[info->l1] & ((1UL << base_size) - 1));
+    return;
+  } else if (info->op == __dfsan::SExt) {
+    z3::expr base = get_cached_expr(info->l1, input_deps);
+    uint32_t base_size = base.get_sort().bv_size();
+    tsize_cache_[l] = tsize_cache_[info->l1];
+    cache_expr(l, z3::sext(base, info->size - base_size));
+    RECORD_VALUE((int64_t)(value_cache_[info->l1] & ((1UL << base_size) - 1)));
+    return;
+  } else if (info->op == __dfsan::Trunc) {
+    z3::expr base = get_cached_expr(info->l1, input_deps);
+    tsize_cache_[l] = tsize_cache_[info->l1];
+    cache_expr(l, base.extract(info->size - 1, 0));
+    RECORD_VALUE(value_cache_[info->l1] & ((1UL << info->size) - 1));
+    return;
+  } else if (info->op == __dfsan::IntToPtr) {
+    z3::expr e = get_cached_expr(info->l1, input_deps);
+    tsize_cache_[l] = tsize_cache_[info->l1];
+    cache_expr(l, e);
+    RECORD_VALUE(value_cache_[info->l1]);
+    return;
+  } //FIXME: other casting ops (PtrToInt, BitCast)?
+  // symsan-defined
+  else if (info->op == __dfsan::Extract) {
+    z3::expr base = get_cached_expr(info->l1, input_deps);
+    tsize_cache_[l] = tsize_cache_[info->l1];
+    cache_expr(l, base.extract((info->op2.i + info->size) - 1, info->op2.i));
+    RECORD_VALUE((value_cache_[info->l1] >> info->op2.i) &
+                  ((1UL << info->size) - 1));
+    return;
+  } else if (info->op == __dfsan::Not) {
+    if (info->l2 == 0 || info->size != 1) {
+      throw z3::exception("invalid Not operation");
+    }
+    z3::expr e = get_cached_expr(info->l2, input_deps);
+    tsize_cache_[l] = tsize_cache_[info->l2];
+    if (!e.is_bool()) {
+      throw z3::exception("Only LNot should be recorded");
     }
+    cache_expr(l, !e);
+    RECORD_VALUE(!value_cache_[info->l2]);
+    return;
+  } else if (info->op == __dfsan::Neg) {
+    if (info->l2 == 0) {
+      throw z3::exception("invalid Neg predicate");
+    }
+    z3::expr e = get_cached_expr(info->l2, input_deps);
+    tsize_cache_[l] = tsize_cache_[info->l2];
+    cache_expr(l, -e);
+    RECORD_VALUE(-value_cache_[info->l2]);
+    return;
+  }
+  // higher-order
+  else if (info->op == __dfsan::fmemcmp) {
+    z3::expr op1 = (info->l1 >= CONST_OFFSET) ?
+                   get_cached_expr(info->l1, input_deps) :
+                   read_concrete(l, info->size); // memcmp size in bytes
+    if (info->l2 < CONST_OFFSET) {
+      throw z3::exception("invalid memcmp operand2");
+    }
+    z3::expr op2 = get_cached_expr(info->l2, input_deps);
+    tsize_cache_[l] = 1;
+    z3::expr e = z3::ite(op1 == op2, context_.bv_val(0, 32),
+                                     context_.bv_val(1, 32));
+    cache_expr(l, e);
+    RECORD_VALUE(0); // memcmp result is always 0 or 1
+    return;
+  } else if (info->op == __dfsan::fsize) {
+    // file size
+    z3::symbol symbol = context_.str_symbol("fsize");
+    z3::sort sort = context_.bv_sort(info->size);
+    z3::expr base = context_.constant(symbol, sort);
+    tsize_cache_[l] = 1;
+    has_fsize = true; // XXX: set a flag
+    // don't cache because of deps
+    if (info->op1.i) {
+      // minus the offset stored in op1
+      z3::expr offset = context_.bv_val((uint64_t)info->op1.i, info->size);
+      cache_expr(l, base - offset);
+    } else {
+      cache_expr(l, base);
+    }
+    RECORD_VALUE(0); // FIXME: map to input size
+    return;
+  } else if (info->op == __dfsan::fatoi) {
+    // string to integer conversion
+    assert(info->l1 == 0 && info->l2 >= CONST_OFFSET);
+    dfsan_label_info *src = get_label_info(info->l2);
+    assert(src->op == __dfsan::Load);
+    uint32_t offset = get_label_info(src->l1)->op1.i; // legacy: offset in op1
+    uint32_t input = get_label_info(src->l1)->op2.i;
+    int base = info->op1.i;
+    // FIXME: dependencies?
+    tsize_cache_[l] = 1;
+    // XXX: hacky, avoid string theory
+    snprintf(name, sizeof(name), atoi_name_format, input, offset, base);
+    z3::symbol symbol = context_.str_symbol(name);
+    z3::sort sort = context_.bv_sort(info->size);
+    cache_expr(l, context_.constant(symbol, sort));
+    RECORD_VALUE(0); // FIXME: map to atoi result?
+    return;
+  } else if (info->op == __dfsan::Alloca || info->op == __dfsan::Free) {
+    // not expression, do nothing
+    tsize_cache_[l] = 0;
+    RECORD_VALUE(0);
+    return;
+  }
 
-    // common ops
-    uint8_t size = info->size;
-    uint64_t valmask = size < 64 ? (1UL << size) - 1 : ~0UL;
-    // size for concat is a bit complicated ...
-    if (info->op == __dfsan::Concat && info->l1 == 0) {
-      assert(info->l2 >= CONST_OFFSET);
-      size = info->size - get_label_info(info->l2)->size;
-      valmask = (1UL << size) - 1;
-    }
-    z3::expr op1 = context_.bv_val((uint64_t)info->op1.i, size);
-    uint64_t val1 = info->op1.i & valmask;
-    if (info->l1 >= CONST_OFFSET) {
-      op1 = get_cached_expr(info->l1, input_deps).simplify();
-      if (op1.is_bv() && info->op != __dfsan::Concat) {
-        // XXX: fix size mismatch, only for bv and not concat
-        uint8_t op_size = op1.get_sort().bv_size();
-        if (op_size > size) {
-          op1 = op1.extract(size - 1, 0);
-        } else if (op_size < size) {
-          op1 = z3::zext(op1, size - op_size);
-        }
+  // common ops
+  uint8_t size = info->size;
+  uint64_t valmask = size < 64 ? (1UL << size) - 1 : ~0UL;
+  // size for concat is a bit complicated ...
+  if (info->op == __dfsan::Concat && info->l1 == 0) {
+    assert(info->l2 >= CONST_OFFSET);
+    size = info->size - get_label_info(info->l2)->size;
+    valmask = (1UL << size) - 1;
+  }
+  z3::expr op1 = context_.bv_val((uint64_t)info->op1.i, size);
+  uint64_t val1 = info->op1.i & valmask;
+  if (info->l1 >= CONST_OFFSET) {
+    op1 = get_cached_expr(info->l1, input_deps).simplify();
+    if (op1.is_bv() && info->op != __dfsan::Concat) {
+      // XXX: fix size mismatch, only for bv and not concat
+      uint8_t op_size = op1.get_sort().bv_size();
+      if (op_size > size) {
+        op1 = op1.extract(size - 1, 0);
+      } else if (op_size < size) {
+        op1 = z3::zext(op1, size - op_size);
       }
+    }
 #if FILTER_WRONG_AST
-      val1 = value_cache_[info->l1] & valmask;
+    val1 = value_cache_[info->l1] & valmask;
 #endif
-    } else if (info->size == 1) {
-      op1 = context_.bool_val(info->op1.i == 1);
-    }
-    // handle op2
-    if (info->op == __dfsan::Concat && info->l2 == 0) {
-      assert(info->l1 >= CONST_OFFSET);
-      size = info->size - get_label_info(info->l1)->size;
-      valmask = (1UL << size) - 1;
-    }
-    z3::expr op2 = context_.bv_val((uint64_t)info->op2.i, size);
-    uint64_t val2 = info->op2.i & valmask;
-    if (info->l2 >= CONST_OFFSET) {
-      op2 = get_cached_expr(info->l2, input_deps).simplify();
-      if (op2.is_bv() && info->op != __dfsan::Concat) {
-        // XXX: fix size mismatch, only for bv and not concat
-        uint8_t op_size = op2.get_sort().bv_size();
-        if (op_size > size) {
-          op2 = op2.extract(size - 1, 0);
-        } else if (op_size < size) {
-          op2 = z3::zext(op2, size - op_size);
-        }
+  } else if (info->size == 1) {
+    op1 = context_.bool_val(info->op1.i == 1);
+  }
+  // handle op2
+  if (info->op == __dfsan::Concat && info->l2 == 0) {
+    assert(info->l1 >= CONST_OFFSET);
+    size = info->size - get_label_info(info->l1)->size;
+    valmask = (1UL << size) - 1;
+  }
+  z3::expr op2 = context_.bv_val((uint64_t)info->op2.i, size);
+  uint64_t val2 = info->op2.i & valmask;
+  if (info->l2 >= CONST_OFFSET) {
+    op2 = get_cached_expr(info->l2, input_deps).simplify();
+    if (op2.is_bv() && info->op != __dfsan::Concat) {
+      // XXX: fix size mismatch, only for bv and not concat
+      uint8_t op_size = op2.get_sort().bv_size();
+      if (op_size > size) {
+        op2 = op2.extract(size - 1, 0);
+      } else if (op_size < size) {
+        op2 = z3::zext(op2, size - op_size);
       }
+    }
 #if FILTER_WRONG_AST
-      val2 = value_cache_[info->l2] & valmask;
+    val2 = value_cache_[info->l2] & valmask;
 #endif
-    } else if (info->size == 1) {
-      op2 = context_.bool_val(info->op2.i == 1);
+  } else if (info->size == 1) {
+    op2 = context_.bool_val(info->op2.i == 1);
+  }
+  // update tree_size
+  tsize_cache_[l] = tsize_cache_[info->l1] + tsize_cache_[info->l2];
+
+  switch((info->op & 0xff)) {
+    // llvm doesn't distinguish between logical and bitwise and/or/xor
+    case __dfsan::And: {
+      cache_expr(l, info->size != 1 ? (op1 & op2) : (op1 && op2));
+      RECORD_VALUE((info->size != 1) ? (val1 & val2) : (val1 && val2));
+      break;
     }
-    // update tree_size
-    tsize_cache_.emplace_back(tsize_cache_[info->l1] + tsize_cache_[info->l2]);
-
-    switch((info->op & 0xff)) {
-      // llvm doesn't distinguish between logical and bitwise and/or/xor
-      case __dfsan::And: {
-        cache_expr(l, info->size != 1 ? (op1 & op2) : (op1 && op2));
-        RECORD_VALUE((info->size != 1) ? (val1 & val2) : (val1 && val2));
-        break;
-      }
-      case __dfsan::Or: {
-        cache_expr(l, info->size != 1 ? (op1 | op2) : (op1 || op2));
-        RECORD_VALUE((info->size != 1) ? (val1 | val2) : (val1 || val2));
-        break;
-      }
-      case __dfsan::Xor: {
-        cache_expr(l, op1 ^ op2);
-        RECORD_VALUE(val1 ^ val2);
-        break;
-      }
-      case __dfsan::Shl: {
-        cache_expr(l, z3::shl(op1, op2));
-        RECORD_VALUE(val1 << (val2 % size));
-        break;
-      }
-      case __dfsan::LShr: {
-        cache_expr(l, z3::lshr(op1, op2));
-        RECORD_VALUE(val1 >> (val2 % size));
-        break;
-      }
-      case __dfsan::AShr: {
-        cache_expr(l, z3::ashr(op1, op2));
-        RECORD_VALUE((int64_t)val1 >> (val2 % size));
-        break;
-      }
-      case __dfsan::Add: {
-        cache_expr(l, op1 + op2);
-        RECORD_VALUE(val1 + val2);
-        break;
-      }
-      case __dfsan::Sub: {
-        cache_expr(l, op1 - op2);
-        RECORD_VALUE(val1 - val2);
-        break;
-      }
-      case __dfsan::Mul: {
-        cache_expr(l, op1 * op2);
-        RECORD_VALUE(val1 * val2);
-        break;
-      }
-      case __dfsan::UDiv: {
-        cache_expr(l, z3::udiv(op1, op2));
-        if (val2 == 0) {
-          fprintf(stderr, "WARNING: division by zero for label %u\n", l);
-          RECORD_VALUE(0);
-        } else
-          RECORD_VALUE(val1 / val2);
-        break;
-      }
-      case __dfsan::SDiv: {
-        cache_expr(l, op1 / op2);
-        if (val2 == 0) {
-          fprintf(stderr, "WARNING: division by zero for label %u\n", l);
-          RECORD_VALUE(0);
-        } else
-          RECORD_VALUE((int64_t)val1 / (int64_t)val2);
-        break;
-      }
-      case __dfsan::URem: {
-        cache_expr(l, z3::urem(op1, op2));
-        if (val2 == 0) {
-          fprintf(stderr, "WARNING: division by zero for label %u\n", l);
-          RECORD_VALUE(0);
-        } else
-          RECORD_VALUE(val1 % val2);
-        break;
-      }
-      case __dfsan::SRem: {
-        cache_expr(l, z3::srem(op1, op2));
-        if (val2 == 0) {
-          fprintf(stderr, "WARNING: division by zero for label %u\n", l);
-          RECORD_VALUE(0);
-        } else
-          RECORD_VALUE((int64_t)val1 % (int64_t)val2);
-        break;
-      }
-      // relational
-      case __dfsan::ICmp: {
-        cache_expr(l, get_cmd(op1, op2, info->op >> 8));
+    case __dfsan::Or: {
+      cache_expr(l, info->size != 1 ? (op1 | op2) : (op1 || op2));
+      RECORD_VALUE((info->size != 1) ? (val1 | val2) : (val1 || val2));
+      break;
+    }
+    case __dfsan::Xor: {
+      cache_expr(l, op1 ^ op2);
+      RECORD_VALUE(val1 ^ val2);
+      break;
+    }
+    case __dfsan::Shl: {
+      cache_expr(l, z3::shl(op1, op2));
+      RECORD_VALUE(val1 << (val2 % size));
+      break;
+    }
+    case __dfsan::LShr: {
+      cache_expr(l, z3::lshr(op1, op2));
+      RECORD_VALUE(val1 >> (val2 % size));
+      break;
+    }
+    case __dfsan::AShr: {
+      cache_expr(l, z3::ashr(op1, op2));
+      RECORD_VALUE((int64_t)val1 >> (val2 % size));
+      break;
+    }
+    case __dfsan::Add: {
+      cache_expr(l, op1 + op2);
+      RECORD_VALUE(val1 + val2);
+      break;
+    }
+    case __dfsan::Sub: {
+      cache_expr(l, op1 - op2);
+      RECORD_VALUE(val1 - val2);
+      break;
+    }
+    case __dfsan::Mul: {
+      cache_expr(l, op1 * op2);
+      RECORD_VALUE(val1 * val2);
+      break;
+    }
+    case __dfsan::UDiv: {
+      cache_expr(l, z3::udiv(op1, op2));
+      if (val2 == 0) {
+        fprintf(stderr, "WARNING: division by zero for label %u\n", l);
+        RECORD_VALUE(0);
+      } else
+        RECORD_VALUE(val1 / val2);
+      break;
+    }
+    case __dfsan::SDiv: {
+      cache_expr(l, op1 / op2);
+      if (val2 == 0) {
+        fprintf(stderr, "WARNING: division by zero for label %u\n", l);
+        RECORD_VALUE(0);
+      } else
+        RECORD_VALUE((int64_t)val1 / (int64_t)val2);
+      break;
+    }
+    case __dfsan::URem: {
+      cache_expr(l, z3::urem(op1, op2));
+      if (val2 == 0) {
+        fprintf(stderr, "WARNING: division by zero for label %u\n", l);
+        RECORD_VALUE(0);
+      } else
+        RECORD_VALUE(val1 % val2);
+      break;
+    }
+    case __dfsan::SRem: {
+      cache_expr(l, z3::srem(op1, op2));
+      if (val2 == 0) {
+        fprintf(stderr, "WARNING: division by zero for label %u\n", l);
+        RECORD_VALUE(0);
+      } else
+        RECORD_VALUE((int64_t)val1 % (int64_t)val2);
+      break;
+    }
+    // relational
+    case __dfsan::ICmp: {
+      cache_expr(l, get_cmd(op1, op2, info->op >> 8));
 #if FILTER_WRONG_AST
-        // we have both operands recorded for ICmp
-        if ((info->op1.i & valmask) != val1 ||
-            (info->op2.i & valmask) != val2) {
-          // fprintf(stderr, "WARNING: value mismatch for label %u:"
-          //         "expected op1 %lu, got %lu, expected op2 %lu, got %lu\n",
-          //         l, info->op1.i, val1, info->op2.i, val2);
-          // fprintf(stderr, "cond: %s\n", get_cmd(op1, op2, info->op >> 8).to_string().c_str());
-          // dump_value_cache(info->l1);
-          // dump_value_cache(info->l2);
-
-          // memcmp is a special case, just fix it for now
-          bool is_memcmp = false;
-          if (get_label_info(info->l1)->op == __dfsan::fmemcmp) {
-            value_cache_[info->l1] = val1 = info->op1.i;
-            is_memcmp = true;
-          }
-          if (get_label_info(info->l2)->op == __dfsan::fmemcmp) {
-            value_cache_[info->l2] = val2 = info->op2.i;
-            is_memcmp = true;
-          }
-          if (!is_memcmp)
-            throw z3::exception("value mismatch for ICmp");
+      // we have both operands recorded for ICmp
+      if ((info->op1.i & valmask) != val1 ||
+          (info->op2.i & valmask) != val2) {
+        // fprintf(stderr, "WARNING: value mismatch for label %u:"
+        //         "expected op1 %lu, got %lu, expected op2 %lu, got %lu\n",
+        //         l, info->op1.i, val1, info->op2.i, val2);
+        // fprintf(stderr, "cond: %s\n", get_cmd(op1, op2, info->op >> 8).to_string().c_str());
+        // dump_value_cache(info->l1);
+        // dump_value_cache(info->l2);
+
+        // memcmp is a special case, just fix it for now
+        bool is_memcmp = false;
+        if (get_label_info(info->l1)->op == __dfsan::fmemcmp) {
+          value_cache_[info->l1] = val1 = info->op1.i;
+          is_memcmp = true;
         }
-        value_cache_.emplace_back(
-            eval_icmp(info->op >> 8, val1, val2, size) ? 1 : 0);
-#endif
-        break;
-      }
-      // concat
-      case __dfsan::Concat: {
-        cache_expr(l, z3::concat(op2, op1)); // little endian
-        RECORD_VALUE((val2 << op1.get_sort().bv_size()) | (val1));
-        break;
+        if (get_label_info(info->l2)->op == __dfsan::fmemcmp) {
+          value_cache_[info->l2] = val2 = info->op2.i;
+          is_memcmp = true;
+        }
+        if (!is_memcmp)
+          throw z3::exception("value mismatch for ICmp");
       }
-      default:
-        fprintf(stderr, "WARNING: unsupported operator %u for label %u\n",
-                info->op & 0xff, l);
-        throw z3::exception("unsupported operator");
-        break;
+      value_cache_[l] =
+          eval_icmp(info->op >> 8, val1, val2, size) ? 1 : 0;
+#endif
+      break;
+    }
+    // concat
+    case __dfsan::Concat: {
+      cache_expr(l, z3::concat(op2, op1)); // little endian
+      RECORD_VALUE((val2 << op1.get_sort().bv_size()) | (val1));
+      break;
     }
+    default:
+      fprintf(stderr, "WARNING: unsupported operator %u for label %u\n",
+              info->op & 0xff, l);
+      throw z3::exception("unsupported operator");
+      break;
   }
-
-  return get_cached_expr(label, deps);
 }
 
 int Z3AstParser::parse_cond(dfsan_label label, bool result, bool add_nested, std::vector<uint64_t> &tasks) {
@@ -605,8 +684,10 @@ int Z3AstParser::parse_cond(dfsan_label label, bool result, bool add_nested, std
     // collect additional input deps
     collect_more_deps(inputs);
 
-    // add nested constraints
+    // add nested constraints, only the ones related to the branch by the
+    // input bytes they actually read
     add_nested_constraints(inputs, task.get());
+    slice_independent(task->at(0), *task, 1);
 
     // save the task
     tasks.push_back(save_task(task));
@@ -651,18 +732,40 @@ int Z3AstParser::parse_gep(dfsan_label ptr_label, uptr ptr, dfsan_label index_la
                            uint64_t num_elems, uint64_t elem_size, int64_t current_offset,
                            bool enum_index, std::vector<uint64_t> &tasks) {
 
-  if (index_label < CONST_OFFSET ||
-      index_label == __dfsan::kInitializingLabel || index_label >= size_ ||
-      ptr_label == __dfsan::kInitializingLabel || ptr_label >= size_) {
-    // invalid label
+  if (invalid_gep_labels(ptr_label, index_label)) {
     return -1;
   }
 
   // early return if nothing to do
-  if (!enum_index || // if we are not enumerating the index
-      (num_elems == 0 && // if the GEP type is not an array,
-       // and we also don't have a pointer label
-       ptr_label == 0)) {
+  if (!enum_index) { // if we are not enumerating the index
+    return 0;
+  }
+
+  std::unique_ptr<index_range> range;
+  if (parse_gep_range(ptr_label, ptr, index_label, index, num_elems, elem_size,
+                      current_offset, range)) {
+    return -1;
+  }
+  if (range) {
+    construct_index_tasks(range->index, range->curr, range->lb, range->ub,
+                          range->step, range->nested, tasks);
+  }
+  return 0;
+}
+
+int Z3AstParser::parse_gep_range(dfsan_label ptr_label, uptr ptr,
+                                 dfsan_label index_label, int64_t index,
+                                 uint64_t num_elems, uint64_t elem_size,
+                                 int64_t current_offset,
+                                 std::unique_ptr<index_range> &range) {
+
+  if (invalid_gep_labels(ptr_label, index_label)) {
+    return -1;
+  }
+
+  // early return if nothing to do
+  if (num_elems == 0 && // if the GEP type is not an array,
+      ptr_label == 0) { // and we also don't have a pointer label
     return 0;
   }
 
@@ -687,11 +790,13 @@ int Z3AstParser::parse_gep(dfsan_label ptr_label, uptr ptr, dfsan_label index_la
     collect_more_deps(inputs);
     z3_task_t nested_tasks;
     add_nested_constraints(inputs, &nested_tasks);
+    slice_independent(i, nested_tasks, 0);
 
     // first, check against fixed array bounds if available
     z3::expr idx = z3::zext(i, 64 - size);
     if (num_elems > 0) {
-      construct_index_tasks(idx, index, 0, num_elems, 1, nested_tasks, tasks);
+      range.reset(new index_range{idx, (uint64_t)index, 0, num_elems, 1,
+                                  std::move(nested_tasks)});
     } else {
       dfsan_label_info *bounds = get_label_info(ptr_label);
       // fprintf(stderr, "GEP bounds: lower=0x%lx, upper=0x%lx)\n",
@@ -707,8 +812,11 @@ int Z3AstParser::parse_gep(dfsan_label ptr_label, uptr ptr, dfsan_label index_la
           // when the size of the buffer is fixed
           z3::expr p = context_.bv_val(ptr, 64);
           z3::expr np = idx * es + co + p;
-          construct_index_tasks(np, index, (uint64_t)bounds->op1.i,
-              (uint64_t)bounds->op2.i, elem_size, nested_tasks, tasks);
+          // the range is of addresses, so is the current value
+          uint64_t curr = ptr + index * elem_size + current_offset;
+          range.reset(new index_range{np, curr,
+              (uint64_t)bounds->op1.i, (uint64_t)bounds->op2.i, elem_size,
+              std::move(nested_tasks)});
         }
       }
     }
@@ -722,6 +830,7 @@ int Z3AstParser::parse_gep(dfsan_label ptr_label, uptr ptr, dfsan_label index_la
   }
 
   // exception happened, nothing added
+  range.reset();
   return -1;
 }
 
@@ -858,69 +967,566 @@ size_t Z3AstParser::add_nested_constraints(input_dep_set_t &inputs, z3_task_t *t
   return added.size();
 }
 
+namespace {
+// union-find over the input variables of the constraints, keyed by the ids
+// of the z3 constants
+struct var_partition {
+  std::unordered_map<unsigned, unsigned> parent;
+  // a variable in each visited expr, if any
+  std::unordered_map<unsigned, int64_t> var_of;
+  // variables whose relation to the input bytes is not explicit
+  bool opaque = false;
+
+  unsigned find(unsigned x) {
+    while (parent[x] != x) {
+      x = parent[x] = parent[parent[x]];
+    }
+    return x;
+  }
+
+  int64_t visit(const z3::expr &e) {
+    auto itr = var_of.find(e.id());
+    if (itr != var_of.end()) {
+      return itr->second;
+    }
+    int64_t var = -1;
+    if (e.is_const() && e.decl().decl_kind() == Z3_OP_UNINTERPRETED) {
+      var = e.id();
+      parent.emplace(var, var);
+      if (e.decl().name().str().find("input") != 0) {
+        opaque = true;
+      }
+    } else if (e.is_app()) {
+      for (unsigned i = 0; i < e.num_args(); i++) {
+        int64_t v = visit(e.arg(i));
+        if (v < 0) {
+          continue;
+        } else if (var < 0) {
+          var = v;
+        } else {
+          parent[find(v)] = find(var);
+        }
+      }
+    }
+    var_of.emplace(e.id(), var);
+    return var;
+  }
+};
+}
+
+size_t Z3AstParser::slice_independent(const z3::expr &root, z3_task_t &task,
+                                      size_t first) {
+  if (task.size() <= first) {
+    return 0;
+  }
+  var_partition vars;
+  int64_t root_var = vars.visit(root);
+  std::vector<int64_t> task_vars;
+  for (size_t i = first; i < task.size(); i++) {
+    task_vars.push_back(vars.visit(task[i]));
+  }
+  // atoi and fsize variables stand for input bytes, which we can't tell
+  if (vars.opaque || root_var < 0) {
+    return 0;
+  }
+
+  unsigned root_set = vars.find(root_var);
+  size_t kept = first;
+  for (size_t i = first; i < task.size(); i++) {
+    int64_t v = task_vars[i - first];
+    // constraints without variables are kept unless trivial
+    if (v < 0 ? !task[i].is_true() : vars.find(v) == root_set) {
+      task[kept++] = task[i];
+    }
+  }
+  size_t dropped = task.size() - kept;
+  task.erase(task.begin() + kept, task.end());
+  return dropped;
+}
+
+int Z3AstParser::export_task(uint64_t task_id, std::string &smt2) {
+  auto task = retrieve_task(task_id);
+  if (task == nullptr) {
+    return -1;
+  }
+
+  try {
+    // the assertions keep their order, so the optimistic one stays first
+    z3::solver solver(context_);
+    for (auto const& e : *task) {
+      solver.add(e);
+    }
+    smt2 = solver.to_smt2();
+  } catch (z3::exception ze) {
+    return -1;
+  }
+  return 0;
+}
+
+int Z3AstParser::export_gep(dfsan_label ptr_label, uptr ptr,
+                            dfsan_label index_label, int64_t index,
+                            uint64_t num_elems, uint64_t elem_size,
+                            int64_t current_offset, exported_gep &gep) {
+  std::unique_ptr<index_range> range;
+  gep.smt2.clear();
+  if (parse_gep_range(ptr_label, ptr, index_label, index, num_elems, elem_size,
+                      current_offset, range)) {
+    return -1;
+  }
+  if (!range || range->ub <= range->lb || range->step == 0) {
+    return 0;
+  }
+
+  try {
+    z3::solver solver(context_);
+    solver.add(range->index == context_.bv_val(range->curr, 64));
+    for (auto const& e : range->nested) {
+      solver.add(e);
+    }
+    gep.smt2 = solver.to_smt2();
+  } catch (z3::exception ze) {
+    return -1;
+  }
+  gep.curr = range->curr;
+  gep.lb = range->lb;
+  gep.ub = range->ub;
+  gep.step = range->step;
+  return 0;
+}
+
+// parse the assertions from export_task or export_gep, in order
+static void parse_exported(z3::context &context, const std::string &smt2,
+                           z3_task_t &task) {
+  z3::expr_vector exprs = context.parse_string(smt2.c_str());
+  for (unsigned i = 0; i < exprs.size(); i++) {
+    // to_smt2 prints one of the assertions as (and e true), unwrap it so
+    // the task is the same as exported, e.g., for the query cache and the
+    // literals of the session
+    z3::expr e = exprs[i];
+    if (e.is_and() && e.num_args() == 2 && e.arg(1).is_true()) {
+      e = e.arg(0);
+    }
+    task.push_back(e);
+  }
+}
+
+int Z3ParserSolver::restart(std::vector<input_t> &inputs) {
+  // the constraints of the last run are stale
+  session_.reset();
+  return Z3AstParser::restart(inputs);
+}
+
+z3::expr Z3ParserSolver::Session::literal(const z3::expr &e) {
+  auto itr = lits_.find(e.id());
+  if (itr != lits_.end()) {
+    return itr->second;
+  }
+  // an int symbol, which generate_solution skips
+  z3::expr lit = context_.constant(context_.int_symbol(lits_.size()),
+                                   context_.bool_sort());
+  solver_->add(z3::implies(lit, e));
+  lits_.insert({e.id(), lit});
+  return lit;
+}
+
 Z3ParserSolver::solving_status
 Z3ParserSolver::solve_task(uint64_t task_id, unsigned timeout, solution_t &solutions) {
-  solving_status ret = unknown_error;
   auto task = retrieve_task(task_id);
   if (task == nullptr) {
     return invalid_task;
   }
+  return solve(session_, *task, timeout, solutions);
+}
 
+Z3ParserSolver::solving_status
+Z3ParserSolver::solve_exported(Session &session, const std::string &smt2,
+                               unsigned timeout, solution_t &solutions) const {
+  z3_task_t task;
   try {
-    // setup global solver
-    z3::solver solver(context_, "QF_BV");
+    parse_exported(session.context(), smt2, task);
+  } catch (z3::exception ze) {
+    return invalid_task;
+  }
+  if (task.empty()) {
+    return invalid_task;
+  }
+  return solve(session, task, timeout, solutions);
+}
+
+Z3ParserSolver::solving_status
+Z3ParserSolver::solve(Session &session, const z3_task_t &task,
+                      unsigned timeout, solution_t &solutions) const {
+  solving_status ret = unknown_error;
+  try {
+    QueryCache::query_t query;
+    bool nested_unsat = false;
+    if (query_cache_ &&
+        lookup_task(task, query, nested_unsat, ret, solutions)) {
+      return ret;
+    }
+    // known unsat nested constraints are not checked again
+    z3_task_t optimistic = {task.at(0)};
+    const z3_task_t &solving = nested_unsat ? optimistic : task;
+
+    if (!session.solver_) {
+      session.solver_ = std::make_unique<z3::solver>(session.context_, "QF_BV");
+    }
+    z3::solver &solver = *session.solver_;
+    z3::expr_vector assumptions(session.context_);
+    for (size_t i = 1; i < solving.size(); i++) {
+      assumptions.push_back(session.literal(solving.at(i)));
+    }
     solver.set("timeout", timeout);
-    // solve the first constraint (optimistic)
-    z3::expr e = task->at(0);
-    solver.add(e);
+    auto start = std::chrono::steady_clock::now();
+    solver.push();
+    solver.add(solving.at(0));
+    ret = check_task(solver, solving, assumptions, solutions);
+    solver.pop();
+    if (nested_unsat && ret == nested_sat) {
+      ret = opt_sat_nested_unsat;
+    }
+    if (query_cache_) {
+      cache_task(task, query, ret, solutions,
+                 std::chrono::duration_cast<std::chrono::microseconds>(
+                     std::chrono::steady_clock::now() - start).count());
+    }
+  } catch (z3::exception ze) {
+    // the session may be left in any scope
+    session.reset();
+    ret = unknown_error;
+  }
+  return ret;
+}
+
+// z3's own hash is structural, so it is the same across contexts and runs,
+// but only 32 bits, the children and the values are mixed in once more
+static uint64_t hash_expr(const z3::expr &e,
+                          std::unordered_map<unsigned, uint64_t> &memo) {
+  auto itr = memo.find(e.id());
+  if (itr != memo.end()) {
+    return itr->second;
+  }
+  uint64_t h = QueryCache::mix(0, e.hash());
+  uint64_t v;
+  if (e.is_numeral_u64(v)) {
+    h = QueryCache::mix(h, v);
+  } else if (e.is_const()) {
+    h = QueryCache::mix(h, std::hash<std::string>{}(e.decl().name().str()));
+  }
+  if (e.is_app()) {
+    for (unsigned i = 0; i < e.num_args(); i++) {
+      h = QueryCache::mix(h, hash_expr(e.arg(i), memo));
+    }
+  }
+  memo.emplace(e.id(), h);
+  return h;
+}
+
+static inline void to_solutions(const QueryCache::model_t &model,
+                                Z3ParserSolver::solution_t &solutions) {
+  solutions.clear();
+  for (auto const& [pos, value] : model) {
+    solutions.push_back({(uint32_t)(pos >> 32), (uint32_t)pos, value});
+  }
+}
+
+bool Z3ParserSolver::lookup_task(const z3_task_t &task,
+                                 QueryCache::query_t &query,
+                                 bool &nested_unsat, solving_status &ret,
+                                 solution_t &solutions) const {
+  std::unordered_map<unsigned, uint64_t> memo;
+  query.clear();
+  for (auto const& e : task) {
+    query.push_back(hash_expr(e, memo));
+  }
+  QueryCache::query_t optimistic = {query.front()};
+  QueryCache::normalize(query);
+
+  QueryCache::model_t model;
+  uint64_t cost = 0;
+  nested_unsat = false;
+  auto hit = query_cache_->lookup(query, model, cost, cache_stats_);
+  if (hit == QueryCache::candidate) {
+    if (!check_model(task, model)) {
+      return false;
+    }
+    cache_stats_.candidate_hits++;
+    cache_stats_.saved_us += cost;
+    hit = QueryCache::sat;
+  }
+  if (hit == QueryCache::sat) {
+    to_solutions(model, solutions);
+    ret = nested_sat;
+    return true;
+  } else if (hit != QueryCache::unsat) {
+    return false;
+  } else if (query.size() == 1) {
+    ret = opt_unsat;
+    return true;
+  }
+
+  // the whole task is unsat, the optimistic constraint alone may not be
+  hit = query_cache_->lookup(optimistic, model, cost, cache_stats_);
+  if (hit == QueryCache::sat) {
+    to_solutions(model, solutions);
+    ret = opt_sat_nested_unsat;
+    return true;
+  } else if (hit == QueryCache::unsat) {
+    ret = opt_unsat;
+    return true;
+  }
+  nested_unsat = true;
+  return false;
+}
+
+void Z3ParserSolver::cache_task(const z3_task_t &task,
+                                const QueryCache::query_t &query,
+                                solving_status ret,
+                                const solution_t &solutions,
+                                uint64_t cost) const {
+  std::unordered_map<unsigned, uint64_t> memo;
+  QueryCache::query_t optimistic = {hash_expr(task.at(0), memo)};
+  QueryCache::model_t model;
+  for (auto const& sol : solutions) {
+    model.push_back({(uint64_t)sol.id << 32 | sol.offset, sol.val});
+  }
+  switch (ret) {
+    case opt_unsat:
+      query_cache_->insert(optimistic, false, model, cost);
+      break;
+    case nested_sat:
+      query_cache_->insert(query, true, model, cost);
+      break;
+    case opt_sat_nested_unsat:
+      query_cache_->insert(optimistic, true, model, cost);
+      query_cache_->insert(query, false, QueryCache::model_t(), cost);
+      break;
+    case opt_sat_nested_timeout:
+      query_cache_->insert(optimistic, true, model, cost);
+      break;
+    default:
+      break;
+  }
+}
+
+bool Z3ParserSolver::check_model(const z3_task_t &task,
+                                 const QueryCache::model_t &model) const {
+  z3::context &context = task.at(0).ctx();
+  z3::expr_vector src(context);
+  z3::expr_vector dst(context);
+  z3::sort sort = context.bv_sort(8);
+  char name[256];
+  for (auto const& [pos, value] : model) {
+    snprintf(name, sizeof(name), input_name_format,
+             (uint32_t)(pos >> 32), (uint32_t)pos);
+    src.push_back(context.constant(context.str_symbol(name), sort));
+    dst.push_back(context.bv_val(value, 8));
+  }
+  // the bytes not in the model are left symbolic, so any constraint on
+  // them fails the check
+  for (auto e : task) {
+    if (!e.substitute(src, dst).simplify().is_true()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// the uninterpreted constants, e.g., the input bytes, an expr depends on
+static void collect_decls(const z3::expr &e, std::unordered_set<unsigned> &decls,
+                          std::unordered_set<unsigned> &visited) {
+  if (!visited.insert(e.id()).second) {
+    return;
+  }
+  if (e.is_const() && e.decl().decl_kind() == Z3_OP_UNINTERPRETED) {
+    decls.insert(e.decl().id());
+  } else if (e.is_app()) {
+    for (unsigned i = 0; i < e.num_args(); i++) {
+      collect_decls(e.arg(i), decls, visited);
+    }
+  }
+}
+
+Z3ParserSolver::solving_status
+Z3ParserSolver::check_task(z3::solver &solver, const z3_task_t &task,
+                           const z3::expr_vector &assumptions,
+                           solution_t &solutions) const {
+  solving_status ret = unknown_error;
+  auto start = std::chrono::steady_clock::now();
+  // solve the first constraint (optimistic), already asserted
+  if (dump_smt2_) {
     printf("[optimistic]: %s\n", solver.to_smt2().c_str());
-    z3::check_result res = solver.check();
-    if (res == z3::sat) {
-      ret = opt_sat;
-      // optimistic sat, save a model
-      z3::model m = solver.get_model();
-      // check nested, if any
-      if (task->size() > 1) {
-        solver.push();
-        // add nested constraints
-        for (size_t i = 1; i < task->size(); i++) {
-          solver.add(task->at(i));
-        }
-        printf("[nested]: %s\n", solver.to_smt2().c_str());
-        res = solver.check();
-        if (res == z3::sat) {
-          ret = nested_sat;
-          m = solver.get_model();
-        } else if (res == z3::unsat) {
-          // fprintf(stderr, "WARNING: nested unsat for task %lu: %s\n",
-          //     task_id, solver.to_smt2().data());
-          ret = opt_sat_nested_unsat;
-        } else {
-          ret = opt_sat_nested_timeout;
+  }
+  z3::check_result res = solver.check();
+  solves_++;
+  if (res == z3::sat) {
+    ret = opt_sat;
+    // optimistic sat, save a model
+    z3::model m = solver.get_model();
+    // check nested, if any
+    if (task.size() > 1) {
+      // asserted behind the literals
+      if (dump_smt2_) {
+        for (size_t i = 1; i < task.size(); i++) {
+          printf("[nested]: %s\n", task.at(i).to_string().c_str());
         }
+      }
+      res = solver.check(assumptions);
+      solves_++;
+      if (res == z3::sat) {
+        ret = nested_sat;
+        m = solver.get_model();
+      } else if (res == z3::unsat) {
+        ret = opt_sat_nested_unsat;
       } else {
-        ret = nested_sat; // XXX: upgrade to nested_sat?
+        ret = opt_sat_nested_timeout;
       }
-      generate_solution(m, solutions);
-    } else if (res == z3::unsat) {
-      ret = opt_unsat;
-      //AOUT("\n%s\n", __z3_solver.to_smt2().c_str());
-      //AOUT("  tree_size = %d", __dfsan_label_info[label].tree_size);
     } else {
-      ret = opt_timeout;
+      ret = nested_sat; // XXX: upgrade to nested_sat?
     }
-  } catch (z3::exception ze) {
-    ret = unknown_error;
+    // the session also has the nested constraints of the other tasks,
+    // switched off but still assigned by the model, only the bytes of the
+    // constraints the model was checked with are part of the solution
+    std::unordered_set<unsigned> decls, visited;
+    size_t checked = ret == nested_sat ? task.size() : 1;
+    for (size_t i = 0; i < checked; i++) {
+      collect_decls(task.at(i), decls, visited);
+    }
+    generate_solution(m, solutions, &decls);
+  } else if (res == z3::unsat) {
+    ret = opt_unsat;
+  } else {
+    ret = opt_timeout;
   }
+  solve_us_ += std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start).count();
 
   return ret;
 }
 
-void Z3ParserSolver::generate_solution(z3::model &m, solution_t &solutions) {
+int Z3ParserSolver::enum_gep(z3::context &context, const exported_gep &gep,
+                             unsigned budget, const solution_cb_t &cb) const {
+  z3_task_t exprs;
+  try {
+    parse_exported(context, gep.smt2, exprs);
+  } catch (z3::exception ze) {
+    return -1;
+  }
+  if (exprs.empty() || !exprs[0].is_eq()) {
+    return -1;
+  }
+
+  using clock = std::chrono::steady_clock;
+  auto start = clock::now();
+  auto deadline = start + std::chrono::milliseconds(budget);
+  // what's left of the budget, as a solver timeout
+  auto remaining = [&deadline]() -> unsigned {
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - clock::now()).count();
+    return left > 0 ? (unsigned)left : 0;
+  };
+
+  int found = 0;
+  z3::expr idx = exprs[0].arg(0);
+  z3::solver solver(context, "QF_BV");
+  auto check = [&]() {
+    solves_++;
+    return solver.check();
+  };
+  auto emit = [&](z3::model &m) {
+    solution_t solutions;
+    generate_solution(m, solutions);
+    found++;
+    return cb(solutions);
+  };
+
+  auto enumerate = [&]() {
+    // drop the nested constraints if they can't hold, or can't be checked
+    // in half of the budget, the solutions are then optimistic ones, as
+    // solve_task would give
+    if (exprs.size() > 1) {
+      unsigned left = remaining() / 2;
+      if (left == 0) {
+        return;
+      }
+      solver.set("timeout", left);
+      solver.push();
+      for (size_t i = 1; i < exprs.size(); i++) {
+        solver.add(exprs[i]);
+      }
+      if (check() != z3::sat) {
+        solver.pop();
+      }
+    }
+
+    // boundary values first, they are the most likely to go wrong
+    uint64_t last = gep.lb + (gep.ub - gep.lb - 1) / gep.step * gep.step;
+    std::unordered_set<uint64_t> tried = {gep.curr};
+    for (uint64_t v : {gep.lb, last, gep.ub}) {
+      if (!tried.insert(v).second) {
+        continue;
+      }
+      unsigned left = remaining();
+      if (left == 0) {
+        return;
+      }
+      solver.set("timeout", left);
+      solver.push();
+      solver.add(idx == context.bv_val(v, 64));
+      if (check() == z3::sat) {
+        z3::model m = solver.get_model();
+        if (!emit(m)) {
+          return;
+        }
+      }
+      solver.pop();
+    }
+
+    // then the rest of the range, blocking every value found
+    z3::expr lb = context.bv_val(gep.lb, 64);
+    solver.add(z3::uge(idx, lb));
+    solver.add(z3::ult(idx, context.bv_val(gep.ub, 64)));
+    if (gep.step > 1) {
+      solver.add(z3::urem(idx - lb, context.bv_val(gep.step, 64)) ==
+                 context.bv_val(0, 64));
+    }
+    for (uint64_t v : tried) {
+      solver.add(idx != context.bv_val(v, 64));
+    }
+    while (unsigned left = remaining()) {
+      solver.set("timeout", left);
+      if (check() != z3::sat) {
+        break;
+      }
+      z3::model m = solver.get_model();
+      uint64_t v = m.eval(idx, true).get_numeral_uint64();
+      if (!emit(m)) {
+        break;
+      }
+      solver.add(idx != context.bv_val(v, 64));
+    }
+  };
+
+  try {
+    enumerate();
+  } catch (z3::exception ze) {
+    // keep what has been found
+  }
+  solve_us_ += std::chrono::duration_cast<std::chrono::microseconds>(
+      clock::now() - start).count();
+
+  return found;
+}
+
+void Z3ParserSolver::generate_solution(z3::model &m, solution_t &solutions,
+                                       const std::unordered_set<unsigned> *decls) const {
   // from qsym
   unsigned num_constants = m.num_consts();
   for (unsigned i = 0; i < num_constants; i++) {
     z3::func_decl decl = m.get_const_decl(i);
+    if (decls && !decls->count(decl.id())) {
+      continue;
+    }
     z3::expr e = m.get_const_interp(decl);
     z3::symbol name = decl.name();
 
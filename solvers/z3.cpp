@@ -38,6 +38,7 @@ struct context_hash {
 static std::unordered_map<trace_context, uint16_t, context_hash> __branches;
 static const uint16_t MAX_BRANCH_COUNT = 16;
 static const uint64_t MAX_GEP_INDEX = 0x10000;
+static const unsigned GEP_BUDGET = 5000U; // ms to enumerate a GEP index
 static std::unordered_set<uptr> __buffers;
 
 
@@ -315,21 +316,22 @@ __taint_trace_gep(dfsan_label ptr_label, uint64_t ptr, dfsan_label index_label,
       index, index_label, num_elems, elem_size, current_offset);
 
   void *addr = __builtin_return_address(0);
-  std::vector<uint64_t> tasks;
-  if (__z3_parser->parse_gep(ptr_label, ptr, index_label, index, num_elems,
-                             elem_size, current_offset, true, tasks)) {
+  // one incremental solver for all the indices, rather than a task each
+  symsan::Z3AstParser::exported_gep gep;
+  int solved = __z3_parser->export_gep(ptr_label, ptr, index_label, index,
+      num_elems, elem_size, current_offset, gep);
+  if (solved == 0 && !gep.smt2.empty()) {
+    solved = __z3_parser->enum_gep(__z3_context, gep, GEP_BUDGET,
+        [](symsan::Z3ParserSolver::solution_t &solutions) {
+          generate_input(solutions);
+          return true;
+        });
+  }
+  if (solved < 0) {
     AOUT("WARNING: failed to parse gep %d @%p\n", index_label, addr);
     return;
   }
-
-  for (auto id : tasks) {
-    // solve
-    if (__solve_task(id)) {
-      AOUT("gep solved\n");
-    } else {
-      AOUT("gep not solvable @%p\n", addr);
-    }
-  }
+  AOUT("gep %d solved %d indices @%p\n", index_label, solved, addr);
 
   // mark as visited
   __solved_labels.insert(index_label);
@@ -357,6 +359,11 @@ extern "C" void InitializeSolver() {
   __instance_id = flags().instance_id;
   __session_id = flags().session_id;
   __z3_parser = new symsan::Z3ParserSolver((void*)UnionTableAddr(), uniontable_size, __z3_context);
+  __z3_parser->set_dump_smt2(flags().debug);
+  if (flags().query_cache[0]) {
+    __z3_parser->set_query_cache(
+        std::make_shared<symsan::QueryCache>(flags().query_cache));
+  }
   std::vector<symsan::input_t> inputs;
   inputs.push_back({(u8*)tainted.buf, tainted.size});
   __z3_parser->restart(inputs);
@@ -0,0 +1,142 @@
+// RUN: rm -rf %t.out
+// RUN: mkdir -p %t.out
+// RUN: python -c'print("A"*16)' > %t.bin
+// RUN: env KO_USE_Z3=1 %ko-clang -o %t %s
+// RUN: env TAINT_OPTIONS="taint_file=%t.bin output_dir=%t.out" %t %t.bin 100000 4 | FileCheck %s
+// RUN: python -c'print("A"*8192)' > %t.big
+// RUN: env TAINT_OPTIONS="taint_file=%t.big output_dir=%t.out" %t %t.big 100000 1 | FileCheck %s --check-prefix=BIG
+
+// Scaling benchmark of the label allocation: the same number of unions,
+// split over 1, 2, 4, ... threads, each building its own chain of new
+// labels. e.g., up to 32 threads:
+//   TAINT_OPTIONS="taint_file=input" ./label_scaling input 10000000 32
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "lib.h"
+
+typedef uint32_t dfsan_label;
+
+// from the runtime, not instrumented
+extern dfsan_label dfsan_union(dfsan_label l1, dfsan_label l2, uint16_t op,
+                               uint16_t size, uint64_t op1, uint64_t op2);
+extern dfsan_label dfsan_read_label(const void *addr, size_t size);
+extern size_t dfsan_get_label_count(void);
+
+#define OP_ADD 13 // llvm::Instruction::Add
+#define MAX_THREADS 64
+
+static dfsan_label in[16];
+
+struct worker {
+  pthread_t thread;
+  uint64_t seed;
+  size_t n;
+  int ordered;
+};
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *one_union(void *arg) {
+  *(dfsan_label *)arg = dfsan_union(in[0], 0, OP_ADD, 32, 0, ~0ULL);
+  return NULL;
+}
+
+// whether the unions of l come from the chunk of the calling thread: another
+// thread takes a chunk in between, so labels from the counter jump over it
+static int from_chunk(dfsan_label l) {
+  dfsan_label x = dfsan_union(l, 0, OP_ADD, 32, 0, 1);
+  dfsan_label other;
+  pthread_t thread;
+  pthread_create(&thread, NULL, one_union, &other);
+  pthread_join(thread, NULL);
+  dfsan_label y = dfsan_union(l, 0, OP_ADD, 32, 0, 2);
+  return y == x + 1;
+}
+
+static void *chain(void *arg) {
+  struct worker *w = (struct worker *)arg;
+  // a different constant per run and thread, so no union is deduplicated
+  dfsan_label x = dfsan_union(in[w->seed % 16], 0, OP_ADD, 32, 0, w->seed);
+  w->ordered = 1;
+  for (size_t i = 0; i < w->n; i++) {
+    dfsan_label y = dfsan_union(in[i % 16], x, OP_ADD, 32, 0, 0);
+    // a label is always larger than the ones it is built from
+    if (y <= x)
+      w->ordered = 0;
+    x = y;
+  }
+  return NULL;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 4) {
+    fprintf(stderr, "usage: %s input unions max_threads\n", argv[0]);
+    return 1;
+  }
+  size_t n = strtoull(argv[2], NULL, 0);
+  int max_threads = atoi(argv[3]);
+  if (max_threads > MAX_THREADS)
+    max_threads = MAX_THREADS;
+
+  // read in more than one call, each gets its own block of labels, and the
+  // unions of the last one still take labels from a chunk, whether the block
+  // fits in the chunk of the thread or not
+  static unsigned char buf[8192];
+  FILE *fp = chk_fopen(argv[1], "rb");
+  fseek(fp, 0, SEEK_END);
+  size_t size = ftell(fp) - 1; // without the newline
+  rewind(fp);
+  if (size > sizeof(buf))
+    size = sizeof(buf);
+  chk_fread(buf, 1, size / 2, fp);
+  // a union in between, so the thread has a chunk when the second read comes
+  dfsan_union(dfsan_read_label(buf, 1), 0, OP_ADD, 32, 0, 0);
+  chk_fread(buf + size / 2, 1, size - size / 2, fp);
+  fclose(fp);
+  for (int i = 0; i < 16; i++) {
+    in[i] = dfsan_read_label(&buf[size - 16 + i], 1);
+  }
+  printf("%zu bytes in two reads: %s\n", size,
+         from_chunk(in[15]) ? "chunked" : "unchunked");
+
+  struct worker workers[MAX_THREADS];
+  uint64_t seed = 1;
+  for (int threads = 1; threads <= max_threads; threads *= 2) {
+    size_t labels = dfsan_get_label_count();
+    double start = now();
+    for (int t = 0; t < threads; t++) {
+      workers[t].seed = seed++;
+      workers[t].n = n / threads;
+      pthread_create(&workers[t].thread, NULL, chain, &workers[t]);
+    }
+    int ordered = 1;
+    for (int t = 0; t < threads; t++) {
+      pthread_join(workers[t].thread, NULL);
+      ordered &= workers[t].ordered;
+    }
+    double elapsed = now() - start;
+    // the unused tails of the chunks of the threads are counted
+    printf("%d threads: %zu unions, %.1f ns/union, %zu labels used, %s\n",
+           threads, n / threads * threads, elapsed * 1e9 / n,
+           dfsan_get_label_count() - labels,
+           ordered ? "ordered" : "unordered");
+  }
+  return 0;
+}
+
+// CHECK: 16 bytes in two reads: chunked
+// CHECK: 1 threads: 100000 unions, {{.*}}, ordered
+// CHECK: 2 threads: 100000 unions, {{.*}}, ordered
+// CHECK: 4 threads: 100000 unions, {{.*}}, ordered
+
+// BIG: 8192 bytes in two reads: chunked
+// BIG: 1 threads: 100000 unions, {{.*}}, ordered
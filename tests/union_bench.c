@@ -0,0 +1,80 @@
+// RUN: rm -rf %t.out
+// RUN: mkdir -p %t.out
+// RUN: python -c'print("A"*16)' > %t.bin
+// RUN: env KO_USE_Z3=1 %ko-clang -o %t %s
+// RUN: env TAINT_OPTIONS="taint_file=%t.bin output_dir=%t.out" %t %t.bin 100000 | FileCheck %s
+
+// Microbenchmark of the union table: ns per __taint_union, with a chain of
+// unions over the input bytes that creates a new label each, then the same
+// chain again, where every union is deduplicated. e.g., for 1M, 10M and 100M
+// labels:
+//   TAINT_OPTIONS="taint_file=input" ./union_bench input 1000000
+//   TAINT_OPTIONS="taint_file=input" ./union_bench input 10000000
+//   TAINT_OPTIONS="taint_file=input" ./union_bench input 100000000
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "lib.h"
+
+typedef uint32_t dfsan_label;
+
+// from the runtime, not instrumented
+extern dfsan_label dfsan_union(dfsan_label l1, dfsan_label l2, uint16_t op,
+                               uint16_t size, uint64_t op1, uint64_t op2);
+extern dfsan_label dfsan_read_label(const void *addr, size_t size);
+extern size_t dfsan_get_label_count(void);
+
+#define OP_ADD 13 // llvm::Instruction::Add
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static dfsan_label chain(const dfsan_label *in, size_t n) {
+  dfsan_label x = in[0];
+  for (size_t i = 0; i < n; i++) {
+    x = dfsan_union(in[i % 16], x, OP_ADD, 32, 0, 0);
+  }
+  return x;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    fprintf(stderr, "usage: %s input unions\n", argv[0]);
+    return 1;
+  }
+  size_t n = strtoull(argv[2], NULL, 0);
+
+  unsigned char buf[16];
+  FILE *fp = chk_fopen(argv[1], "rb");
+  chk_fread(buf, 1, sizeof(buf), fp);
+  fclose(fp);
+  dfsan_label in[16];
+  for (int i = 0; i < 16; i++) {
+    in[i] = dfsan_read_label(&buf[i], 1);
+  }
+
+  size_t labels = dfsan_get_label_count();
+  double start = now();
+  dfsan_label last = chain(in, n);
+  double elapsed = now() - start;
+  printf("miss: %zu unions, %.1f ns/union, %zu new labels\n", n,
+         elapsed * 1e9 / n, dfsan_get_label_count() - labels);
+
+  labels = dfsan_get_label_count();
+  start = now();
+  dfsan_label again = chain(in, n);
+  elapsed = now() - start;
+  printf("hit: %zu unions, %.1f ns/union, %zu new labels, %s\n", n,
+         elapsed * 1e9 / n, dfsan_get_label_count() - labels,
+         again == last ? "same" : "different");
+  return 0;
+}
+
+// CHECK: miss: 100000 unions, {{.*}}, 100000 new labels
+// CHECK: hit: 100000 unions, {{.*}}, 0 new labels, same